@@ -36,6 +36,19 @@ resource 'MENU' (129) {
         "Send", noIcon, "S", noMark, plain;
         "-", noIcon, noKey, noMark, plain;
         "Settings...", noIcon, ",", noMark, plain;
+        "Display Benchmark", noIcon, noKey, noMark, plain;
+        "Capture to File...", noIcon, "K", noMark, plain;
+        "Show Received Text", noIcon, noKey, check, plain;
+        "Latency Report", noIcon, noKey, noMark, plain;
+        "Link Benchmark...", noIcon, noKey, noMark, plain;
+        "Both Ports", noIcon, noKey, noMark, plain;
+        "Bridge Ports", noIcon, noKey, noMark, plain;
+        "Compress Link", noIcon, noKey, noMark, plain;
+        "Channels", noIcon, noKey, noMark, plain;
+        "Terminal Emulation", noIcon, "T", noMark, plain;
+        "Statistics", noIcon, "I", noMark, plain;
+        "Log Statistics to Port B", noIcon, noKey, noMark, plain;
+        "Triggers...", noIcon, "R", noMark, plain;
         "-", noIcon, noKey, noMark, plain;
         "Quit", noIcon, "Q", noMark, plain;
     }
@@ -55,12 +68,32 @@ resource 'MENU' (130) {
         "Clear", noIcon, noKey, noMark, plain;
         "-", noIcon, noKey, noMark, plain;
         "Select All", noIcon, "A", noMark, plain;
+        "-", noIcon, noKey, noMark, plain;
+        "Find...", noIcon, "F", noMark, plain;
+        "Find Again", noIcon, "G", noMark, plain;
+    }
+};
+
+/* Transfer Menu */
+resource 'MENU' (131) {
+    131, textMenuProc;
+    allEnabled, enabled;
+    "Transfer";
+    {
+        "Send File...", noIcon, noKey, noMark, plain;
+        "Receive File", noIcon, noKey, noMark, plain;
+        "-", noIcon, noKey, noMark, plain;
+        "ZMODEM", noIcon, noKey, check, plain;
+        "YMODEM", noIcon, noKey, noMark, plain;
+        "XMODEM-1K", noIcon, noKey, noMark, plain;
+        "-", noIcon, noKey, noMark, plain;
+        "Cancel Transfer", noIcon, ".", noMark, plain;
     }
 };
 
 /* Menu Bar */
 resource 'MBAR' (128) {
-    { 128, 129, 130 };
+    { 128, 129, 130, 131 };
 };
 
 /* SIZE resource for MultiFinder */
@@ -81,8 +114,8 @@ resource 'SIZE' (-1) {
     reserved,
     reserved,
     reserved,
-    128 * 1024,
-    128 * 1024
+    512 * 1024,
+    384 * 1024
 };
 
 /* About Dialog */
@@ -182,7 +215,7 @@ resource 'BNDL' (128, purgeable) {
 
 /* Settings Dialog */
 resource 'DLOG' (129) {
-    {40, 40, 200, 300},
+    {40, 40, 325, 340},
     dBoxProc,
     visible,
     noGoAway,
@@ -195,13 +228,13 @@ resource 'DLOG' (129) {
 resource 'DITL' (129) {
     {
         /* Item 1: OK Button */
-        {125, 170, 145, 240},
+        {250, 210, 270, 280},
         Button {
             enabled,
             "OK"
         };
         /* Item 2: Cancel Button */
-        {125, 85, 145, 155},
+        {250, 125, 270, 195},
         Button {
             enabled,
             "Cancel"
@@ -271,5 +304,252 @@ resource 'DITL' (129) {
         UserItem {
             disabled
         };
+        /* Item 14: Redraw rate label */
+        {112, 15, 128, 150},
+        StaticText {
+            disabled,
+            "Max redraws/sec:"
+        };
+        /* Item 15: Redraw rate field */
+        {112, 155, 128, 195},
+        EditText {
+            enabled,
+            ""
+        };
+        /* Item 16: Character delay label */
+        {134, 15, 150, 150},
+        StaticText {
+            disabled,
+            "Char delay (ms):"
+        };
+        /* Item 17: Character delay field */
+        {134, 155, 150, 195},
+        EditText {
+            enabled,
+            ""
+        };
+        /* Item 18: Line delay label */
+        {156, 15, 172, 150},
+        StaticText {
+            disabled,
+            "Line delay (ms):"
+        };
+        /* Item 19: Line delay field */
+        {156, 155, 172, 195},
+        EditText {
+            enabled,
+            ""
+        };
+        /* Item 20: Wait-for-prompt label */
+        {178, 15, 194, 120},
+        StaticText {
+            disabled,
+            "Wait for prompt:"
+        };
+        /* Item 21: Wait-for-prompt field */
+        {178, 125, 194, 245},
+        EditText {
+            enabled,
+            ""
+        };
+        /* Item 22: Flow control label */
+        {202, 15, 218, 55},
+        StaticText {
+            disabled,
+            "Flow:"
+        };
+        /* Item 23: No flow control radio */
+        {202, 60, 218, 120},
+        RadioButton {
+            enabled,
+            "None"
+        };
+        /* Item 24: Hardware handshake radio */
+        {202, 125, 218, 205},
+        RadioButton {
+            enabled,
+            "CTS/DTR"
+        };
+        /* Item 25: XON/XOFF output radio */
+        {222, 60, 238, 135},
+        RadioButton {
+            enabled,
+            "XON out"
+        };
+        /* Item 26: XON/XOFF input radio */
+        {222, 140, 238, 205},
+        RadioButton {
+            enabled,
+            "XON in"
+        };
+        /* Item 27: XON/XOFF both directions radio */
+        {222, 210, 238, 290},
+        RadioButton {
+            enabled,
+            "XON both"
+        };
+    }
+};
+
+/* Display Benchmark results */
+resource 'DLOG' (130) {
+    {40, 40, 190, 300},
+    dBoxProc,
+    visible,
+    noGoAway,
+    0,
+    130,
+    "",
+    alertPositionMainScreen
+};
+
+resource 'DITL' (130) {
+    {
+        /* OK Button */
+        {120, 95, 140, 165},
+        Button {
+            enabled,
+            "OK"
+        };
+        /* Title */
+        {10, 20, 26, 240},
+        StaticText {
+            disabled,
+            "Receive area throughput (chars/sec)"
+        };
+        /* Per-character TEKey path */
+        {35, 20, 51, 240},
+        StaticText {
+            disabled,
+            "TextEdit per char: ^0"
+        };
+        /* Batched TEInsert path */
+        {55, 20, 71, 240},
+        StaticText {
+            disabled,
+            "TextEdit batched: ^1"
+        };
+        /* Scrollback store */
+        {75, 20, 91, 240},
+        StaticText {
+            disabled,
+            "Scrollback store: ^2"
+        };
+        /* Scrollback store drawn from the glyph cache */
+        {95, 20, 111, 240},
+        StaticText {
+            disabled,
+            "Store + glyph cache: ^3"
+        };
+    }
+};
+
+/* Latency report */
+resource 'DLOG' (131) {
+    {40, 40, 170, 320},
+    dBoxProc,
+    visible,
+    noGoAway,
+    0,
+    131,
+    "",
+    alertPositionMainScreen
+};
+
+resource 'DITL' (131) {
+    {
+        /* OK Button */
+        {100, 105, 120, 175},
+        Button {
+            enabled,
+            "OK"
+        };
+        /* Keystroke to wire */
+        {10, 20, 26, 260},
+        StaticText {
+            disabled,
+            "Keystroke to wire (^2 sends):"
+        };
+        {28, 30, 44, 260},
+        StaticText {
+            disabled,
+            "^0"
+        };
+        /* Wire to screen */
+        {52, 20, 68, 260},
+        StaticText {
+            disabled,
+            "Wire to screen (^3 redraws):"
+        };
+        {70, 30, 86, 260},
+        StaticText {
+            disabled,
+            "^1"
+        };
+    }
+};
+
+/* Link benchmark setup */
+resource 'DLOG' (132) {
+    {40, 40, 210, 340},
+    dBoxProc,
+    visible,
+    noGoAway,
+    0,
+    132,
+    "",
+    alertPositionMainScreen
+};
+
+resource 'DITL' (132) {
+    {
+        /* Item 1: Start Button */
+        {135, 215, 155, 285},
+        Button {
+            enabled,
+            "Start"
+        };
+        /* Item 2: Cancel Button */
+        {135, 130, 155, 200},
+        Button {
+            enabled,
+            "Cancel"
+        };
+        /* Item 3: Seconds label */
+        {10, 15, 26, 140},
+        StaticText {
+            disabled,
+            "Seconds per run:"
+        };
+        /* Item 4: Seconds field */
+        {10, 145, 26, 185},
+        EditText {
+            enabled,
+            ""
+        };
+        /* Item 5: Current settings radio */
+        {35, 15, 51, 285},
+        RadioButton {
+            enabled,
+            "Current baud rate and flow control"
+        };
+        /* Item 6: Every baud rate radio */
+        {55, 15, 71, 285},
+        RadioButton {
+            enabled,
+            "Every baud rate"
+        };
+        /* Item 7: Every setting radio */
+        {75, 15, 91, 285},
+        RadioButton {
+            enabled,
+            "Every baud rate and flow control"
+        };
+        /* Item 8: Far end note */
+        {98, 15, 128, 285},
+        StaticText {
+            disabled,
+            "The far end must echo: serial_terminal.py --echo"
+        };
     }
 };
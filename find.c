@@ -0,0 +1,255 @@
+/*
+ * find.c - Incremental search over the scrollback store
+ *
+ * Each line is searched with Boyer-Moore-Horspool: the pattern is lined
+ * up against the text and compared from its last byte backwards, and
+ * the text byte under the pattern's last position says how far the
+ * pattern can move on. A miss usually costs one comparison per pattern
+ * length of text. Case folding goes through a table, and the skip table
+ * is indexed by the unfolded byte, so the inner loop never folds the
+ * byte it skips on.
+ */
+
+#include <string.h>
+
+#include "find.h"
+
+static void FindCompile(FindState *f, const unsigned char *pattern, short length,
+                        int ignoreCase);
+static void FindClear(FindState *f, ScrollbackStore *sb);
+static void FindNarrow(FindState *f, ScrollbackStore *sb);
+static void FindLine(FindState *f, const unsigned char *text, short length,
+                     unsigned long line);
+static void FindAddHit(FindState *f, unsigned long line, short column);
+
+/*
+ * Start with an empty pattern and no hits
+ */
+void FindInit(FindState *f)
+{
+    FindCompile(f, (const unsigned char *)"", 0, 0);
+    f->first = 0;
+    f->count = 0;
+    f->dropped = 0;
+    f->scanLine = 0;
+    f->linesSearched = 0;
+}
+
+/*
+ * Search the store for a new pattern and return the number of hits.
+ * When the new pattern only adds to the end of the previous one, the
+ * previous hits are checked against it instead of searching again.
+ */
+long FindSearch(FindState *f, ScrollbackStore *sb, const unsigned char *pattern,
+                short length, int ignoreCase)
+{
+    int narrowing;
+    short i;
+
+    if (length > kFindMaxPattern) {
+        length = kFindMaxPattern;
+    }
+
+    /* Every hit of the longer pattern is a hit of this one, if none were lost */
+    narrowing = (f->length > 0 && length >= f->length && (ignoreCase != 0) == f->ignoreCase &&
+                 f->dropped == 0 && sb->firstLine + sb->lineCount >= f->scanLine);
+    for (i = 0; narrowing && i < f->length; i++) {
+        narrowing = (f->fold[pattern[i]] == f->pattern[i]);
+    }
+
+    FindCompile(f, pattern, length, ignoreCase);
+    if (narrowing) {
+        FindNarrow(f, sb);
+    } else {
+        FindClear(f, sb);
+    }
+    FindUpdate(f, sb);
+    return f->count;
+}
+
+/*
+ * Bring the hits up to date with the store: forget those on lines that
+ * have been dropped, and search lines added or still open since the
+ * last call
+ */
+void FindUpdate(FindState *f, ScrollbackStore *sb)
+{
+    unsigned long line;
+    unsigned long endLine;
+
+    if (f->length == 0) {
+        return;
+    }
+
+    /* Cleared since the last search: the line numbers start again */
+    endLine = sb->firstLine + sb->lineCount;
+    if (endLine < f->scanLine) {
+        FindClear(f, sb);
+    }
+
+    while (f->count > 0 && f->hits[f->first & kFindHitMask].line < sb->firstLine) {
+        f->first++;
+        f->count--;
+    }
+
+    /* The open line may have grown, so its hits are found again */
+    if (f->scanLine < sb->firstLine) {
+        f->scanLine = sb->firstLine;
+    }
+    while (f->count > 0 && FindHitAt(f, f->count - 1)->line >= f->scanLine) {
+        f->count--;
+    }
+
+    for (line = f->scanLine; line < endLine; line++) {
+        FindLine(f, (const unsigned char *)ScrollbackLinePtr(sb, line),
+                 sb->lineLength[line & kScrollbackLineMask], line);
+    }
+
+    f->scanLine = endLine;
+    if (sb->lineOpen && endLine > sb->firstLine) {
+        f->scanLine--;
+    }
+}
+
+/*
+ * Index of the first hit at or after a line and column, or count if
+ * there is none
+ */
+long FindHitIndex(const FindState *f, unsigned long line, short column)
+{
+    const FindHit *hit;
+    long low;
+    long high;
+    long middle;
+
+    low = 0;
+    high = f->count;
+    while (low < high) {
+        middle = (low + high) / 2;
+        hit = FindHitAt(f, middle);
+        if (hit->line < line || (hit->line == line && hit->column < column)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+ * Take a pattern, folding it when ignoring case, and build the skip
+ * table. A byte that is not in the pattern before its last position
+ * moves it its whole length.
+ */
+static void FindCompile(FindState *f, const unsigned char *pattern, short length,
+                        int ignoreCase)
+{
+    unsigned char skip[256];
+    short i;
+
+    for (i = 0; i < 256; i++) {
+        f->fold[i] = (unsigned char)i;
+        if (ignoreCase && i >= 'A' && i <= 'Z') {
+            f->fold[i] = (unsigned char)(i + 'a' - 'A');
+        }
+    }
+
+    f->ignoreCase = (ignoreCase != 0);
+    f->length = length;
+    for (i = 0; i < length; i++) {
+        f->pattern[i] = f->fold[pattern[i]];
+    }
+
+    memset(skip, (length > 0) ? length : 1, sizeof(skip));
+    for (i = 0; i < length - 1; i++) {
+        skip[f->pattern[i]] = (unsigned char)(length - 1 - i);
+    }
+    for (i = 0; i < 256; i++) {
+        f->shift[i] = skip[f->fold[i]];
+    }
+}
+
+/*
+ * Drop every hit and search the whole store from its oldest line
+ */
+static void FindClear(FindState *f, ScrollbackStore *sb)
+{
+    f->first = 0;
+    f->count = 0;
+    f->dropped = 0;
+    f->scanLine = sb->firstLine;
+}
+
+/*
+ * Keep the hits that still match after the pattern grew, in order
+ */
+static void FindNarrow(FindState *f, ScrollbackStore *sb)
+{
+    const unsigned char *text;
+    FindHit *hit;
+    long kept;
+    long i;
+    short j;
+
+    kept = 0;
+    for (i = 0; i < f->count; i++) {
+        hit = FindHitAt(f, i);
+        if (hit->line < sb->firstLine || hit->line >= f->scanLine ||
+            hit->column + f->length > sb->lineLength[hit->line & kScrollbackLineMask]) {
+            continue;
+        }
+        text = (const unsigned char *)ScrollbackLinePtr(sb, hit->line) + hit->column;
+        for (j = f->length - 1; j >= 0 && f->fold[text[j]] == f->pattern[j]; j--) {
+        }
+        if (j < 0) {
+            *FindHitAt(f, kept) = *hit;
+            kept++;
+        }
+    }
+    f->count = kept;
+}
+
+/*
+ * Record every occurrence of the pattern in one line
+ */
+static void FindLine(FindState *f, const unsigned char *text, short length,
+                     unsigned long line)
+{
+    const unsigned char *fold = f->fold;
+    const unsigned char *pattern = f->pattern;
+    short last = f->length - 1;
+    short i;
+    short j;
+    unsigned char c;
+
+    f->linesSearched++;
+    for (i = 0; i + last < length; i += f->shift[c]) {
+        c = text[i + last];
+        if (fold[c] != pattern[last]) {
+            continue;
+        }
+        for (j = last - 1; j >= 0 && fold[text[i + j]] == pattern[j]; j--) {
+        }
+        if (j < 0) {
+            FindAddHit(f, line, i);
+        }
+    }
+}
+
+/*
+ * Append a hit, pushing out the oldest when the ring is full
+ */
+static void FindAddHit(FindState *f, unsigned long line, short column)
+{
+    FindHit *hit;
+
+    if (f->count == kFindMaxHits) {
+        f->first++;
+        f->count--;
+        f->dropped++;
+    }
+    hit = FindHitAt(f, f->count);
+    hit->line = line;
+    hit->column = column;
+    f->count++;
+}
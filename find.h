@@ -0,0 +1,54 @@
+/*
+ * find.h - Incremental search over the scrollback store
+ *
+ * A Boyer-Moore-Horspool search runs over each stored line and the hits
+ * are kept in text order. Typing one more character of the pattern only
+ * re-checks the hits already found, since a match of the longer pattern
+ * is a match of the shorter one where it starts; text received since the
+ * last search is scanned on its own. A hit is a line and a column, so a
+ * match does not span the wrap between two stored lines. No Toolbox
+ * calls and no allocation.
+ */
+
+#ifndef FIND_H
+#define FIND_H
+
+#include "serialcore.h"
+
+#define kFindMaxPattern     64
+#define kFindMaxHits        2048        /* Power of two; the newest are kept */
+#define kFindHitMask        (kFindMaxHits - 1)
+
+typedef struct FindHit {
+    unsigned long line;             /* Scrollback line number */
+    short column;
+} FindHit;
+
+typedef struct FindState {
+    /* Pattern, folded to lower case when ignoring case */
+    unsigned char pattern[kFindMaxPattern];
+    short length;
+    int ignoreCase;
+    unsigned char fold[256];        /* Byte to the form compared */
+    unsigned char shift[256];       /* Horspool skip, by the byte under the pattern's end */
+
+    /* Hits, a ring in text order */
+    FindHit hits[kFindMaxHits];
+    unsigned long first;            /* Ring index of the oldest hit */
+    long count;
+    unsigned long dropped;          /* Older hits pushed out of a full ring */
+    unsigned long scanLine;         /* Lines before this are searched and closed */
+
+    unsigned long linesSearched;    /* In all, for the tests and benchmark */
+} FindState;
+
+/* The i'th hit in text order, 0 <= i < count */
+#define FindHitAt(f, i)     (&(f)->hits[((f)->first + (unsigned long)(i)) & kFindHitMask])
+
+void FindInit(FindState *f);
+long FindSearch(FindState *f, ScrollbackStore *sb, const unsigned char *pattern,
+                short length, int ignoreCase);
+void FindUpdate(FindState *f, ScrollbackStore *sb);
+long FindHitIndex(const FindState *f, unsigned long line, short column);
+
+#endif /* FIND_H */
@@ -0,0 +1,86 @@
+/*
+ * glyph.c - Pre-rendered monospaced glyphs composed into 1-bit lines
+ *
+ * Each scanline of a composed line is built left to right in an
+ * accumulator: every character shifts its glyph row in, and whole bytes
+ * are stored as they fill. Nothing depends on the glyph width being a
+ * divisor of 8, so Monaco 9's 6-pixel cells pack without gaps.
+ */
+
+#include <string.h>
+
+#include "glyph.h"
+
+/*
+ * Take glyphs from a strip of kGlyphCount 8-pixel cells, leftmost pixel
+ * in the high bit, kGlyphStripRowBytes per scanline and height
+ * scanlines. Pixels right of width are dropped. Returns 0 if the size
+ * is beyond what an atlas holds.
+ */
+int GlyphLoad(GlyphAtlas *a, const unsigned char *strip, short width, short height)
+{
+    short row;
+    short c;
+    short shift;
+
+    if (width < 1 || width > kGlyphMaxWidth || height < 1 || height > kGlyphMaxHeight) {
+        return 0;
+    }
+
+    a->width = width;
+    a->height = height;
+    shift = kGlyphMaxWidth - width;
+    for (row = 0; row < height; row++) {
+        for (c = 0; c < kGlyphCount; c++) {
+            a->bits[row][c] = strip[(long)row * kGlyphStripRowBytes + c] >> shift;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compose count characters into a->height scanlines of rowBytes each,
+ * starting at dest. The rest of each scanline is cleared, so the buffer
+ * can be copied over whatever was on screen.
+ */
+void GlyphCompose(const GlyphAtlas *a, const unsigned char *text, short count,
+                  unsigned char *dest, short rowBytes)
+{
+    const unsigned char *glyphs;
+    unsigned char *out;
+    unsigned char *end;
+    unsigned long acc;
+    short width = a->width;
+    short bits;
+    short row;
+    short i;
+
+    if ((long)count * width > (long)rowBytes * 8) {
+        count = (short)((long)rowBytes * 8 / width);
+    }
+
+    for (row = 0; row < a->height; row++) {
+        glyphs = a->bits[row];
+        out = dest;
+        end = dest + rowBytes;
+        acc = 0;
+        bits = 0;
+
+        for (i = 0; i < count; i++) {
+            acc = (acc << width) | glyphs[text[i]];
+            bits += width;
+            if (bits >= 8) {
+                bits -= 8;
+                *out++ = (unsigned char)(acc >> bits);
+            }
+        }
+        if (bits > 0) {
+            *out++ = (unsigned char)(acc << (8 - bits));
+        }
+        if (out < end) {
+            memset(out, 0, end - out);
+        }
+
+        dest += rowBytes;
+    }
+}
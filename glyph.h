@@ -0,0 +1,37 @@
+/*
+ * glyph.h - Pre-rendered monospaced glyphs composed into 1-bit lines
+ *
+ * The application draws its font once into a strip of 8-pixel cells,
+ * one per character code, and loads it into a GlyphAtlas. A line of
+ * text is then composed straight into a 1-bit row buffer, a few shifts
+ * and ORs per character and scanline, and goes on screen with a single
+ * CopyBits instead of a DrawText through the font machinery. No
+ * Toolbox calls and no allocation.
+ */
+
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#define kGlyphMaxWidth      8       /* Pixels; a glyph row fits in a byte */
+#define kGlyphMaxHeight     16
+#define kGlyphCount         256
+
+/* Row bytes of the strip GlyphLoad() reads: one byte-wide cell per code */
+#define kGlyphStripRowBytes kGlyphCount
+
+/* Even row bytes holding columns cells of width pixels, as QuickDraw wants */
+#define GlyphRowBytes(columns, width)   ((((long)(columns) * (width) + 15) / 16) * 2)
+
+typedef struct GlyphAtlas {
+    short width;
+    short height;
+
+    /* Scanline of every code, right-aligned in width bits; by row for locality */
+    unsigned char bits[kGlyphMaxHeight][kGlyphCount];
+} GlyphAtlas;
+
+int GlyphLoad(GlyphAtlas *a, const unsigned char *strip, short width, short height);
+void GlyphCompose(const GlyphAtlas *a, const unsigned char *text, short count,
+                  unsigned char *dest, short rowBytes);
+
+#endif /* GLYPH_H */
@@ -0,0 +1,250 @@
+/*
+ * lzss.c - Streaming LZSS compression for the serial link
+ *
+ * The encoder finds matches through a single hash table of the latest
+ * position for each three-byte prefix, with no chains to walk, so every
+ * input byte costs about the same. Candidates are always checked
+ * against the window, which keeps stale table entries harmless. The
+ * decoder is byte-driven and stops at any input boundary.
+ */
+
+#include <string.h>
+
+#include "lzss.h"
+
+/* Decoder states */
+#define kStateHeader    0
+#define kStateHeader2   1
+#define kStateFlags     2
+#define kStateItem      3
+#define kStateMatch     4
+
+#define Hash(p) \
+    ((((unsigned short)(p)[0] << 6) ^ ((unsigned short)(p)[1] << 3) ^ (p)[2]) & kLzssHashMask)
+
+/*
+ * Start a new stream
+ */
+void LzssInitEncoder(LzssEncoder *e)
+{
+    memset(e->window, 0, sizeof(e->window));
+    memset(e->head, 0, sizeof(e->head));
+    e->pos = 0;
+}
+
+/*
+ * Compress up to kLzssMaxBlock bytes into one block. dest must hold
+ * LzssBound(count) bytes. Returns the block's length, header included.
+ */
+long LzssEncode(LzssEncoder *e, const unsigned char *data, long count, unsigned char *dest)
+{
+    unsigned char *out;
+    unsigned char *flagPtr;
+    unsigned short mask;
+    unsigned short distance;
+    unsigned short h;
+    unsigned long pos;
+    long i;
+    long j;
+    long best;
+    long limit;
+    long payload;
+
+    if (count <= 0) {
+        return 0;
+    }
+    if (count > kLzssMaxBlock) {
+        count = kLzssMaxBlock;
+    }
+
+    /* The payload goes after room for a two-byte header */
+    out = dest + 2;
+    flagPtr = out;
+    mask = 0;
+    pos = e->pos;
+    distance = 0;
+
+    i = 0;
+    while (i < count) {
+        if (mask == 0) {
+            flagPtr = out++;
+            *flagPtr = 0;
+            mask = 1;
+        }
+
+        /* The latest earlier position with the same three bytes, if near enough */
+        best = 0;
+        limit = count - i;
+        if (limit >= kLzssMinMatch) {
+            if (limit > kLzssMaxMatch) {
+                limit = kLzssMaxMatch;
+            }
+            h = Hash(data + i);
+            distance = (unsigned short)((unsigned short)pos - e->head[h]);
+            e->head[h] = (unsigned short)pos;
+
+            if (distance != 0 && distance < kLzssWindowSize) {
+                /* Bytes at or past the current position come from the input */
+                while (best < limit &&
+                       (best < distance ?
+                        e->window[(pos - distance + best) & kLzssWindowMask] :
+                        data[i + best - distance]) == data[i + best]) {
+                    best++;
+                }
+            }
+        }
+
+        if (best >= kLzssMinMatch) {
+            *out++ = (unsigned char)(distance >> 4);
+            *out++ = (unsigned char)(((distance & 15) << 4) | (best - kLzssMinMatch));
+
+            /* Later positions inside the match go into the table too */
+            for (j = 0; j < best; j++) {
+                if (j > 0 && i + j + kLzssMinMatch <= count) {
+                    e->head[Hash(data + i + j)] = (unsigned short)(pos + j);
+                }
+                e->window[(pos + j) & kLzssWindowMask] = data[i + j];
+            }
+            pos += best;
+            i += best;
+        } else {
+            *flagPtr |= (unsigned char)mask;
+            *out++ = data[i];
+            e->window[pos & kLzssWindowMask] = data[i];
+            pos++;
+            i++;
+        }
+
+        mask = (mask << 1) & 0xFF;
+    }
+    e->pos = pos;
+
+    /* Short payloads take a one-byte header */
+    payload = out - (dest + 2);
+    if (payload < 0x80) {
+        dest[0] = (unsigned char)payload;
+        memmove(dest + 1, dest + 2, payload);
+        return payload + 1;
+    }
+    dest[0] = (unsigned char)(0x80 | (payload >> 8));
+    dest[1] = (unsigned char)payload;
+    return payload + 2;
+}
+
+/*
+ * Start a new stream
+ */
+void LzssInitDecoder(LzssDecoder *d)
+{
+    memset(d->window, 0, sizeof(d->window));
+    d->pos = 0;
+    d->state = kStateHeader;
+    d->remaining = 0;
+    d->flags = 0;
+    d->flagBits = 0;
+    d->matchHigh = 0;
+    d->ended = 0;
+}
+
+/*
+ * Decompress received bytes into dest. Stops when the input runs out,
+ * when dest has less than kLzssMaxMatch bytes of room left, or just
+ * after kLzssEnd, which sets d->ended. *used is the input consumed;
+ * returns the number of bytes decoded.
+ */
+long LzssDecode(LzssDecoder *d, const unsigned char *data, long count, long *used,
+                unsigned char *dest, long destSize)
+{
+    const unsigned char *in;
+    const unsigned char *end;
+    unsigned char *out;
+    unsigned char *outLimit;
+    unsigned short distance;
+    unsigned long pos;
+    short length;
+    unsigned char c;
+
+    in = data;
+    end = data + count;
+    out = dest;
+    outLimit = dest + destSize - kLzssMaxMatch;
+    pos = d->pos;
+
+    while (in < end && !d->ended) {
+        c = *in;
+
+        /* A match can add kLzssMaxMatch bytes */
+        if (d->state >= kStateItem && out > outLimit) {
+            break;
+        }
+
+        switch (d->state) {
+            case kStateHeader:
+                if (c == kLzssEnd) {
+                    d->ended = 1;
+                } else if (c & 0x80) {
+                    d->remaining = (long)(c & 0x7F) << 8;
+                    d->state = kStateHeader2;
+                } else {
+                    d->remaining = c;
+                    d->state = kStateFlags;
+                }
+                in++;
+                continue;
+
+            case kStateHeader2:
+                d->remaining |= c;
+                d->state = (d->remaining > 0) ? kStateFlags : kStateHeader;
+                in++;
+                continue;
+
+            case kStateFlags:
+                d->flags = c;
+                d->flagBits = 8;
+                d->state = kStateItem;
+                break;
+
+            case kStateItem:
+                if (d->flags & 1) {
+                    /* Literal */
+                    *out++ = c;
+                    d->window[pos & kLzssWindowMask] = c;
+                    pos++;
+                    d->flags >>= 1;
+                    d->flagBits--;
+                } else {
+                    d->matchHigh = c;
+                    d->state = kStateMatch;
+                }
+                break;
+
+            case kStateMatch:
+                distance = (unsigned short)((d->matchHigh << 4) | (c >> 4));
+                length = (short)((c & 15) + kLzssMinMatch);
+
+                /* Byte by byte, since a match may overlap its own output */
+                while (length-- > 0) {
+                    c = d->window[(pos - distance) & kLzssWindowMask];
+                    *out++ = c;
+                    d->window[pos & kLzssWindowMask] = c;
+                    pos++;
+                }
+                d->flags >>= 1;
+                d->flagBits--;
+                d->state = kStateItem;
+                break;
+        }
+
+        /* Every byte past the header belongs to the block's payload */
+        in++;
+        if (--d->remaining == 0) {
+            d->state = kStateHeader;
+        } else if (d->state == kStateItem && d->flagBits == 0) {
+            d->state = kStateFlags;
+        }
+    }
+
+    d->pos = pos;
+    *used = in - data;
+    return out - dest;
+}
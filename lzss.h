@@ -0,0 +1,78 @@
+/*
+ * lzss.h - Streaming LZSS compression for the serial link
+ *
+ * A small-window LZSS that runs on a 68000 with nothing but shifts,
+ * compares and a 4 KB hash table. Both directions keep their window
+ * from block to block, so short messages still compress against
+ * everything sent before them. No Toolbox calls and no allocation:
+ * the encoder and decoder are plain structures owned by the caller.
+ *
+ * Wire format, after the handshake:
+ *
+ *   block     header, then flag bytes each followed by up to 8 items
+ *   header    one byte 1..127 giving the payload length, or two bytes
+ *             0x80 | high 7 bits, low 8 bits; a single 0 byte ends
+ *             compressed mode and plain bytes follow
+ *   flags     bit 0 first: 1 = literal byte, 0 = match
+ *   match     two bytes: distance (1..4095) in the high 12 bits,
+ *             length - 3 (3..18) in the low 4
+ *
+ * Windows start out as zeros on both ends.
+ */
+
+#ifndef LZSS_H
+#define LZSS_H
+
+#define kLzssWindowBits     12
+#define kLzssWindowSize     (1 << kLzssWindowBits)          /* 4 KB */
+#define kLzssWindowMask     (kLzssWindowSize - 1)
+#define kLzssHashSize       4096
+#define kLzssHashMask       (kLzssHashSize - 1)
+#define kLzssMinMatch       3
+#define kLzssMaxMatch       18
+
+/* Most input one LzssEncode call takes */
+#define kLzssMaxBlock       4096
+
+/* Worst-case encoded size of count bytes, whatever the block split */
+#define LzssBound(count) \
+    ((count) + ((count) + 7) / 8 + 2 * (((count) + kLzssMaxBlock - 1) / kLzssMaxBlock))
+
+/* Single byte that ends compressed mode */
+#define kLzssEnd            0x00
+
+/*
+ * Handshake. The side that wants compression sends kLzssHello and sends
+ * nothing more until kLzssAccept comes back; a far end that knows the
+ * format answers with kLzssAccept and compresses everything after it.
+ * SerialFindMarker() spots either one in the received stream.
+ */
+#define kLzssHello          "\033Lz1?"
+#define kLzssAccept         "\033Lz1!"
+#define kLzssMarkerLength   5
+
+typedef struct LzssEncoder {
+    unsigned char window[kLzssWindowSize];
+    unsigned short head[kLzssHashSize];     /* Latest position of each hash */
+    unsigned long pos;                      /* Bytes encoded, free-running */
+} LzssEncoder;
+
+typedef struct LzssDecoder {
+    unsigned char window[kLzssWindowSize];
+    unsigned long pos;                      /* Bytes decoded, free-running */
+    short state;
+    long remaining;                         /* Payload bytes left in the block */
+    unsigned char flags;
+    short flagBits;                         /* Items left under this flag byte */
+    unsigned char matchHigh;                /* First byte of a split match */
+    int ended;                              /* Saw kLzssEnd */
+} LzssDecoder;
+
+void LzssInitEncoder(LzssEncoder *e);
+long LzssEncode(LzssEncoder *e, const unsigned char *data, long count, unsigned char *dest);
+
+void LzssInitDecoder(LzssDecoder *d);
+long LzssDecode(LzssDecoder *d, const unsigned char *data, long count, long *used,
+                unsigned char *dest, long destSize);
+
+#endif /* LZSS_H */
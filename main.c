@@ -20,15 +20,42 @@
 #include <ToolUtils.h>
 #include <SegLoad.h>
 #include <Sound.h>
+#include <OSUtils.h>
+#include <Gestalt.h>
+#include <Timer.h>
+#include <Files.h>
+#include <StandardFile.h>
+#include <Processes.h>
+
+#include "serialcore.h"
+#include "transfer.h"
+#include "lzss.h"
+#include "mux.h"
+#include "terminal.h"
+#include "glyph.h"
+#include "find.h"
+#include "trigger.h"
 
 /* Resource IDs */
 #define kMenuBarID      128
 #define kAppleMenuID    128
 #define kFileMenuID     129
 #define kEditMenuID     130
+#define kTransferMenuID 131
+
+/* Transfer menu items */
+#define kTransferSendItem       1
+#define kTransferReceiveItem    2
+#define kTransferZModemItem     4
+#define kTransferYModemItem     5
+#define kTransferXModemItem     6
+#define kTransferCancelItem     8
 
 #define kAboutDialogID  128
 #define kSettingsDialogID 129
+#define kDisplayBenchDialogID 130
+#define kLatencyDialogID 131
+#define kLinkBenchDialogID 132
 #define kSendButtonID   128
 
 /* Settings dialog item IDs */
@@ -44,6 +71,29 @@
 #define kSettingsBaud19200  10
 #define kSettingsBaud38400  11
 #define kSettingsBaud57600  12
+#define kSettingsFrameRateLabel 14
+#define kSettingsFrameRate  15
+#define kSettingsCharDelayLabel 16
+#define kSettingsCharDelay  17
+#define kSettingsLineDelayLabel 18
+#define kSettingsLineDelay  19
+#define kSettingsPromptLabel 20
+#define kSettingsPrompt     21
+#define kSettingsFlowLabel  22
+#define kSettingsFlowNone   23
+#define kSettingsFlowHardware 24
+#define kSettingsFlowXOnOut 25
+#define kSettingsFlowXOnIn  26
+#define kSettingsFlowXOnBoth 27
+
+/* Link Benchmark dialog items */
+#define kBenchStart         1
+#define kBenchCancel        2
+#define kBenchSecondsLabel  3
+#define kBenchSeconds       4
+#define kBenchCurrent       5
+#define kBenchAllBauds      6
+#define kBenchAllSettings   7
 
 /* Port selection */
 #define kPortModem      0
@@ -57,9 +107,20 @@
 #define kBaud38400  4
 #define kBaud57600  5
 
+/* Flow control modes */
+#define kFlowNone       0   /* No handshaking */
+#define kFlowHardware   1   /* CTS holds our output, DTR holds theirs */
+#define kFlowXOnOut     2   /* XOFF from the device holds our output */
+#define kFlowXOnIn      3   /* We send XOFF when our input fills */
+#define kFlowXOnBoth    4   /* XON/XOFF in both directions */
+
+/* XON/XOFF characters */
+#define kXOnChar        0x11
+#define kXOffChar       0x13
+
 /* Window dimensions */
 #define kWindowWidth    320
-#define kWindowHeight   195
+#define kWindowHeight   210
 
 /* Send text area positions */
 #define kSendLeft       10
@@ -73,22 +134,204 @@
 #define kButtonRight    200
 #define kButtonBottom   102
 
+/* Transmit progress indicator, right of the button */
+#define kTxStatusLeft   210
+#define kTxStatusTop    82
+#define kTxStatusRight  310
+#define kTxStatusBottom 102
+
 /* Receive text area positions */
 #define kRecvLeft       10
 #define kRecvTop        122
 #define kRecvRight      310
 #define kRecvBottom     185
 
-/* Maximum receive buffer size */
+/* Status line below the receive area */
+#define kStatusLeft     10
+#define kStatusTop      190
+#define kStatusRight    310
+#define kStatusBottom   205
+
+/* Receive scroll bar, overlapping the right edge of the receive frame */
+#define kScrollBarWidth 16
+
+/* Second port's window: a receive area and nothing else */
+#define kPortWindowWidth    320
+#define kPortWindowHeight   100
+#define kPortRecvLeft       10
+#define kPortRecvTop        10
+#define kPortRecvRight      310
+#define kPortRecvBottom     90
+
+/* Terminal window: a VT100-sized grid, smaller if the screen is */
+#define kTermColumns        80
+#define kTermRows           24
+#define kTermMargin         4
+#define kTermReplyMax       32      /* Longest reply or key sequence sent at once */
+
+/* Maximum text kept by the TextEdit paths in the display benchmark */
 #define kMaxReceiveText 4096
 
-/* Serial port driver reference numbers */
-static short gSerialOutRef = 0;
-static short gSerialInRef = 0;
+/* Receive engine buffer sizes */
+#define kRxRingSize         16384   /* Staging ring filled at interrupt time (power of two) */
+#define kRxRingMask         (kRxRingSize - 1)
+#define kSerDriverBufSize   4096    /* Input buffer handed to the serial driver */
+#define kRxPollBudget       1024    /* Max bytes moved into TextEdit per loop pass */
+#define kPortTxSize         8192    /* Raw send ring per port (power of two) */
+#define kPortTxMask         (kPortTxSize - 1)
+
+/* Transmit pipeline */
+#define kTxChunkSize        256     /* Bytes per chained async write */
+#define kTxStatusTicks      10      /* Minimum ticks between progress redraws */
+#define kMaxPacingDelay     10000   /* Longest inter-character/line delay, ms */
+#define kMaxPromptLength    31
+#define kPromptTimeoutTicks 600     /* Give up waiting for a prompt after 10 s */
+
+/* Receive area redraw budget, in redraws per second */
+#define kDefaultFrameRate   15
+#define kMinFrameRate       1
+#define kMaxFrameRate       60
+
+/* Display benchmark: how long each insertion path is fed synthetic data */
+#define kDisplayBenchTicks  120
+
+/* Serial driver status code for bytes waiting in the input buffer */
+#define kSerStatusInputCount 2
+
+/* Serial driver control code for handshaking including DTR */
+#define kSerControlHandshakeDTR 14
+
+/* Throughput sampling period for the status line */
+#define kStatusSampleTicks  60
+
+/* Capture to file: received bytes are staged in a ring of buffers */
+#define kCaptureBufferSize  16384
+#define kCaptureBuffers     4       /* Power of two */
+#define kCaptureBufferMask  (kCaptureBuffers - 1)
+#define kCaptureFlushTicks  60      /* Write a partial buffer after this long */
+#define kCaptureDrainBatches (kRxRingSize / kRxPollBudget)
+#define kCaptureCreator     'ttxt'
+#define kCaptureFileType    'TEXT'
+
+/* File menu items */
+#define kFileCaptureItem    5
+#define kFileDisplayItem    6
+#define kFileLatencyItem    7
+#define kFileLinkBenchItem  8
+#define kFileBothPortsItem  9
+#define kFileBridgeItem     10
+#define kFileCompressItem   11
+#define kFileChannelsItem   12
+#define kFileTerminalItem   13
+#define kFileStatisticsItem 14
+#define kFileStatsLogItem   15
+#define kFileTriggersItem   16
+#define kFileQuitItem       18
+
+/* Edit menu items */
+#define kEditFindItem       10
+#define kEditFindAgainItem  11
+
+/* Find window: the pattern field, the case box and the hit count */
+#define kFindWindowWidth    320
+#define kFindWindowHeight   58
+#define kFindFieldLeft      50
+#define kFindFieldTop       8
+#define kFindFieldRight     310
+#define kFindFieldBottom    26
+#define kFindBoxTop         34
+#define kFindBoxBottom      50
+#define kFindStatusLeft     150
+
+/* Triggers window: the list, the status line and the Apply button */
+#define kTrigWindowWidth    360
+#define kTrigWindowHeight   194
+#define kTrigFieldLeft      8
+#define kTrigFieldTop       8
+#define kTrigFieldRight     352
+#define kTrigFieldBottom    158
+#define kTrigButtonLeft     282
+#define kTrigButtonTop      166
+#define kTrigButtonBottom   186
+
+/* Hot-path profile: the sections of one main loop pass */
+#define kProfSleep          0       /* WaitNextEvent */
+#define kProfEvents         1       /* HandleEvent and AdjustCursor */
+#define kProfTextEdit       2       /* TEIdle */
+#define kProfReceive        3       /* ServicePorts, through to the displays */
+#define kProfTransmit       4
+#define kProfTransfer       5
+#define kProfLink           6       /* Benchmark, compressed link and channels */
+#define kProfCapture        7
+#define kProfStatistics     8       /* UpdateStatistics */
+#define kProfDisplay        9       /* Receive areas and terminal redraw */
+#define kProfSections       10
+
+/* Statistics window and the line logged on Port B */
+#define kStatsWindowWidth   330
+#define kStatsMargin        8
+#define kStatsLines         (kProfSections + 5)
+#define kStatsLogMax        640
+
+/* Compressed link */
+#define kLinkAnswerTicks    180     /* Wait this long for the far end's reply */
+#define kLinkOff            0
+#define kLinkAsking         1       /* kLzssHello sent, no reply yet */
+#define kLinkOn             2
+#define kLinkClosing        3       /* Our end marker sent, the far end's due */
+
+/* Channel link */
+#define kChanOff            0
+#define kChanAsking         1       /* kMuxHello sent, no reply yet */
+#define kChanOn             2
+#define kChanClosing        3       /* Draining, then our close frame sent */
+#define kChanFileChunk      1024    /* File bytes read per call */
+
+/* File transfer */
+#define kXferQueueLimit     8192    /* Protocol bytes queued ahead of the port */
+#define kXferStatusTicks    20      /* Minimum ticks between progress redraws */
+#define kXferResultTicks    300     /* How long the outcome stays on the status line */
+#define kXferFileCreator    'SSND'
+#define kXferFileType       'BINA'
+
+/* Event loop scheduling */
+#define kBusyHoldTicks      30      /* Keep polling this long after any activity */
+#define kMaxIdleSleep       30      /* Longest sleep in the foreground */
+#define kBackgroundSleep    60      /* Longest sleep in the background */
+#define kNoWakeUpSleep      6       /* Cap when completions cannot wake us */
+#define kSerialBudgetTicks  2       /* Receive work allowed per loop pass */
+#define kMicrosecondsPerTick 16667UL
+
+/* Link benchmark */
+#define kBenchTableSize     4096    /* Pattern period (power of two) */
+#define kBenchTableMask     (kBenchTableSize - 1)
+#define kBenchChunk         256     /* Pattern bytes per queued message */
+#define kBenchQueueLimit    1024    /* Pattern bytes queued ahead of the port */
+#define kBenchResync        8       /* Bytes that must line up to regain sync */
+#define kBenchWindow        256     /* Longest run of lost bytes a resync finds */
+#define kBenchSettleTicks   30      /* Quiet needed before a run starts */
+#define kBenchMaxSettleTicks 180
+#define kBenchDrainTicks    60      /* Quiet that ends a run's drain */
+#define kBenchMaxDrainTicks 300
+#define kBenchDefaultSeconds 5
+#define kBenchMaxSeconds    60
+#define kFlowSettings       5
+
+/* Link benchmark phases */
+#define kBenchIdle          0
+#define kBenchSettle        1       /* Discarding stale input after a change */
+#define kBenchRun           2       /* Sending and checking the echo */
+#define kBenchDrain         3       /* Waiting for the last echoes */
+
+/* Which settings a benchmark covers */
+#define kBenchSweepCurrent  0
+#define kBenchSweepBauds    1
+#define kBenchSweepAll      2
 
 /* Serial port settings */
 static short gCurrentPort = kPortModem;     /* 0 = Modem (A), 1 = Printer (B) */
 static short gCurrentBaud = kBaud9600;      /* Default to 9600 */
+static short gFlowControl = kFlowNone;      /* Default to no handshaking */
 
 /* Baud rate constants for SerReset (from Serial.h) */
 static short gBaudRates[] = {
@@ -100,18 +343,418 @@ static short gBaudRates[] = {
     baud57600   /* kBaud57600 */
 };
 
+/* Port names for the greeting and the second port's window */
+static char *gPortNames[] = {
+    "Modem", "Printer"
+};
+
+/*
+ * One serial port: its driver pair, asynchronous receive engine and raw
+ * send ring. The receive completion routine advances rxHead as reads
+ * finish; the main loop consumes from rxTail. Both are free-running
+ * counters, so the number of buffered bytes is always rxHead - rxTail.
+ * The send ring is the same the other way round: the main loop adds at
+ * txHead and the write completion routine retires at txTail. It carries
+ * the second port's typing and bridged bytes; the main port's own sends
+ * go through the transmit queue.
+ */
+typedef struct SerialPort {
+    short inRef;                        /* Driver reference numbers, or 0 */
+    short outRef;
+    char *rxRing;                       /* kRxRingSize bytes, kept once allocated */
+    char *driverBuf;                    /* Input buffer handed to the serial driver */
+    volatile unsigned long rxHead;
+    volatile unsigned long rxTail;
+    volatile Boolean rxPending;         /* A read is queued with the driver */
+    volatile Boolean rxStalled;         /* Ring was full, no read re-issued */
+    volatile Boolean rxRunning;         /* Engine accepts completions */
+    volatile long rxErrors;             /* Reads that finished with an error */
+    volatile unsigned long rxArrival;   /* First byte since the last poll */
+    ParamBlockRec rxParamBlock;
+    CntrlParam rxStatusBlock;
+    IOCompletionUPP rxCompletionUPP;
+    char *txRing;                       /* kPortTxSize bytes, kept once allocated */
+    volatile unsigned long txHead;
+    volatile unsigned long txTail;
+    volatile Boolean txPending;         /* A write is queued with the driver */
+    volatile Boolean txRunning;         /* Completion may chain the next write */
+    ParamBlockRec txParamBlock;
+    IOCompletionUPP txCompletionUPP;
+} SerialPort;
+
+/* Both ports, indexed by kPortModem and kPortPrinter */
+static SerialPort gPorts[2];
+static SerialPort *gMainPort = &gPorts[kPortModem];    /* gPorts[gCurrentPort] */
+static long gAppA5 = 0;
+
+/*
+ * Dual-port operation. With gDualPort set, the port gCurrentPort does not
+ * name is opened too, at the same settings, with its own window. Bridging
+ * forwards each port's input to the other's send ring with no display,
+ * so the Mac relays between two devices.
+ */
+static Boolean gDualPort = false;
+static Boolean gBridging = false;
+static Boolean gServiceOtherFirst = false;      /* Swaps the poll order each pass */
+static unsigned long gBridged[2];               /* Bytes forwarded from each port */
+
+/* A message waiting in the transmit queue, already translated for the wire */
+typedef struct TxMessage {
+    struct TxMessage *next;
+    long length;
+    Boolean raw;                    /* Protocol data: no pacing or prompt gating */
+    unsigned long stamp;            /* Microseconds at the keystroke, or 0 */
+    char *data;                     /* Follows the header in the same block */
+} TxMessage;
+
+/*
+ * Asynchronous transmit pipeline state.
+ * Messages queue up behind gTxQueueHead. The one at the head is being
+ * written from gTxBuffer; unless pacing is on, the completion routine
+ * chains kTxChunkSize writes until gTxSent reaches gTxLength.
+ */
+static TxMessage *gTxQueueHead = NULL;
+static TxMessage *gTxQueueTail = NULL;
+static short gTxQueueCount = 0;
+static long gTxBacklog = 0;                     /* Bytes queued behind the head */
+static char *gTxBuffer = NULL;
+static long gTxLength = 0;
+static volatile long gTxSent = 0;
+static volatile Boolean gTxRaw = false;         /* Current message bypasses pacing */
+static volatile Boolean gTxPending = false;     /* A write is queued with the driver */
+static volatile Boolean gTxRunning = false;     /* Completion may chain the next write */
+static volatile OSErr gTxError = noErr;
+static ParamBlockRec gTxParamBlock;
+static IOCompletionUPP gTxCompletionUPP = NULL;
+static long gTxShownSent = -1;                  /* Progress last drawn on screen */
+static unsigned long gTxShownTicks = 0;
+
+/* Transmit pacing, set in the Settings dialog */
+static short gTxCharDelay = 0;                  /* ms between characters */
+static short gTxLineDelay = 0;                  /* ms after each line */
+static Str255 gTxPrompt;                        /* Wait for this after each line */
+static short gPromptFail[kMaxPromptLength + 1]; /* KMP failure table for gTxPrompt */
+static short gPromptMatched = 0;                /* Prompt characters matched so far */
+static volatile Boolean gTxWriteEndsLine = false;
+static volatile Boolean gTxAwaitGate = false;   /* A line went out; hold the next */
+static volatile Boolean gTxPromptSeen = false;
+static volatile unsigned long gTxLastDone = 0;  /* Microseconds at last completion */
+static volatile unsigned long gTxGateTicks = 0; /* TickCount when the gate closed */
+static volatile unsigned long gTxFirstWire = 0; /* Microseconds when the head message
+                                                   first reached the driver, or 0 */
+
+/* Timing */
+static Boolean gHasMicroseconds = false;
+
+/* Batch of received bytes handed to TextEdit in one TEInsert */
+static char gRecvBatch[kRxPollBudget];
+
 /* Baud rate names for debug output */
 static char *gBaudNames[] = {
     "1200", "2400", "9600", "19200", "38400", "57600"
 };
 
+/* Characters per second at each rate, with a start and a stop bit */
+static long gBaudCharRates[] = {
+    120, 240, 960, 1920, 3840, 5760
+};
+
+/* Flow control names for the status line */
+static char *gFlowNames[] = {
+    "none", "CTS/DTR", "XON out", "XON in", "XON/XOFF"
+};
+
+/* Throughput and error statistics for the status line */
+static volatile unsigned long gTxTotal = 0;     /* Bytes written since the port opened */
+static unsigned long gStatLastTicks = 0;
+static unsigned long gStatLastRx = 0;
+static unsigned long gStatLastTx = 0;
+static long gStatLastRxErrors = 0;
+static long gStatRxRate = 0;                    /* Bytes/sec over the last sample */
+static long gStatTxRate = 0;
+static long gStatBestLossless = 0;              /* Best receive rate with no errors */
+static long gStatErrors = 0;                    /* Overrun, parity, framing, read errors */
+
+/*
+ * A receive area: the scrollback store behind it and what of it is on
+ * screen. The main window has one and the second port's window another.
+ */
+typedef struct ReceivePane {
+    WindowPtr window;
+    Rect frame;                     /* Framed area, scroll bar at its right */
+    Rect textRect;                  /* Where lines are drawn */
+    short rows;
+    ScrollbackStore store;
+    Boolean storeReady;
+    ControlHandle scroll;
+    unsigned long lastRender;       /* TickCount of the last render */
+    unsigned long drawnTop;         /* Top line of the pixels on screen */
+    unsigned long arrival;          /* Oldest byte waiting to be drawn, or 0 */
+    int lastWasCR;                  /* Previous batch ended in CR */
+} ReceivePane;
+
 /* Application globals */
 static WindowPtr gMainWindow = NULL;
 static TEHandle gSendText = NULL;
-static TEHandle gRecvText = NULL;
+static ReceivePane gRecvPane;
+static WindowPtr gPortWindow = NULL;        /* Second port's window, or NULL */
+static ReceivePane gPortPane;
 static ControlHandle gSendButton = NULL;
+static ControlActionUPP gRecvScrollActionUPP = NULL;
+static short gRecvLineHeight = 11;
+static short gRecvAscent = 9;
+static short gRecvCharWidth = 6;
+static short gRecvFrameRate = kDefaultFrameRate;
+static RgnHandle gRecvScrollRgn = NULL;     /* Scratch region for ScrollRect */
+static GlyphAtlas *gGlyphs = NULL;          /* Pre-rendered Monaco 9, or NULL for DrawText */
+static BitMap gLineBits;                    /* One receive line composed from gGlyphs */
 static Boolean gRunning = true;
 
+/*
+ * Capture state. The main loop fills buffer gCapQueued & mask; a buffer
+ * is handed to the writer by incrementing gCapQueued. Writes run one at
+ * a time with PBWriteAsync and the completion routine chains the next,
+ * so the disk keeps up even when the main loop is busy drawing. Only the
+ * main loop changes gCapQueued, and only the writer changes gCapWritten.
+ */
+static short gCapRefNum = 0;                    /* Capture file, or 0 */
+static char *gCapBuffer[kCaptureBuffers];
+static long gCapLength[kCaptureBuffers];
+static volatile unsigned long gCapQueued = 0;   /* Buffers handed to the writer */
+static volatile unsigned long gCapWritten = 0;  /* Buffers written to disk */
+static volatile Boolean gCapWriting = false;    /* A write is queued */
+static volatile OSErr gCapError = noErr;
+static ParamBlockRec gCapParamBlock;
+static IOCompletionUPP gCapCompletionUPP = NULL;
+static unsigned long gCapFillTicks = 0;         /* First byte in the fill buffer */
+static unsigned long gCapBytes = 0;             /* Bytes captured */
+static unsigned long gCapDropped = 0;           /* Bytes lost with every buffer full */
+static Boolean gRecvDisplay = true;             /* Received text goes on screen */
+
+/*
+ * File transfer state. The protocol engine in transfer.c is allocated
+ * while a transfer runs; received bytes go to it instead of the display.
+ */
+static XferState *gXfer = NULL;
+static XferIO gXferIO;
+static short gXferProtocol = kXferZModem;
+static short gXferRefNum = 0;               /* Open data fork, or 0 */
+static short gXferZStart = 0;               /* Progress matching a ZMODEM start */
+static unsigned long gXferShownTicks = 0;
+static unsigned long gXferEndTicks = 0;     /* When the last transfer finished */
+static short gXferResult = kXferIdle;
+static const char *gXferMessage = NULL;
+
+/*
+ * Compressed link, off unless asked for. While it is on, outgoing text
+ * is LZSS-encoded as it is queued and received bytes are decoded before
+ * anything else sees them. The codec state is allocated while in use.
+ */
+typedef struct CompressedLink {
+    LzssEncoder encoder;
+    LzssDecoder decoder;
+    unsigned long stateTicks;       /* When asking or closing began */
+    short matched;                  /* Accept marker bytes seen so far */
+    unsigned long wireIn;           /* Compressed bytes each way */
+    unsigned long wireOut;
+    unsigned long plainIn;          /* The same, decompressed */
+    unsigned long plainOut;
+    unsigned long lastPlainIn;      /* At the last statistics sample */
+    unsigned long lastPlainOut;
+    long plainInRate;               /* Effective bytes/sec */
+    long plainOutRate;
+} CompressedLink;
+
+static CompressedLink *gLink = NULL;
+static short gLinkState = kLinkOff;
+static char gLinkPlain[kRxPollBudget];      /* Decoded bytes for the receive path */
+
+/*
+ * Channel link, off unless asked for. While it is on, everything on the
+ * main port travels in mux.c frames: typed text on the console channel,
+ * "@bot" lines on the bot channel and files on the bulk channel. A file
+ * goes as two messages, its name and then its data.
+ */
+typedef struct ChannelLink {
+    MuxState mux;
+    unsigned long stateTicks;       /* When asking or closing began */
+    short matched;                  /* Accept marker bytes seen so far */
+    Boolean closeSent;
+    short sendRefNum;               /* File going out on the bulk channel, or 0 */
+    long sendLeft;                  /* Its bytes not yet queued */
+    Boolean receiving;              /* Bulk data is file contents, not a name */
+    short nameLength;
+    char name[kXferMaxName];
+    unsigned long bulkIn;           /* File bytes each way */
+    unsigned long bulkOut;
+    unsigned long arrival;          /* Of the batch being fed to the engine */
+} ChannelLink;
+
+static ChannelLink *gChan = NULL;
+static short gChanState = kChanOff;
+static MuxIO gChanIO;
+static char gChanPlain[kMuxMaxPayload];     /* Delivered text for the receive path */
+static unsigned char gChanFile[kChanFileChunk];
+
+/*
+ * Terminal emulation, off unless asked for. The main port's received
+ * bytes go through terminal.c onto a grid in a window of its own, and
+ * lines scrolling off its top land in the main receive area, so the
+ * history is kept as plain text. Keys typed in the window go out as a
+ * VT100 would send them.
+ */
+static WindowPtr gTermWindow = NULL;
+static TermScreen *gTerm = NULL;
+static TermIO gTermIO;
+static Rect gTermRect;                      /* The cells, in gTermWindow */
+static short gTermCursorRow = -1;           /* Where the cursor is drawn, -1 if not */
+static short gTermCursorColumn = 0;
+static unsigned long gTermLastRender = 0;
+static unsigned long gTermBells = 0;        /* Bells already sounded */
+static unsigned long gTermArrival = 0;      /* Oldest batch not yet on screen */
+/*
+ * Find. The pattern in the Find window is looked for in the main receive
+ * area's scrollback by find.c, again on every keystroke. Hits are framed
+ * where the receive area draws them and the current one is inverted.
+ */
+static WindowPtr gFindWindow = NULL;
+static TEHandle gFindText = NULL;
+static ControlHandle gFindCaseBox = NULL;
+static FindState *gFind = NULL;
+static Boolean gFindHaveHit = false;        /* gFindLine and gFindColumn are a hit */
+static unsigned long gFindLine = 0;
+static short gFindColumn = 0;
+
+/*
+ * Triggers. The list in the Triggers window is compiled by trigger.c
+ * when applied, and every received byte runs through it. The text is
+ * kept in gTrigSource while the window is shut, for this session only.
+ * A send goes out through SendToTerminalHost, so kTrigMaxText must not
+ * exceed kTermReplyMax.
+ */
+static WindowPtr gTrigWindow = NULL;
+static TEHandle gTrigText = NULL;
+static ControlHandle gTrigApply = NULL;
+static TrigSet *gTrig = NULL;               /* Armed triggers, or NULL before the first */
+static Handle gTrigSource = NULL;           /* The list as last applied */
+static short gTrigResult = kTrigOK;         /* From the last TrigLoad */
+static short gTrigBadLine = 0;
+static short gTrigCapture = -1;             /* kTrigCaptureOn or Off for the main loop, or -1 */
+
+static char gTrigExample[] =
+    "# pattern => send TEXT, beep, capture on or capture off\r"
+    "# Take the # off a line to use it; Enter applies the list.\r"
+    "# login: => send guest\\r\r"
+    "# BEGIN LOG => capture on\r"
+    "# END LOG => capture off\r";
+
+/*
+ * Event loop scheduling. The loop sleeps 0 while anything is moving and
+ * backs off to longer sleeps once the line has been quiet for a while.
+ * A receive completion wakes a sleeping loop with WakeUpProcess, so a
+ * long idle sleep never delays the first byte of a burst.
+ */
+static unsigned long gLastActivityTicks = 0;    /* Last event, byte or write */
+static unsigned long gLastEventTicks = 0;       /* event.when of the last event */
+static short gIdleSleep = 0;                    /* Current back-off step */
+static Boolean gInBackground = false;
+static Boolean gCanWakeUp = false;              /* WakeUpProcess is available */
+static ProcessSerialNumber gAppPSN;
+static volatile Boolean gSleeping = false;      /* Inside WaitNextEvent */
+static RgnHandle gMouseRgn = NULL;              /* Cursor shape holds inside this */
+
+/*
+ * Latency statistics, in microseconds. Keystroke to wire runs from the
+ * event that sent a message to the completion of its first write; wire
+ * to screen runs from the receive completion that delivered a byte to
+ * the redraw that showed it.
+ */
+typedef struct LatencyStat {
+    unsigned long count;
+    unsigned long total;
+    unsigned long worst;
+} LatencyStat;
+
+static LatencyStat gKeyToWire;
+static LatencyStat gWireToScreen;
+
+/*
+ * Hot-path profile. Each main loop pass is split into sections, and the
+ * time from one section boundary to the next is charged to the section
+ * just finished, so the sections add up to the wall time. Only kept
+ * while the statistics window is open or being logged, since reading
+ * the clock costs a trap per boundary.
+ */
+typedef struct ProfileStat {
+    unsigned long calls;
+    unsigned long seconds;          /* Elapsed time in whole seconds */
+    unsigned long micro;            /* Plus these microseconds */
+    unsigned long worst;            /* Longest single call, microseconds */
+} ProfileStat;
+
+static ProfileStat gProfile[kProfSections];
+static Boolean gProfiling = false;
+static unsigned long gProfileStartTicks = 0;
+
+/* Driver line errors on the main port, counted per status sample */
+static unsigned long gErrOverrun = 0;
+static unsigned long gErrParity = 0;
+static unsigned long gErrFraming = 0;
+
+static WindowPtr gStatsWindow = NULL;
+static Boolean gStatsLogging = false;       /* A "#stat" line on Port B each second */
+
+static const char *gProfileNames[kProfSections] = {
+    "Sleep", "Events", "TextEdit", "Receive", "Transmit",
+    "Transfer", "Link", "Capture", "Statistics", "Display"
+};
+
+/* Field names in the logged line */
+static const char *gProfileKeys[kProfSections] = {
+    "sleep", "events", "te", "recv", "send",
+    "xfer", "link", "cap", "stat", "draw"
+};
+
+/*
+ * Link benchmark state. A pseudo-random pattern goes out as raw
+ * messages and the far end echoes it; each returning byte is checked
+ * against the pattern at rxPos. A mismatch collects kBenchResync bytes
+ * and looks for where they line up again, telling lost bytes from
+ * damaged ones.
+ */
+typedef struct LinkBench {
+    short phase;
+    short sweep;
+    short run;                      /* Index of the setting under test */
+    short runCount;
+    short seconds;                  /* Length of each run */
+    short baud;                     /* Setting under test */
+    short flow;
+    short savedBaud;                /* Settings to restore afterwards */
+    short savedFlow;
+    unsigned long phaseTicks;       /* When the phase began */
+    unsigned long quietTicks;       /* Last byte received */
+    unsigned long startMicros;      /* Run start */
+    unsigned long lastMicros;       /* Last byte received in the run */
+    unsigned long txPos;            /* Pattern bytes queued */
+    unsigned long rxPos;            /* Pattern position expected next */
+    unsigned long good;
+    unsigned long dropped;
+    unsigned long corrupt;
+    unsigned long overruns;         /* Status samples reporting an overrun */
+    short lookCount;
+    unsigned char look[kBenchResync];
+} LinkBench;
+
+static LinkBench gBench;
+static unsigned char *gBenchTable = NULL;   /* One pattern period */
+static short gBenchSeconds = kBenchDefaultSeconds;
+static short gBenchSweep = kBenchSweepCurrent;
+
+static char *gXferProtocolNames[] = {
+    "ZMODEM", "YMODEM", "XMODEM-1K"
+};
+
 /* Function prototypes */
 static void InitializeToolbox(void);
 static void InitializeMenus(void);
@@ -125,12 +768,182 @@ static void HandleMenuChoice(long menuChoice);
 static void HandleAppleMenu(short item);
 static void HandleFileMenu(short item);
 static void HandleEditMenu(short item);
+static void HandleTransferMenu(short item);
+static void UpdateTransferMenu(void);
+static void StartFileSend(void);
+static void StartFileReceive(short protocol);
+static void ServiceFileTransfer(void);
+static void EndFileTransfer(void);
+static long QueueRawTransmit(const unsigned char *data, long count);
+static Boolean AllocateTransfer(void);
+static void StartCapture(void);
+static void StopCapture(void);
+static void CaptureReceivedBytes(const char *data, long count);
+static void ServiceCapture(void);
+static void IssueCaptureWrite(void);
+static void CaptureCompletion(ParmBlkPtr paramBlock);
+static void UpdateFileMenu(void);
+static void InitializeScheduling(void);
+static unsigned long ComputeSleepTicks(void);
+static void AdjustCursor(Point where);
+static void RecordLatency(LatencyStat *stat, unsigned long elapsed);
+static void DoLatencyReport(void);
+static void AppendLatency(Str255 dest, const LatencyStat *stat);
+static void ResetProfile(void);
+static void UpdateProfiling(void);
+static unsigned long ProfileStart(void);
+static unsigned long ProfileLap(short section, unsigned long start);
+static void OpenStatsWindow(void);
+static void CloseStatsWindow(void);
+static void DrawStatsWindow(void);
+static void DrawStatsText(short right, short v, ConstStr255Param text);
+static void DrawStatsNumber(short right, short v, unsigned long value);
+static void SetStatsLogging(Boolean on);
+static void LogStatistics(void);
+static void StartLinkBench(void);
+static void StopLinkBench(Boolean cancelled);
+static void ServiceLinkBench(void);
+static void LinkBenchInput(const unsigned char *data, long count);
+static void LinkBenchResync(void);
+static void LinkBenchApply(short baud, short flow);
+static void LinkBenchNextRun(void);
+static void LinkBenchReport(void);
+static void ReportLine(ConstStr255Param line);
+static long XferWriteRoom(void *context);
+static void XferWrite(void *context, const unsigned char *data, long count);
+static long XferReadFile(void *context, long offset, unsigned char *data, long count);
+static int XferCreateFile(void *context, const char *name, long size);
+static int XferWriteFile(void *context, const unsigned char *data, long count);
+static void XferCloseFile(void *context, int complete);
+static unsigned long XferTicks(void *context);
 static void UpdateWindow(WindowPtr window);
 static void SendTextToSerial(void);
+static void IssueTransmitWrite(void);
+static void TransmitCompletion(ParmBlkPtr paramBlock);
+static void ServiceTransmit(void);
+static void StopTransmit(void);
+static void DrawTransmitStatus(void);
+static Boolean TransmitGateOpen(void);
+static void BuildPromptTable(void);
+static void ScanForPrompt(const char *data, long count);
+static void InitializeTiming(void);
+static unsigned long NowMicroseconds(void);
+static long GetDialogNumber(DialogPtr dialog, short item, long minValue, long maxValue);
+static void SetDialogNumber(DialogPtr dialog, short item, long value);
+static void ConfigureFlowControl(SerialPort *port);
+static void ResetStatistics(void);
+static void UpdateStatistics(void);
+static void DrawStatusLine(void);
+static void AppendPString(Str255 dest, ConstStr255Param src);
+static void AppendCString(Str255 dest, const char *src);
+static void AppendNumber(Str255 dest, long value);
 static void PollSerialInput(void);
+static void ReceiveBytes(char *data, long count, unsigned long arrival);
+static void StartCompressedLink(void);
+static void StopCompressedLink(void);
+static void EndCompressedLink(ConstStr255Param report);
+static void ServiceCompressedLink(void);
+static void LinkInput(char *data, long count, unsigned long arrival);
+static TxMessage *CompressMessage(TxMessage *plain);
+static void StartChannels(void);
+static void StopChannels(void);
+static void EndChannels(ConstStr255Param report);
+static void ServiceChannels(void);
+static void ChannelInput(char *data, long count, unsigned long arrival);
+static void SendFileOnChannel(void);
+static long ChanWriteQueued(void *context);
+static void ChanWrite(void *context, const unsigned char *data, long count);
+static void ChanWriteNow(void *context, const unsigned char *data, long count);
+static long ChanAccept(void *context, short channel);
+static void ChanDeliver(void *context, short channel, const unsigned char *data,
+                        long count, int end);
+static void ServicePorts(void);
+static void PollOtherPort(void);
+static void BridgePorts(void);
+static long ForwardPort(short from);
+static Boolean PortsBusy(void);
+static short OtherPort(void);
+static Boolean OpenOtherPort(void);
+static void CloseOtherPort(void);
+static void CloseSerialPort(SerialPort *port);
+static void SetBridging(Boolean on);
+static void SendKeyToOtherPort(char key);
+static void CreatePortWindow(void);
+static void ClosePortWindow(void);
+static void OpenTerminalWindow(void);
+static void CloseTerminalWindow(void);
+static void SendKeyToTerminal(char key);
+static void SendToTerminalHost(const unsigned char *data, long count);
+static void TermScrollOff(void *context, const unsigned char *text, short length);
+static void TermReplyToHost(void *context, const unsigned char *data, long count);
+static void RenderTerminal(Boolean immediate);
+static void DrawTerminal(void);
+static void DrawTerminalCells(short row, short left, short right);
+static void DrawTerminalCursor(void);
+static void OpenFindWindow(void);
+static void CloseFindWindow(void);
+static void DrawFindWindow(void);
+static void DrawFindStatus(void);
+static void FindKey(char key, short modifiers);
+static void FindTyped(void);
+static void FindAgain(Boolean backward);
+static void ShowFindHit(long index);
+static void UpdateFindHits(void);
+static void InvalFindHits(void);
+static void DrawFindHit(const Rect *rowRect, const FindHit *hit);
+static void OpenTrigWindow(void);
+static void CloseTrigWindow(void);
+static void DrawTrigWindow(void);
+static void DrawTrigStatus(void);
+static void ApplyTriggers(void);
+static void ScanTriggers(const char *data, long count);
+static void FireTriggers(unsigned long fired);
+static void ServiceTriggers(void);
+static long PortQueueTransmit(SerialPort *port, const char *data, long count);
+static void IssuePortWrite(SerialPort *port);
+static void StopPortTransmit(SerialPort *port);
+static void PortWriteCompleted(SerialPort *port);
+static void ModemWriteCompletion(ParmBlkPtr paramBlock);
+static void PrinterWriteCompletion(ParmBlkPtr paramBlock);
 static void DoAboutDialog(void);
 static void DoSettingsDialog(void);
 static Boolean ReinitializeSerial(void);
+static void SetRadioButton(DialogPtr dialog, short item, Boolean on);
+static void StartReceiveEngine(SerialPort *port);
+static void StopReceiveEngine(SerialPort *port);
+static void IssueReceiveRead(SerialPort *port);
+static void ReceiveCompleted(SerialPort *port);
+static void ModemReceiveCompletion(ParmBlkPtr paramBlock);
+static void PrinterReceiveCompletion(ParmBlkPtr paramBlock);
+static long ReadReceivedBytes(SerialPort *port, char *dest, long maxCount);
+static int MacSerialOpen(void *context, short port, short baud);
+static long MacSerialRead(void *context, char *data, long maxCount);
+static long MacSerialWrite(void *context, const char *data, long count);
+static int MacSerialStatus(void *context, SerialStatus *status);
+static void AppendReceivedText(ReceivePane *pane, char *buffer, long count);
+static void AppendTextEditBatched(TEHandle te, char *buffer, long count);
+static void AppendTextEditPerChar(TEHandle te, char *buffer, long count);
+static void DoDisplayBenchmark(void);
+static Boolean ScrollbackInit(ScrollbackStore *sb, short columns, short rows);
+static void ScrollbackDispose(ScrollbackStore *sb);
+static Boolean InitReceivePane(ReceivePane *pane, WindowPtr window, const Rect *frame);
+static void DisposeReceivePane(ReceivePane *pane);
+static void DrawReceiveArea(ReceivePane *pane);
+static void DrawReceiveLines(ReceivePane *pane, unsigned long fromLine, unsigned long toLine);
+static void BuildGlyphCache(void);
+static void DisposeGlyphCache(void);
+static void RenderReceiveArea(ReceivePane *pane, Boolean immediate);
+static void UpdateReceiveScrollBar(ReceivePane *pane);
+static void ScrollReceiveView(ReceivePane *pane, long delta);
+static void TrackReceiveScroll(ReceivePane *pane, ControlHandle control, short part,
+                               Point localPoint);
+static pascal void ReceiveScrollAction(ControlHandle control, short part);
+
+/* The serial core reaches each port through these */
+static SerialDriver gPortDrivers[2] = {
+    { &gPorts[kPortModem], MacSerialOpen, MacSerialRead, MacSerialWrite, MacSerialStatus },
+    { &gPorts[kPortPrinter], MacSerialOpen, MacSerialRead, MacSerialWrite, MacSerialStatus }
+};
 
 /*
  * Main entry point
@@ -138,9 +951,15 @@ static Boolean ReinitializeSerial(void);
 void main(void)
 {
     EventRecord event;
+    Boolean gotEvent;
+    unsigned long lap;
 
     InitializeToolbox();
     InitializeMenus();
+    InitializeTiming();
+
+    /* Remember our A5 world for the receive completion routine */
+    gAppA5 = SetCurrentA5();
 
     if (!InitializeSerial()) {
         /* Serial port failed to open - show alert and continue anyway */
@@ -148,35 +967,308 @@ void main(void)
     }
 
     CreateMainWindow();
+    InitializeScheduling();
 
-    /* Main event loop */
+    /* Main event loop - the sleep adapts to what is going on */
     while (gRunning) {
-        if (WaitNextEvent(everyEvent, &event, 5, NULL)) {
+        lap = ProfileStart();
+        gSleeping = true;
+        gotEvent = WaitNextEvent(everyEvent, &event, ComputeSleepTicks(), gMouseRgn);
+        gSleeping = false;
+        lap = ProfileLap(kProfSleep, lap);
+        if (gotEvent) {
             HandleEvent(&event);
+            AdjustCursor(event.where);
         }
+        lap = ProfileLap(kProfEvents, lap);
 
         /* Blink the text cursor */
         if (gSendText != NULL) {
             TEIdle(gSendText);
         }
+        if (gFindText != NULL) {
+            TEIdle(gFindText);
+        }
+        if (gTrigText != NULL) {
+            TEIdle(gTrigText);
+        }
+        lap = ProfileLap(kProfTextEdit, lap);
 
-        /* Check for incoming serial data */
-        PollSerialInput();
+        /* Check for incoming serial data on each open port */
+        ServicePorts();
+        lap = ProfileLap(kProfReceive, lap);
+
+        /* Finish sends and show their progress */
+        ServiceTransmit();
+        lap = ProfileLap(kProfTransmit, lap);
+
+        /* Let a file transfer stream data and time out */
+        ServiceFileTransfer();
+        lap = ProfileLap(kProfTransfer, lap);
+
+        /* Feed and time the link benchmark */
+        ServiceLinkBench();
+
+        /* Give up on a compression handshake nobody answers */
+        ServiceCompressedLink();
+
+        /* Frame, resend and deliver on the channel link */
+        ServiceChannels();
+        lap = ProfileLap(kProfLink, lap);
+
+        /* Start or stop the capture a trigger asked for */
+        ServiceTriggers();
+
+        /* Hand idle capture data to the disk */
+        ServiceCapture();
+        lap = ProfileLap(kProfCapture, lap);
+
+        /* Refresh throughput figures once a second */
+        UpdateStatistics();
+        lap = ProfileLap(kProfStatistics, lap);
+
+        /* Bring the receive areas up to date within the frame budget */
+        RenderReceiveArea(&gRecvPane, false);
+        if (gPortWindow != NULL) {
+            RenderReceiveArea(&gPortPane, false);
+        }
+        RenderTerminal(false);
+        ProfileLap(kProfDisplay, lap);
     }
 
     /* Cleanup */
+    if (gBench.phase != kBenchIdle) {
+        StopLinkBench(true);
+    }
+    if (gXfer != NULL) {
+        XferCancel(gXfer);
+        EndFileTransfer();
+    }
     if (gSendText != NULL) {
         TEDispose(gSendText);
     }
-    if (gRecvText != NULL) {
-        TEDispose(gRecvText);
+    if (gTermWindow != NULL) {
+        CloseTerminalWindow();
+    }
+    if (gStatsWindow != NULL) {
+        CloseStatsWindow();
+    }
+    if (gFindWindow != NULL) {
+        CloseFindWindow();
+    }
+    if (gTrigWindow != NULL) {
+        CloseTrigWindow();
+    }
+    if (gTrig != NULL) {
+        DisposePtr((Ptr)gTrig);
+    }
+    if (gTrigSource != NULL) {
+        DisposeHandle(gTrigSource);
+    }
+    DisposeReceivePane(&gRecvPane);
+    if (gPortWindow != NULL) {
+        ClosePortWindow();
     }
     if (gMainWindow != NULL) {
         DisposeWindow(gMainWindow);
     }
+    if (gMouseRgn != NULL) {
+        DisposeRgn(gMouseRgn);
+    }
+    DisposeGlyphCache();
     CleanupSerial();
 }
 
+/*
+ * Find out whether interrupt-time code can wake the event loop
+ */
+static void InitializeScheduling(void)
+{
+    long response;
+
+    gCanWakeUp = (Gestalt(gestaltOSAttr, &response) == noErr &&
+                  (response & (1L << gestaltLaunchControl)) != 0 &&
+                  GetCurrentProcess(&gAppPSN) == noErr);
+    gMouseRgn = NewRgn();
+    gLastActivityTicks = TickCount();
+}
+
+/*
+ * Choose the WaitNextEvent sleep for this pass. Zero while data is
+ * waiting, a send or transfer is under way, or the line was active in
+ * the last half second; after that it doubles each idle pass up to
+ * kMaxIdleSleep. The caret still blinks on time and a held redraw still
+ * runs when its frame comes due.
+ */
+static unsigned long ComputeSleepTicks(void)
+{
+    unsigned long now;
+    unsigned long sleep;
+    unsigned long limit;
+    unsigned long due;
+    ReceivePane *pane;
+    TEHandle te;
+    short i;
+
+    now = TickCount();
+
+    if (gTxQueueHead != NULL || gXfer != NULL || gBench.phase != kBenchIdle ||
+        PortsBusy() || (gChanState != kChanOff && !MuxIdle(&gChan->mux)) ||
+        now - gLastActivityTicks < kBusyHoldTicks) {
+        gIdleSleep = 0;
+        return 0;
+    }
+
+    limit = gInBackground ? kBackgroundSleep : kMaxIdleSleep;
+    if (!gCanWakeUp && limit > kNoWakeUpSleep) {
+        /* Nothing will cut the sleep short when bytes arrive */
+        limit = kNoWakeUpSleep;
+    }
+
+    sleep = (gIdleSleep == 0) ? 1 : (unsigned long)gIdleSleep * 2;
+    if (sleep > limit) {
+        sleep = limit;
+    }
+    gIdleSleep = (short)sleep;
+
+    /* A redraw held back by the frame budget, in either window */
+    for (i = 0; i < 2; i++) {
+        pane = (i == 0) ? &gRecvPane : &gPortPane;
+        if (pane->storeReady && pane->store.dirty) {
+            due = pane->lastRender + 60 / gRecvFrameRate;
+            if ((long)(due - now) <= 0) {
+                sleep = 0;
+            } else if (due - now < sleep) {
+                sleep = due - now;
+            }
+        }
+    }
+
+    if (gTerm != NULL && gTerm->dirty) {
+        due = gTermLastRender + 60 / gRecvFrameRate;
+        if ((long)(due - now) <= 0) {
+            sleep = 0;
+        } else if (due - now < sleep) {
+            sleep = due - now;
+        }
+    }
+
+    /* The next caret blink, in whichever field is active */
+    te = gSendText;
+    if (gFindText != NULL && (*gFindText)->active) {
+        te = gFindText;
+    }
+    if (gTrigText != NULL && (*gTrigText)->active) {
+        te = gTrigText;
+    }
+    if (!gInBackground && te != NULL && (*te)->active &&
+        (*te)->selStart == (*te)->selEnd) {
+        due = (unsigned long)(*te)->caretTime + GetCaretTime();
+        if ((long)(due - now) <= 0) {
+            sleep = 0;
+        } else if (due - now < sleep) {
+            sleep = due - now;
+        }
+    }
+
+    return sleep;
+}
+
+/*
+ * Show the I-beam over the send field and the arrow elsewhere, and set
+ * gMouseRgn to the area where that shape stays right so WaitNextEvent
+ * only reports mouse-moved events when it has to change
+ */
+static void AdjustCursor(Point where)
+{
+    Rect frame;
+    Point corner;
+    RgnHandle frameRgn;
+    GrafPtr savePort;
+
+    if (gMouseRgn == NULL) {
+        return;
+    }
+
+    /* In the background the cursor belongs to someone else */
+    SetRectRgn(gMouseRgn, -32767, -32767, 32767, 32767);
+    if (gInBackground) {
+        return;
+    }
+    if (gMainWindow == NULL || gMainWindow != FrontWindow()) {
+        SetCursor(&qd.arrow);
+        return;
+    }
+
+    GetPort(&savePort);
+    SetPort(gMainWindow);
+    SetRect(&frame, kSendLeft + 4, kSendTop + 4, kSendRight - 4, kSendBottom - 4);
+    corner = topLeft(frame);
+    LocalToGlobal(&corner);
+    OffsetRect(&frame, corner.h - frame.left, corner.v - frame.top);
+    SetPort(savePort);
+
+    frameRgn = NewRgn();
+    if (frameRgn == NULL) {
+        return;
+    }
+    RectRgn(frameRgn, &frame);
+
+    if (PtInRect(where, &frame)) {
+        SetCursor(*GetCursor(iBeamCursor));
+        CopyRgn(frameRgn, gMouseRgn);
+    } else {
+        SetCursor(&qd.arrow);
+        DiffRgn(gMouseRgn, frameRgn, gMouseRgn);
+    }
+    DisposeRgn(frameRgn);
+}
+
+/*
+ * Add one latency sample. When the total would overflow, the count and
+ * total are both halved, so the average keeps following recent samples.
+ */
+static void RecordLatency(LatencyStat *stat, unsigned long elapsed)
+{
+    if (stat->total + elapsed < stat->total) {
+        stat->total /= 2;
+        stat->count /= 2;
+    }
+    stat->count++;
+    stat->total += elapsed;
+    if (elapsed > stat->worst) {
+        stat->worst = elapsed;
+    }
+}
+
+/*
+ * Pick the best available clock for pacing and timing
+ */
+static void InitializeTiming(void)
+{
+    long response;
+
+    /* Microseconds needs the extended Time Manager */
+    gHasMicroseconds = (Gestalt(gestaltTimeMgrVersion, &response) == noErr &&
+                        response >= gestaltExtendedTimeMgr);
+}
+
+/*
+ * Current time in microseconds, modulo 2^32. Falls back to TickCount
+ * (1/60 s resolution) without the extended Time Manager. Only differences
+ * are meaningful. Safe to call at interrupt time.
+ */
+static unsigned long NowMicroseconds(void)
+{
+    UnsignedWide now;
+
+    if (gHasMicroseconds) {
+        Microseconds(&now);
+        return now.lo;
+    }
+    return TickCount() * 16667UL;
+}
+
 /*
  * Initialize the Mac Toolbox managers
  */
@@ -210,547 +1302,5656 @@ static void InitializeMenus(void)
             AppendResMenu(appleMenu, 'DRVR');
         }
 
+        UpdateFileMenu();
+        UpdateTransferMenu();
+
         DrawMenuBar();
     }
 }
 
 /*
- * Initialize the serial port using current settings
+ * Initialize the serial port using current settings, and the other port
+ * too when both are in use
  * Port A (Modem) connects to /dev/tnt1 in emulator (use /dev/tnt0 on host)
  * Port B (Printer) outputs to ser_b.out file
  */
 static Boolean InitializeSerial(void)
 {
+    Boolean opened;
+
+    gMainPort = &gPorts[gCurrentPort];
+
+    /* Opens through MacSerialOpen, then sends "Serial ready: Modem @ 9600" */
+    opened = SerialOpen(&gPortDrivers[gCurrentPort], gCurrentPort, gCurrentBaud,
+                        gPortNames[gCurrentPort], gBaudNames[gCurrentBaud]) != 0;
+
+    if (gDualPort && !OpenOtherPort()) {
+        CloseOtherPort();
+        UpdateFileMenu();
+        SysBeep(10);
+    }
+    return opened;
+}
+
+/*
+ * Driver open for the serial core: open the port's driver pair, set
+ * the baud rate (8N1) and handshaking, and start the receive engine.
+ * Returns noErr or the Device Manager error.
+ */
+static int MacSerialOpen(void *context, short port, short baud)
+{
+    SerialPort *sp = (SerialPort *)context;
     OSErr err;
-    SerShk handshake;
+
+    /* Buffers and completion routines last as long as the application */
+    if (sp->rxRing == NULL) {
+        sp->rxRing = NewPtr(kRxRingSize);
+    }
+    if (sp->driverBuf == NULL) {
+        sp->driverBuf = NewPtr(kSerDriverBufSize);
+    }
+    if (sp->txRing == NULL) {
+        sp->txRing = NewPtr(kPortTxSize);
+    }
+    if (sp->rxRing == NULL || sp->driverBuf == NULL || sp->txRing == NULL) {
+        return memFullErr;
+    }
+    if (sp->rxCompletionUPP == NULL) {
+        sp->rxCompletionUPP = NewIOCompletionUPP((port == kPortModem) ?
+                                                 ModemReceiveCompletion :
+                                                 PrinterReceiveCompletion);
+        sp->txCompletionUPP = NewIOCompletionUPP((port == kPortModem) ?
+                                                 ModemWriteCompletion :
+                                                 PrinterWriteCompletion);
+    }
 
     /* Select driver names based on port setting */
-    if (gCurrentPort == kPortModem) {
+    if (port == kPortModem) {
         /* Open modem port (port A) */
-        err = OpenDriver("\p.AOut", &gSerialOutRef);
+        err = OpenDriver("\p.AOut", &sp->outRef);
         if (err != noErr) {
-            return false;
+            return err;
         }
-        err = OpenDriver("\p.AIn", &gSerialInRef);
+        err = OpenDriver("\p.AIn", &sp->inRef);
         if (err != noErr) {
-            return false;
+            return err;
         }
     } else {
         /* Open printer port (port B) */
-        err = OpenDriver("\p.BOut", &gSerialOutRef);
+        err = OpenDriver("\p.BOut", &sp->outRef);
         if (err != noErr) {
-            return false;
+            return err;
         }
-        err = OpenDriver("\p.BIn", &gSerialInRef);
+        err = OpenDriver("\p.BIn", &sp->inRef);
         if (err != noErr) {
-            return false;
+            return err;
         }
     }
 
-    /* Configure handshaking - no flow control */
-    handshake.fXOn = 0;
-    handshake.fCTS = 0;
-    handshake.errs = 0;
-    handshake.evts = 0;
-    handshake.fInX = 0;
-
-    SerHShake(gSerialInRef, &handshake);
+    /* Set baud rate, 8N1 */
+    SerReset(sp->outRef, gBaudRates[baud] + stop10 + noParity + data8);
+    SerReset(sp->inRef, gBaudRates[baud] + stop10 + noParity + data8);
 
-    /* Set baud rate based on current setting, 8N1 */
-    SerReset(gSerialOutRef, gBaudRates[gCurrentBaud] + stop10 + noParity + data8);
-    SerReset(gSerialInRef, gBaudRates[gCurrentBaud] + stop10 + noParity + data8);
-
-    /* Send test message with port and baud info */
-    {
-        char msg[64];
-        char *prefix = "Serial ready: ";
-        char *portName = (gCurrentPort == kPortModem) ? "Modem" : "Printer";
-        char *baudName = gBaudNames[gCurrentBaud];
-        long count = 0;
+    /* Configure handshaking from the flow control setting */
+    ConfigureFlowControl(sp);
 
-        /* Build message: "Serial ready: Modem @ 9600\r\n" */
-        while (*prefix) {
-            msg[count++] = *prefix++;
-        }
-        while (*portName) {
-            msg[count++] = *portName++;
-        }
-        msg[count++] = ' ';
-        msg[count++] = '@';
-        msg[count++] = ' ';
-        while (*baudName) {
-            msg[count++] = *baudName++;
-        }
-        msg[count++] = '\r';
-        msg[count++] = '\n';
+    /* Replace the driver's small default input buffer with a larger one */
+    SerSetBuf(sp->inRef, sp->driverBuf, kSerDriverBufSize);
 
-        FSWrite(gSerialOutRef, &count, msg);
+    /* Keep an asynchronous read outstanding from now on */
+    StartReceiveEngine(sp);
+    sp->txHead = 0;
+    sp->txTail = 0;
+    sp->txRunning = true;
+    if (sp == gMainPort) {
+        ResetStatistics();
     }
 
-    return true;
+    return noErr;
 }
 
 /*
- * Close the serial port
+ * Driver read: bytes the receive engine has already collected
  */
-static void CleanupSerial(void)
+static long MacSerialRead(void *context, char *data, long maxCount)
 {
-    if (gSerialOutRef != 0) {
-        CloseDriver(gSerialOutRef);
-        gSerialOutRef = 0;
-    }
-    if (gSerialInRef != 0) {
-        CloseDriver(gSerialInRef);
-        gSerialInRef = 0;
-    }
+    return ReadReceivedBytes((SerialPort *)context, data, maxCount);
 }
 
 /*
- * Create the main application window with send/receive text areas and button
+ * Driver write: a short synchronous write, used for the greeting.
+ * Everything else goes through the asynchronous transmit queue.
  */
-static void CreateMainWindow(void)
+static long MacSerialWrite(void *context, const char *data, long count)
 {
-    Rect windowRect;
-    Rect textRect;
-    Rect buttonRect;
-
-    /* Center the window on screen */
-    SetRect(&windowRect,
-            (qd.screenBits.bounds.right - kWindowWidth) / 2,
-            (qd.screenBits.bounds.bottom - kWindowHeight) / 2 + 20,
-            (qd.screenBits.bounds.right + kWindowWidth) / 2,
-            (qd.screenBits.bounds.bottom + kWindowHeight) / 2 + 20);
-
-    gMainWindow = NewWindow(NULL, &windowRect, "\pSerial Terminal",
-                            true, documentProc, (WindowPtr)-1, true, 0);
+    SerialPort *sp = (SerialPort *)context;
 
-    if (gMainWindow == NULL) {
-        return;
+    if (sp->outRef == 0 || FSWrite(sp->outRef, &count, data) != noErr) {
+        return 0;
     }
+    return count;
+}
 
-    SetPort(gMainWindow);
-    TextFont(kFontIDMonaco);
-    TextSize(9);
+/*
+ * Driver status: receive totals and the line errors the driver has
+ * counted since the previous call
+ */
+static int MacSerialStatus(void *context, SerialStatus *status)
+{
+    SerialPort *sp = (SerialPort *)context;
+    SerStaRec serialStatus;
+    OSErr err;
 
-    /* Create send text area - inset from frame border */
-    SetRect(&textRect, kSendLeft + 4, kSendTop + 4, kSendRight - 4, kSendBottom - 4);
-    gSendText = TENew(&textRect, &textRect);
+    status->received = sp->rxHead;
+    status->inputWaiting = (long)(sp->rxHead - sp->rxTail);
+    status->lineErrors = 0;
 
-    if (gSendText != NULL) {
-        TEActivate(gSendText);
+    if (sp->inRef == 0) {
+        return notOpenErr;
     }
 
-    /* Create Send button */
-    SetRect(&buttonRect, kButtonLeft, kButtonTop, kButtonRight, kButtonBottom);
-    gSendButton = NewControl(gMainWindow, &buttonRect, "\pSend",
-                             true, 0, 0, 1, pushButProc, 0);
-
-    /* Create receive text area - inset from frame border */
-    SetRect(&textRect, kRecvLeft + 4, kRecvTop + 4, kRecvRight - 4, kRecvBottom - 4);
-    gRecvText = TENew(&textRect, &textRect);
-
-    /* Make receive text read-only by not activating it */
+    /* cumErrs holds errors since the previous SerStatus call */
+    err = SerStatus(sp->inRef, &serialStatus);
+    if (err == noErr) {
+        if (serialStatus.cumErrs & (swOverrunErr | hwOverrunErr)) {
+            status->lineErrors |= kSerialOverrun;
+        }
+        if (serialStatus.cumErrs & parityErr) {
+            status->lineErrors |= kSerialParity;
+        }
+        if (serialStatus.cumErrs & framingErr) {
+            status->lineErrors |= kSerialFraming;
+        }
+    }
+    return err;
 }
 
 /*
- * Handle all events
+ * Apply the flow control setting to an open port.
+ * Uses the extended handshake call so DTR can hold off the device when
+ * our input buffer fills; XON/XOFF input also uses the driver's buffer
+ * level to send XOFF.
  */
-static void HandleEvent(EventRecord *event)
+static void ConfigureFlowControl(SerialPort *port)
 {
-    switch (event->what) {
-        case mouseDown:
-            HandleMouseDown(event);
-            break;
-
-        case keyDown:
-        case autoKey:
-            HandleKeyDown(event);
-            break;
+    SerShk handshake;
 
-        case updateEvt:
-            UpdateWindow((WindowPtr)event->message);
-            break;
+    handshake.fXOn = (gFlowControl == kFlowXOnOut || gFlowControl == kFlowXOnBoth);
+    handshake.fCTS = (gFlowControl == kFlowHardware);
+    handshake.xOn = kXOnChar;
+    handshake.xOff = kXOffChar;
+    handshake.errs = 0;
+    handshake.evts = 0;
+    handshake.fInX = (gFlowControl == kFlowXOnIn || gFlowControl == kFlowXOnBoth);
+    handshake.fDTR = (gFlowControl == kFlowHardware);
 
-        case activateEvt:
-            if (gSendText != NULL) {
-                if (event->modifiers & activeFlag) {
-                    TEActivate(gSendText);
-                } else {
-                    TEDeactivate(gSendText);
-                }
-            }
-            break;
+    if (Control(port->outRef, kSerControlHandshakeDTR, &handshake) != noErr) {
+        /* Older drivers only know the basic handshake call */
+        SerHShake(port->outRef, &handshake);
+    }
+}
+
+/*
+ * Close the serial ports
+ */
+static void CleanupSerial(void)
+{
+    char end;
+
+    /* A transfer cannot survive the port closing */
+    if (gXfer != NULL) {
+        XferCancel(gXfer);
+        EndFileTransfer();
+    }
+    if (gCapRefNum != 0) {
+        StopCapture();
+    }
+
+    StopTransmit();
+    if (gLinkState != kLinkOff) {
+        /* Let the far end know plain bytes follow */
+        end = kLzssEnd;
+        if (gLinkState == kLinkOn) {
+            gPortDrivers[gCurrentPort].write(gMainPort, &end, 1);
+        }
+        EndCompressedLink("\pLink uncompressed: port closed");
+    }
+    if (gChanState != kChanOff) {
+        /* The queue is gone, so the close frame goes out directly */
+        if (gChanState == kChanOn || gChanState == kChanClosing) {
+            gChanIO.write = ChanWriteNow;
+            MuxClose(&gChan->mux);
+        }
+        EndChannels("\pChannels closed: port closed");
+    }
+    CloseSerialPort(&gPorts[kPortModem]);
+    CloseSerialPort(&gPorts[kPortPrinter]);
+}
+
+/*
+ * Stop a port's engines and close its drivers, if open
+ */
+static void CloseSerialPort(SerialPort *port)
+{
+    StopReceiveEngine(port);
+    StopPortTransmit(port);
+
+    if (port->outRef != 0) {
+        CloseDriver(port->outRef);
+        port->outRef = 0;
+    }
+    if (port->inRef != 0) {
+        SerSetBuf(port->inRef, NULL, 0);
+        CloseDriver(port->inRef);
+        port->inRef = 0;
+    }
+}
+
+/*
+ * Start the asynchronous receive engine on a port's open input driver
+ */
+static void StartReceiveEngine(SerialPort *port)
+{
+    if (port->inRef == 0) {
+        return;
+    }
+
+    port->rxHead = 0;
+    port->rxTail = 0;
+    port->rxErrors = 0;
+    port->rxArrival = 0;
+    port->rxStalled = false;
+    port->rxRunning = true;
+
+    IssueReceiveRead(port);
+}
+
+/*
+ * Stop the receive engine and cancel the outstanding read
+ */
+static void StopReceiveEngine(SerialPort *port)
+{
+    port->rxRunning = false;
+
+    if (port->rxPending && port->inRef != 0) {
+        /* KillIO runs the completion routine with abortErr before returning */
+        KillIO(port->inRef);
+    }
+
+    port->rxPending = false;
+    port->rxStalled = false;
+}
+
+/*
+ * Queue the next asynchronous read into the free part of the ring.
+ * Called from the main loop to start the engine and from the completion
+ * routine at interrupt time, so it must not move memory or call the
+ * driver synchronously.
+ */
+static void IssueReceiveRead(SerialPort *port)
+{
+    unsigned long used;
+    unsigned long offset;
+    long space;
+    long waiting;
+
+    used = port->rxHead - port->rxTail;
+    if (used >= kRxRingSize) {
+        /* Ring is full - the driver's own buffer holds data until we restart */
+        port->rxStalled = true;
+        return;
+    }
+
+    /* Read into the contiguous region up to the physical end of the ring */
+    offset = port->rxHead & kRxRingMask;
+    space = kRxRingSize - offset;
+    if (space > (long)(kRxRingSize - used)) {
+        space = kRxRingSize - used;
+    }
+
+    /*
+     * Ask for everything the driver has already buffered so one completion
+     * drains a whole burst. When the line is quiet, ask for a single byte so
+     * the read finishes as soon as anything arrives.
+     */
+    waiting = 0;
+    port->rxStatusBlock.ioCRefNum = port->inRef;
+    port->rxStatusBlock.csCode = kSerStatusInputCount;
+    if (PBStatusImmed((ParmBlkPtr)&port->rxStatusBlock) == noErr) {
+        waiting = *(long *)port->rxStatusBlock.csParam;
+    }
+    if (waiting < 1) {
+        waiting = 1;
+    }
+    if (waiting > space) {
+        waiting = space;
+    }
+
+    port->rxParamBlock.ioParam.ioCompletion = port->rxCompletionUPP;
+    port->rxParamBlock.ioParam.ioRefNum = port->inRef;
+    port->rxParamBlock.ioParam.ioBuffer = &port->rxRing[offset];
+    port->rxParamBlock.ioParam.ioReqCount = waiting;
+    port->rxParamBlock.ioParam.ioPosMode = fsAtMark;
+    port->rxParamBlock.ioParam.ioPosOffset = 0;
+
+    port->rxStalled = false;
+    port->rxPending = true;
+    PBReadAsync(&port->rxParamBlock);
+}
+
+/*
+ * Completion routines for receive reads - run at interrupt time.
+ * Each port has its own, so neither depends on how the Device Manager
+ * passes the parameter block pointer.
+ */
+static void ModemReceiveCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+
+    oldA5 = SetA5(gAppA5);
+    ReceiveCompleted(&gPorts[kPortModem]);
+    SetA5(oldA5);
+}
+
+static void PrinterReceiveCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+
+    oldA5 = SetA5(gAppA5);
+    ReceiveCompleted(&gPorts[kPortPrinter]);
+    SetA5(oldA5);
+}
+
+/*
+ * Take in a finished read and queue the next - interrupt time
+ */
+static void ReceiveCompleted(SerialPort *port)
+{
+    OSErr result;
+
+    result = port->rxParamBlock.ioParam.ioResult;
+    port->rxHead += port->rxParamBlock.ioParam.ioActCount;
+    port->rxPending = false;
+
+    if (result != noErr) {
+        port->rxErrors++;
+    }
+
+    if (port->rxParamBlock.ioParam.ioActCount > 0) {
+        if (port->rxArrival == 0) {
+            port->rxArrival = NowMicroseconds() | 1;
+        }
+
+        /* Cut a long idle sleep short so the bytes are handled now */
+        if (gCanWakeUp && gSleeping) {
+            gSleeping = false;
+            WakeUpProcess(&gAppPSN);
+        }
+    }
+
+    /* Keep a read outstanding unless we are shutting down */
+    if (port->rxRunning && result != abortErr) {
+        IssueReceiveRead(port);
+    }
+}
+
+/*
+ * Copy bytes that have already arrived out of a port's staging ring.
+ * Returns the number of bytes copied; never waits for the driver.
+ */
+static long ReadReceivedBytes(SerialPort *port, char *dest, long maxCount)
+{
+    unsigned long head;
+    unsigned long tail;
+    long available;
+    long count;
+    long chunk;
+
+    head = port->rxHead;
+    tail = port->rxTail;
+    available = head - tail;
+    count = (available < maxCount) ? available : maxCount;
+
+    if (count > 0) {
+        /* Copy in at most two pieces around the end of the ring */
+        chunk = kRxRingSize - (tail & kRxRingMask);
+        if (chunk > count) {
+            chunk = count;
+        }
+        BlockMoveData(&port->rxRing[tail & kRxRingMask], dest, chunk);
+        if (count > chunk) {
+            BlockMoveData(port->rxRing, dest + chunk, count - chunk);
+        }
+        port->rxTail = tail + count;
+    }
+
+    /* Restart the engine if it stopped because the ring was full */
+    if (port->rxStalled && !port->rxPending && port->rxRunning) {
+        IssueReceiveRead(port);
+    }
+
+    return count;
+}
+
+/*
+ * Add bytes to a port's send ring and start writing them. Takes what
+ * fits and returns the count; the rest stays with the caller.
+ */
+static long PortQueueTransmit(SerialPort *port, const char *data, long count)
+{
+    unsigned long head;
+    long room;
+    long chunk;
+
+    if (port->outRef == 0) {
+        return 0;
+    }
+
+    room = kPortTxSize - (long)(port->txHead - port->txTail);
+    if (count > room) {
+        count = room;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    /* Copy in at most two pieces around the end of the ring */
+    head = port->txHead;
+    chunk = kPortTxSize - (long)(head & kPortTxMask);
+    if (chunk > count) {
+        chunk = count;
+    }
+    BlockMoveData(data, &port->txRing[head & kPortTxMask], chunk);
+    if (count > chunk) {
+        BlockMoveData(data + chunk, port->txRing, count - chunk);
+    }
+    port->txHead = head + count;
+
+    /* With no write in flight nothing would pick the bytes up */
+    if (!port->txPending) {
+        IssuePortWrite(port);
+    }
+    return count;
+}
+
+/*
+ * Write the run of bytes from the tail of a port's send ring to the
+ * physical end of the ring. Called from the main loop and from the
+ * completion routine.
+ */
+static void IssuePortWrite(SerialPort *port)
+{
+    unsigned long tail;
+    long count;
+    long chunk;
+
+    tail = port->txTail;
+    count = (long)(port->txHead - tail);
+    chunk = kPortTxSize - (long)(tail & kPortTxMask);
+    if (count > chunk) {
+        count = chunk;
+    }
+    if (count <= 0 || !port->txRunning) {
+        return;
+    }
+
+    port->txParamBlock.ioParam.ioCompletion = port->txCompletionUPP;
+    port->txParamBlock.ioParam.ioRefNum = port->outRef;
+    port->txParamBlock.ioParam.ioBuffer = &port->txRing[tail & kPortTxMask];
+    port->txParamBlock.ioParam.ioReqCount = count;
+    port->txParamBlock.ioParam.ioPosMode = fsAtMark;
+    port->txParamBlock.ioParam.ioPosOffset = 0;
+
+    port->txPending = true;
+    PBWriteAsync(&port->txParamBlock);
+}
+
+/*
+ * Completion routines for send ring writes - run at interrupt time
+ */
+static void ModemWriteCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+
+    oldA5 = SetA5(gAppA5);
+    PortWriteCompleted(&gPorts[kPortModem]);
+    SetA5(oldA5);
+}
+
+static void PrinterWriteCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+
+    oldA5 = SetA5(gAppA5);
+    PortWriteCompleted(&gPorts[kPortPrinter]);
+    SetA5(oldA5);
+}
+
+/*
+ * Retire written bytes and chain the next write - interrupt time
+ */
+static void PortWriteCompleted(SerialPort *port)
+{
+    port->txTail += port->txParamBlock.ioParam.ioActCount;
+    port->txPending = false;
+
+    if (port->txParamBlock.ioParam.ioResult != noErr) {
+        /* Closing or failed: what is left will not go out */
+        port->txTail = port->txHead;
+        return;
+    }
+    IssuePortWrite(port);
+}
+
+/*
+ * Abandon a port's send ring - used before the port closes
+ */
+static void StopPortTransmit(SerialPort *port)
+{
+    port->txRunning = false;
+
+    if (port->txPending && port->outRef != 0) {
+        KillIO(port->outRef);
+    }
+    port->txPending = false;
+    port->txHead = 0;
+    port->txTail = 0;
+}
+
+/*
+ * Create the main application window with send/receive text areas and button
+ */
+static void CreateMainWindow(void)
+{
+    Rect windowRect;
+    Rect textRect;
+    Rect buttonRect;
+    Rect recvRect;
+    FontInfo fontInfo;
+
+    /* Center the window on screen */
+    SetRect(&windowRect,
+            (qd.screenBits.bounds.right - kWindowWidth) / 2,
+            (qd.screenBits.bounds.bottom - kWindowHeight) / 2 + 20,
+            (qd.screenBits.bounds.right + kWindowWidth) / 2,
+            (qd.screenBits.bounds.bottom + kWindowHeight) / 2 + 20);
+
+    gMainWindow = NewWindow(NULL, &windowRect, "\pSerial Terminal",
+                            true, documentProc, (WindowPtr)-1, true, 0);
+
+    if (gMainWindow == NULL) {
+        return;
+    }
+
+    SetPort(gMainWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+
+    /* Create send text area - inset from frame border */
+    SetRect(&textRect, kSendLeft + 4, kSendTop + 4, kSendRight - 4, kSendBottom - 4);
+    gSendText = TENew(&textRect, &textRect);
+
+    if (gSendText != NULL) {
+        TEActivate(gSendText);
+    }
+
+    /* Create Send button */
+    SetRect(&buttonRect, kButtonLeft, kButtonTop, kButtonRight, kButtonBottom);
+    gSendButton = NewControl(gMainWindow, &buttonRect, "\pSend",
+                             true, 0, 0, 1, pushButProc, 0);
+
+    /* Receive areas are laid out in Monaco 9 character cells */
+    GetFontInfo(&fontInfo);
+    gRecvAscent = fontInfo.ascent;
+    gRecvLineHeight = fontInfo.ascent + fontInfo.descent + fontInfo.leading;
+    gRecvCharWidth = CharWidth('M');
+    BuildGlyphCache();
+    gRecvScrollActionUPP = NewControlActionUPP(ReceiveScrollAction);
+    gRecvScrollRgn = NewRgn();
+
+    /* Create the receive area with its scrollback store and scroll bar */
+    SetRect(&recvRect, kRecvLeft, kRecvTop, kRecvRight, kRecvBottom);
+    InitReceivePane(&gRecvPane, gMainWindow, &recvRect);
+}
+
+/*
+ * Show the second port's window, titled with the port's name. Its
+ * receive area keeps its text while the ports are reopened.
+ */
+static void CreatePortWindow(void)
+{
+    Rect windowRect;
+    Rect recvRect;
+    Str255 title;
+
+    title[0] = 0;
+    AppendCString(title, gPortNames[OtherPort()]);
+    AppendCString(title, " Port");
+
+    if (gPortWindow != NULL) {
+        SetWTitle(gPortWindow, title);
+        return;
+    }
+
+    /* Under the main window, near the bottom of the screen */
+    SetRect(&windowRect,
+            (qd.screenBits.bounds.right - kPortWindowWidth) / 2,
+            qd.screenBits.bounds.bottom - kPortWindowHeight - 8,
+            (qd.screenBits.bounds.right + kPortWindowWidth) / 2,
+            qd.screenBits.bounds.bottom - 8);
+
+    gPortWindow = NewWindow(NULL, &windowRect, title,
+                            true, documentProc, (WindowPtr)-1, true, 0);
+    if (gPortWindow == NULL) {
+        return;
+    }
+
+    SetPort(gPortWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+
+    SetRect(&recvRect, kPortRecvLeft, kPortRecvTop, kPortRecvRight, kPortRecvBottom);
+    InitReceivePane(&gPortPane, gPortWindow, &recvRect);
+}
+
+/*
+ * Put the second port's window away with its scrollback
+ */
+static void ClosePortWindow(void)
+{
+    DisposeReceivePane(&gPortPane);
+    DisposeWindow(gPortWindow);
+    gPortWindow = NULL;
+}
+
+/*
+ * File > Terminal Emulation: open the terminal window with a blank
+ * screen. The grid is 80 by 24 where the screen has room for it.
+ */
+static void OpenTerminalWindow(void)
+{
+    Rect windowRect;
+    short columns;
+    short rows;
+    short width;
+    short height;
+
+    gTerm = (TermScreen *)NewPtr(sizeof(TermScreen));
+    if (gTerm == NULL) {
+        SysBeep(10);
+        return;
+    }
+
+    columns = (qd.screenBits.bounds.right - 2 * kTermMargin - 8) / gRecvCharWidth;
+    if (columns > kTermColumns) {
+        columns = kTermColumns;
+    }
+    rows = (qd.screenBits.bounds.bottom - GetMBarHeight() - 2 * kTermMargin - 32) /
+           gRecvLineHeight;
+    if (rows > kTermRows) {
+        rows = kTermRows;
+    }
+
+    gTermIO.context = NULL;
+    gTermIO.scrollOff = TermScrollOff;
+    gTermIO.reply = TermReplyToHost;
+    TermInit(gTerm, &gTermIO, rows, columns);
+
+    width = gTerm->columns * gRecvCharWidth + 2 * kTermMargin;
+    height = gTerm->rows * gRecvLineHeight + 2 * kTermMargin;
+    SetRect(&windowRect,
+            (qd.screenBits.bounds.right - width) / 2,
+            GetMBarHeight() + 24,
+            (qd.screenBits.bounds.right + width) / 2,
+            GetMBarHeight() + 24 + height);
+
+    gTermWindow = NewWindow(NULL, &windowRect, "\pTerminal",
+                            true, noGrowDocProc, (WindowPtr)-1, true, 0);
+    if (gTermWindow == NULL) {
+        DisposePtr((Ptr)gTerm);
+        gTerm = NULL;
+        SysBeep(10);
+        return;
+    }
+
+    SetPort(gTermWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+    SetRect(&gTermRect, kTermMargin, kTermMargin,
+            kTermMargin + gTerm->columns * gRecvCharWidth,
+            kTermMargin + gTerm->rows * gRecvLineHeight);
+
+    /* History from here on starts on a line of its own */
+    if (gRecvPane.storeReady && gRecvPane.store.lineOpen) {
+        ScrollbackAppend(&gRecvPane.store, "\r", 1);
+    }
+    gTermCursorRow = -1;
+    gTermBells = 0;
+    gTermArrival = 0;
+}
+
+/*
+ * Put the terminal window away. What is on its screen goes into the
+ * receive area first, as if it had scrolled off.
+ */
+static void CloseTerminalWindow(void)
+{
+    short last;
+    short row;
+
+    last = gTerm->rows - 1;
+    while (last >= 0 && TermRowLength(gTerm, last) == 0) {
+        last--;
+    }
+    for (row = 0; row <= last; row++) {
+        TermScrollOff(NULL, gTerm->chars[row], TermRowLength(gTerm, row));
+    }
+
+    DisposeWindow(gTermWindow);
+    gTermWindow = NULL;
+    DisposePtr((Ptr)gTerm);
+    gTerm = NULL;
+}
+
+/*
+ * Handle all events
+ */
+static void HandleEvent(EventRecord *event)
+{
+    if (event->what != nullEvent && event->what != osEvt) {
+        gLastEventTicks = event->when;
+        gLastActivityTicks = TickCount();
+    }
+
+    switch (event->what) {
+        case mouseDown:
+            HandleMouseDown(event);
+            break;
+
+        case keyDown:
+        case autoKey:
+            HandleKeyDown(event);
+            break;
+
+        case updateEvt:
+            UpdateWindow((WindowPtr)event->message);
+            break;
+
+        case activateEvt:
+            if (gSendText != NULL && (WindowPtr)event->message == gMainWindow) {
+                if (event->modifiers & activeFlag) {
+                    TEActivate(gSendText);
+                } else {
+                    TEDeactivate(gSendText);
+                }
+            } else if (gFindText != NULL && (WindowPtr)event->message == gFindWindow) {
+                if (event->modifiers & activeFlag) {
+                    TEActivate(gFindText);
+                } else {
+                    TEDeactivate(gFindText);
+                }
+            } else if (gTrigText != NULL && (WindowPtr)event->message == gTrigWindow) {
+                if (event->modifiers & activeFlag) {
+                    TEActivate(gTrigText);
+                } else {
+                    TEDeactivate(gTrigText);
+                }
+            }
+            break;
+
+        case osEvt:
+            if (((event->message >> 24) & 0xFF) == suspendResumeMessage) {
+                gInBackground = (event->message & resumeFlag) == 0;
+                if (gSendText != NULL && gMainWindow == FrontWindow()) {
+                    if (gInBackground) {
+                        TEDeactivate(gSendText);
+                    } else {
+                        TEActivate(gSendText);
+                    }
+                } else if (gFindText != NULL && gFindWindow == FrontWindow()) {
+                    if (gInBackground) {
+                        TEDeactivate(gFindText);
+                    } else {
+                        TEActivate(gFindText);
+                    }
+                } else if (gTrigText != NULL && gTrigWindow == FrontWindow()) {
+                    if (gInBackground) {
+                        TEDeactivate(gTrigText);
+                    } else {
+                        TEActivate(gTrigText);
+                    }
+                }
+            }
+            /* Mouse-moved events only need the cursor adjusted */
+            break;
     }
 }
 
 /*
  * Handle mouse down events
  */
-static void HandleMouseDown(EventRecord *event)
+static void HandleMouseDown(EventRecord *event)
+{
+    WindowPtr window;
+    short part;
+    long menuChoice;
+    ControlHandle control;
+    short controlPart;
+    Point localPoint;
+    Rect textFrame;
+
+    part = FindWindow(event->where, &window);
+
+    switch (part) {
+        case inMenuBar:
+            menuChoice = MenuSelect(event->where);
+            HandleMenuChoice(menuChoice);
+            break;
+
+        case inSysWindow:
+            SystemClick(event, window);
+            break;
+
+        case inContent:
+            if (window != FrontWindow()) {
+                SelectWindow(window);
+            } else if (window == gMainWindow) {
+                SetPort(gMainWindow);
+                localPoint = event->where;
+                GlobalToLocal(&localPoint);
+
+                /* Check if click is in button or receive scroll bar */
+                controlPart = FindControl(localPoint, window, &control);
+                if (control != NULL && control == gSendButton) {
+                    if (controlPart == kControlButtonPart) {
+                        if (TrackControl(control, localPoint, NULL) == kControlButtonPart) {
+                            SendTextToSerial();
+                        }
+                    }
+                    return;
+                }
+                if (control != NULL && control == gRecvPane.scroll) {
+                    TrackReceiveScroll(&gRecvPane, control, controlPart, localPoint);
+                    return;
+                }
+
+                /* Check if click is in text area */
+                if (gSendText != NULL) {
+                    SetRect(&textFrame, kSendLeft, kSendTop, kSendRight, kSendBottom);
+                    if (PtInRect(localPoint, &textFrame)) {
+                        TEClick(localPoint, (event->modifiers & shiftKey) != 0, gSendText);
+                    }
+                }
+            } else if (window == gFindWindow) {
+                SetPort(gFindWindow);
+                localPoint = event->where;
+                GlobalToLocal(&localPoint);
+
+                controlPart = FindControl(localPoint, window, &control);
+                if (control != NULL && control == gFindCaseBox) {
+                    if (TrackControl(control, localPoint, NULL) != 0) {
+                        SetControlValue(control, !GetControlValue(control));
+                        FindTyped();
+                    }
+                    return;
+                }
+                SetRect(&textFrame, kFindFieldLeft, kFindFieldTop,
+                        kFindFieldRight, kFindFieldBottom);
+                if (PtInRect(localPoint, &textFrame)) {
+                    TEClick(localPoint, (event->modifiers & shiftKey) != 0, gFindText);
+                }
+            } else if (window == gTrigWindow) {
+                SetPort(gTrigWindow);
+                localPoint = event->where;
+                GlobalToLocal(&localPoint);
+
+                controlPart = FindControl(localPoint, window, &control);
+                if (control != NULL && control == gTrigApply) {
+                    if (TrackControl(control, localPoint, NULL) == kControlButtonPart) {
+                        ApplyTriggers();
+                    }
+                    return;
+                }
+                SetRect(&textFrame, kTrigFieldLeft, kTrigFieldTop,
+                        kTrigFieldRight, kTrigFieldBottom);
+                if (PtInRect(localPoint, &textFrame)) {
+                    TEClick(localPoint, (event->modifiers & shiftKey) != 0, gTrigText);
+                }
+            } else if (window == gPortWindow) {
+                SetPort(gPortWindow);
+                localPoint = event->where;
+                GlobalToLocal(&localPoint);
+
+                controlPart = FindControl(localPoint, window, &control);
+                if (control != NULL && control == gPortPane.scroll) {
+                    TrackReceiveScroll(&gPortPane, control, controlPart, localPoint);
+                }
+            }
+            break;
+
+        case inDrag:
+            DragWindow(window, event->where, &qd.screenBits.bounds);
+            break;
+
+        case inGoAway:
+            if (TrackGoAway(window, event->where)) {
+                if (window == gPortWindow) {
+                    /* Closing the second port's window goes back to one port */
+                    CloseOtherPort();
+                    UpdateFileMenu();
+                } else if (window == gTermWindow) {
+                    CloseTerminalWindow();
+                    UpdateFileMenu();
+                } else if (window == gStatsWindow) {
+                    CloseStatsWindow();
+                    UpdateFileMenu();
+                } else if (window == gFindWindow) {
+                    CloseFindWindow();
+                } else if (window == gTrigWindow) {
+                    CloseTrigWindow();
+                } else {
+                    gRunning = false;
+                }
+            }
+            break;
+    }
+}
+
+/*
+ * Handle key down events
+ */
+static void HandleKeyDown(EventRecord *event)
+{
+    char key;
+
+    key = event->message & charCodeMask;
+
+    /* Check for command key */
+    if (event->modifiers & cmdKey) {
+        /* Command+Return sends text */
+        if (key == '\r') {
+            SendTextToSerial();
+        } else {
+            HandleMenuChoice(MenuKey(key));
+        }
+    } else if (gPortWindow != NULL && gPortWindow == FrontWindow()) {
+        /* The second port's window is a plain terminal */
+        SendKeyToOtherPort(key);
+    } else if (gTermWindow != NULL && gTermWindow == FrontWindow()) {
+        SendKeyToTerminal(key);
+    } else if (gFindWindow != NULL && gFindWindow == FrontWindow()) {
+        FindKey(key, event->modifiers);
+    } else if (gTrigWindow != NULL && gTrigWindow == FrontWindow()) {
+        /* Enter applies the list; Return starts a new line in it */
+        if (key == 0x03) {
+            ApplyTriggers();
+        } else {
+            TEKey(key, gTrigText);
+        }
+    } else if (gSendText != NULL) {
+        /* Pass key to TextEdit */
+        TEKey(key, gSendText);
+    }
+}
+
+/*
+ * Handle menu selections
+ */
+static void HandleMenuChoice(long menuChoice)
+{
+    short menuID;
+    short menuItem;
+
+    if (menuChoice == 0) {
+        return;
+    }
+
+    menuID = HiWord(menuChoice);
+    menuItem = LoWord(menuChoice);
+
+    switch (menuID) {
+        case kAppleMenuID:
+            HandleAppleMenu(menuItem);
+            break;
+
+        case kFileMenuID:
+            HandleFileMenu(menuItem);
+            break;
+
+        case kEditMenuID:
+            HandleEditMenu(menuItem);
+            break;
+
+        case kTransferMenuID:
+            HandleTransferMenu(menuItem);
+            break;
+    }
+
+    HiliteMenu(0);
+}
+
+/*
+ * Handle Apple menu items
+ */
+static void HandleAppleMenu(short item)
+{
+    Str255 itemName;
+    MenuHandle appleMenu;
+
+    if (item == 1) {
+        DoAboutDialog();
+    } else {
+        /* Open desk accessory */
+        appleMenu = GetMenuHandle(kAppleMenuID);
+        if (appleMenu != NULL) {
+            GetMenuItemText(appleMenu, item, itemName);
+            OpenDeskAcc(itemName);
+        }
+    }
+}
+
+/*
+ * Handle File menu items
+ */
+static void HandleFileMenu(short item)
+{
+    switch (item) {
+        case 1: /* Send */
+            SendTextToSerial();
+            break;
+
+        case 3: /* Settings... */
+            DoSettingsDialog();
+            break;
+
+        case 4: /* Display Benchmark */
+            DoDisplayBenchmark();
+            break;
+
+        case kFileCaptureItem: /* Capture to File... / Stop Capture */
+            if (gCapRefNum != 0) {
+                StopCapture();
+            } else {
+                StartCapture();
+            }
+            break;
+
+        case kFileDisplayItem: /* Show Received Text */
+            gRecvDisplay = !gRecvDisplay;
+            UpdateFileMenu();
+            break;
+
+        case kFileLatencyItem: /* Latency Report */
+            DoLatencyReport();
+            break;
+
+        case kFileLinkBenchItem: /* Link Benchmark... / Stop Benchmark */
+            if (gBench.phase != kBenchIdle) {
+                StopLinkBench(true);
+            } else {
+                StartLinkBench();
+            }
+            break;
+
+        case kFileBothPortsItem: /* Both Ports */
+            if (gDualPort) {
+                CloseOtherPort();
+            } else {
+                gDualPort = true;
+                if (!OpenOtherPort()) {
+                    CloseOtherPort();
+                    SysBeep(10);
+                }
+            }
+            UpdateFileMenu();
+            break;
+
+        case kFileBridgeItem: /* Bridge Ports */
+            SetBridging(!gBridging);
+            break;
+
+        case kFileCompressItem: /* Compress Link */
+            if (gLinkState == kLinkOff) {
+                StartCompressedLink();
+            } else if (gLinkState == kLinkOn) {
+                StopCompressedLink();
+            } else {
+                /* Still waiting on the far end */
+                SysBeep(10);
+            }
+            break;
+
+        case kFileChannelsItem: /* Channels */
+            if (gChanState == kChanOff) {
+                StartChannels();
+            } else if (gChanState == kChanOn) {
+                StopChannels();
+            } else {
+                SysBeep(10);
+            }
+            break;
+
+        case kFileTerminalItem: /* Terminal Emulation */
+            if (gTermWindow != NULL) {
+                CloseTerminalWindow();
+            } else {
+                OpenTerminalWindow();
+            }
+            UpdateFileMenu();
+            break;
+
+        case kFileStatisticsItem: /* Statistics */
+            if (gStatsWindow != NULL) {
+                CloseStatsWindow();
+            } else {
+                OpenStatsWindow();
+            }
+            UpdateFileMenu();
+            break;
+
+        case kFileStatsLogItem: /* Log Statistics to Port B */
+            SetStatsLogging(!gStatsLogging);
+            break;
+
+        case kFileTriggersItem: /* Triggers... */
+            OpenTrigWindow();
+            break;
+
+        case kFileQuitItem: /* Quit */
+            gRunning = false;
+            break;
+    }
+}
+
+/*
+ * Keep the capture item's wording and the check marks current
+ */
+static void UpdateFileMenu(void)
+{
+    MenuHandle menu;
+
+    menu = GetMenuHandle(kFileMenuID);
+    if (menu == NULL) {
+        return;
+    }
+
+    SetMenuItemText(menu, kFileCaptureItem,
+                    (gCapRefNum != 0) ? "\pStop Capture" : "\pCapture to File...");
+    CheckItem(menu, kFileDisplayItem, gRecvDisplay);
+    SetMenuItemText(menu, kFileLinkBenchItem,
+                    (gBench.phase != kBenchIdle) ? "\pStop Benchmark" : "\pLink Benchmark...");
+    CheckItem(menu, kFileBothPortsItem, gDualPort);
+    CheckItem(menu, kFileBridgeItem, gBridging);
+    CheckItem(menu, kFileCompressItem, gLinkState == kLinkOn);
+    CheckItem(menu, kFileChannelsItem, gChanState == kChanOn);
+    CheckItem(menu, kFileTerminalItem, gTermWindow != NULL);
+    CheckItem(menu, kFileStatisticsItem, gStatsWindow != NULL);
+    CheckItem(menu, kFileStatsLogItem, gStatsLogging);
+    CheckItem(menu, kFileTriggersItem, gTrig != NULL && gTrig->count > 0);
+    if (gDualPort) {
+        EnableItem(menu, kFileBridgeItem);
+    } else {
+        DisableItem(menu, kFileBridgeItem);
+    }
+}
+
+/*
+ * Handle Transfer menu items
+ */
+static void HandleTransferMenu(short item)
+{
+    switch (item) {
+        case kTransferSendItem:
+            if (gChanState == kChanOn) {
+                SendFileOnChannel();
+            } else {
+                StartFileSend();
+            }
+            break;
+
+        case kTransferReceiveItem:
+            StartFileReceive(gXferProtocol);
+            break;
+
+        case kTransferZModemItem:
+        case kTransferYModemItem:
+        case kTransferXModemItem:
+            gXferProtocol = item - kTransferZModemItem;
+            UpdateTransferMenu();
+            break;
+
+        case kTransferCancelItem:
+            if (gXfer != NULL) {
+                XferCancel(gXfer);
+                EndFileTransfer();
+            }
+            break;
+    }
+}
+
+/*
+ * Check the selected protocol and enable the items that apply
+ */
+static void UpdateTransferMenu(void)
+{
+    MenuHandle menu;
+    short item;
+
+    menu = GetMenuHandle(kTransferMenuID);
+    if (menu == NULL) {
+        return;
+    }
+
+    for (item = kTransferZModemItem; item <= kTransferXModemItem; item++) {
+        CheckItem(menu, item, item - kTransferZModemItem == gXferProtocol);
+    }
+
+    if (gXfer != NULL) {
+        DisableItem(menu, kTransferSendItem);
+        DisableItem(menu, kTransferReceiveItem);
+        EnableItem(menu, kTransferCancelItem);
+    } else {
+        EnableItem(menu, kTransferSendItem);
+        EnableItem(menu, kTransferReceiveItem);
+        DisableItem(menu, kTransferCancelItem);
+    }
+}
+
+/*
+ * Handle Edit menu items
+ */
+static void HandleEditMenu(short item)
+{
+    TEHandle te;
+
+    /* Editing goes to the Find field or trigger list while its window is in front */
+    te = gSendText;
+    if (gFindWindow != NULL && gFindWindow == FrontWindow()) {
+        te = gFindText;
+    } else if (gTrigWindow != NULL && gTrigWindow == FrontWindow()) {
+        te = gTrigText;
+    }
+    if (te == NULL) {
+        return;
+    }
+
+    switch (item) {
+        case 1: /* Undo */
+            /* TextEdit doesn't support undo */
+            break;
+
+        case 3: /* Cut */
+            TECut(te);
+            break;
+
+        case 4: /* Copy */
+            TECopy(te);
+            break;
+
+        case 5: /* Paste */
+            TEPaste(te);
+            break;
+
+        case 6: /* Clear */
+            TEDelete(te);
+            break;
+
+        case 8: /* Select All */
+            TESetSelect(0, 32767, te);
+            break;
+
+        case kEditFindItem: /* Find... */
+            OpenFindWindow();
+            return;
+
+        case kEditFindAgainItem: /* Find Again */
+            FindAgain(false);
+            return;
+    }
+
+    if (te == gFindText) {
+        FindTyped();
+    }
+}
+
+/*
+ * Update window contents
+ */
+static void UpdateWindow(WindowPtr window)
+{
+    Rect textFrame;
+
+    if (window == gTermWindow) {
+        BeginUpdate(window);
+        SetPort(window);
+        DrawTerminal();
+        EndUpdate(window);
+        return;
+    }
+
+    if (window == gStatsWindow) {
+        BeginUpdate(window);
+        SetPort(window);
+        DrawStatsWindow();
+        EndUpdate(window);
+        return;
+    }
+
+    if (window == gFindWindow) {
+        BeginUpdate(window);
+        SetPort(window);
+        DrawFindWindow();
+        EndUpdate(window);
+        return;
+    }
+
+    if (window == gTrigWindow) {
+        BeginUpdate(window);
+        SetPort(window);
+        DrawTrigWindow();
+        EndUpdate(window);
+        return;
+    }
+
+    if (window == gPortWindow) {
+        /* Just the receive area and its scroll bar */
+        BeginUpdate(window);
+        SetPort(window);
+        FrameRect(&gPortPane.frame);
+        DrawControls(window);
+        DrawReceiveArea(&gPortPane);
+        EndUpdate(window);
+        return;
+    }
+
+    if (window != gMainWindow) {
+        return;
+    }
+
+    BeginUpdate(window);
+    SetPort(window);
+
+    /* Draw send label */
+    MoveTo(kSendLeft, kSendTop - 5);
+    DrawString("\pSend:");
+
+    /* Draw frame around send text area */
+    SetRect(&textFrame, kSendLeft, kSendTop, kSendRight, kSendBottom);
+    FrameRect(&textFrame);
+
+    /* Draw send text edit contents */
+    if (gSendText != NULL) {
+        TEUpdate(&textFrame, gSendText);
+    }
+
+    /* Draw button */
+    if (gSendButton != NULL) {
+        DrawControls(window);
+    }
+
+    /* Draw transmit progress */
+    gTxShownSent = -1;
+    DrawTransmitStatus();
+
+    /* Draw receive label */
+    MoveTo(kRecvLeft, kRecvTop - 5);
+    DrawString("\pReceived:");
+
+    /* Draw frame around receive text area */
+    FrameRect(&gRecvPane.frame);
+
+    /* Draw receive text contents */
+    DrawReceiveArea(&gRecvPane);
+
+    /* Draw throughput status line */
+    DrawStatusLine();
+
+    EndUpdate(window);
+}
+
+/*
+ * Queue the text from the text edit field for the serial port.
+ * The text is translated once into a transmit buffer and written with
+ * asynchronous writes, so the event loop and receive engine keep running
+ * while it goes out. Sends made while others are in flight wait in the
+ * transmit queue.
+ */
+static void SendTextToSerial(void)
+{
+    Handle textHandle;
+    long textLength;
+    TxMessage *message;
+    short channel;
+
+    if (gSendText == NULL) {
+        return;
+    }
+
+    /* Get the text from TextEdit */
+    textHandle = (Handle)TEGetText(gSendText);
+    textLength = (*gSendText)->teLength;
+
+    if (textLength == 0) {
+        SysBeep(10);
+        return;
+    }
+
+    /*
+     * Typed text would spoil the benchmark pattern or the bridged stream,
+     * and must wait until the far end has answered a compression request
+     */
+    if (gMainPort->outRef == 0 || gBench.phase != kBenchIdle || gBridging ||
+        gLinkState == kLinkAsking || (gChanState != kChanOff && gChanState != kChanOn)) {
+        SysBeep(10);
+        return;
+    }
+
+    /* Worst case every character is a CR, plus the final CR+LF */
+    message = (TxMessage *)NewPtr(sizeof(TxMessage) + textLength * 2 + 2);
+    if (message == NULL) {
+        SysBeep(10);
+        return;
+    }
+
+    message->next = NULL;
+    message->raw = false;
+    message->data = (char *)(message + 1);
+
+    /* Back-date the stamp to the event that asked for the send */
+    message->stamp = (NowMicroseconds() -
+                      (TickCount() - gLastEventTicks) * kMicrosecondsPerTick) | 1;
+    HLock(textHandle);
+    message->length = SerialTranslateOutgoing(*textHandle, textLength, message->data);
+    HUnlock(textHandle);
+
+    if (gLinkState == kLinkOn) {
+        message = CompressMessage(message);
+        if (message == NULL) {
+            SysBeep(10);
+            return;
+        }
+    }
+
+    if (gChanState == kChanOn) {
+        /* One message on its channel; the text stays put if it cannot go yet */
+        channel = kMuxConsole;
+        if (message->length >= 4 && message->data[0] == '@' &&
+            (message->data[1] | 0x20) == 'b' && (message->data[2] | 0x20) == 'o' &&
+            (message->data[3] | 0x20) == 't') {
+            channel = kMuxBot;
+        }
+        if (MuxWriteRoom(&gChan->mux, channel) < message->length) {
+            DisposePtr((Ptr)message);
+            SysBeep(10);
+            return;
+        }
+        MuxWrite(&gChan->mux, channel, (unsigned char *)message->data, message->length, 1);
+        DisposePtr((Ptr)message);
+        MuxPoll(&gChan->mux);
+
+        TESetSelect(0, 32767, gSendText);
+        TEDelete(gSendText);
+        return;
+    }
+
+    /* Append to the queue; ServiceTransmit starts it when its turn comes */
+    if (gTxQueueTail != NULL) {
+        gTxQueueTail->next = message;
+        gTxBacklog += message->length;
+    } else {
+        gTxQueueHead = message;
+    }
+    gTxQueueTail = message;
+    gTxQueueCount++;
+
+    /* Clear the text field */
+    TESetSelect(0, 32767, gSendText);
+    TEDelete(gSendText);
+
+    ServiceTransmit();
+    DrawTransmitStatus();
+}
+
+/*
+ * Queue the next write from the transmit buffer.
+ * With a character delay each byte is written on its own; with line
+ * pacing or prompt gating a write never runs past the end of a line.
+ * Called from ServiceTransmit and from the completion routine.
+ */
+static void IssueTransmitWrite(void)
+{
+    long count;
+    long limit;
+    char *data;
+
+    data = gTxBuffer + gTxSent;
+    limit = gTxLength - gTxSent;
+    if (limit > kTxChunkSize && !gTxRaw) {
+        limit = kTxChunkSize;
+    }
+
+    gTxWriteEndsLine = false;
+    if (gTxRaw) {
+        /* Protocol packets go out whole */
+        count = limit;
+    } else if (gTxCharDelay > 0) {
+        count = 1;
+        gTxWriteEndsLine = (gTxLineDelay > 0 || gTxPrompt[0] > 0) && data[0] == '\n';
+    } else if (gTxLineDelay > 0 || gTxPrompt[0] > 0) {
+        for (count = 0; count < limit; ) {
+            if (data[count++] == '\n') {
+                gTxWriteEndsLine = true;
+                break;
+            }
+        }
+    } else {
+        count = limit;
+    }
+
+    if (gTxWriteEndsLine) {
+        /* The reply to this line is what we wait for */
+        gTxPromptSeen = false;
+        gPromptMatched = 0;
+    }
+
+    gTxParamBlock.ioParam.ioCompletion = gTxCompletionUPP;
+    gTxParamBlock.ioParam.ioRefNum = gMainPort->outRef;
+    gTxParamBlock.ioParam.ioBuffer = data;
+    gTxParamBlock.ioParam.ioReqCount = count;
+    gTxParamBlock.ioParam.ioPosMode = fsAtMark;
+    gTxParamBlock.ioParam.ioPosOffset = 0;
+
+    gTxPending = true;
+    PBWriteAsync(&gTxParamBlock);
+}
+
+/*
+ * Completion routine for transmit writes - runs at interrupt time.
+ * Chains the next write directly unless pacing has to wait first.
+ */
+static void TransmitCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+    OSErr result;
+
+    oldA5 = SetA5(gAppA5);
+
+    result = gTxParamBlock.ioParam.ioResult;
+    gTxSent += gTxParamBlock.ioParam.ioActCount;
+    gTxTotal += gTxParamBlock.ioParam.ioActCount;
+    gTxLastDone = NowMicroseconds();
+    gTxPending = false;
+    if (gTxFirstWire == 0) {
+        gTxFirstWire = gTxLastDone | 1;
+    }
+
+    if (gTxWriteEndsLine) {
+        gTxAwaitGate = true;
+        gTxGateTicks = TickCount();
+    }
+
+    if (result != noErr) {
+        gTxError = result;
+    } else if (gTxRunning && gTxSent < gTxLength &&
+               (gTxRaw || gTxCharDelay == 0) && !gTxWriteEndsLine) {
+        IssueTransmitWrite();
+    }
+
+    SetA5(oldA5);
+}
+
+/*
+ * Decide whether pacing allows the next write to start now
+ */
+static Boolean TransmitGateOpen(void)
+{
+    unsigned long elapsed;
+
+    if (gTxRaw) {
+        return true;
+    }
+
+    elapsed = NowMicroseconds() - gTxLastDone;
+
+    if (gTxCharDelay > 0 && elapsed < (unsigned long)gTxCharDelay * 1000UL) {
+        return false;
+    }
+
+    if (gTxAwaitGate) {
+        if (gTxLineDelay > 0 && elapsed < (unsigned long)gTxLineDelay * 1000UL) {
+            return false;
+        }
+        if (gTxPrompt[0] > 0 && !gTxPromptSeen &&
+            TickCount() - gTxGateTicks < kPromptTimeoutTicks) {
+            return false;
+        }
+        gTxAwaitGate = false;
+    }
+
+    return true;
+}
+
+/*
+ * Called from the event loop: retire finished messages, start the next
+ * one, issue paced writes when their delay is up, and keep the progress
+ * indicator current
+ */
+static void ServiceTransmit(void)
+{
+    TxMessage *done;
+
+    /* The head message has reached the driver: take its latency sample */
+    if (gTxFirstWire != 0 && gTxQueueHead != NULL && gTxQueueHead->stamp != 0) {
+        RecordLatency(&gKeyToWire, gTxFirstWire - gTxQueueHead->stamp);
+        gTxQueueHead->stamp = 0;
+    }
+
+    if (gTxBuffer != NULL || gTxQueueHead != NULL) {
+        gLastActivityTicks = TickCount();
+    }
+
+    if (gTxPending) {
+        if (gTxSent != gTxShownSent && TickCount() - gTxShownTicks >= kTxStatusTicks) {
+            DrawTransmitStatus();
+        }
+        return;
+    }
+
+    /* Retire the message at the head once it is fully written */
+    if (gTxBuffer != NULL && (gTxSent >= gTxLength || gTxError != noErr)) {
+        if (gTxError != noErr && gTxError != abortErr) {
+            SysBeep(10);
+        }
+
+        done = gTxQueueHead;
+        gTxQueueHead = done->next;
+        if (gTxQueueHead == NULL) {
+            gTxQueueTail = NULL;
+        } else {
+            gTxBacklog -= gTxQueueHead->length;
+        }
+        gTxQueueCount--;
+        DisposePtr((Ptr)done);
+
+        gTxRunning = false;
+        gTxBuffer = NULL;
+        gTxLength = 0;
+        gTxSent = 0;
+        DrawTransmitStatus();
+    }
+
+    if (gMainPort->outRef == 0) {
+        return;
+    }
+
+    /* Start the next queued message */
+    if (gTxBuffer == NULL && gTxQueueHead != NULL) {
+        if (gTxCompletionUPP == NULL) {
+            gTxCompletionUPP = NewIOCompletionUPP(TransmitCompletion);
+        }
+        gTxBuffer = gTxQueueHead->data;
+        gTxLength = gTxQueueHead->length;
+        gTxRaw = gTxQueueHead->raw;
+        gTxSent = 0;
+        gTxError = noErr;
+        gTxFirstWire = 0;
+        gTxRunning = true;
+    }
+
+    if (gTxBuffer != NULL && gTxSent < gTxLength && TransmitGateOpen()) {
+        IssueTransmitWrite();
+    }
+
+    if (gTxSent != gTxShownSent && TickCount() - gTxShownTicks >= kTxStatusTicks) {
+        DrawTransmitStatus();
+    }
+}
+
+/*
+ * Abandon all queued sends - used before the port closes
+ */
+static void StopTransmit(void)
+{
+    TxMessage *message;
+
+    gTxRunning = false;
+
+    if (gTxPending && gMainPort->outRef != 0) {
+        KillIO(gMainPort->outRef);
+    }
+    gTxPending = false;
+
+    while (gTxQueueHead != NULL) {
+        message = gTxQueueHead;
+        gTxQueueHead = message->next;
+        DisposePtr((Ptr)message);
+    }
+    gTxQueueTail = NULL;
+    gTxQueueCount = 0;
+    gTxBacklog = 0;
+
+    gTxBuffer = NULL;
+    gTxLength = 0;
+    gTxSent = 0;
+    gTxAwaitGate = false;
+}
+
+/*
+ * Queue protocol output as a raw message: no line ending translation,
+ * pacing or prompt gating. Returns the number of bytes queued.
+ */
+static long QueueRawTransmit(const unsigned char *data, long count)
+{
+    TxMessage *message;
+
+    if (gMainPort->outRef == 0 || count <= 0) {
+        return 0;
+    }
+
+    message = (TxMessage *)NewPtr(sizeof(TxMessage) + count);
+    if (message == NULL) {
+        return 0;
+    }
+    message->next = NULL;
+    message->raw = true;
+    message->stamp = 0;
+    message->length = count;
+    message->data = (char *)(message + 1);
+    BlockMoveData(data, message->data, count);
+
+    if (gTxQueueTail != NULL) {
+        gTxQueueTail->next = message;
+        gTxBacklog += count;
+    } else {
+        gTxQueueHead = message;
+    }
+    gTxQueueTail = message;
+    gTxQueueCount++;
+
+    ServiceTransmit();
+    return count;
+}
+
+/*
+ * File > Compress Link: ask the far end to switch to LZSS. Nothing else
+ * is sent until it answers; serial_terminal.py does, plain devices just
+ * see a short escape sequence and the link stays as it was.
+ */
+static void StartCompressedLink(void)
+{
+    if (gMainPort->outRef == 0 || gXfer != NULL || gBench.phase != kBenchIdle ||
+        gBridging || gLinkState != kLinkOff || gChanState != kChanOff) {
+        SysBeep(10);
+        return;
+    }
+
+    gLink = (CompressedLink *)NewPtrClear(sizeof(CompressedLink));
+    if (gLink == NULL) {
+        SysBeep(10);
+        return;
+    }
+    LzssInitEncoder(&gLink->encoder);
+    LzssInitDecoder(&gLink->decoder);
+
+    QueueRawTransmit((const unsigned char *)kLzssHello, kLzssMarkerLength);
+    gLinkState = kLinkAsking;
+    gLink->stateTicks = TickCount();
+    ReportLine("\pAsking the far end to compress...");
+}
+
+/*
+ * Send our end marker; the link is plain again once the far end's
+ * marker comes back
+ */
+static void StopCompressedLink(void)
+{
+    unsigned char end;
+
+    end = kLzssEnd;
+    QueueRawTransmit(&end, 1);
+    gLinkState = kLinkClosing;
+    gLink->stateTicks = TickCount();
+    UpdateFileMenu();
+}
+
+/*
+ * Back to plain bytes both ways
+ */
+static void EndCompressedLink(ConstStr255Param report)
+{
+    gLinkState = kLinkOff;
+    if (gLink != NULL) {
+        DisposePtr((Ptr)gLink);
+        gLink = NULL;
+    }
+    ReportLine(report);
+    UpdateFileMenu();
+}
+
+/*
+ * Called from the event loop: a far end that has not answered by now
+ * is not going to
+ */
+static void ServiceCompressedLink(void)
+{
+    if ((gLinkState == kLinkAsking || gLinkState == kLinkClosing) &&
+        TickCount() - gLink->stateTicks >= kLinkAnswerTicks) {
+        EndCompressedLink(gLinkState == kLinkAsking ?
+                          "\pNo answer - the link stays uncompressed" :
+                          "\pLink uncompressed");
+    }
+}
+
+/*
+ * Received bytes while a compressed link is asked for, on or closing.
+ * Bytes up to the far end's accept marker are plain, and so is
+ * everything after its end marker.
+ */
+static void LinkInput(char *data, long count, unsigned long arrival)
+{
+    long offset;
+    long used;
+    long plain;
+    unsigned char end;
+
+    if (gLinkState == kLinkAsking) {
+        offset = SerialFindMarker((unsigned char *)data, count, kLzssAccept, &gLink->matched);
+        if (offset < 0) {
+            ReceiveBytes(data, count, arrival);
+            return;
+        }
+
+        /* Show what came before the marker, not the marker itself */
+        ReceiveBytes(data, (offset > kLzssMarkerLength) ? offset - kLzssMarkerLength : 0,
+                     arrival);
+        data += offset;
+        count -= offset;
+        gLinkState = kLinkOn;
+        ReportLine("\pLink compressed (LZSS)");
+        UpdateFileMenu();
+    }
+
+    while (count > 0 && gLinkState != kLinkOff) {
+        plain = LzssDecode(&gLink->decoder, (unsigned char *)data, count, &used,
+                           (unsigned char *)gLinkPlain, sizeof(gLinkPlain));
+        gLink->wireIn += used;
+        gLink->plainIn += plain;
+        ReceiveBytes(gLinkPlain, plain, arrival);
+        data += used;
+        count -= used;
+
+        if (gLink->decoder.ended) {
+            /* The far end went plain; answer in kind if we have not yet */
+            if (gLinkState == kLinkOn) {
+                end = kLzssEnd;
+                QueueRawTransmit(&end, 1);
+            }
+            EndCompressedLink("\pLink uncompressed");
+        }
+    }
+
+    ReceiveBytes(data, count, arrival);
+}
+
+/*
+ * Replace a translated message with its LZSS encoding, in blocks of at
+ * most kLzssMaxBlock. The result is raw: pacing means nothing once the
+ * lines are compressed. Returns NULL if there is no memory for it.
+ */
+static TxMessage *CompressMessage(TxMessage *plain)
+{
+    TxMessage *message;
+    long offset;
+    long count;
+
+    message = (TxMessage *)NewPtr(sizeof(TxMessage) + LzssBound(plain->length));
+    if (message == NULL) {
+        DisposePtr((Ptr)plain);
+        return NULL;
+    }
+
+    message->next = NULL;
+    message->raw = true;
+    message->stamp = plain->stamp;
+    message->data = (char *)(message + 1);
+    message->length = 0;
+    for (offset = 0; offset < plain->length; offset += count) {
+        count = plain->length - offset;
+        if (count > kLzssMaxBlock) {
+            count = kLzssMaxBlock;
+        }
+        message->length += LzssEncode(&gLink->encoder,
+                                      (unsigned char *)plain->data + offset, count,
+                                      (unsigned char *)message->data + message->length);
+    }
+
+    gLink->plainOut += plain->length;
+    gLink->wireOut += message->length;
+    DisposePtr((Ptr)plain);
+    return message;
+}
+
+/*
+ * File > Channels: ask the far end to split the link into framed
+ * channels. As with compression, only serial_terminal.py answers.
+ */
+static void StartChannels(void)
+{
+    if (gMainPort->outRef == 0 || gXfer != NULL || gBench.phase != kBenchIdle ||
+        gBridging || gLinkState != kLinkOff || gChanState != kChanOff) {
+        SysBeep(10);
+        return;
+    }
+
+    gChan = (ChannelLink *)NewPtrClear(sizeof(ChannelLink));
+    if (gChan == NULL) {
+        SysBeep(10);
+        return;
+    }
+
+    gChanIO.context = NULL;
+    gChanIO.writeQueued = ChanWriteQueued;
+    gChanIO.write = ChanWrite;
+    gChanIO.accept = ChanAccept;
+    gChanIO.deliver = ChanDeliver;
+    gChanIO.ticks = XferTicks;
+
+    /* Resend after the line could have drained a full window and more */
+    MuxStart(&gChan->mux, &gChanIO,
+             30 + (kMuxQueueLimit + kMuxWindow * kMuxMaxFrame) * 60L /
+                  gBaudCharRates[gCurrentBaud]);
+
+    QueueRawTransmit((const unsigned char *)kMuxHello, kMuxMarkerLength);
+    gChanState = kChanAsking;
+    gChan->stateTicks = TickCount();
+    ReportLine("\pAsking the far end for channels...");
+}
+
+/*
+ * Let what is in flight finish, then close. A file still being sent is
+ * cut short.
+ */
+static void StopChannels(void)
+{
+    if (gChan->sendRefNum != 0) {
+        FSClose(gChan->sendRefNum);
+        gChan->sendRefNum = 0;
+        ReportLine("\pFile send stopped");
+    }
+    gChanState = kChanClosing;
+    gChan->stateTicks = TickCount();
+    UpdateFileMenu();
+}
+
+/*
+ * Back to plain bytes both ways. A file half received is kept.
+ */
+static void EndChannels(ConstStr255Param report)
+{
+    gChanState = kChanOff;
+    if (gChan != NULL) {
+        if (gChan->sendRefNum != 0) {
+            FSClose(gChan->sendRefNum);
+        }
+        DisposePtr((Ptr)gChan);
+        gChan = NULL;
+    }
+    XferCloseFile(NULL, 0);
+    ReportLine(report);
+    UpdateFileMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Called from the event loop: keep a file flowing into the bulk channel,
+ * let the engine frame, resend and deliver, and see the handshakes
+ * through or give up on them
+ */
+static void ServiceChannels(void)
+{
+    long room;
+    long count;
+    Str255 line;
+
+    if (gChanState == kChanOff) {
+        return;
+    }
+    if (gChanState == kChanAsking) {
+        if (TickCount() - gChan->stateTicks >= kLinkAnswerTicks) {
+            EndChannels("\pNo answer - channels stay off");
+        }
+        return;
+    }
+
+    while (gChan->sendRefNum != 0) {
+        room = MuxWriteRoom(&gChan->mux, kMuxBulk);
+        count = (gChan->sendLeft < room) ? gChan->sendLeft : room;
+        if (count > kChanFileChunk) {
+            count = kChanFileChunk;
+        }
+        if (room <= 0) {
+            break;
+        }
+        if (count > 0 && FSRead(gChan->sendRefNum, &count, gChanFile) != noErr) {
+            count = 0;
+            gChan->sendLeft = 0;
+        }
+        gChan->sendLeft -= count;
+        gChan->bulkOut += count;
+        MuxWrite(&gChan->mux, kMuxBulk, gChanFile, count, gChan->sendLeft == 0);
+
+        if (gChan->sendLeft == 0) {
+            FSClose(gChan->sendRefNum);
+            gChan->sendRefNum = 0;
+            line[0] = 0;
+            AppendCString(line, "File queued on the bulk channel, ");
+            AppendNumber(line, (long)gChan->bulkOut);
+            AppendCString(line, " bytes");
+            ReportLine(line);
+        }
+    }
+
+    MuxPoll(&gChan->mux);
+    if (gChan->mux.failed) {
+        EndChannels("\pChannels lost: the far end stopped answering");
+        return;
+    }
+
+    if (gChanState == kChanClosing) {
+        if (!gChan->closeSent &&
+            (MuxIdle(&gChan->mux) || TickCount() - gChan->stateTicks >= kLinkAnswerTicks)) {
+            MuxClose(&gChan->mux);
+            gChan->closeSent = true;
+            gChan->stateTicks = TickCount();
+        } else if (gChan->closeSent && TickCount() - gChan->stateTicks >= kLinkAnswerTicks) {
+            EndChannels("\pChannels closed");
+        }
+    }
+}
+
+/*
+ * Received bytes while channels are asked for, on or closing. Bytes up
+ * to the far end's accept marker are plain, and so is everything after
+ * its close frame.
+ */
+static void ChannelInput(char *data, long count, unsigned long arrival)
+{
+    long offset;
+    long used;
+
+    if (gChanState == kChanAsking) {
+        offset = SerialFindMarker((unsigned char *)data, count, kMuxAccept, &gChan->matched);
+        if (offset < 0) {
+            ReceiveBytes(data, count, arrival);
+            return;
+        }
+
+        ReceiveBytes(data, (offset > kMuxMarkerLength) ? offset - kMuxMarkerLength : 0,
+                     arrival);
+        data += offset;
+        count -= offset;
+        gChanState = kChanOn;
+        ReportLine("\pChannels on: console, bot, bulk");
+        UpdateFileMenu();
+    }
+
+    if (count > 0 && gChanState != kChanOff) {
+        gChan->arrival = arrival;
+        used = MuxInput(&gChan->mux, (unsigned char *)data, count);
+        data += used;
+        count -= used;
+
+        if (gChan->mux.closed) {
+            /* The far end is done; answer in kind if we have not yet */
+            if (!gChan->closeSent) {
+                MuxClose(&gChan->mux);
+            }
+            EndChannels("\pChannels closed");
+        }
+    }
+
+    ReceiveBytes(data, count, arrival);
+}
+
+/*
+ * Transfer > Send File... while channels are on: the file goes out on
+ * the bulk channel, name first, without holding up anything typed
+ */
+static void SendFileOnChannel(void)
+{
+    StandardFileReply reply;
+    long size;
+    short refNum;
+
+    if (gChan->sendRefNum != 0 || MuxWriteRoom(&gChan->mux, kMuxBulk) <= kXferMaxName) {
+        SysBeep(10);
+        return;
+    }
+
+    StandardGetFile(NULL, -1, NULL, &reply);
+    if (!reply.sfGood) {
+        return;
+    }
+    if (gChanState != kChanOn) {
+        SysBeep(10);
+        return;
+    }
+
+    refNum = 0;
+    if (FSpOpenDF(&reply.sfFile, fsRdPerm, &refNum) != noErr ||
+        GetEOF(refNum, &size) != noErr) {
+        if (refNum != 0) {
+            FSClose(refNum);
+        }
+        SysBeep(10);
+        return;
+    }
+
+    MuxWrite(&gChan->mux, kMuxBulk, reply.sfFile.name + 1, reply.sfFile.name[0], 1);
+    gChan->sendRefNum = refNum;
+    gChan->sendLeft = size;
+    gChan->bulkOut = 0;
+}
+
+/*
+ * Engine callback: bytes queued ahead of the port
+ */
+static long ChanWriteQueued(void *context)
+{
+    return gTxBacklog + (gTxLength - gTxSent);
+}
+
+/*
+ * Engine callback: queue frames
+ */
+static void ChanWrite(void *context, const unsigned char *data, long count)
+{
+    QueueRawTransmit(data, count);
+}
+
+/*
+ * Engine callback while the port closes: write straight to the driver
+ */
+static void ChanWriteNow(void *context, const unsigned char *data, long count)
+{
+    gPortDrivers[gCurrentPort].write(gMainPort, (const char *)data, count);
+}
+
+/*
+ * Engine callback: the receive path and the file take whatever comes
+ */
+static long ChanAccept(void *context, short channel)
+{
+    return kMuxMaxPayload;
+}
+
+/*
+ * Engine callback: console and bot text go to the receive area as if it
+ * had arrived plain; bulk messages are a file name and then its contents
+ */
+static void ChanDeliver(void *context, short channel, const unsigned char *data,
+                        long count, int end)
+{
+    Str255 line;
+    long i;
+
+    if (channel != kMuxBulk) {
+        BlockMoveData(data, gChanPlain, count);
+        ReceiveBytes(gChanPlain, count, gChan->arrival);
+        return;
+    }
+
+    if (!gChan->receiving) {
+        for (i = 0; i < count && gChan->nameLength < kXferMaxName - 1; i++) {
+            gChan->name[gChan->nameLength++] = data[i];
+        }
+        if (end) {
+            gChan->name[gChan->nameLength] = '\0';
+            gChan->nameLength = 0;
+            gChan->receiving = true;
+            gChan->bulkIn = 0;
+            if (!XferCreateFile(NULL, gChan->name, -1)) {
+                SysBeep(10);
+            }
+        }
+        return;
+    }
+
+    if (gXferRefNum != 0 && count > 0 && !XferWriteFile(NULL, data, count)) {
+        XferCloseFile(NULL, 0);
+        SysBeep(10);
+    }
+    gChan->bulkIn += count;
+
+    if (end) {
+        XferCloseFile(NULL, 1);
+        gChan->receiving = false;
+        line[0] = 0;
+        AppendCString(line, "Received ");
+        AppendCString(line, gChan->name);
+        AppendCString(line, " on the bulk channel, ");
+        AppendNumber(line, (long)gChan->bulkIn);
+        AppendCString(line, " bytes");
+        ReportLine(line);
+    }
+}
+
+/*
+ * Begin a transfer with the protocol engine. Returns false if there is
+ * no memory for it or another transfer is running.
+ */
+static Boolean AllocateTransfer(void)
+{
+    if (gXfer != NULL || gMainPort->outRef == 0 || gBench.phase != kBenchIdle || gBridging ||
+        gLinkState != kLinkOff || gChanState != kChanOff) {
+        SysBeep(10);
+        return false;
+    }
+
+    gXfer = (XferState *)NewPtr(sizeof(XferState));
+    if (gXfer == NULL) {
+        SysBeep(10);
+        return false;
+    }
+
+    gXferIO.context = NULL;
+    gXferIO.writeRoom = XferWriteRoom;
+    gXferIO.write = XferWrite;
+    gXferIO.readFile = XferReadFile;
+    gXferIO.createFile = XferCreateFile;
+    gXferIO.writeFile = XferWriteFile;
+    gXferIO.closeFile = XferCloseFile;
+    gXferIO.ticks = XferTicks;
+    gXferShownTicks = 0;
+    return true;
+}
+
+/*
+ * Transfer > Send File...: pick a file and offer it to the other end
+ */
+static void StartFileSend(void)
+{
+    StandardFileReply reply;
+    char name[kXferMaxName];
+    long size;
+    short i;
+
+    StandardGetFile(NULL, -1, NULL, &reply);
+    if (!reply.sfGood) {
+        return;
+    }
+    if (!AllocateTransfer()) {
+        return;
+    }
+
+    if (FSpOpenDF(&reply.sfFile, fsRdPerm, &gXferRefNum) != noErr ||
+        GetEOF(gXferRefNum, &size) != noErr) {
+        if (gXferRefNum != 0) {
+            FSClose(gXferRefNum);
+            gXferRefNum = 0;
+        }
+        DisposePtr((Ptr)gXfer);
+        gXfer = NULL;
+        SysBeep(10);
+        return;
+    }
+
+    for (i = 0; i < reply.sfFile.name[0] && i < kXferMaxName - 1; i++) {
+        name[i] = reply.sfFile.name[i + 1];
+    }
+    name[i] = '\0';
+
+    XferStartSend(gXfer, &gXferIO, gXferProtocol, name, size);
+    UpdateTransferMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Transfer > Receive File, or a ZMODEM start seen in the receive stream.
+ * Files are saved in the application's folder under the sender's names.
+ */
+static void StartFileReceive(short protocol)
+{
+    if (!AllocateTransfer()) {
+        return;
+    }
+
+    XferStartReceive(gXfer, &gXferIO, protocol);
+    UpdateTransferMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Called from the event loop: let the engine stream and time out, keep
+ * the status line current and clean up when the transfer ends
+ */
+static void ServiceFileTransfer(void)
+{
+    if (gXfer == NULL) {
+        return;
+    }
+
+    XferPoll(gXfer);
+
+    if (gXfer->status != kXferRunning) {
+        EndFileTransfer();
+        return;
+    }
+
+    if (TickCount() - gXferShownTicks >= kXferStatusTicks) {
+        gXferShownTicks = TickCount();
+        DrawStatusLine();
+    }
+}
+
+/*
+ * Release the engine and any open file once a transfer has ended
+ */
+static void EndFileTransfer(void)
+{
+    gXferResult = gXfer->status;
+    gXferMessage = gXfer->message;
+    gXferEndTicks = TickCount();
+
+    if (gXferRefNum != 0) {
+        FSClose(gXferRefNum);
+        gXferRefNum = 0;
+    }
+
+    DisposePtr((Ptr)gXfer);
+    gXfer = NULL;
+    gXferZStart = 0;
+
+    if (gXferResult != kXferDone) {
+        SysBeep(10);
+    }
+    UpdateTransferMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Engine callback: bytes it may queue now. Keeping only a few packets
+ * ahead of the port lets a ZRPOS take effect quickly.
+ */
+static long XferWriteRoom(void *context)
+{
+    long queued;
+
+    queued = gTxBacklog + (gTxLength - gTxSent);
+    return (queued < kXferQueueLimit) ? kXferQueueLimit - queued : 0;
+}
+
+/*
+ * Engine callback: queue protocol output
+ */
+static void XferWrite(void *context, const unsigned char *data, long count)
+{
+    QueueRawTransmit(data, count);
+}
+
+/*
+ * Engine callback: read file data to send, returns bytes read or -1
+ */
+static long XferReadFile(void *context, long offset, unsigned char *data, long count)
+{
+    OSErr err;
+
+    if (SetFPos(gXferRefNum, fsFromStart, offset) != noErr) {
+        return -1;
+    }
+    err = FSRead(gXferRefNum, &count, data);
+    if (err != noErr && err != eofErr) {
+        return -1;
+    }
+    return count;
+}
+
+/*
+ * Engine callback: create a file for the sender's name. Characters the
+ * File Manager rejects are replaced, and a number is added to the name
+ * rather than overwrite an existing file.
+ */
+static int XferCreateFile(void *context, const char *name, long size)
+{
+    FSSpec spec;
+    Str63 fileName;
+    short length;
+    short suffix;
+    OSErr err;
+
+    for (length = 0; name[length] != '\0' && length < 27; length++) {
+        fileName[length + 1] = (name[length] == ':') ? '-' : name[length];
+    }
+    fileName[0] = length;
+
+    for (suffix = 1; suffix < 100; suffix++) {
+        err = FSMakeFSSpec(0, 0, fileName, &spec);
+        if (err == fnfErr) {
+            break;
+        }
+        if (err != noErr) {
+            return 0;
+        }
+
+        /* Name taken: try "name 2", "name 3", ... */
+        fileName[0] = length;
+        fileName[++fileName[0]] = ' ';
+        AppendNumber(fileName, suffix + 1);
+    }
+
+    if (FSpCreate(&spec, kXferFileCreator, kXferFileType, smSystemScript) != noErr) {
+        return 0;
+    }
+    if (FSpOpenDF(&spec, fsWrPerm, &gXferRefNum) != noErr) {
+        gXferRefNum = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Engine callback: append received data to the open file
+ */
+static int XferWriteFile(void *context, const unsigned char *data, long count)
+{
+    return FSWrite(gXferRefNum, &count, data) == noErr;
+}
+
+/*
+ * Engine callback: close the received file. An incomplete file is kept
+ * so whatever arrived is not lost.
+ */
+static void XferCloseFile(void *context, int complete)
+{
+    if (gXferRefNum != 0) {
+        FSClose(gXferRefNum);
+        gXferRefNum = 0;
+        FlushVol(NULL, 0);
+    }
+}
+
+/*
+ * Engine callback: clock in ticks
+ */
+static unsigned long XferTicks(void *context)
+{
+    return TickCount();
+}
+
+/*
+ * File > Capture to File...: ask for a file and start logging every
+ * received byte to it
+ */
+static void StartCapture(void)
+{
+    StandardFileReply reply;
+    short i;
+    OSErr err;
+
+    StandardPutFile("\pCapture received data to:", "\pSerial Capture", &reply);
+    if (!reply.sfGood) {
+        return;
+    }
+
+    for (i = 0; i < kCaptureBuffers; i++) {
+        gCapBuffer[i] = NewPtr(kCaptureBufferSize);
+        if (gCapBuffer[i] == NULL) {
+            while (--i >= 0) {
+                DisposePtr(gCapBuffer[i]);
+            }
+            SysBeep(10);
+            return;
+        }
+    }
+
+    if (reply.sfReplacing) {
+        FSpDelete(&reply.sfFile);
+    }
+    err = FSpCreate(&reply.sfFile, kCaptureCreator, kCaptureFileType, reply.sfScript);
+    if (err == noErr) {
+        err = FSpOpenDF(&reply.sfFile, fsWrPerm, &gCapRefNum);
+    }
+    if (err != noErr) {
+        gCapRefNum = 0;
+        for (i = 0; i < kCaptureBuffers; i++) {
+            DisposePtr(gCapBuffer[i]);
+        }
+        SysBeep(10);
+        return;
+    }
+
+    if (gCapCompletionUPP == NULL) {
+        gCapCompletionUPP = NewIOCompletionUPP(CaptureCompletion);
+    }
+    for (i = 0; i < kCaptureBuffers; i++) {
+        gCapLength[i] = 0;
+    }
+    gCapQueued = 0;
+    gCapWritten = 0;
+    gCapWriting = false;
+    gCapError = noErr;
+    gCapBytes = 0;
+    gCapDropped = 0;
+
+    UpdateFileMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Write out everything buffered, then close the capture file. Waits
+ * for the queued writes, which are already on their way to the disk.
+ */
+static void StopCapture(void)
+{
+    short i;
+
+    if (gCapRefNum == 0) {
+        return;
+    }
+
+    /* Hand over the partly filled buffer */
+    if (gCapLength[gCapQueued & kCaptureBufferMask] > 0 &&
+        gCapQueued - gCapWritten < kCaptureBuffers) {
+        gCapQueued++;
+    }
+    while (gCapError == noErr && (gCapWriting || gCapWritten != gCapQueued)) {
+        if (!gCapWriting) {
+            IssueCaptureWrite();
+        }
+    }
+
+    FSClose(gCapRefNum);
+    gCapRefNum = 0;
+    FlushVol(NULL, 0);
+
+    for (i = 0; i < kCaptureBuffers; i++) {
+        DisposePtr(gCapBuffer[i]);
+        gCapBuffer[i] = NULL;
+    }
+
+    if (gCapError != noErr || gCapDropped > 0) {
+        SysBeep(10);
+    }
+    UpdateFileMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Copy received bytes into the fill buffer, handing each full buffer to
+ * the writer. When every buffer is waiting for the disk the bytes are
+ * counted as dropped rather than stalling the receive path.
+ */
+static void CaptureReceivedBytes(const char *data, long count)
+{
+    long index;
+    long room;
+    long chunk;
+
+    while (count > 0) {
+        if (gCapQueued - gCapWritten >= kCaptureBuffers) {
+            gCapDropped += count;
+            break;
+        }
+
+        index = gCapQueued & kCaptureBufferMask;
+        if (gCapLength[index] == 0) {
+            gCapFillTicks = TickCount();
+        }
+
+        room = kCaptureBufferSize - gCapLength[index];
+        chunk = (count < room) ? count : room;
+        BlockMoveData(data, gCapBuffer[index] + gCapLength[index], chunk);
+        gCapLength[index] += chunk;
+        gCapBytes += chunk;
+        data += chunk;
+        count -= chunk;
+
+        if (gCapLength[index] == kCaptureBufferSize) {
+            gCapQueued++;
+        }
+    }
+
+    if (!gCapWriting && gCapWritten != gCapQueued && gCapError == noErr) {
+        IssueCaptureWrite();
+    }
+}
+
+/*
+ * Called from the event loop: hand over a partial buffer that has waited
+ * long enough, restart the writer, and stop on a disk error
+ */
+static void ServiceCapture(void)
+{
+    if (gCapRefNum == 0) {
+        return;
+    }
+
+    if (gCapError != noErr) {
+        StopCapture();
+        return;
+    }
+
+    if (gCapLength[gCapQueued & kCaptureBufferMask] > 0 &&
+        gCapQueued - gCapWritten < kCaptureBuffers &&
+        TickCount() - gCapFillTicks >= kCaptureFlushTicks) {
+        gCapQueued++;
+    }
+
+    if (!gCapWriting && gCapWritten != gCapQueued) {
+        IssueCaptureWrite();
+    }
+}
+
+/*
+ * Queue an asynchronous write of the oldest handed-over buffer. Called
+ * from the main loop when no write is queued, and from the completion
+ * routine.
+ */
+static void IssueCaptureWrite(void)
+{
+    long index;
+
+    index = gCapWritten & kCaptureBufferMask;
+
+    gCapParamBlock.ioParam.ioCompletion = gCapCompletionUPP;
+    gCapParamBlock.ioParam.ioRefNum = gCapRefNum;
+    gCapParamBlock.ioParam.ioBuffer = gCapBuffer[index];
+    gCapParamBlock.ioParam.ioReqCount = gCapLength[index];
+    gCapParamBlock.ioParam.ioPosMode = fsAtMark;
+    gCapParamBlock.ioParam.ioPosOffset = 0;
+
+    gCapWriting = true;
+    PBWriteAsync(&gCapParamBlock);
+}
+
+/*
+ * Completion routine for capture writes - runs at interrupt time.
+ * Frees the buffer just written and chains the next one.
+ */
+static void CaptureCompletion(ParmBlkPtr paramBlock)
+{
+    long oldA5;
+
+    oldA5 = SetA5(gAppA5);
+
+    if (gCapParamBlock.ioParam.ioResult != noErr) {
+        gCapError = gCapParamBlock.ioParam.ioResult;
+        gCapWriting = false;
+    } else {
+        gCapLength[gCapWritten & kCaptureBufferMask] = 0;
+        gCapWritten++;
+        if (gCapWritten != gCapQueued) {
+            IssueCaptureWrite();
+        } else {
+            gCapWriting = false;
+        }
+    }
+
+    SetA5(oldA5);
+}
+
+/*
+ * Start throughput sampling afresh - called when the port is opened
+ */
+static void ResetStatistics(void)
+{
+    gTxTotal = 0;
+    gStatLastTicks = TickCount();
+    gStatLastRx = gMainPort->rxHead;
+    gStatLastTx = 0;
+    gStatLastRxErrors = 0;
+    gStatRxRate = 0;
+    gStatTxRate = 0;
+    gStatBestLossless = 0;
+    gStatErrors = 0;
+}
+
+/*
+ * Sample throughput and driver errors once per kStatusSampleTicks.
+ * A sample with no overrun, parity, framing or read errors counts toward
+ * the best lossless receive rate, which is the figure to compare when
+ * choosing a baud rate and flow control setting.
+ */
+static void UpdateStatistics(void)
+{
+    unsigned long now;
+    unsigned long elapsed;
+    unsigned long rx;
+    unsigned long tx;
+    long errors;
+    SerialStatus serialStatus;
+    GrafPtr savePort;
+
+    now = TickCount();
+    elapsed = now - gStatLastTicks;
+    if (elapsed < kStatusSampleTicks || gMainPort->inRef == 0) {
+        return;
+    }
+
+    rx = gMainPort->rxHead;
+    tx = gTxTotal;
+    gStatRxRate = (long)((rx - gStatLastRx) * 60 / elapsed);
+    gStatTxRate = (long)((tx - gStatLastTx) * 60 / elapsed);
+
+    /* Line errors are reported since the previous status call */
+    errors = gMainPort->rxErrors - gStatLastRxErrors;
+    gStatLastRxErrors = gMainPort->rxErrors;
+    if (gBench.phase == kBenchIdle &&
+        MacSerialStatus(gMainPort, &serialStatus) == noErr &&
+        serialStatus.lineErrors != 0) {
+        errors++;
+        if (serialStatus.lineErrors & kSerialOverrun) {
+            gErrOverrun++;
+        }
+        if (serialStatus.lineErrors & kSerialParity) {
+            gErrParity++;
+        }
+        if (serialStatus.lineErrors & kSerialFraming) {
+            gErrFraming++;
+        }
+    }
+    gStatErrors += errors;
+
+    if (errors == 0 && gStatRxRate > gStatBestLossless) {
+        gStatBestLossless = gStatRxRate;
+    }
+
+    if (gLink != NULL) {
+        gLink->plainInRate = (long)((gLink->plainIn - gLink->lastPlainIn) * 60 / elapsed);
+        gLink->plainOutRate = (long)((gLink->plainOut - gLink->lastPlainOut) * 60 / elapsed);
+        gLink->lastPlainIn = gLink->plainIn;
+        gLink->lastPlainOut = gLink->plainOut;
+    }
+
+    gStatLastTicks = now;
+    gStatLastRx = rx;
+    gStatLastTx = tx;
+
+    DrawStatusLine();
+
+    if (gStatsWindow != NULL) {
+        GetPort(&savePort);
+        SetPort(gStatsWindow);
+        DrawStatsWindow();
+        SetPort(savePort);
+    }
+    if (gStatsLogging) {
+        LogStatistics();
+    }
+}
+
+/*
+ * Draw the status line: current rates, best lossless rate, errors and
+ * the flow control in use, or the progress of a file transfer
+ */
+static void DrawStatusLine(void)
+{
+    Rect statusRect;
+    Str255 line;
+    long ratio;
+
+    if (gMainWindow == NULL) {
+        return;
+    }
+
+    line[0] = 0;
+    if (gBench.phase != kBenchIdle) {
+        /* Benchmark progress */
+        AppendCString(line, "Bench ");
+        AppendNumber(line, gBench.run + 1);
+        AppendCString(line, "/");
+        AppendNumber(line, gBench.runCount);
+        AppendCString(line, " ");
+        AppendCString(line, gBaudNames[gBench.baud]);
+        AppendCString(line, " ");
+        AppendCString(line, gFlowNames[gBench.flow]);
+        AppendCString(line, gBench.phase == kBenchSettle ? " settling" : " ok ");
+        if (gBench.phase != kBenchSettle) {
+            AppendNumber(line, (long)gBench.good);
+            AppendCString(line, " bad ");
+            AppendNumber(line, (long)(gBench.dropped + gBench.corrupt));
+        }
+    } else if (gXfer != NULL) {
+        /* Transfer progress replaces the rates while it runs */
+        AppendCString(line, gXferProtocolNames[gXfer->protocol]);
+        AppendCString(line, gXfer->sending ? " send " : " receive ");
+        AppendCString(line, gXfer->fileName);
+        AppendCString(line, " ");
+        AppendNumber(line, gXfer->position < 0 ? 0 : gXfer->position);
+        if (gXfer->fileSize >= 0) {
+            AppendCString(line, "/");
+            AppendNumber(line, gXfer->fileSize);
+        }
+    } else if (gBridging) {
+        /* Bytes relayed each way since bridging started */
+        AppendCString(line, "Bridge ");
+        AppendCString(line, gPortNames[kPortModem]);
+        AppendCString(line, ">");
+        AppendNumber(line, (long)gBridged[kPortModem]);
+        AppendCString(line, "  ");
+        AppendCString(line, gPortNames[kPortPrinter]);
+        AppendCString(line, ">");
+        AppendNumber(line, (long)gBridged[kPortPrinter]);
+        AppendCString(line, "  errs ");
+        AppendNumber(line, gStatErrors);
+    } else if (gLinkState == kLinkOn && gLink->wireIn + gLink->wireOut > 0) {
+        /* Compression ratio so far and the rates as the user sees them */
+        ratio = (long)((gLink->plainIn + gLink->plainOut) * 10 /
+                       (gLink->wireIn + gLink->wireOut));
+        AppendCString(line, "LZ ");
+        AppendNumber(line, ratio / 10);
+        AppendCString(line, ".");
+        AppendNumber(line, ratio % 10);
+        AppendCString(line, ":1  Rx ");
+        AppendNumber(line, gLink->plainInRate);
+        AppendCString(line, " Tx ");
+        AppendNumber(line, gLink->plainOutRate);
+        AppendCString(line, " cps eff  errs ");
+        AppendNumber(line, gStatErrors);
+    } else if (gChanState == kChanOn) {
+        /* Line rates with the channels' repair work and file progress */
+        AppendCString(line, "Chan Rx ");
+        AppendNumber(line, gStatRxRate);
+        AppendCString(line, " Tx ");
+        AppendNumber(line, gStatTxRate);
+        AppendCString(line, " cps  resent ");
+        AppendNumber(line, (long)gChan->mux.retransmits);
+        AppendCString(line, " bad ");
+        AppendNumber(line, (long)gChan->mux.badFrames);
+        if (gChan->sendRefNum != 0 || gChan->receiving) {
+            AppendCString(line, "  bulk ");
+            AppendNumber(line, (long)((gChan->receiving ? gChan->bulkIn : gChan->bulkOut) >> 10));
+            AppendCString(line, "K");
+        }
+    } else if (gXferResult != kXferIdle && TickCount() - gXferEndTicks < kXferResultTicks) {
+        AppendCString(line, gXferResult == kXferDone ? "Transfer complete" :
+                            gXferResult == kXferCancelled ? "Transfer cancelled" :
+                            "Transfer failed");
+        if (gXferMessage != NULL && gXferResult != kXferDone) {
+            AppendCString(line, ": ");
+            AppendCString(line, gXferMessage);
+        }
+    } else {
+        AppendCString(line, "Rx ");
+        AppendNumber(line, gStatRxRate);
+        AppendCString(line, " Tx ");
+        AppendNumber(line, gStatTxRate);
+        AppendCString(line, " cps  best ");
+        AppendNumber(line, gStatBestLossless);
+        AppendCString(line, "  errs ");
+        AppendNumber(line, gStatErrors);
+        AppendCString(line, "  ");
+        AppendCString(line, gFlowNames[gFlowControl]);
+    }
+
+    if (gCapRefNum != 0) {
+        AppendCString(line, "  cap ");
+        AppendNumber(line, (long)(gCapBytes >> 10));
+        AppendCString(line, "K");
+        if (gCapDropped > 0) {
+            AppendCString(line, " lost ");
+            AppendNumber(line, (long)gCapDropped);
+        }
+    }
+
+    SetPort(gMainWindow);
+    SetRect(&statusRect, kStatusLeft, kStatusTop, kStatusRight, kStatusBottom);
+    EraseRect(&statusRect);
+    MoveTo(kStatusLeft, kStatusBottom - 4);
+    DrawString(line);
+}
+
+/*
+ * Append a Pascal string to a Pascal string, truncating at 255
+ */
+static void AppendPString(Str255 dest, ConstStr255Param src)
+{
+    short count;
+
+    count = src[0];
+    if (dest[0] + count > 255) {
+        count = 255 - dest[0];
+    }
+    BlockMoveData(src + 1, dest + dest[0] + 1, count);
+    dest[0] += count;
+}
+
+/*
+ * Append a C string to a Pascal string, truncating at 255
+ */
+static void AppendCString(Str255 dest, const char *src)
+{
+    while (*src && dest[0] < 255) {
+        dest[++dest[0]] = *src++;
+    }
+}
+
+/*
+ * Append a decimal number to a Pascal string
+ */
+static void AppendNumber(Str255 dest, long value)
+{
+    Str255 number;
+
+    NumToString(value, number);
+    AppendPString(dest, number);
+}
+
+/*
+ * Build the KMP failure table for the wait-for-prompt string
+ */
+static void BuildPromptTable(void)
+{
+    short length;
+    short i;
+    short k;
+
+    length = gTxPrompt[0];
+    gPromptFail[0] = 0;
+    k = 0;
+    for (i = 1; i < length; i++) {
+        while (k > 0 && gTxPrompt[1 + i] != gTxPrompt[1 + k]) {
+            k = gPromptFail[k - 1];
+        }
+        if (gTxPrompt[1 + i] == gTxPrompt[1 + k]) {
+            k++;
+        }
+        gPromptFail[i] = k;
+    }
+    gPromptMatched = 0;
+}
+
+/*
+ * Watch received bytes for the wait-for-prompt string
+ */
+static void ScanForPrompt(const char *data, long count)
+{
+    short length;
+    short k;
+    const char *end;
+
+    /* The prompt may arrive before the line's write has completed */
+    length = gTxPrompt[0];
+    if (length == 0 || gTxPromptSeen) {
+        return;
+    }
+
+    k = gPromptMatched;
+    for (end = data + count; data < end; data++) {
+        while (k > 0 && *data != (char)gTxPrompt[1 + k]) {
+            k = gPromptFail[k - 1];
+        }
+        if (*data == (char)gTxPrompt[1 + k]) {
+            k++;
+        }
+        if (k == length) {
+            gTxPromptSeen = true;
+            k = 0;
+        }
+    }
+    gPromptMatched = k;
+}
+
+/*
+ * Draw the transmit progress bar and bytes remaining
+ */
+static void DrawTransmitStatus(void)
+{
+    Rect statusRect;
+    Rect barRect;
+    long sent;
+    Str255 remainingText;
+
+    if (gMainWindow == NULL) {
+        return;
+    }
+
+    SetPort(gMainWindow);
+    SetRect(&statusRect, kTxStatusLeft, kTxStatusTop, kTxStatusRight, kTxStatusBottom);
+    EraseRect(&statusRect);
+
+    sent = gTxSent;
+    gTxShownSent = sent;
+    gTxShownTicks = TickCount();
+
+    if (gTxBuffer == NULL || gTxLength == 0) {
+        return;
+    }
+
+    /* Bar across the top, filled in proportion to bytes written */
+    SetRect(&barRect, kTxStatusLeft, kTxStatusTop + 2, kTxStatusRight, kTxStatusTop + 8);
+    FrameRect(&barRect);
+    InsetRect(&barRect, 1, 1);
+    barRect.right = barRect.left + (short)(((long)(barRect.right - barRect.left) * sent) / gTxLength);
+    PaintRect(&barRect);
+
+    /* Bytes remaining underneath, covering the current message and everything queued */
+    NumToString(gTxLength - sent + gTxBacklog, remainingText);
+    MoveTo(kTxStatusLeft, kTxStatusBottom - 2);
+    DrawString(remainingText);
+    DrawString("\p left");
+    if (gTxQueueCount > 1) {
+        NumToString(gTxQueueCount - 1, remainingText);
+        DrawString("\p +");
+        DrawString(remainingText);
+        DrawString("\p queued");
+    }
+}
+
+/*
+ * Append a batch of raw received bytes to the scrollback store.
+ * Line endings are translated in one pass before storing.
+ */
+static void AppendReceivedText(ReceivePane *pane, char *buffer, long count)
+{
+    count = SerialTranslateIncoming(buffer, count, &pane->lastWasCR);
+    if (count > 0) {
+        ScrollbackAppend(&pane->store, buffer, count);
+    }
+}
+
+/*
+ * TextEdit insertion with one TEInsert per batch and one head trim.
+ * Used by the display benchmark only.
+ */
+static void AppendTextEditBatched(TEHandle te, char *buffer, long count)
+{
+    long overflow;
+
+    count = SerialTranslateIncoming(buffer, count, &gRecvPane.lastWasCR);
+    if (count <= 0) {
+        return;
+    }
+
+    TESetSelect(32767, 32767, te);
+    TEInsert(buffer, count, te);
+
+    overflow = (*te)->teLength - kMaxReceiveText;
+    if (overflow > 0) {
+        TESetSelect(0, overflow, te);
+        TEDelete(te);
+    }
+}
+
+/*
+ * Original one-TEKey-per-byte TextEdit insertion.
+ * Used by the display benchmark only.
+ */
+static void AppendTextEditPerChar(TEHandle te, char *buffer, long count)
+{
+    long i;
+
+    for (i = 0; i < count; i++) {
+        char c = buffer[i];
+
+        /* Convert LF to CR for Mac TextEdit */
+        if (c == '\n') {
+            c = '\r';
+        }
+
+        /* Skip CR if followed by LF (handle CRLF) */
+        if (c == '\r' && i + 1 < count && buffer[i + 1] == '\n') {
+            continue;
+        }
+
+        /* Insert character at end of receive text */
+        TESetSelect(32767, 32767, te);
+        TEKey(c, te);
+    }
+
+    /* Limit receive buffer size - remove oldest text if too large */
+    if ((*te)->teLength > kMaxReceiveText) {
+        TESetSelect(0, (*te)->teLength - kMaxReceiveText, te);
+        TEDelete(te);
+    }
+}
+
+/*
+ * Move data collected by the receive engine into the scrollback store.
+ * Drawing is left to RenderReceiveArea so it does not scale with the
+ * number of batches received.
+ */
+static void PollSerialInput(void)
+{
+    long count;
+    short batches;
+    unsigned long start;
+    unsigned long arrival;
+
+    if (gMainPort->inRef == 0 || !gRecvPane.storeReady) {
+        return;
+    }
+
+    /*
+     * Full batches keep coming for up to kSerialBudgetTicks, so a burst
+     * is not spread over many passes; a capture drains the whole ring
+     */
+    start = TickCount();
+    for (batches = 0; batches < kCaptureDrainBatches; batches++) {
+        /* Only bytes that have already arrived are consumed - no driver calls */
+        arrival = gMainPort->rxArrival;
+        count = gPortDrivers[gCurrentPort].read(gMainPort, gRecvBatch, sizeof(gRecvBatch));
+        if (count <= 0) {
+            return;
+        }
+        gLastActivityTicks = TickCount();
+        if (gMainPort->rxHead == gMainPort->rxTail) {
+            gMainPort->rxArrival = 0;
+        }
+
+        if (gChanState != kChanOff) {
+            /* Channel frames are unpacked first */
+            ChannelInput(gRecvBatch, count, arrival);
+        } else if (gLinkState != kLinkOff) {
+            /* A compressed link decodes first */
+            LinkInput(gRecvBatch, count, arrival);
+        } else {
+            ReceiveBytes(gRecvBatch, count, arrival);
+        }
+
+        if (count < (long)sizeof(gRecvBatch) ||
+            (gCapRefNum == 0 && TickCount() - start >= kSerialBudgetTicks)) {
+            return;
+        }
+    }
+}
+
+/*
+ * Give each open port its turn from the event loop. The port served
+ * first alternates between passes so a busy one cannot starve the other.
+ * While bridging, bytes go straight from each port to the other.
+ */
+static void ServicePorts(void)
+{
+    if (gBridging) {
+        BridgePorts();
+        return;
+    }
+
+    if (!gDualPort) {
+        PollSerialInput();
+        return;
+    }
+
+    gServiceOtherFirst = !gServiceOtherFirst;
+    if (gServiceOtherFirst) {
+        PollOtherPort();
+        PollSerialInput();
+    } else {
+        PollSerialInput();
+        PollOtherPort();
+    }
+}
+
+/*
+ * Move bytes received on the second port into its window. That port
+ * has no transfers, capture or prompt gating - it is a plain terminal.
+ */
+static void PollOtherPort(void)
+{
+    SerialPort *port;
+    long count;
+    short batches;
+    unsigned long start;
+    unsigned long arrival;
+
+    port = &gPorts[OtherPort()];
+    if (port->inRef == 0 || gPortWindow == NULL || !gPortPane.storeReady) {
+        return;
+    }
+
+    start = TickCount();
+    for (batches = 0; batches < kCaptureDrainBatches; batches++) {
+        arrival = port->rxArrival;
+        count = gPortDrivers[OtherPort()].read(port, gRecvBatch, sizeof(gRecvBatch));
+        if (count <= 0) {
+            return;
+        }
+        gLastActivityTicks = TickCount();
+        if (port->rxHead == port->rxTail) {
+            port->rxArrival = 0;
+        }
+
+        AppendReceivedText(&gPortPane, gRecvBatch, count);
+        if (gPortPane.arrival == 0) {
+            gPortPane.arrival = arrival;
+        }
+
+        if (count < (long)sizeof(gRecvBatch) || TickCount() - start >= kSerialBudgetTicks) {
+            return;
+        }
+    }
+}
+
+/*
+ * Relay each port's received bytes to the other port's send ring
+ * within the usual time budget. Nothing is drawn per byte; the status
+ * line shows the running totals.
+ */
+static void BridgePorts(void)
+{
+    unsigned long start;
+    long moved;
+
+    start = TickCount();
+    do {
+        moved = ForwardPort(kPortModem) + ForwardPort(kPortPrinter);
+        if (moved > 0) {
+            gLastActivityTicks = TickCount();
+        }
+    } while (moved > 0 && TickCount() - start < kSerialBudgetTicks);
+}
+
+/*
+ * Forward one batch from a port to the other. Takes only what the far
+ * send ring has room for; the rest waits in the receive ring, and when
+ * that fills the driver's handshaking holds off the sender.
+ */
+static long ForwardPort(short from)
+{
+    SerialPort *source;
+    SerialPort *dest;
+    long count;
+
+    source = &gPorts[from];
+    dest = &gPorts[(from == kPortModem) ? kPortPrinter : kPortModem];
+
+    count = kPortTxSize - (long)(dest->txHead - dest->txTail);
+    if (count > (long)sizeof(gRecvBatch)) {
+        count = sizeof(gRecvBatch);
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    count = ReadReceivedBytes(source, gRecvBatch, count);
+    if (count <= 0) {
+        return 0;
+    }
+    if (source->rxHead == source->rxTail) {
+        source->rxArrival = 0;
+    }
+
+    /* The capture file still sees the selected port's side */
+    if (gCapRefNum != 0 && from == gCurrentPort) {
+        CaptureReceivedBytes(gRecvBatch, count);
+    }
+
+    PortQueueTransmit(dest, gRecvBatch, count);
+    gBridged[from] += count;
+    return count;
+}
+
+/*
+ * True while received bytes or queued sends are waiting on either port
+ */
+static Boolean PortsBusy(void)
+{
+    short i;
+
+    for (i = kPortModem; i <= kPortPrinter; i++) {
+        if (gPorts[i].rxHead != gPorts[i].rxTail || gPorts[i].txHead != gPorts[i].txTail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * The port that is not selected in Settings
+ */
+static short OtherPort(void)
+{
+    return (gCurrentPort == kPortModem) ? kPortPrinter : kPortModem;
+}
+
+/*
+ * Open the second port at the same speed and settings, greet it and
+ * show its window. Returns false if the port would not open.
+ */
+static Boolean OpenOtherPort(void)
+{
+    short other;
+
+    other = OtherPort();
+    if (!SerialOpen(&gPortDrivers[other], other, gCurrentBaud,
+                    gPortNames[other], gBaudNames[gCurrentBaud])) {
+        return false;
+    }
+
+    CreatePortWindow();
+    return gPortWindow != NULL;
+}
+
+/*
+ * Back to one port: stop bridging and close the second port and its window
+ */
+static void CloseOtherPort(void)
+{
+    gBridging = false;
+    gDualPort = false;
+    if (gStatsLogging) {
+        gStatsLogging = false;
+        UpdateProfiling();
+    }
+
+    CloseSerialPort(&gPorts[OtherPort()]);
+    if (gPortWindow != NULL) {
+        ClosePortWindow();
+    }
+}
+
+/*
+ * Start or stop relaying between the ports. Bridging needs both ports
+ * and owns them outright, so nothing else may be sending.
+ */
+static void SetBridging(Boolean on)
+{
+    Str255 line;
+
+    if (on == gBridging) {
+        return;
+    }
+    if (on && (!gDualPort || gXfer != NULL || gBench.phase != kBenchIdle ||
+               gTxQueueHead != NULL || gLinkState != kLinkOff || gChanState != kChanOff ||
+               gStatsLogging)) {
+        SysBeep(10);
+        return;
+    }
+
+    gBridging = on;
+    gBridged[kPortModem] = 0;
+    gBridged[kPortPrinter] = 0;
+
+    line[0] = 0;
+    AppendCString(line, on ? "Bridging " : "Bridge stopped: ");
+    AppendCString(line, gPortNames[kPortModem]);
+    AppendCString(line, " <> ");
+    AppendCString(line, gPortNames[kPortPrinter]);
+    ReportLine(line);
+
+    UpdateFileMenu();
+    DrawStatusLine();
+}
+
+/*
+ * Send a key typed in the second port's window; Return goes out as CR+LF
+ */
+static void SendKeyToOtherPort(char key)
+{
+    char data[2];
+    long count;
+
+    if (gBridging) {
+        /* The relayed stream must not get keystrokes mixed in */
+        SysBeep(10);
+        return;
+    }
+
+    data[0] = key;
+    count = 1;
+    if (key == '\r') {
+        data[1] = '\n';
+        count = 2;
+    }
+    PortQueueTransmit(&gPorts[OtherPort()], data, count);
+}
+
+/*
+ * Send a key typed in the terminal window. The arrow keys go out as
+ * VT100 cursor keys and Delete as DEL; Return is CR, or CR+LF in
+ * newline mode.
+ */
+static void SendKeyToTerminal(char key)
+{
+    unsigned char data[3];
+    long count;
+
+    data[0] = (unsigned char)key;
+    count = 1;
+
+    switch ((unsigned char)key) {
+        case 0x1C: /* Left arrow */
+        case 0x1D: /* Right arrow */
+        case 0x1E: /* Up arrow */
+        case 0x1F: /* Down arrow */
+            data[0] = 0x1B;
+            data[1] = '[';
+            data[2] = "DCAB"[key - 0x1C];
+            count = 3;
+            break;
+
+        case 0x03: /* Enter */
+        case '\r':
+            data[0] = '\r';
+            if (gTerm->newLine) {
+                data[1] = '\n';
+                count = 2;
+            }
+            break;
+
+        case 0x08: /* Delete */
+            data[0] = 0x7F;
+            break;
+    }
+
+    SendToTerminalHost(data, count);
+}
+
+/*
+ * Send keys, a terminal reply or a trigger's text down the main port
+ * however the link is set up: as a console message, compressed, or as
+ * they are
+ */
+static void SendToTerminalHost(const unsigned char *data, long count)
+{
+    unsigned char packed[LzssBound(kTermReplyMax)];
+
+    if (gMainPort->outRef == 0 || gBench.phase != kBenchIdle || gBridging ||
+        gLinkState == kLinkAsking || (gChanState != kChanOff && gChanState != kChanOn) ||
+        count > kTermReplyMax) {
+        SysBeep(10);
+        return;
+    }
+
+    if (gChanState == kChanOn) {
+        if (MuxWrite(&gChan->mux, kMuxConsole, data, count, 1) != count) {
+            SysBeep(10);
+        }
+        MuxPoll(&gChan->mux);
+    } else if (gLinkState == kLinkOn) {
+        gLink->plainOut += count;
+        count = LzssEncode(&gLink->encoder, data, count, packed);
+        gLink->wireOut += count;
+        QueueRawTransmit(packed, count);
+    } else {
+        QueueRawTransmit(data, count);
+    }
+}
+
+/*
+ * Terminal callback: a line leaving the top of the screen goes into the
+ * main receive area's history
+ */
+static void TermScrollOff(void *context, const unsigned char *text, short length)
+{
+    if (!gRecvPane.storeReady) {
+        return;
+    }
+    ScrollbackAppend(&gRecvPane.store, (const char *)text, length);
+    ScrollbackAppend(&gRecvPane.store, "\r", 1);
+}
+
+/*
+ * Terminal callback: answer a status or attributes request
+ */
+static void TermReplyToHost(void *context, const unsigned char *data, long count)
+{
+    SendToTerminalHost(data, count);
+}
+
+/*
+ * Hand received bytes to whatever wants them: the benchmark, a transfer,
+ * or the triggers and the receive area. A compressed link has already
+ * decoded them. The receive area translates line endings in place.
+ */
+static void ReceiveBytes(char *data, long count, unsigned long arrival)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    /* Raw bytes, before any display translation */
+    if (gCapRefNum != 0) {
+        CaptureReceivedBytes(data, count);
+    }
+
+    if (gBench.phase != kBenchIdle) {
+        /* The link benchmark checks the echo instead of showing it */
+        LinkBenchInput((unsigned char *)data, count);
+    } else if (gXfer != NULL) {
+        /* A transfer in progress owns the received bytes */
+        XferInput(gXfer, (unsigned char *)data, count);
+    } else {
+        /* A ZMODEM sender on the other end starts a download by itself */
+        if (XferIsZModemStart((unsigned char *)data, count, &gXferZStart)) {
+            StartFileReceive(kXferZModem);
+        }
+
+        ScanForPrompt(data, count);
+        ScanTriggers(data, count);
+        if (gRecvDisplay && gTerm != NULL) {
+            /* Escape sequences and all; the grid gets the raw bytes */
+            TermWrite(gTerm, (unsigned char *)data, count);
+            if (gTermArrival == 0) {
+                gTermArrival = arrival;
+            }
+        } else if (gRecvDisplay) {
+            AppendReceivedText(&gRecvPane, data, count);
+            if (gRecvPane.arrival == 0) {
+                gRecvPane.arrival = arrival;
+            }
+        }
+    }
+}
+
+/*
+ * Initialize a scrollback store wrapping at the given column count
+ * for a view of the given number of rows.
+ * Allocates up to kScrollbackMaxChunks text chunks; settles for fewer
+ * if memory is short. Returns false if even the minimum is unavailable.
+ */
+static Boolean ScrollbackInit(ScrollbackStore *sb, short columns, short rows)
+{
+    short i;
+
+    sb->chunkCount = 0;
+    sb->lineStart = (unsigned long *)NewPtr(kScrollbackLines * sizeof(unsigned long));
+    sb->lineLength = (unsigned char *)NewPtr(kScrollbackLines);
+
+    if (sb->lineStart != NULL && sb->lineLength != NULL) {
+        for (i = 0; i < kScrollbackMaxChunks; i++) {
+            sb->chunks[i] = NewPtr(kScrollbackChunkSize);
+            if (sb->chunks[i] == NULL) {
+                break;
+            }
+            sb->chunkCount++;
+        }
+    }
+
+    if (sb->chunkCount < kScrollbackMinChunks) {
+        ScrollbackDispose(sb);
+        return false;
+    }
+
+    sb->capacity = (unsigned long)sb->chunkCount * kScrollbackChunkSize;
+    sb->columns = columns;
+    sb->rows = rows;
+    ScrollbackClear(sb);
+    return true;
+}
+
+/*
+ * Release all memory held by a scrollback store
+ */
+static void ScrollbackDispose(ScrollbackStore *sb)
+{
+    short i;
+
+    for (i = 0; i < sb->chunkCount; i++) {
+        DisposePtr(sb->chunks[i]);
+    }
+    sb->chunkCount = 0;
+
+    if (sb->lineStart != NULL) {
+        DisposePtr((Ptr)sb->lineStart);
+        sb->lineStart = NULL;
+    }
+    if (sb->lineLength != NULL) {
+        DisposePtr((Ptr)sb->lineLength);
+        sb->lineLength = NULL;
+    }
+}
+
+/*
+ * Set up a receive area inside frame: its scrollback store, wrapped to
+ * the text width, and a scroll bar down the frame's right edge.
+ * Returns false if the store could not be allocated.
+ */
+static Boolean InitReceivePane(ReceivePane *pane, WindowPtr window, const Rect *frame)
+{
+    Rect scrollRect;
+    short columns;
+
+    pane->window = window;
+    pane->frame = *frame;
+    SetRect(&pane->textRect, frame->left + 4, frame->top + 4,
+            frame->right - kScrollBarWidth - 2, frame->bottom - 4);
+    pane->rows = (pane->textRect.bottom - pane->textRect.top) / gRecvLineHeight;
+    pane->drawnTop = 0;
+    pane->lastRender = 0;
+    pane->arrival = 0;
+    pane->lastWasCR = 0;
+
+    /* Monaco is monospaced, so one width serves every character */
+    columns = (pane->textRect.right - pane->textRect.left) / CharWidth('M');
+    if (columns > kScrollbackMaxColumns) {
+        columns = kScrollbackMaxColumns;
+    }
+    pane->storeReady = ScrollbackInit(&pane->store, columns, pane->rows);
+
+    SetRect(&scrollRect, frame->right - kScrollBarWidth, frame->top,
+            frame->right, frame->bottom);
+    pane->scroll = NewControl(window, &scrollRect, "\p", true, 0, 0, 0, scrollBarProc, 0);
+
+    return pane->storeReady;
+}
+
+/*
+ * Release a receive area's scrollback. The scroll bar goes with its window.
+ */
+static void DisposeReceivePane(ReceivePane *pane)
+{
+    if (pane->storeReady) {
+        ScrollbackDispose(&pane->store);
+        pane->storeReady = false;
+    }
+}
+
+/*
+ * Draw the whole receive area as of the last render.
+ * Used for update events, which must not get ahead of the incremental
+ * state kept by RenderReceiveArea.
+ */
+static void DrawReceiveArea(ReceivePane *pane)
+{
+    EraseRect(&pane->textRect);
+
+    DrawReceiveLines(pane, pane->drawnTop, pane->drawnTop + pane->rows);
+}
+
+/*
+ * Redraw the rows showing lines fromLine..toLine-1 in a view whose top
+ * is pane->drawnTop. Rows past the end of the text are just erased.
+ * With the glyph cache each row is composed offscreen and copied with
+ * one CopyBits; otherwise it is erased and drawn with DrawText.
+ */
+static void DrawReceiveLines(ReceivePane *pane, unsigned long fromLine, unsigned long toLine)
+{
+    ScrollbackStore *sb;
+    Rect rowRect;
+    Rect srcRect;
+    unsigned long line;
+    unsigned long endLine;
+    char *text;
+    short length;
+    short row;
+    const FindHit *hit;
+    long hitIndex;
+
+    if (!pane->storeReady) {
+        return;
+    }
+    sb = &pane->store;
+
+    if (fromLine < pane->drawnTop) {
+        fromLine = pane->drawnTop;
+    }
+    if (toLine > pane->drawnTop + pane->rows) {
+        toLine = pane->drawnTop + pane->rows;
+    }
+
+    if (gGlyphs != NULL) {
+        /* The composed row covers the whole text width, so no erase is needed */
+        gLineBits.rowBytes = (short)GlyphRowBytes(1, pane->textRect.right - pane->textRect.left);
+        SetRect(&gLineBits.bounds, 0, 0, gLineBits.rowBytes * 8, gRecvLineHeight);
+        SetRect(&srcRect, 0, 0, pane->textRect.right - pane->textRect.left, gRecvLineHeight);
+    }
+
+    /* Find hits are in line order, so one lookup serves every row */
+    hitIndex = 0;
+    if (pane == &gRecvPane && gFind != NULL) {
+        hitIndex = FindHitIndex(gFind, fromLine, 0);
+    }
+
+    endLine = sb->firstLine + sb->lineCount;
+    for (line = fromLine; line < toLine; line++) {
+        row = line - pane->drawnTop;
+        SetRect(&rowRect, pane->textRect.left, pane->textRect.top + row * gRecvLineHeight,
+                pane->textRect.right, pane->textRect.top + (row + 1) * gRecvLineHeight);
+
+        text = NULL;
+        length = 0;
+        if (line >= sb->firstLine && line < endLine) {
+            text = ScrollbackLinePtr(sb, line);
+            length = sb->lineLength[line & kScrollbackLineMask];
+        }
+
+        if (gGlyphs != NULL) {
+            GlyphCompose(gGlyphs, (unsigned char *)text, length,
+                         (unsigned char *)gLineBits.baseAddr, gLineBits.rowBytes);
+            CopyBits(&gLineBits, &pane->window->portBits, &srcRect, &rowRect, srcCopy, NULL);
+        } else {
+            EraseRect(&rowRect);
+            if (length > 0) {
+                MoveTo(pane->textRect.left, rowRect.top + gRecvAscent);
+                DrawText(text, 0, length);
+            }
+        }
+
+        while (pane == &gRecvPane && gFind != NULL && hitIndex < gFind->count &&
+               (hit = FindHitAt(gFind, hitIndex))->line == line) {
+            DrawFindHit(&rowRect, hit);
+            hitIndex++;
+        }
+    }
+}
+
+/*
+ * Draw every character code once in Monaco 9 into an offscreen strip
+ * and keep the result as a glyph atlas, with a buffer for one composed
+ * receive line. Without the memory, or with a font too big for the
+ * atlas, gGlyphs stays NULL and lines are drawn with DrawText.
+ */
+static void BuildGlyphCache(void)
+{
+    GrafPort port;
+    GrafPtr savePort;
+    BitMap strip;
+    short c;
+
+    if (gRecvCharWidth > kGlyphMaxWidth || gRecvLineHeight > kGlyphMaxHeight) {
+        return;
+    }
+
+    strip.rowBytes = kGlyphStripRowBytes;
+    SetRect(&strip.bounds, 0, 0, kGlyphCount * 8, gRecvLineHeight);
+    strip.baseAddr = NewPtrClear((long)kGlyphStripRowBytes * gRecvLineHeight);
+    gGlyphs = (GlyphAtlas *)NewPtr(sizeof(GlyphAtlas));
+    gLineBits.baseAddr = NewPtr(GlyphRowBytes(kScrollbackMaxColumns, gRecvCharWidth) *
+                                gRecvLineHeight);
+    if (strip.baseAddr == NULL || gGlyphs == NULL || gLineBits.baseAddr == NULL) {
+        if (strip.baseAddr != NULL) {
+            DisposePtr(strip.baseAddr);
+        }
+        DisposeGlyphCache();
+        return;
+    }
+
+    GetPort(&savePort);
+    OpenPort(&port);
+    SetPortBits(&strip);
+    PortSize(strip.bounds.right, strip.bounds.bottom);
+    RectRgn(port.visRgn, &strip.bounds);
+    ClipRect(&strip.bounds);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+    for (c = 0; c < kGlyphCount; c++) {
+        MoveTo(c * 8, gRecvAscent);
+        DrawChar(c);
+    }
+    ClosePort(&port);
+    SetPort(savePort);
+
+    GlyphLoad(gGlyphs, (unsigned char *)strip.baseAddr, gRecvCharWidth, gRecvLineHeight);
+    DisposePtr(strip.baseAddr);
+}
+
+/*
+ * Free the glyph atlas and line buffer; drawing falls back to DrawText
+ */
+static void DisposeGlyphCache(void)
+{
+    if (gGlyphs != NULL) {
+        DisposePtr((Ptr)gGlyphs);
+        gGlyphs = NULL;
+    }
+    if (gLineBits.baseAddr != NULL) {
+        DisposePtr(gLineBits.baseAddr);
+        gLineBits.baseAddr = NULL;
+    }
+}
+
+/*
+ * Bring a receive area on screen up to date with its scrollback store.
+ * Pixels still valid are moved with ScrollRect and only changed or newly
+ * exposed lines are drawn. Unless immediate, this runs at most
+ * gRecvFrameRate times per second however many batches arrived.
+ */
+static void RenderReceiveArea(ReceivePane *pane, Boolean immediate)
+{
+    ScrollbackStore *sb;
+    unsigned long now;
+    unsigned long top;
+    long delta;
+
+    if (!pane->storeReady || pane->window == NULL) {
+        return;
+    }
+    sb = &pane->store;
+
+    top = sb->topLine;
+    if (!sb->dirty && top == pane->drawnTop) {
+        return;
+    }
+
+    now = TickCount();
+    if (!immediate && now - pane->lastRender < (unsigned long)(60 / gRecvFrameRate)) {
+        return;
+    }
+    pane->lastRender = now;
+
+    if (pane == &gRecvPane && gFind != NULL && sb->dirty) {
+        UpdateFindHits();
+    }
+
+    SetPort(pane->window);
+    UpdateReceiveScrollBar(pane);
+
+    if (pane->window != FrontWindow()) {
+        /* Parts may be covered - let the update event repaint from scratch */
+        pane->drawnTop = top;
+        InvalRect(&pane->textRect);
+        sb->dirty = false;
+        pane->arrival = 0;
+        return;
+    }
+
+    delta = (long)(top - pane->drawnTop);
+
+    if (delta >= pane->rows || -delta >= pane->rows) {
+        /* Nothing on screen can be reused */
+        pane->drawnTop = top;
+        EraseRect(&pane->textRect);
+        DrawReceiveLines(pane, top, top + pane->rows);
+    } else {
+        if (delta != 0) {
+            ScrollRect(&pane->textRect, 0, (short)(-delta * gRecvLineHeight), gRecvScrollRgn);
+        }
+        pane->drawnTop = top;
+
+        if (delta > 0) {
+            /* Lines scrolled in at the bottom */
+            DrawReceiveLines(pane, top + pane->rows - delta, top + pane->rows);
+        } else if (delta < 0) {
+            /* Lines scrolled in at the top */
+            DrawReceiveLines(pane, top, top - delta);
+        }
+
+        if (sb->dirty) {
+            DrawReceiveLines(pane, sb->dirtyLine, top + pane->rows);
+        }
+    }
+
+    sb->dirty = false;
+
+    /* Everything received so far is on screen now */
+    if (pane->arrival != 0) {
+        RecordLatency(&gWireToScreen, NowMicroseconds() - pane->arrival);
+        pane->arrival = 0;
+    }
+}
+
+/*
+ * Sync a receive scroll bar with its store's line count and view
+ */
+static void UpdateReceiveScrollBar(ReceivePane *pane)
+{
+    ScrollbackStore *sb;
+    long maxTop;
+
+    if (pane->scroll == NULL || !pane->storeReady) {
+        return;
+    }
+    sb = &pane->store;
+
+    maxTop = (long)sb->lineCount - pane->rows;
+    if (maxTop < 0) {
+        maxTop = 0;
+    }
+
+    if (GetControlMaximum(pane->scroll) != maxTop) {
+        SetControlMaximum(pane->scroll, (short)maxTop);
+    }
+    if (GetControlValue(pane->scroll) != (short)(sb->topLine - sb->firstLine)) {
+        SetControlValue(pane->scroll, (short)(sb->topLine - sb->firstLine));
+    }
+}
+
+/*
+ * Scroll a receive view by a number of lines and redraw it now
+ */
+static void ScrollReceiveView(ReceivePane *pane, long delta)
+{
+    ScrollbackStore *sb;
+    long top;
+    long maxTop;
+
+    if (!pane->storeReady) {
+        return;
+    }
+    sb = &pane->store;
+
+    maxTop = (long)sb->lineCount - pane->rows;
+    if (maxTop < 0) {
+        maxTop = 0;
+    }
+
+    top = (long)(sb->topLine - sb->firstLine) + delta;
+    if (top < 0) {
+        top = 0;
+    }
+    if (top > maxTop) {
+        top = maxTop;
+    }
+
+    sb->topLine = sb->firstLine + top;
+    sb->followTail = (top == maxTop);
+
+    RenderReceiveArea(pane, true);
+}
+
+/*
+ * Follow a click in a receive scroll bar
+ */
+static void TrackReceiveScroll(ReceivePane *pane, ControlHandle control, short part,
+                               Point localPoint)
+{
+    if (part == kControlIndicatorPart) {
+        /* Thumb drag - jump to the new position afterwards */
+        if (TrackControl(control, localPoint, NULL) != 0) {
+            ScrollReceiveView(pane, (long)GetControlValue(control) -
+                                    (long)(pane->store.topLine - pane->store.firstLine));
+        }
+    } else if (part != 0) {
+        TrackControl(control, localPoint, gRecvScrollActionUPP);
+    }
+}
+
+/*
+ * Scroll bar action procedure for the arrows and page regions
+ */
+static pascal void ReceiveScrollAction(ControlHandle control, short part)
+{
+    ReceivePane *pane;
+
+    pane = ((*control)->contrlOwner == gPortWindow) ? &gPortPane : &gRecvPane;
+
+    switch (part) {
+        case kControlUpButtonPart:
+            ScrollReceiveView(pane, -1);
+            break;
+
+        case kControlDownButtonPart:
+            ScrollReceiveView(pane, 1);
+            break;
+
+        case kControlPageUpPart:
+            ScrollReceiveView(pane, -(pane->rows - 1));
+            break;
+
+        case kControlPageDownPart:
+            ScrollReceiveView(pane, pane->rows - 1);
+            break;
+    }
+}
+
+/*
+ * Bring the terminal window up to date with its grid within the frame
+ * budget. Whole-screen scrolls move pixels with ScrollRect; after that
+ * only the cells that changed are drawn, and the cell the cursor left.
+ */
+static void RenderTerminal(Boolean immediate)
+{
+    TermScreen *t = gTerm;
+    unsigned long now;
+    short cursorRow;
+    short row;
+
+    if (t == NULL) {
+        return;
+    }
+
+    cursorRow = t->cursorVisible ? t->row : -1;
+    if (!t->dirty && cursorRow == gTermCursorRow &&
+        (cursorRow < 0 || t->column == gTermCursorColumn)) {
+        return;
+    }
+
+    now = TickCount();
+    if (!immediate && now - gTermLastRender < (unsigned long)(60 / gRecvFrameRate)) {
+        return;
+    }
+    gTermLastRender = now;
+
+    if (t->bells != gTermBells) {
+        /* One beep a frame, however many bells came */
+        gTermBells = t->bells;
+        SysBeep(10);
+    }
+
+    SetPort(gTermWindow);
+    if (gTermWindow != FrontWindow()) {
+        /* Parts may be covered - let the update event repaint from scratch */
+        InvalRect(&gTermRect);
+        TermClean(t);
+        gTermCursorRow = -1;
+        gTermArrival = 0;
+        return;
+    }
+
+    if (t->scrolled >= t->rows) {
+        DrawTerminal();
+    } else {
+        if (t->scrolled > 0) {
+            ScrollRect(&gTermRect, 0, (short)(-t->scrolled * gRecvLineHeight),
+                       gRecvScrollRgn);
+            gTermCursorRow -= t->scrolled;
+        }
+
+        /* Take the old cursor off, then draw what changed */
+        if (gTermCursorRow >= 0) {
+            TermTouch(t, gTermCursorRow, gTermCursorColumn);
+        }
+        for (row = 0; row < t->rows; row++) {
+            if (t->dirtyLeft[row] < t->dirtyRight[row]) {
+                DrawTerminalCells(row, t->dirtyLeft[row], t->dirtyRight[row]);
+            }
+        }
+        TermClean(t);
+
+        gTermCursorRow = -1;
+        if (t->cursorVisible) {
+            gTermCursorRow = t->row;
+            gTermCursorColumn = t->column;
+            DrawTerminalCursor();
+        }
+    }
+
+    if (gTermArrival != 0) {
+        RecordLatency(&gWireToScreen, NowMicroseconds() - gTermArrival);
+        gTermArrival = 0;
+    }
+}
+
+/*
+ * Draw the whole grid and the cursor, for update events and when
+ * nothing on screen can be reused
+ */
+static void DrawTerminal(void)
+{
+    short row;
+
+    if (gTerm == NULL) {
+        return;
+    }
+
+    EraseRect(&gTermRect);
+    for (row = 0; row < gTerm->rows; row++) {
+        DrawTerminalCells(row, 0, gTerm->columns);
+    }
+    TermClean(gTerm);
+
+    gTermCursorRow = -1;
+    if (gTerm->cursorVisible) {
+        gTermCursorRow = gTerm->row;
+        gTermCursorColumn = gTerm->column;
+        DrawTerminalCursor();
+    }
+}
+
+/*
+ * Draw cells left..right-1 of a row, one DrawText per run of the same
+ * attributes. Bold Monaco is a pixel wider, so bold runs are drawn a
+ * cell at a time to stay on the grid.
+ */
+static void DrawTerminalCells(short row, short left, short right)
+{
+    unsigned char *chars = gTerm->chars[row];
+    unsigned char *attrs = gTerm->attrs[row];
+    Rect cellRect;
+    short top;
+    short end;
+    short i;
+    unsigned char attr;
+
+    top = gTermRect.top + row * gRecvLineHeight;
+    SetRect(&cellRect, gTermRect.left + left * gRecvCharWidth, top,
+            gTermRect.left + right * gRecvCharWidth, top + gRecvLineHeight);
+    EraseRect(&cellRect);
+
+    while (left < right) {
+        attr = attrs[left];
+        end = left + 1;
+        while (end < right && attrs[end] == attr) {
+            end++;
+        }
+
+        if (attr == 0) {
+            MoveTo(gTermRect.left + left * gRecvCharWidth, top + gRecvAscent);
+            DrawText((Ptr)chars, left, end - left);
+        } else {
+            if (attr & kTermInverse) {
+                SetRect(&cellRect, gTermRect.left + left * gRecvCharWidth, top,
+                        gTermRect.left + end * gRecvCharWidth, top + gRecvLineHeight);
+                PaintRect(&cellRect);
+                TextMode(srcBic);
+            }
+            TextFace(((attr & kTermBold) ? bold : 0) |
+                     ((attr & kTermUnderline) ? underline : 0));
+
+            if (attr & kTermBold) {
+                for (i = left; i < end; i++) {
+                    MoveTo(gTermRect.left + i * gRecvCharWidth, top + gRecvAscent);
+                    DrawChar(chars[i]);
+                }
+            } else {
+                MoveTo(gTermRect.left + left * gRecvCharWidth, top + gRecvAscent);
+                DrawText((Ptr)chars, left, end - left);
+            }
+
+            TextFace(0);
+            TextMode(srcOr);
+        }
+        left = end;
+    }
+}
+
+/*
+ * Invert the cell at gTermCursorRow, gTermCursorColumn
+ */
+static void DrawTerminalCursor(void)
+{
+    Rect cellRect;
+
+    SetRect(&cellRect, gTermRect.left + gTermCursorColumn * gRecvCharWidth,
+            gTermRect.top + gTermCursorRow * gRecvLineHeight,
+            gTermRect.left + (gTermCursorColumn + 1) * gRecvCharWidth,
+            gTermRect.top + (gTermCursorRow + 1) * gRecvLineHeight);
+    InvertRect(&cellRect);
+}
+
+/*
+ * Open the Find window, or bring it to the front. The search state is
+ * kept only while the window is open.
+ */
+static void OpenFindWindow(void)
+{
+    Rect windowRect;
+    Rect textRect;
+    Rect boxRect;
+
+    if (gFindWindow != NULL) {
+        SelectWindow(gFindWindow);
+        return;
+    }
+    if (!gRecvPane.storeReady) {
+        SysBeep(10);
+        return;
+    }
+
+    gFind = (FindState *)NewPtr(sizeof(FindState));
+    if (gFind == NULL) {
+        SysBeep(10);
+        return;
+    }
+    FindInit(gFind);
+    gFindHaveHit = false;
+
+    SetRect(&windowRect,
+            (qd.screenBits.bounds.right - kFindWindowWidth) / 2,
+            GetMBarHeight() + 24,
+            (qd.screenBits.bounds.right + kFindWindowWidth) / 2,
+            GetMBarHeight() + 24 + kFindWindowHeight);
+    gFindWindow = NewWindow(NULL, &windowRect, "\pFind",
+                            true, noGrowDocProc, (WindowPtr)-1, true, 0);
+    if (gFindWindow == NULL) {
+        DisposePtr((Ptr)gFind);
+        gFind = NULL;
+        SysBeep(10);
+        return;
+    }
+
+    SetPort(gFindWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+
+    SetRect(&textRect, kFindFieldLeft + 3, kFindFieldTop + 3,
+            kFindFieldRight - 3, kFindFieldBottom - 3);
+    gFindText = TENew(&textRect, &textRect);
+    SetRect(&boxRect, kFindFieldLeft, kFindBoxTop, kFindStatusLeft - 8, kFindBoxBottom);
+    gFindCaseBox = NewControl(gFindWindow, &boxRect, "\pIgnore case",
+                              true, 1, 0, 1, checkBoxProc, 0);
+    if (gFindText == NULL) {
+        CloseFindWindow();
+        SysBeep(10);
+        return;
+    }
+    TEActivate(gFindText);
+}
+
+/*
+ * Put the Find window away and take the hits off the receive area
+ */
+static void CloseFindWindow(void)
+{
+    if (gFindText != NULL) {
+        TEDispose(gFindText);
+        gFindText = NULL;
+    }
+    DisposeWindow(gFindWindow);
+    gFindWindow = NULL;
+    gFindCaseBox = NULL;
+
+    DisposePtr((Ptr)gFind);
+    gFind = NULL;
+    gFindHaveHit = false;
+    InvalFindHits();
+}
+
+/*
+ * Draw the Find window into the current port
+ */
+static void DrawFindWindow(void)
+{
+    Rect frame;
+
+    EraseRect(&gFindWindow->portRect);
+    MoveTo(10, kFindFieldTop + 12);
+    DrawString("\pFind:");
+    SetRect(&frame, kFindFieldLeft, kFindFieldTop, kFindFieldRight, kFindFieldBottom);
+    FrameRect(&frame);
+    TEUpdate(&gFindWindow->portRect, gFindText);
+    DrawControls(gFindWindow);
+    DrawFindStatus();
+}
+
+/*
+ * Show where the current hit stands among them all, into the current port
+ */
+static void DrawFindStatus(void)
+{
+    Rect statusRect;
+    Str255 line;
+    long index;
+
+    SetRect(&statusRect, kFindStatusLeft, kFindBoxTop, kFindFieldRight, kFindBoxBottom);
+    EraseRect(&statusRect);
+
+    line[0] = 0;
+    if (gFind->length == 0) {
+        return;
+    }
+    if (gFind->count == 0) {
+        AppendCString(line, "No matches");
+    } else {
+        index = FindHitIndex(gFind, gFindLine, gFindColumn);
+        if (gFindHaveHit && index < gFind->count) {
+            AppendNumber(line, index + 1);
+            AppendCString(line, " of ");
+        }
+        AppendNumber(line, gFind->count);
+        if (gFind->dropped > 0) {
+            /* Only the newest kFindMaxHits are kept */
+            AppendCString(line, "+");
+        }
+        AppendCString(line, (gFind->count == 1) ? " match" : " matches");
+    }
+    MoveTo(kFindStatusLeft, kFindBoxBottom - 4);
+    DrawString(line);
+}
+
+/*
+ * A key typed in the Find window. Return finds the next hit and
+ * Shift-Return the previous one; Escape closes the window; anything
+ * else edits the pattern and searches again.
+ */
+static void FindKey(char key, short modifiers)
+{
+    if (key == '\r' || key == 0x03) {
+        FindAgain((modifiers & shiftKey) != 0);
+        return;
+    }
+    if (key == 0x1B) {
+        CloseFindWindow();
+        return;
+    }
+
+    /* Room for the pattern, unless the key removes or moves */
+    if ((unsigned char)key >= ' ' && key != 0x7F &&
+        (*gFindText)->teLength - ((*gFindText)->selEnd - (*gFindText)->selStart) >=
+        kFindMaxPattern) {
+        SysBeep(10);
+        return;
+    }
+    TEKey(key, gFindText);
+    FindTyped();
+}
+
+/*
+ * Search for what is now in the Find field. The current hit stays put
+ * if it still matches, so typing narrows in place; otherwise the first
+ * hit at or after the top of the view becomes current.
+ */
+static void FindTyped(void)
+{
+    GrafPtr savePort;
+    long index;
+    short length;
+
+    length = (*gFindText)->teLength;
+    if (length > kFindMaxPattern) {
+        length = kFindMaxPattern;
+    }
+    HLock((*gFindText)->hText);
+    FindSearch(gFind, &gRecvPane.store, (unsigned char *)*(*gFindText)->hText, length,
+               GetControlValue(gFindCaseBox) != 0);
+    HUnlock((*gFindText)->hText);
+
+    if (gFind->count == 0) {
+        gFindHaveHit = false;
+        InvalFindHits();
+    } else {
+        if (gFindHaveHit) {
+            index = FindHitIndex(gFind, gFindLine, gFindColumn);
+        } else {
+            index = FindHitIndex(gFind, gRecvPane.store.topLine, 0);
+        }
+        ShowFindHit((index < gFind->count) ? index : 0);
+    }
+
+    GetPort(&savePort);
+    SetPort(gFindWindow);
+    DrawFindStatus();
+    SetPort(savePort);
+}
+
+/*
+ * Move to the next or previous hit, going round at the ends
+ */
+static void FindAgain(Boolean backward)
+{
+    GrafPtr savePort;
+    long index;
+
+    if (gFind == NULL || gFind->count == 0) {
+        SysBeep(10);
+        return;
+    }
+
+    if (!gFindHaveHit) {
+        index = FindHitIndex(gFind, gRecvPane.store.topLine, 0);
+    } else if (backward) {
+        index = FindHitIndex(gFind, gFindLine, gFindColumn) - 1;
+    } else {
+        index = FindHitIndex(gFind, gFindLine, gFindColumn + 1);
+    }
+    if (index < 0) {
+        index = gFind->count - 1;
+    } else if (index >= gFind->count) {
+        index = 0;
+    }
+    ShowFindHit(index);
+
+    GetPort(&savePort);
+    SetPort(gFindWindow);
+    DrawFindStatus();
+    SetPort(savePort);
+}
+
+/*
+ * Make a hit the current one and scroll it into view, a third of the
+ * way down if it was off screen
+ */
+static void ShowFindHit(long index)
+{
+    ScrollbackStore *sb = &gRecvPane.store;
+    const FindHit *hit;
+    long top;
+    long maxTop;
+
+    hit = FindHitAt(gFind, index);
+    gFindLine = hit->line;
+    gFindColumn = hit->column;
+    gFindHaveHit = true;
+
+    if (gFindLine < sb->topLine || gFindLine >= sb->topLine + gRecvPane.rows) {
+        maxTop = (long)sb->lineCount - gRecvPane.rows;
+        if (maxTop < 0) {
+            maxTop = 0;
+        }
+        top = (long)(gFindLine - sb->firstLine) - gRecvPane.rows / 3;
+        if (top < 0) {
+            top = 0;
+        }
+        if (top > maxTop) {
+            top = maxTop;
+        }
+        sb->topLine = sb->firstLine + top;
+        sb->followTail = (top == maxTop);
+    }
+    InvalFindHits();
+}
+
+/*
+ * Search the text received since the last render, keeping the count in
+ * the Find window current
+ */
+static void UpdateFindHits(void)
+{
+    GrafPtr savePort;
+    long count;
+    unsigned long dropped;
+
+    count = gFind->count;
+    dropped = gFind->dropped;
+    FindUpdate(gFind, &gRecvPane.store);
+    if (gFind->count != count || gFind->dropped != dropped) {
+        GetPort(&savePort);
+        SetPort(gFindWindow);
+        DrawFindStatus();
+        SetPort(savePort);
+    }
+}
+
+/*
+ * Redraw the main receive area from scratch, since hit marks move with
+ * pixels that ScrollRect reuses
+ */
+static void InvalFindHits(void)
+{
+    GrafPtr savePort;
+
+    if (gMainWindow == NULL || !gRecvPane.storeReady) {
+        return;
+    }
+    GetPort(&savePort);
+    SetPort(gMainWindow);
+    RenderReceiveArea(&gRecvPane, true);
+    InvalRect(&gRecvPane.textRect);
+    SetPort(savePort);
+}
+
+/*
+ * Mark a hit on a receive row just drawn: the current one inverted, the
+ * others framed
+ */
+static void DrawFindHit(const Rect *rowRect, const FindHit *hit)
+{
+    Rect hitRect;
+
+    SetRect(&hitRect, rowRect->left + hit->column * gRecvCharWidth, rowRect->top,
+            rowRect->left + (hit->column + gFind->length) * gRecvCharWidth, rowRect->bottom);
+    if (hitRect.right > rowRect->right) {
+        hitRect.right = rowRect->right;
+    }
+    if (gFindHaveHit && hit->line == gFindLine && hit->column == gFindColumn) {
+        InvertRect(&hitRect);
+    } else {
+        FrameRect(&hitRect);
+    }
+}
+
+/*
+ * Open the Triggers window on the list last applied, or bring it to the
+ * front
+ */
+static void OpenTrigWindow(void)
+{
+    Rect windowRect;
+    Rect textRect;
+    Rect buttonRect;
+
+    if (gTrigWindow != NULL) {
+        SelectWindow(gTrigWindow);
+        return;
+    }
+
+    SetRect(&windowRect,
+            (qd.screenBits.bounds.right - kTrigWindowWidth) / 2,
+            GetMBarHeight() + 40,
+            (qd.screenBits.bounds.right + kTrigWindowWidth) / 2,
+            GetMBarHeight() + 40 + kTrigWindowHeight);
+    gTrigWindow = NewWindow(NULL, &windowRect, "\pTriggers",
+                            true, noGrowDocProc, (WindowPtr)-1, true, 0);
+    if (gTrigWindow == NULL) {
+        SysBeep(10);
+        return;
+    }
+
+    SetPort(gTrigWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+
+    SetRect(&textRect, kTrigFieldLeft + 3, kTrigFieldTop + 3,
+            kTrigFieldRight - 3, kTrigFieldBottom - 3);
+    gTrigText = TENew(&textRect, &textRect);
+    SetRect(&buttonRect, kTrigButtonLeft, kTrigButtonTop, kTrigFieldRight, kTrigButtonBottom);
+    gTrigApply = NewControl(gTrigWindow, &buttonRect, "\pApply",
+                            true, 0, 0, 1, pushButProc, 0);
+    if (gTrigText == NULL) {
+        DisposeWindow(gTrigWindow);
+        gTrigWindow = NULL;
+        gTrigApply = NULL;
+        SysBeep(10);
+        return;
+    }
+
+    /* Keep the caret in view as the list grows past the field */
+    TEAutoView(true, gTrigText);
+    if (gTrigSource != NULL) {
+        HLock(gTrigSource);
+        TESetText(*gTrigSource, GetHandleSize(gTrigSource), gTrigText);
+        HUnlock(gTrigSource);
+    } else {
+        TESetText(gTrigExample, sizeof(gTrigExample) - 1, gTrigText);
+    }
+    TESetSelect(0, 0, gTrigText);
+    TEActivate(gTrigText);
+}
+
+/*
+ * Put the Triggers window away, applying the list as it stands
+ */
+static void CloseTrigWindow(void)
 {
-    WindowPtr window;
-    short part;
-    long menuChoice;
-    ControlHandle control;
-    Point localPoint;
-    Rect textFrame;
+    ApplyTriggers();
 
-    part = FindWindow(event->where, &window);
+    TEDispose(gTrigText);
+    gTrigText = NULL;
+    DisposeWindow(gTrigWindow);
+    gTrigWindow = NULL;
+    gTrigApply = NULL;
+}
 
-    switch (part) {
-        case inMenuBar:
-            menuChoice = MenuSelect(event->where);
-            HandleMenuChoice(menuChoice);
+/*
+ * Draw the Triggers window into the current port
+ */
+static void DrawTrigWindow(void)
+{
+    Rect frame;
+
+    EraseRect(&gTrigWindow->portRect);
+    SetRect(&frame, kTrigFieldLeft, kTrigFieldTop, kTrigFieldRight, kTrigFieldBottom);
+    FrameRect(&frame);
+    TEUpdate(&gTrigWindow->portRect, gTrigText);
+    DrawControls(gTrigWindow);
+    DrawTrigStatus();
+}
+
+/*
+ * Show how many triggers are armed, or why the list was refused, into
+ * the current port
+ */
+static void DrawTrigStatus(void)
+{
+    Rect statusRect;
+    Str255 line;
+    short count;
+
+    SetRect(&statusRect, kTrigFieldLeft, kTrigButtonTop, kTrigButtonLeft - 8, kTrigButtonBottom);
+    EraseRect(&statusRect);
+
+    line[0] = 0;
+    if (gTrigResult != kTrigOK && gTrigBadLine > 0) {
+        AppendCString(line, "Line ");
+        AppendNumber(line, gTrigBadLine);
+        AppendCString(line, ": ");
+    }
+    switch (gTrigResult) {
+        case kTrigOK:
+            count = (gTrig != NULL) ? gTrig->count : 0;
+            if (count == 0) {
+                AppendCString(line, "No triggers armed");
+            } else {
+                AppendNumber(line, count);
+                AppendCString(line, (count == 1) ? " trigger armed" : " triggers armed");
+            }
             break;
 
-        case inSysWindow:
-            SystemClick(event, window);
+        case kTrigErrSyntax:
+            AppendCString(line, "not pattern => action");
             break;
 
-        case inContent:
-            if (window != FrontWindow()) {
-                SelectWindow(window);
-            } else if (window == gMainWindow) {
-                SetPort(gMainWindow);
-                localPoint = event->where;
-                GlobalToLocal(&localPoint);
+        case kTrigErrTooLong:
+            AppendCString(line, "over ");
+            AppendNumber(line, kTrigMaxPattern);
+            AppendCString(line, " bytes");
+            break;
 
-                /* Check if click is in button */
-                if (gSendButton != NULL) {
-                    if (FindControl(localPoint, window, &control) == kControlButtonPart) {
-                        if (TrackControl(control, localPoint, NULL) == kControlButtonPart) {
-                            SendTextToSerial();
-                        }
-                        return;
-                    }
-                }
+        case kTrigErrTooMany:
+            AppendCString(line, "more than ");
+            AppendNumber(line, kTrigMaxTriggers);
+            AppendCString(line, " triggers");
+            break;
 
-                /* Check if click is in text area */
-                if (gSendText != NULL) {
-                    SetRect(&textFrame, kSendLeft, kSendTop, kSendRight, kSendBottom);
-                    if (PtInRect(localPoint, &textFrame)) {
-                        TEClick(localPoint, (event->modifiers & shiftKey) != 0, gSendText);
-                    }
+        case kTrigErrTooBig:
+            AppendCString(line, "Too many different pattern bytes");
+            break;
+    }
+    MoveTo(kTrigFieldLeft, kTrigButtonBottom - 6);
+    DrawString(line);
+}
+
+/*
+ * Compile the list in the Triggers window and arm it, keeping the text
+ * for the next time the window opens. A list with a mistake arms
+ * nothing, so half a list never runs.
+ */
+static void ApplyTriggers(void)
+{
+    Handle textHandle;
+    long length;
+    GrafPtr savePort;
+
+    textHandle = (Handle)TEGetText(gTrigText);
+    length = (*gTrigText)->teLength;
+    if (gTrigSource == NULL) {
+        gTrigSource = NewHandle(length);
+    } else {
+        SetHandleSize(gTrigSource, length);
+    }
+    if (gTrigSource != NULL && MemError() == noErr) {
+        BlockMoveData(*textHandle, *gTrigSource, length);
+    }
+
+    if (gTrig == NULL) {
+        gTrig = (TrigSet *)NewPtr(sizeof(TrigSet));
+        if (gTrig == NULL) {
+            SysBeep(10);
+            return;
+        }
+    }
+
+    HLock(textHandle);
+    gTrigResult = TrigLoad(gTrig, *textHandle, length, &gTrigBadLine);
+    HUnlock(textHandle);
+    if (gTrigResult != kTrigOK) {
+        SysBeep(10);
+    }
+
+    GetPort(&savePort);
+    SetPort(gTrigWindow);
+    DrawTrigStatus();
+    SetPort(savePort);
+    UpdateFileMenu();
+}
+
+/*
+ * Run received bytes through the armed triggers, firing each as its
+ * pattern completes
+ */
+static void ScanTriggers(const char *data, long count)
+{
+    unsigned long fired;
+    long used;
+
+    if (gTrig == NULL || gTrig->count == 0) {
+        return;
+    }
+
+    while (count > 0) {
+        used = TrigScan(gTrig, (const unsigned char *)data, count, &fired);
+        if (fired != 0) {
+            FireTriggers(fired);
+        }
+        data += used;
+        count -= used;
+    }
+}
+
+/*
+ * Carry out the actions of the triggers whose patterns just completed,
+ * in list order. Capture needs the file dialog, so it is left for the
+ * main loop.
+ */
+static void FireTriggers(unsigned long fired)
+{
+    const TrigEntry *entry;
+    short i;
+
+    for (i = 0; i < gTrig->count; i++) {
+        if ((fired & (1UL << i)) == 0) {
+            continue;
+        }
+        entry = &gTrig->entries[i];
+        switch (entry->action) {
+            case kTrigSend:
+                if (entry->textLength > 0) {
+                    SendToTerminalHost(entry->text, entry->textLength);
                 }
+                break;
+
+            case kTrigBeep:
+                SysBeep(10);
+                break;
+
+            case kTrigCaptureOn:
+            case kTrigCaptureOff:
+                gTrigCapture = entry->action;
+                break;
+        }
+    }
+}
+
+/*
+ * Start or stop the capture a trigger asked for, once the received
+ * batch that fired it has been dealt with
+ */
+static void ServiceTriggers(void)
+{
+    short action;
+
+    action = gTrigCapture;
+    if (action < 0) {
+        return;
+    }
+    gTrigCapture = -1;
+
+    if (action == kTrigCaptureOn && gCapRefNum == 0) {
+        StartCapture();
+    } else if (action == kTrigCaptureOff && gCapRefNum != 0) {
+        StopCapture();
+    }
+}
+
+/*
+ * Measure how many characters per second the receive area absorbs
+ * through four paths: per-character TEKey, batched TEInsert, and the
+ * scrollback store with its own renderer drawing lines with DrawText
+ * and then from the glyph cache. Each path is fed 80-column
+ * lines of synthetic text for kDisplayBenchTicks, including the cost of
+ * drawing. The receive history is cleared afterwards.
+ */
+static void DoDisplayBenchmark(void)
+{
+    DialogPtr dialog;
+    short itemHit;
+    char pattern[sizeof(gRecvBatch)];
+    long i;
+    short pass;
+    long bytes;
+    long cps[4];
+    unsigned long start;
+    unsigned long elapsed;
+    Rect textRect;
+    TEHandle te;
+    GlyphAtlas *glyphs;
+    Str255 perCharText;
+    Str255 batchedText;
+    Str255 storeText;
+    Str255 glyphText;
+
+    if (!gRecvPane.storeReady || gMainWindow == NULL) {
+        return;
+    }
+
+    /* The benchmark replaces the history that find hits point into */
+    if (gFindWindow != NULL) {
+        CloseFindWindow();
+    }
+
+    /* 78 printable characters then CR+LF, like a chatty device */
+    for (i = 0; i < (long)sizeof(pattern); i++) {
+        long column = i % 80;
+        if (column == 78) {
+            pattern[i] = '\r';
+        } else if (column == 79) {
+            pattern[i] = '\n';
+        } else {
+            pattern[i] = ' ' + (char)((i / 80 + column) % 95);
+        }
+    }
+
+    SetPort(gMainWindow);
+    SetCursor(*GetCursor(watchCursor));
+    textRect = gRecvPane.textRect;
+    glyphs = gGlyphs;
+
+    for (pass = 0; pass < 4; pass++) {
+        te = NULL;
+        if (pass < 2) {
+            te = TENew(&textRect, &textRect);
+            if (te == NULL) {
+                cps[pass] = 0;
+                continue;
+            }
+        } else {
+            /* The store path with DrawText, then with the glyph cache if there is one */
+            gGlyphs = (pass == 3) ? glyphs : NULL;
+            if (pass == 3 && glyphs == NULL) {
+                cps[pass] = 0;
+                continue;
+            }
+            ScrollbackClear(&gRecvPane.store);
+        }
+        EraseRect(&textRect);
+        gRecvPane.lastWasCR = 0;
+
+        bytes = 0;
+        start = TickCount();
+        do {
+            /* The translating paths work in place, so feed them a copy */
+            BlockMoveData(pattern, gRecvBatch, sizeof(gRecvBatch));
+            if (pass == 0) {
+                AppendTextEditPerChar(te, gRecvBatch, sizeof(gRecvBatch));
+            } else if (pass == 1) {
+                AppendTextEditBatched(te, gRecvBatch, sizeof(gRecvBatch));
+            } else {
+                AppendReceivedText(&gRecvPane, gRecvBatch, sizeof(gRecvBatch));
+                RenderReceiveArea(&gRecvPane, true);
             }
+            bytes += sizeof(gRecvBatch);
+            elapsed = TickCount() - start;
+        } while (elapsed < kDisplayBenchTicks);
+
+        cps[pass] = (bytes * 60) / (long)elapsed;
+
+        if (te != NULL) {
+            TEDispose(te);
+        }
+    }
+
+    gGlyphs = glyphs;
+    ScrollbackClear(&gRecvPane.store);
+    gRecvPane.lastWasCR = 0;
+    RenderReceiveArea(&gRecvPane, true);
+    InitCursor();
+
+    NumToString(cps[0], perCharText);
+    NumToString(cps[1], batchedText);
+    NumToString(cps[2], storeText);
+    NumToString(cps[3], glyphText);
+    ParamText(perCharText, batchedText, storeText, glyphText);
+
+    dialog = GetNewDialog(kDisplayBenchDialogID, NULL, (WindowPtr)-1);
+    if (dialog != NULL) {
+        ModalDialog(NULL, &itemHit);
+        DisposeDialog(dialog);
+    }
+
+    InvalRect(&gMainWindow->portRect);
+}
+
+/*
+ * File > Link Benchmark...: ask how long each run lasts and which
+ * settings to cover, then start streaming. Needs an echo at the far
+ * end, such as serial_terminal.py --echo.
+ */
+static void StartLinkBench(void)
+{
+    DialogPtr dialog;
+    short itemHit;
+    short item;
+    Boolean done;
+    Boolean start;
+    GrafPtr savePort;
+    unsigned long seed;
+    long i;
+    unsigned char value;
+
+    if (gMainPort->outRef == 0 || gXfer != NULL || gBridging || gLinkState != kLinkOff ||
+        gChanState != kChanOff) {
+        SysBeep(10);
+        return;
+    }
+
+    dialog = GetNewDialog(kLinkBenchDialogID, NULL, (WindowPtr)-1);
+    if (dialog == NULL) {
+        SysBeep(10);
+        return;
+    }
+
+    GetPort(&savePort);
+    SetPort(dialog);
+
+    SetDialogNumber(dialog, kBenchSeconds, gBenchSeconds);
+    for (item = kBenchCurrent; item <= kBenchAllSettings; item++) {
+        SetRadioButton(dialog, item, item - kBenchCurrent == gBenchSweep);
+    }
+    SelectDialogItemText(dialog, kBenchSeconds, 0, 32767);
+
+    done = false;
+    start = false;
+    while (!done) {
+        ModalDialog(NULL, &itemHit);
+
+        switch (itemHit) {
+            case kBenchStart:
+                gBenchSeconds = (short)GetDialogNumber(dialog, kBenchSeconds,
+                                                       1, kBenchMaxSeconds);
+                start = true;
+                done = true;
+                break;
+
+            case kBenchCancel:
+                done = true;
+                break;
+
+            /* Coverage selection */
+            case kBenchCurrent:
+            case kBenchAllBauds:
+            case kBenchAllSettings:
+                gBenchSweep = itemHit - kBenchCurrent;
+                for (item = kBenchCurrent; item <= kBenchAllSettings; item++) {
+                    SetRadioButton(dialog, item, item == itemHit);
+                }
+                break;
+        }
+    }
+
+    SetPort(savePort);
+    DisposeDialog(dialog);
+
+    if (!start) {
+        return;
+    }
+
+    /* One period of the pattern, without the XON/XOFF characters */
+    if (gBenchTable == NULL) {
+        gBenchTable = (unsigned char *)NewPtr(kBenchTableSize);
+        if (gBenchTable == NULL) {
+            SysBeep(10);
+            return;
+        }
+        seed = 0x2545F491UL;
+        for (i = 0; i < kBenchTableSize; i++) {
+            do {
+                /* xorshift32 */
+                seed ^= (seed << 13) & 0xFFFFFFFFUL;
+                seed ^= seed >> 17;
+                seed ^= (seed << 5) & 0xFFFFFFFFUL;
+                value = (unsigned char)(seed >> 24);
+            } while ((value & 0x7F) == kXOnChar || (value & 0x7F) == kXOffChar);
+            gBenchTable[i] = value;
+        }
+    }
+
+    gBench.sweep = gBenchSweep;
+    gBench.seconds = gBenchSeconds;
+    gBench.savedBaud = gCurrentBaud;
+    gBench.savedFlow = gFlowControl;
+    gBench.runCount = (gBench.sweep == kBenchSweepCurrent) ? 1 :
+                      (gBench.sweep == kBenchSweepBauds) ? kBaud57600 + 1 :
+                      (kBaud57600 + 1) * kFlowSettings;
+    gBench.run = -1;
+
+    {
+        Str255 line;
+
+        line[0] = 0;
+        AppendCString(line, "Link benchmark, ");
+        AppendNumber(line, gBench.seconds);
+        AppendCString(line, " s per run");
+        ReportLine(line);
+    }
+
+    LinkBenchNextRun();
+    UpdateFileMenu();
+}
+
+/*
+ * Move to the next setting, or finish when all have run
+ */
+static void LinkBenchNextRun(void)
+{
+    gBench.run++;
+    if (gBench.run >= gBench.runCount) {
+        StopLinkBench(false);
+        return;
+    }
+
+    switch (gBench.sweep) {
+        case kBenchSweepCurrent:
+            gBench.baud = gBench.savedBaud;
+            gBench.flow = gBench.savedFlow;
             break;
 
-        case inDrag:
-            DragWindow(window, event->where, &qd.screenBits.bounds);
+        case kBenchSweepBauds:
+            gBench.baud = gBench.run;
+            gBench.flow = gBench.savedFlow;
             break;
 
-        case inGoAway:
-            if (TrackGoAway(window, event->where)) {
-                gRunning = false;
-            }
+        case kBenchSweepAll:
+            gBench.baud = gBench.run / kFlowSettings;
+            gBench.flow = gBench.run % kFlowSettings;
             break;
     }
+
+    LinkBenchApply(gBench.baud, gBench.flow);
+    gBench.phase = kBenchSettle;
+    gBench.phaseTicks = TickCount();
+    gBench.quietTicks = gBench.phaseTicks;
+    DrawStatusLine();
 }
 
 /*
- * Handle key down events
+ * Switch the open port to a baud rate and flow control setting
+ * without closing it, so no greeting goes out mid-benchmark
  */
-static void HandleKeyDown(EventRecord *event)
+static void LinkBenchApply(short baud, short flow)
 {
-    char key;
+    SerReset(gMainPort->outRef, gBaudRates[baud] + stop10 + noParity + data8);
+    SerReset(gMainPort->inRef, gBaudRates[baud] + stop10 + noParity + data8);
+    gFlowControl = flow;
+    ConfigureFlowControl(gMainPort);
+}
 
-    key = event->message & charCodeMask;
+/*
+ * End the benchmark: drop unsent pattern bytes and put the port back
+ * the way the Settings dialog left it
+ */
+static void StopLinkBench(Boolean cancelled)
+{
+    Str255 line;
 
-    /* Check for command key */
-    if (event->modifiers & cmdKey) {
-        /* Command+Return sends text */
-        if (key == '\r') {
-            SendTextToSerial();
-        } else {
-            HandleMenuChoice(MenuKey(key));
-        }
-    } else if (gSendText != NULL) {
-        /* Pass key to TextEdit */
-        TEKey(key, gSendText);
+    if (gBench.phase == kBenchIdle) {
+        return;
+    }
+
+    gBench.phase = kBenchIdle;
+    StopTransmit();
+    if (gMainPort->outRef != 0) {
+        LinkBenchApply(gBench.savedBaud, gBench.savedFlow);
+    }
+    gFlowControl = gBench.savedFlow;
+
+    line[0] = 0;
+    AppendCString(line, cancelled ? "Benchmark stopped" : "Benchmark done");
+    ReportLine(line);
+
+    UpdateFileMenu();
+    DrawTransmitStatus();
+    DrawStatusLine();
+}
+
+/*
+ * Called from the event loop: sample the driver for overruns, keep the
+ * pattern flowing during a run, and step through the phases
+ */
+static void ServiceLinkBench(void)
+{
+    SerialStatus status;
+    unsigned long now;
+    long queued;
+    long i;
+    unsigned char chunk[kBenchChunk];
+
+    if (gBench.phase == kBenchIdle) {
+        return;
+    }
+
+    /* cumErrs covers the time since the previous sample */
+    if (MacSerialStatus(gMainPort, &status) == noErr &&
+        (status.lineErrors & kSerialOverrun) != 0) {
+        gBench.overruns++;
+    }
+
+    now = TickCount();
+    switch (gBench.phase) {
+        case kBenchSettle:
+            /* Wait out echoes of whatever was sent before */
+            if (now - gBench.quietTicks >= kBenchSettleTicks ||
+                now - gBench.phaseTicks >= kBenchMaxSettleTicks) {
+                gBench.txPos = 0;
+                gBench.rxPos = 0;
+                gBench.good = 0;
+                gBench.dropped = 0;
+                gBench.corrupt = 0;
+                gBench.overruns = 0;
+                gBench.lookCount = 0;
+                gBench.startMicros = NowMicroseconds();
+                gBench.lastMicros = gBench.startMicros;
+                gBench.phase = kBenchRun;
+                gBench.phaseTicks = now;
+            }
+            break;
+
+        case kBenchRun:
+            /* Keep a little pattern queued ahead of the port */
+            queued = gTxBacklog + (gTxLength - gTxSent);
+            while (queued + kBenchChunk <= kBenchQueueLimit) {
+                for (i = 0; i < kBenchChunk; i++) {
+                    chunk[i] = gBenchTable[(gBench.txPos + i) & kBenchTableMask];
+                }
+                if (QueueRawTransmit(chunk, kBenchChunk) != kBenchChunk) {
+                    break;
+                }
+                gBench.txPos += kBenchChunk;
+                queued += kBenchChunk;
+            }
+
+            if (now - gBench.phaseTicks >= (unsigned long)gBench.seconds * 60) {
+                gBench.phase = kBenchDrain;
+                gBench.phaseTicks = now;
+                gBench.quietTicks = now;
+            }
+            break;
+
+        case kBenchDrain:
+            /* Finish once the queue is empty and the echoes have stopped */
+            if ((gTxQueueHead == NULL && now - gBench.quietTicks >= kBenchDrainTicks) ||
+                now - gBench.phaseTicks >= kBenchMaxDrainTicks) {
+                StopTransmit();
+                LinkBenchReport();
+                LinkBenchNextRun();
+            }
+            break;
     }
 }
 
 /*
- * Handle menu selections
+ * Check echoed bytes against the pattern. Bytes in step cost one
+ * table lookup; the first mismatch starts collecting bytes for a resync.
  */
-static void HandleMenuChoice(long menuChoice)
+static void LinkBenchInput(const unsigned char *data, long count)
 {
-    short menuID;
-    short menuItem;
+    const unsigned char *end;
+    unsigned long rxPos;
 
-    if (menuChoice == 0) {
+    gBench.quietTicks = TickCount();
+    if (gBench.phase == kBenchSettle) {
+        /* Stale echoes from before this run */
         return;
     }
 
-    menuID = HiWord(menuChoice);
-    menuItem = LoWord(menuChoice);
+    end = data + count;
+    rxPos = gBench.rxPos;
+    while (data < end) {
+        if (gBench.lookCount == 0 && *data == gBenchTable[rxPos & kBenchTableMask]) {
+            rxPos++;
+            gBench.good++;
+            data++;
+            continue;
+        }
 
-    switch (menuID) {
-        case kAppleMenuID:
-            HandleAppleMenu(menuItem);
-            break;
+        gBench.look[gBench.lookCount++] = *data++;
+        if (gBench.lookCount == kBenchResync) {
+            gBench.rxPos = rxPos;
+            LinkBenchResync();
+            rxPos = gBench.rxPos;
+        }
+    }
+    gBench.rxPos = rxPos;
+    gBench.lastMicros = NowMicroseconds();
+}
 
-        case kFileMenuID:
-            HandleFileMenu(menuItem);
+/*
+ * Find where the collected bytes line up with the pattern again.
+ * If they do one position on, a byte was damaged; if further on, the
+ * bytes in between were lost. Otherwise the oldest collected byte is
+ * counted as damaged and the search tries again with the next one.
+ */
+static void LinkBenchResync(void)
+{
+    unsigned long pos;
+    short skip;
+    short i;
+
+    /* One damaged byte: the rest follow on from it */
+    pos = gBench.rxPos + 1;
+    for (i = 1; i < kBenchResync; i++) {
+        if (gBench.look[i] != gBenchTable[(pos + i - 1) & kBenchTableMask]) {
             break;
+        }
+    }
+    if (i == kBenchResync) {
+        gBench.corrupt++;
+        gBench.good += kBenchResync - 1;
+        gBench.rxPos += kBenchResync;
+        gBench.lookCount = 0;
+        return;
+    }
 
-        case kEditMenuID:
-            HandleEditMenu(menuItem);
-            break;
+    /* Lost bytes: everything lines up further on */
+    for (skip = 1; skip <= kBenchWindow; skip++) {
+        pos = gBench.rxPos + skip;
+        for (i = 0; i < kBenchResync; i++) {
+            if (gBench.look[i] != gBenchTable[(pos + i) & kBenchTableMask]) {
+                break;
+            }
+        }
+        if (i == kBenchResync) {
+            gBench.dropped += skip;
+            gBench.good += kBenchResync;
+            gBench.rxPos = pos + kBenchResync;
+            gBench.lookCount = 0;
+            return;
+        }
     }
 
-    HiliteMenu(0);
+    /* Still out of step */
+    gBench.corrupt++;
+    gBench.rxPos++;
+    for (i = 1; i < kBenchResync; i++) {
+        gBench.look[i - 1] = gBench.look[i];
+    }
+    gBench.lookCount--;
 }
 
 /*
- * Handle Apple menu items
+ * Print one run's results in the receive area
  */
-static void HandleAppleMenu(short item)
+static void LinkBenchReport(void)
 {
-    Str255 itemName;
-    MenuHandle appleMenu;
+    Str255 line;
+    unsigned long elapsedMs;
+    unsigned long cps;
+
+    /* Bytes still collecting for a resync never lined up; the rest never came */
+    gBench.corrupt += gBench.lookCount;
+    gBench.lookCount = 0;
+    if (gBench.txPos > gBench.rxPos) {
+        gBench.dropped += gBench.txPos - gBench.rxPos;
+    }
 
-    if (item == 1) {
-        DoAboutDialog();
-    } else {
-        /* Open desk accessory */
-        appleMenu = GetMenuHandle(kAppleMenuID);
-        if (appleMenu != NULL) {
-            GetMenuItemText(appleMenu, item, itemName);
-            OpenDeskAcc(itemName);
-        }
+    /* Effective rate from the start of the run to the last echo */
+    elapsedMs = (gBench.lastMicros - gBench.startMicros) / 1000;
+    cps = 0;
+    if (elapsedMs > 0) {
+        cps = (gBench.good / elapsedMs) * 1000 +
+              (gBench.good % elapsedMs) * 1000 / elapsedMs;
     }
+
+    line[0] = 0;
+    AppendCString(line, gBaudNames[gBench.baud]);
+    AppendCString(line, " ");
+    AppendCString(line, gFlowNames[gBench.flow]);
+    AppendCString(line, ": ");
+    AppendNumber(line, (long)cps);
+    AppendCString(line, " cps");
+    ReportLine(line);
+
+    line[0] = 0;
+    AppendCString(line, "  lost ");
+    AppendNumber(line, (long)gBench.dropped);
+    AppendCString(line, " bad ");
+    AppendNumber(line, (long)gBench.corrupt);
+    AppendCString(line, " overrun ");
+    AppendNumber(line, (long)gBench.overruns);
+    ReportLine(line);
 }
 
 /*
- * Handle File menu items
+ * Add a line of our own to the receive area, on a line of its own
  */
-static void HandleFileMenu(short item)
+static void ReportLine(ConstStr255Param line)
 {
-    switch (item) {
-        case 1: /* Send */
-            SendTextToSerial();
-            break;
-
-        case 3: /* Settings... */
-            DoSettingsDialog();
-            break;
-
-        case 5: /* Quit */
-            gRunning = false;
-            break;
+    if (!gRecvPane.storeReady) {
+        return;
+    }
+    if (gRecvPane.store.lineOpen) {
+        ScrollbackAppend(&gRecvPane.store, "\r", 1);
     }
+    ScrollbackAppend(&gRecvPane.store, (const char *)line + 1, line[0]);
+    ScrollbackAppend(&gRecvPane.store, "\r", 1);
 }
 
 /*
- * Handle Edit menu items
+ * Show average and worst keystroke-to-wire and wire-to-screen latency
+ * since the last report, then start counting afresh
  */
-static void HandleEditMenu(short item)
+static void DoLatencyReport(void)
 {
-    if (gSendText == NULL) {
-        return;
+    DialogPtr dialog;
+    short itemHit;
+    Str255 keyText;
+    Str255 screenText;
+    Str255 keyCount;
+    Str255 screenCount;
+
+    keyText[0] = 0;
+    screenText[0] = 0;
+    AppendLatency(keyText, &gKeyToWire);
+    AppendLatency(screenText, &gWireToScreen);
+    NumToString((long)gKeyToWire.count, keyCount);
+    NumToString((long)gWireToScreen.count, screenCount);
+    ParamText(keyText, screenText, keyCount, screenCount);
+
+    dialog = GetNewDialog(kLatencyDialogID, NULL, (WindowPtr)-1);
+    if (dialog != NULL) {
+        ModalDialog(NULL, &itemHit);
+        DisposeDialog(dialog);
     }
 
-    switch (item) {
-        case 1: /* Undo */
-            /* TextEdit doesn't support undo */
-            break;
+    gKeyToWire.count = gKeyToWire.total = gKeyToWire.worst = 0;
+    gWireToScreen.count = gWireToScreen.total = gWireToScreen.worst = 0;
+}
 
-        case 3: /* Cut */
-            TECut(gSendText);
-            break;
+/*
+ * Append "avg N.N ms, worst N.N ms", or "no samples"
+ */
+static void AppendLatency(Str255 dest, const LatencyStat *stat)
+{
+    unsigned long average;
 
-        case 4: /* Copy */
-            TECopy(gSendText);
-            break;
+    if (stat->count == 0) {
+        AppendCString(dest, "no samples");
+        return;
+    }
 
-        case 5: /* Paste */
-            TEPaste(gSendText);
-            break;
+    /* Tenths of a millisecond */
+    average = stat->total / stat->count / 100;
+    AppendCString(dest, "avg ");
+    AppendNumber(dest, (long)(average / 10));
+    AppendCString(dest, ".");
+    AppendNumber(dest, (long)(average % 10));
+    AppendCString(dest, " ms, worst ");
+    AppendNumber(dest, (long)(stat->worst / 1000));
+    AppendCString(dest, ".");
+    AppendNumber(dest, (long)(stat->worst / 100 % 10));
+    AppendCString(dest, " ms");
+}
 
-        case 6: /* Clear */
-            TEDelete(gSendText);
-            break;
+/*
+ * Clear the profile and the error counts, starting a new period
+ */
+static void ResetProfile(void)
+{
+    short i;
 
-        case 8: /* Select All */
-            TESetSelect(0, 32767, gSendText);
-            break;
+    for (i = 0; i < kProfSections; i++) {
+        gProfile[i].calls = 0;
+        gProfile[i].seconds = 0;
+        gProfile[i].micro = 0;
+        gProfile[i].worst = 0;
     }
+    gErrOverrun = 0;
+    gErrParity = 0;
+    gErrFraming = 0;
+    gProfileStartTicks = TickCount();
 }
 
 /*
- * Update window contents
+ * Profile while anything shows or logs the figures, starting afresh
+ * each time it is switched on
  */
-static void UpdateWindow(WindowPtr window)
+static void UpdateProfiling(void)
 {
-    Rect textFrame;
+    Boolean on;
 
-    if (window != gMainWindow) {
-        return;
+    on = (gStatsWindow != NULL || gStatsLogging);
+    if (on && !gProfiling) {
+        ResetProfile();
     }
+    gProfiling = on;
+}
 
-    BeginUpdate(window);
-    SetPort(window);
-
-    /* Draw send label */
-    MoveTo(kSendLeft, kSendTop - 5);
-    DrawString("\pSend:");
+/*
+ * Time at the top of a loop pass, or 0 when not profiling
+ */
+static unsigned long ProfileStart(void)
+{
+    return gProfiling ? NowMicroseconds() : 0;
+}
 
-    /* Draw frame around send text area */
-    SetRect(&textFrame, kSendLeft, kSendTop, kSendRight, kSendBottom);
-    FrameRect(&textFrame);
+/*
+ * Charge the time since start to a section and return the time now,
+ * the start of the next section. A start of 0 means profiling came on
+ * partway through the pass, so there is nothing to charge yet.
+ */
+static unsigned long ProfileLap(short section, unsigned long start)
+{
+    ProfileStat *stat;
+    unsigned long now;
+    unsigned long elapsed;
 
-    /* Draw send text edit contents */
-    if (gSendText != NULL) {
-        TEUpdate(&textFrame, gSendText);
+    if (!gProfiling) {
+        return 0;
     }
 
-    /* Draw button */
-    if (gSendButton != NULL) {
-        DrawControls(window);
+    now = NowMicroseconds();
+    if (start == 0) {
+        return now;
     }
 
-    /* Draw receive label */
-    MoveTo(kRecvLeft, kRecvTop - 5);
-    DrawString("\pReceived:");
-
-    /* Draw frame around receive text area */
-    SetRect(&textFrame, kRecvLeft, kRecvTop, kRecvRight, kRecvBottom);
-    FrameRect(&textFrame);
-
-    /* Draw receive text contents */
-    if (gRecvText != NULL) {
-        TEUpdate(&textFrame, gRecvText);
+    elapsed = now - start;
+    stat = &gProfile[section];
+    stat->calls++;
+    stat->micro += elapsed;
+    if (stat->micro >= 1000000) {
+        stat->seconds += stat->micro / 1000000;
+        stat->micro %= 1000000;
     }
-
-    EndUpdate(window);
+    if (elapsed > stat->worst) {
+        stat->worst = elapsed;
+    }
+    return now;
 }
 
 /*
- * Send the text from the text edit field to the serial port
- * Converts Mac line endings (CR) to CR+LF for serial output
+ * Open the statistics window, sized to its lines in Monaco 9
  */
-static void SendTextToSerial(void)
+static void OpenStatsWindow(void)
 {
-    Handle textHandle;
-    long textLength;
-    long count;
-    char *textPtr;
-    long i;
-    char crlf[2] = {'\r', '\n'};
+    Rect windowRect;
+    short height;
 
-    if (gSendText == NULL) {
+    height = kStatsLines * gRecvLineHeight + 2 * kStatsMargin;
+    SetRect(&windowRect,
+            qd.screenBits.bounds.right - kStatsWindowWidth - 8,
+            GetMBarHeight() + 24,
+            qd.screenBits.bounds.right - 8,
+            GetMBarHeight() + 24 + height);
+
+    gStatsWindow = NewWindow(NULL, &windowRect, "\pStatistics",
+                             true, noGrowDocProc, (WindowPtr)-1, true, 0);
+    if (gStatsWindow == NULL) {
+        SysBeep(10);
         return;
     }
 
-    /* Get the text from TextEdit */
-    textHandle = (Handle)TEGetText(gSendText);
-    textLength = (*gSendText)->teLength;
+    SetPort(gStatsWindow);
+    TextFont(kFontIDMonaco);
+    TextSize(9);
+    UpdateProfiling();
+}
 
-    if (textLength == 0) {
-        SysBeep(10);
-        return;
-    }
+/*
+ * Put the statistics window away; profiling stops unless it is logged
+ */
+static void CloseStatsWindow(void)
+{
+    DisposeWindow(gStatsWindow);
+    gStatsWindow = NULL;
+    UpdateProfiling();
+}
 
-    if (gSerialOutRef == 0) {
-        SysBeep(10);
-        return;
+/*
+ * Draw the whole statistics window into the current port: a row per
+ * profile section, then the byte and error counts
+ */
+static void DrawStatsWindow(void)
+{
+    const ProfileStat *stat;
+    unsigned long totals[kProfSections];
+    unsigned long wall;
+    unsigned long average;
+    short columns[5];
+    short v;
+    short i;
+    Str255 line;
+
+    EraseRect(&gStatsWindow->portRect);
+
+    /* Right edges of the number columns */
+    columns[0] = kStatsMargin + 17 * gRecvCharWidth;
+    columns[1] = columns[0] + 10 * gRecvCharWidth;
+    columns[2] = columns[1] + 9 * gRecvCharWidth;
+    columns[3] = columns[2] + 9 * gRecvCharWidth;
+    columns[4] = columns[3] + 5 * gRecvCharWidth;
+
+    v = kStatsMargin + gRecvAscent;
+    MoveTo(kStatsMargin, v);
+    DrawString("\pSection");
+    DrawStatsText(columns[0], v, "\pCalls");
+    DrawStatsText(columns[1], v, "\pTotal ms");
+    DrawStatsText(columns[2], v, "\pAvg \xB5s");
+    DrawStatsText(columns[3], v, "\pMax \xB5s");
+    DrawStatsText(columns[4], v, "\p%");
+
+    /* The sections cover the whole loop, so together they are the wall time */
+    wall = 0;
+    for (i = 0; i < kProfSections; i++) {
+        totals[i] = gProfile[i].seconds * 1000 + gProfile[i].micro / 1000;
+        wall += totals[i];
     }
 
-    /* Lock the handle and get pointer */
-    HLock(textHandle);
-    textPtr = *textHandle;
-
-    /* Write to serial port, converting CR to CR+LF */
-    for (i = 0; i < textLength; i++) {
-        if (textPtr[i] == '\r') {
-            /* Send CR+LF for line endings */
-            count = 2;
-            FSWrite(gSerialOutRef, &count, crlf);
+    for (i = 0; i < kProfSections; i++) {
+        stat = &gProfile[i];
+        v += gRecvLineHeight;
+        line[0] = 0;
+        AppendCString(line, gProfileNames[i]);
+        MoveTo(kStatsMargin, v);
+        DrawString(line);
+        if (stat->calls == 0) {
+            continue;
+        }
+
+        /* Microseconds fit 32 bits for the first hour or so */
+        if (stat->seconds < 4000) {
+            average = (stat->seconds * 1000000 + stat->micro) / stat->calls;
         } else {
-            /* Send single character */
-            count = 1;
-            FSWrite(gSerialOutRef, &count, &textPtr[i]);
+            average = totals[i] / stat->calls * 1000;
         }
+        DrawStatsNumber(columns[0], v, stat->calls);
+        DrawStatsNumber(columns[1], v, totals[i]);
+        DrawStatsNumber(columns[2], v, average);
+        DrawStatsNumber(columns[3], v, stat->worst);
+        DrawStatsNumber(columns[4], v, (wall >= 100) ? totals[i] / (wall / 100) : 0);
     }
 
-    /* Send final CR+LF if text doesn't end with one */
-    if (textLength > 0 && textPtr[textLength - 1] != '\r') {
-        count = 2;
-        FSWrite(gSerialOutRef, &count, crlf);
+    v += 2 * gRecvLineHeight;
+    line[0] = 0;
+    AppendCString(line, "Received ");
+    AppendNumber(line, (long)gMainPort->rxHead);
+    AppendCString(line, " bytes, sent ");
+    AppendNumber(line, (long)gTxTotal);
+    MoveTo(kStatsMargin, v);
+    DrawString(line);
+
+    v += gRecvLineHeight;
+    line[0] = 0;
+    AppendCString(line, "Overrun ");
+    AppendNumber(line, (long)gErrOverrun);
+    AppendCString(line, "  Parity ");
+    AppendNumber(line, (long)gErrParity);
+    AppendCString(line, "  Framing ");
+    AppendNumber(line, (long)gErrFraming);
+    AppendCString(line, "  Read ");
+    AppendNumber(line, (long)gMainPort->rxErrors);
+    MoveTo(kStatsMargin, v);
+    DrawString(line);
+
+    v += gRecvLineHeight;
+    line[0] = 0;
+    AppendCString(line, "Profiled for ");
+    AppendNumber(line, (long)((TickCount() - gProfileStartTicks) / 60));
+    AppendCString(line, gHasMicroseconds ? " s" : " s, timed in ticks");
+    if (gStatsLogging) {
+        AppendCString(line, ", logging on Port B");
     }
-
-    HUnlock(textHandle);
-
-    /* Flash the button to indicate success */
-    HiliteControl(gSendButton, 1);
-    Delay(8, NULL);
-    HiliteControl(gSendButton, 0);
-
-    /* Clear the text field */
-    TESetSelect(0, 32767, gSendText);
-    TEDelete(gSendText);
+    MoveTo(kStatsMargin, v);
+    DrawString(line);
 }
 
 /*
- * Poll for incoming serial data and display in receive area
+ * Draw text right-aligned on a column edge
  */
-static void PollSerialInput(void)
+static void DrawStatsText(short right, short v, ConstStr255Param text)
 {
-    long count;
-    char buffer[256];
-    long i;
-    Rect textFrame;
+    MoveTo(right - StringWidth(text), v);
+    DrawString(text);
+}
 
-    if (gSerialInRef == 0 || gRecvText == NULL) {
-        return;
-    }
+/*
+ * Draw a count right-aligned on a column edge
+ */
+static void DrawStatsNumber(short right, short v, unsigned long value)
+{
+    Str255 number;
 
-    /* Check how many bytes are available */
-    SerGetBuf(gSerialInRef, &count);
+    NumToString((long)value, number);
+    DrawStatsText(right, v, number);
+}
 
-    if (count <= 0) {
+/*
+ * Start or stop logging a statistics line on Port B each second. Port B
+ * is opened as the second port if it is not already; it cannot be the
+ * main port, and a bridge owns it outright.
+ */
+static void SetStatsLogging(Boolean on)
+{
+    if (on == gStatsLogging) {
         return;
     }
-
-    /* Limit to buffer size */
-    if (count > sizeof(buffer)) {
-        count = sizeof(buffer);
+    if (on) {
+        if (gCurrentPort == kPortPrinter) {
+            SysBeep(10);
+            ReportLine("\pStatistics: Port B is the main port");
+            return;
+        }
+        if (gBridging) {
+            SysBeep(10);
+            ReportLine("\pStatistics: Port B is bridged");
+            return;
+        }
+        if (!gDualPort) {
+            gDualPort = true;
+            if (!OpenOtherPort()) {
+                CloseOtherPort();
+                SysBeep(10);
+                UpdateFileMenu();
+                return;
+            }
+        }
     }
 
-    /* Read the data */
-    FSRead(gSerialInRef, &count, buffer);
-
-    /* Process received characters */
-    SetPort(gMainWindow);
-
-    for (i = 0; i < count; i++) {
-        char c = buffer[i];
-
-        /* Convert LF to CR for Mac TextEdit */
-        if (c == '\n') {
-            c = '\r';
-        }
+    gStatsLogging = on;
+    UpdateProfiling();
+    ReportLine(on ? "\pStatistics logging on Port B" : "\pStatistics logging stopped");
+    UpdateFileMenu();
+}
 
-        /* Skip CR if followed by LF (handle CRLF) */
-        if (c == '\r' && i + 1 < count && buffer[i + 1] == '\n') {
-            continue;
-        }
+/*
+ * Send one statistics line on Port B for the host to collect:
+ *
+ *   #stat t=S rx=N tx=N ovr=N par=N frm=N rderr=N sleep=C/MS/MAX ...
+ *
+ * with the seconds since profiling started, the main port's byte and
+ * error counts, and for each section its calls, total milliseconds and
+ * longest call in microseconds. A line that does not fit in the send
+ * ring is dropped rather than cut short.
+ */
+static void LogStatistics(void)
+{
+    SerialPort *port = &gPorts[kPortPrinter];
+    char text[kStatsLogMax];
+    long length;
+    Str255 field;
+    short i;
 
-        /* Insert character at end of receive text */
-        TESetSelect(32767, 32767, gRecvText);
-        TEKey(c, gRecvText);
+    if (port->outRef == 0) {
+        return;
     }
 
-    /* Limit receive buffer size - remove oldest text if too large */
-    if ((*gRecvText)->teLength > kMaxReceiveText) {
-        TESetSelect(0, (*gRecvText)->teLength - kMaxReceiveText, gRecvText);
-        TEDelete(gRecvText);
+    field[0] = 0;
+    AppendCString(field, "#stat t=");
+    AppendNumber(field, (long)((TickCount() - gProfileStartTicks) / 60));
+    AppendCString(field, " rx=");
+    AppendNumber(field, (long)gMainPort->rxHead);
+    AppendCString(field, " tx=");
+    AppendNumber(field, (long)gTxTotal);
+    AppendCString(field, " ovr=");
+    AppendNumber(field, (long)gErrOverrun);
+    AppendCString(field, " par=");
+    AppendNumber(field, (long)gErrParity);
+    AppendCString(field, " frm=");
+    AppendNumber(field, (long)gErrFraming);
+    AppendCString(field, " rderr=");
+    AppendNumber(field, (long)gMainPort->rxErrors);
+    BlockMoveData(&field[1], text, field[0]);
+    length = field[0];
+
+    for (i = 0; i < kProfSections; i++) {
+        field[0] = 0;
+        AppendCString(field, " ");
+        AppendCString(field, gProfileKeys[i]);
+        AppendCString(field, "=");
+        AppendNumber(field, (long)gProfile[i].calls);
+        AppendCString(field, "/");
+        AppendNumber(field, (long)(gProfile[i].seconds * 1000 + gProfile[i].micro / 1000));
+        AppendCString(field, "/");
+        AppendNumber(field, (long)gProfile[i].worst);
+        BlockMoveData(&field[1], text + length, field[0]);
+        length += field[0];
     }
+    text[length++] = '\r';
+    text[length++] = '\n';
 
-    /* Update the receive area */
-    SetRect(&textFrame, kRecvLeft, kRecvTop, kRecvRight, kRecvBottom);
-    InvalRect(&textFrame);
+    if (kPortTxSize - (long)(port->txHead - port->txTail) >= length) {
+        PortQueueTransmit(port, text, length);
+    }
 }
 
 /*
@@ -803,6 +7004,44 @@ static Boolean GetRadioButton(DialogPtr dialog, short item)
     return GetControlValue((ControlHandle)itemHandle) != 0;
 }
 
+/*
+ * Read a dialog text field as a number, clamped to a range
+ */
+static long GetDialogNumber(DialogPtr dialog, short item, long minValue, long maxValue)
+{
+    short itemType;
+    Handle itemHandle;
+    Rect itemRect;
+    Str255 itemText;
+    long value;
+
+    GetDialogItem(dialog, item, &itemType, &itemHandle, &itemRect);
+    GetDialogItemText(itemHandle, itemText);
+    StringToNum(itemText, &value);
+
+    if (value < minValue) {
+        value = minValue;
+    } else if (value > maxValue) {
+        value = maxValue;
+    }
+    return value;
+}
+
+/*
+ * Show a number in a dialog text field
+ */
+static void SetDialogNumber(DialogPtr dialog, short item, long value)
+{
+    short itemType;
+    Handle itemHandle;
+    Rect itemRect;
+    Str255 itemText;
+
+    NumToString(value, itemText);
+    GetDialogItem(dialog, item, &itemType, &itemHandle, &itemRect);
+    SetDialogItemText(itemHandle, itemText);
+}
+
 /*
  * Show the Settings dialog
  */
@@ -812,8 +7051,15 @@ static void DoSettingsDialog(void)
     short itemHit;
     short tempPort;
     short tempBaud;
+    short tempFlow;
+    short item;
     Boolean done;
     GrafPtr savePort;
+    short itemType;
+    Handle itemHandle;
+    Rect itemRect;
+    Str255 itemText;
+    Boolean reopen;
 
     dialog = GetNewDialog(kSettingsDialogID, NULL, (WindowPtr)-1);
     if (dialog == NULL) {
@@ -827,6 +7073,7 @@ static void DoSettingsDialog(void)
     /* Initialize dialog with current settings */
     tempPort = gCurrentPort;
     tempBaud = gCurrentBaud;
+    tempFlow = gFlowControl;
 
     /* Set port radio buttons */
     SetRadioButton(dialog, kSettingsModemPort, tempPort == kPortModem);
@@ -840,6 +7087,19 @@ static void DoSettingsDialog(void)
     SetRadioButton(dialog, kSettingsBaud38400, tempBaud == kBaud38400);
     SetRadioButton(dialog, kSettingsBaud57600, tempBaud == kBaud57600);
 
+    /* Set flow control radio buttons */
+    for (item = kSettingsFlowNone; item <= kSettingsFlowXOnBoth; item++) {
+        SetRadioButton(dialog, item, item - kSettingsFlowNone == tempFlow);
+    }
+
+    /* Set receive redraw budget and transmit pacing */
+    SetDialogNumber(dialog, kSettingsFrameRate, gRecvFrameRate);
+    SetDialogNumber(dialog, kSettingsCharDelay, gTxCharDelay);
+    SetDialogNumber(dialog, kSettingsLineDelay, gTxLineDelay);
+    GetDialogItem(dialog, kSettingsPrompt, &itemType, &itemHandle, &itemRect);
+    SetDialogItemText(itemHandle, gTxPrompt);
+    SelectDialogItemText(dialog, kSettingsFrameRate, 0, 32767);
+
     done = false;
     while (!done) {
         ModalDialog(NULL, &itemHit);
@@ -847,9 +7107,42 @@ static void DoSettingsDialog(void)
         switch (itemHit) {
             case kSettingsOK:
                 /* Apply settings */
+                reopen = (tempPort != gCurrentPort || tempBaud != gCurrentBaud ||
+                          tempFlow != gFlowControl);
                 gCurrentPort = tempPort;
                 gCurrentBaud = tempBaud;
-                ReinitializeSerial();
+                gFlowControl = tempFlow;
+
+                gRecvFrameRate = (short)GetDialogNumber(dialog, kSettingsFrameRate,
+                                                        kMinFrameRate, kMaxFrameRate);
+                gTxCharDelay = (short)GetDialogNumber(dialog, kSettingsCharDelay,
+                                                      0, kMaxPacingDelay);
+                gTxLineDelay = (short)GetDialogNumber(dialog, kSettingsLineDelay,
+                                                      0, kMaxPacingDelay);
+
+                GetDialogItem(dialog, kSettingsPrompt, &itemType, &itemHandle, &itemRect);
+                GetDialogItemText(itemHandle, itemText);
+                if (itemText[0] > kMaxPromptLength) {
+                    itemText[0] = kMaxPromptLength;
+                }
+                BlockMoveData(itemText, gTxPrompt, itemText[0] + 1);
+                BuildPromptTable();
+
+                /*
+                 * Pacing and the prompt take effect on queued sends as they
+                 * go out; only a port change closes the port and drops them
+                 */
+                if (reopen) {
+                    if (gTxQueueCount > 0) {
+                        itemText[0] = 0;
+                        AppendCString(itemText, "Settings: ");
+                        AppendNumber(itemText, gTxQueueCount);
+                        AppendCString(itemText, (gTxQueueCount == 1) ? " queued send dropped"
+                                                                     : " queued sends dropped");
+                        ReportLine(itemText);
+                    }
+                    ReinitializeSerial();
+                }
                 done = true;
                 break;
 
@@ -857,6 +7150,18 @@ static void DoSettingsDialog(void)
                 done = true;
                 break;
 
+            /* Flow control selection */
+            case kSettingsFlowNone:
+            case kSettingsFlowHardware:
+            case kSettingsFlowXOnOut:
+            case kSettingsFlowXOnIn:
+            case kSettingsFlowXOnBoth:
+                tempFlow = itemHit - kSettingsFlowNone;
+                for (item = kSettingsFlowNone; item <= kSettingsFlowXOnBoth; item++) {
+                    SetRadioButton(dialog, item, item == itemHit);
+                }
+                break;
+
             /* Port selection */
             case kSettingsModemPort:
                 tempPort = kPortModem;
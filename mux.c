@@ -0,0 +1,536 @@
+/*
+ * mux.c - Framed, checked, multiplexed channels over the serial link
+ *
+ * Each channel is an independent selective-repeat link: the sender keeps
+ * up to kMuxWindow frames in flight and the receiver acknowledges with
+ * the next sequence it wants plus a bitmap of what it already holds, so
+ * only the frames that were really lost go out again. Serial lines never
+ * reorder, which lets a hole in that bitmap trigger a resend at once
+ * instead of waiting out the timer.
+ */
+
+#include <string.h>
+
+#include "mux.h"
+#include "transfer.h"
+
+/* Sending slot states */
+#define kSlotFree       0
+#define kSlotQueued     1
+#define kSlotSent       2
+#define kSlotAcked      3
+
+/* Receiving slot states */
+#define kSlotHeld       1
+
+static void MuxSendBody(MuxState *m, unsigned char *body, long length);
+static void MuxSendData(MuxState *m, short channel, MuxSlot *slot, unsigned char seq);
+static void MuxSendAck(MuxState *m, short channel);
+static void MuxFillWindow(MuxChannel *c);
+static void MuxDeliver(MuxState *m, short channel);
+static void MuxFrame(MuxState *m, unsigned char *frame, long length);
+static void MuxDataFrame(MuxState *m, short channel, const unsigned char *body,
+                         long length, int end);
+static void MuxAckFrame(MuxState *m, short channel, unsigned char expected,
+                        unsigned char held);
+
+/*
+ * Start with every channel empty and sequence numbers at zero on both
+ * ends. retryTicks should cover a full window at the line's speed.
+ */
+void MuxStart(MuxState *m, const MuxIO *io, unsigned long retryTicks)
+{
+    memset(m, 0, sizeof(*m));
+    m->io = io;
+    m->retryTicks = retryTicks;
+}
+
+/*
+ * Bytes MuxWrite() would take for a channel now
+ */
+long MuxWriteRoom(MuxState *m, short channel)
+{
+    MuxChannel *c = &m->channels[channel];
+
+    if ((unsigned char)(c->endHead - c->endTail) >= kMuxEnds) {
+        return 0;
+    }
+    return kMuxQueueSize - (long)(c->queueHead - c->queueTail);
+}
+
+/*
+ * Queue bytes for a channel. With end set, the last byte taken closes
+ * the message, and only if all of data was taken; check MuxWriteRoom()
+ * first to end a message reliably. Returns the count taken.
+ */
+long MuxWrite(MuxState *m, short channel, const unsigned char *data, long count, int end)
+{
+    MuxChannel *c = &m->channels[channel];
+    long room;
+    long first;
+    long offset;
+
+    room = MuxWriteRoom(m, channel);
+    if (room <= 0) {
+        return 0;
+    }
+    if (count > room) {
+        count = room;
+        end = 0;
+    }
+    if (count <= 0 && !end) {
+        return 0;
+    }
+
+    offset = c->queueHead & kMuxQueueMask;
+    first = kMuxQueueSize - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(c->queue + offset, data, first);
+    memcpy(c->queue, data + first, count - first);
+    c->queueHead += count;
+
+    if (end) {
+        c->endAt[c->endHead & kMuxEndMask] = c->queueHead;
+        c->endHead++;
+    }
+    return count;
+}
+
+/*
+ * Nothing waiting to be framed, sent or acknowledged
+ */
+int MuxIdle(MuxState *m)
+{
+    MuxChannel *c;
+    short i;
+
+    for (i = 0; i < kMuxChannels; i++) {
+        c = &m->channels[i];
+        if (c->queueHead != c->queueTail || c->endHead != c->endTail ||
+            c->base != c->next || c->ackDue) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Tell the far end the channels are done. Plain bytes may follow.
+ */
+void MuxClose(MuxState *m)
+{
+    unsigned char body[3];
+
+    body[0] = kMuxFrameClose << 4;
+    MuxSendBody(m, body, 1);
+}
+
+/*
+ * Frame queued data, resend what timed out and send what the line has
+ * room for: acknowledgements first, then the channels in order, with
+ * bulk data held back while anything at all waits for the line.
+ */
+void MuxPoll(MuxState *m)
+{
+    const MuxIO *io = m->io;
+    MuxChannel *c;
+    MuxSlot *slot;
+    unsigned long now;
+    unsigned char seq;
+    long limit;
+    short i;
+
+    now = io->ticks(io->context);
+
+    for (i = 0; i < kMuxChannels; i++) {
+        c = &m->channels[i];
+
+        /* Held frames go up as soon as the application has room */
+        MuxDeliver(m, i);
+
+        for (seq = c->base; seq != c->next; seq++) {
+            slot = &c->tx[seq & kMuxWindowMask];
+            if (slot->state == kSlotSent && now - slot->sentTicks >= m->retryTicks) {
+                slot->state = kSlotQueued;
+                m->retransmits++;
+                if (++slot->retries > kMuxMaxRetries) {
+                    m->failed = 1;
+                }
+            }
+        }
+        MuxFillWindow(c);
+    }
+
+    for (i = 0; i < kMuxChannels; i++) {
+        if (m->channels[i].ackDue && io->writeQueued(io->context) < kMuxQueueLimit) {
+            MuxSendAck(m, i);
+        }
+    }
+
+    for (i = 0; i < kMuxChannels; i++) {
+        c = &m->channels[i];
+        limit = (i == kMuxBulk) ? kMuxBulkLimit : kMuxQueueLimit;
+
+        for (seq = c->base; seq != c->next; seq++) {
+            slot = &c->tx[seq & kMuxWindowMask];
+            if (slot->state != kSlotQueued) {
+                continue;
+            }
+            if (io->writeQueued(io->context) >= limit) {
+                break;
+            }
+            MuxSendData(m, i, slot, seq);
+        }
+    }
+}
+
+/*
+ * Feed received bytes. Stops just after a close frame, which sets
+ * m->closed. Returns the number of bytes consumed.
+ */
+long MuxInput(MuxState *m, const unsigned char *data, long count)
+{
+    long i;
+
+    if (m->closed) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (data[i] != 0) {
+            if (m->frameLength < kMuxMaxFrame) {
+                m->frame[m->frameLength++] = data[i];
+            } else {
+                m->frameOverflow = 1;
+            }
+            continue;
+        }
+
+        if (m->frameOverflow) {
+            m->badFrames++;
+        } else if (m->frameLength > 0) {
+            MuxFrame(m, m->frame, m->frameLength);
+        }
+        m->frameLength = 0;
+        m->frameOverflow = 0;
+
+        if (m->closed) {
+            return i + 1;
+        }
+    }
+    return count;
+}
+
+/*
+ * Add the CRC, COBS-encode the body and queue it with its delimiter.
+ * body must have room for the two CRC bytes.
+ */
+static void MuxSendBody(MuxState *m, unsigned char *body, long length)
+{
+    unsigned char *out;
+    unsigned char *code;
+    unsigned short crc;
+    long i;
+
+    crc = XferCrc16(0, body, length);
+    body[length++] = (unsigned char)(crc >> 8);
+    body[length++] = (unsigned char)crc;
+
+    /* Each code byte counts the run up to the next zero, at most 254 */
+    code = m->out;
+    out = m->out + 1;
+    *code = 1;
+    for (i = 0; i < length; i++) {
+        if (body[i] == 0) {
+            code = out++;
+            *code = 1;
+        } else {
+            *out++ = body[i];
+            if (++*code == 0xFF) {
+                code = out++;
+                *code = 1;
+            }
+        }
+    }
+    *out++ = 0;
+
+    m->io->write(m->io->context, m->out, out - m->out);
+}
+
+/*
+ * Send or resend one data frame
+ */
+static void MuxSendData(MuxState *m, short channel, MuxSlot *slot, unsigned char seq)
+{
+    unsigned char body[kMuxMaxBody];
+
+    body[0] = (unsigned char)(((slot->end ? kMuxFrameEnd : kMuxFrameData) << 4) | channel);
+    body[1] = seq;
+    memcpy(body + 2, slot->data, slot->length);
+    MuxSendBody(m, body, slot->length + 2);
+
+    slot->state = kSlotSent;
+    slot->sentTicks = m->io->ticks(m->io->context);
+    slot->sentOrder = m->sendOrder++;
+    m->channels[channel].framesOut++;
+}
+
+/*
+ * Acknowledge everything received on a channel
+ */
+static void MuxSendAck(MuxState *m, short channel)
+{
+    MuxChannel *c = &m->channels[channel];
+    unsigned char body[5];
+    unsigned char held;
+    short i;
+
+    held = 0;
+    for (i = 0; i < kMuxWindow; i++) {
+        if (c->rx[(c->expected + i) & kMuxWindowMask].state == kSlotHeld) {
+            held |= (unsigned char)(1 << i);
+        }
+    }
+
+    body[0] = (unsigned char)((kMuxFrameAck << 4) | channel);
+    body[1] = c->expected;
+    body[2] = held;
+    MuxSendBody(m, body, 3);
+    c->ackDue = 0;
+}
+
+/*
+ * Cut queued bytes into frames while the window has free slots. A frame
+ * never runs past the end of a message.
+ */
+static void MuxFillWindow(MuxChannel *c)
+{
+    MuxSlot *slot;
+    long count;
+    long offset;
+    long first;
+    int end;
+
+    while ((unsigned char)(c->next - c->base) < kMuxWindow) {
+        count = (long)(c->queueHead - c->queueTail);
+        end = 0;
+        if (c->endHead != c->endTail) {
+            count = (long)(c->endAt[c->endTail & kMuxEndMask] - c->queueTail);
+            end = 1;
+        }
+        if (count > kMuxMaxPayload) {
+            count = kMuxMaxPayload;
+            end = 0;
+        }
+        if (count == 0 && !end) {
+            break;
+        }
+
+        slot = &c->tx[c->next & kMuxWindowMask];
+        offset = c->queueTail & kMuxQueueMask;
+        first = kMuxQueueSize - offset;
+        if (first > count) {
+            first = count;
+        }
+        memcpy(slot->data, c->queue + offset, first);
+        memcpy(slot->data + first, c->queue, count - first);
+        c->queueTail += count;
+        if (end) {
+            c->endTail++;
+        }
+
+        slot->state = kSlotQueued;
+        slot->length = (short)count;
+        slot->end = end;
+        slot->retries = 0;
+        c->next++;
+    }
+}
+
+/*
+ * Hand held frames to the application in order, while it has room
+ */
+static void MuxDeliver(MuxState *m, short channel)
+{
+    const MuxIO *io = m->io;
+    MuxChannel *c = &m->channels[channel];
+    MuxSlot *slot;
+
+    for (;;) {
+        slot = &c->rx[c->expected & kMuxWindowMask];
+        if (slot->state != kSlotHeld || io->accept(io->context, channel) < slot->length) {
+            break;
+        }
+        slot->state = kSlotFree;
+        c->expected++;
+        c->ackDue = 1;
+        io->deliver(io->context, channel, slot->data, slot->length, slot->end);
+    }
+}
+
+/*
+ * Decode, check and act on one received frame
+ */
+static void MuxFrame(MuxState *m, unsigned char *frame, long length)
+{
+    unsigned char *out;
+    unsigned short crc;
+    short channel;
+    short kind;
+    short code;
+    long i;
+    long run;
+
+    /* COBS decode in place; the output never overtakes the input */
+    out = frame;
+    i = 0;
+    while (i < length) {
+        code = frame[i++];
+        if (i + code - 1 > length) {
+            m->badFrames++;
+            return;
+        }
+        for (run = code - 1; run > 0; run--) {
+            *out++ = frame[i++];
+        }
+        if (code != 0xFF && i < length) {
+            *out++ = 0;
+        }
+    }
+    length = out - frame;
+
+    if (length < 3) {
+        m->badFrames++;
+        return;
+    }
+    crc = XferCrc16(0, frame, length - 2);
+    if (frame[length - 2] != (unsigned char)(crc >> 8) ||
+        frame[length - 1] != (unsigned char)crc) {
+        m->badFrames++;
+        return;
+    }
+    length -= 2;
+
+    kind = frame[0] >> 4;
+    channel = frame[0] & 15;
+    if (kind == kMuxFrameClose && length == 1) {
+        m->closed = 1;
+        return;
+    }
+    if (channel >= kMuxChannels) {
+        m->badFrames++;
+        return;
+    }
+
+    switch (kind) {
+        case kMuxFrameData:
+        case kMuxFrameEnd:
+            if (length < 2 || length - 2 > kMuxMaxPayload) {
+                m->badFrames++;
+                return;
+            }
+            MuxDataFrame(m, channel, frame + 1, length - 1, kind == kMuxFrameEnd);
+            break;
+
+        case kMuxFrameAck:
+            if (length != 3) {
+                m->badFrames++;
+                return;
+            }
+            MuxAckFrame(m, channel, frame[1], frame[2]);
+            break;
+
+        default:
+            m->badFrames++;
+            break;
+    }
+}
+
+/*
+ * Hold a data frame in its slot and deliver whatever is now in order.
+ * body is the sequence number followed by the payload.
+ */
+static void MuxDataFrame(MuxState *m, short channel, const unsigned char *body,
+                         long length, int end)
+{
+    MuxChannel *c = &m->channels[channel];
+    MuxSlot *slot;
+    unsigned char seq;
+
+    seq = body[0];
+    c->ackDue = 1;
+
+    /* Anything outside the window is a repeat of a frame already taken */
+    if ((unsigned char)(seq - c->expected) >= kMuxWindow) {
+        return;
+    }
+    slot = &c->rx[seq & kMuxWindowMask];
+    if (slot->state == kSlotHeld) {
+        return;
+    }
+
+    slot->state = kSlotHeld;
+    slot->length = (short)(length - 1);
+    slot->end = end;
+    memcpy(slot->data, body + 1, length - 1);
+    c->framesIn++;
+
+    MuxDeliver(m, channel);
+}
+
+/*
+ * Retire acknowledged frames and resend any the far end skipped over
+ */
+static void MuxAckFrame(MuxState *m, short channel, unsigned char expected,
+                        unsigned char held)
+{
+    MuxChannel *c = &m->channels[channel];
+    MuxSlot *slot;
+    unsigned char inFlight;
+    unsigned char seq;
+    unsigned long latest;
+    int anyHeld;
+    short i;
+
+    /* An acknowledgement from before the window moved tells nothing */
+    inFlight = (unsigned char)(c->next - c->base);
+    if ((unsigned char)(expected - c->base) > inFlight) {
+        return;
+    }
+
+    while (c->base != expected) {
+        c->tx[c->base & kMuxWindowMask].state = kSlotFree;
+        c->base++;
+    }
+
+    /* Frames the far end holds but has not delivered yet */
+    latest = 0;
+    anyHeld = 0;
+    for (i = 0; i < kMuxWindow; i++) {
+        seq = (unsigned char)(expected + i);
+        if (!(held & (1 << i)) || (unsigned char)(seq - c->base) >= (unsigned char)(c->next - c->base)) {
+            continue;
+        }
+        slot = &c->tx[seq & kMuxWindowMask];
+        if (slot->state == kSlotSent || slot->state == kSlotAcked) {
+            if (!anyHeld || (long)(slot->sentOrder - latest) > 0) {
+                latest = slot->sentOrder;
+            }
+            anyHeld = 1;
+        }
+        slot->state = kSlotAcked;
+    }
+
+    /* A frame sent before one that arrived, but missing, was lost */
+    if (anyHeld) {
+        for (seq = c->base; seq != c->next; seq++) {
+            slot = &c->tx[seq & kMuxWindowMask];
+            if (slot->state == kSlotSent && (long)(latest - slot->sentOrder) > 0) {
+                slot->state = kSlotQueued;
+                m->retransmits++;
+            }
+        }
+    }
+}
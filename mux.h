@@ -0,0 +1,140 @@
+/*
+ * mux.h - Framed, checked, multiplexed channels over the serial link
+ *
+ * Splits one serial line into a few logical channels, each with its own
+ * sequence numbers, sliding window and retransmission, so a lost or
+ * damaged frame on one channel never stalls another and bulk data never
+ * sits in front of a keystroke. No Toolbox calls and no allocation: the
+ * application owns the MuxState and reaches the line through a MuxIO.
+ *
+ * Wire format, after the handshake:
+ *
+ *   frame     COBS-encoded body, then a single 0x00 delimiter
+ *   body      kind << 4 | channel, fields, CRC-16 (XMODEM, big-endian)
+ *             over everything before it
+ *   data      seq, 0..128 payload bytes; kMuxFrameEnd marks the last
+ *             frame of a message
+ *   ack       next seq expected, bitmap of frames held from that seq on
+ *             (bit 0 = that seq)
+ *   close     no fields; plain bytes follow the delimiter
+ *
+ * A receiver only moves past a frame once the application has taken it,
+ * so a slow consumer holds its own channel's window shut and nothing else.
+ */
+
+#ifndef MUX_H
+#define MUX_H
+
+#define kMuxChannels        3
+#define kMuxConsole         0       /* Keyboard and screen text */
+#define kMuxBot             1       /* "@bot" commands and their replies */
+#define kMuxBulk            2       /* File data */
+
+#define kMuxWindow          8       /* Frames in flight per channel, power of two */
+#define kMuxWindowMask      (kMuxWindow - 1)
+#define kMuxMaxPayload      128
+#define kMuxQueueSize       2048    /* Unframed bytes per channel, power of two */
+#define kMuxQueueMask       (kMuxQueueSize - 1)
+#define kMuxEnds            16      /* Message ends waiting to be framed, power of two */
+#define kMuxEndMask         (kMuxEnds - 1)
+
+/* Largest body, and its encoded size with the delimiter */
+#define kMuxMaxBody         (2 + kMuxMaxPayload + 2)
+#define kMuxMaxFrame        (kMuxMaxBody + 2)
+
+/*
+ * Output pacing: console and bot frames go out while less than
+ * kMuxQueueLimit bytes wait for the line, bulk frames only once less
+ * than one frame does, so a keystroke never queues behind a file.
+ */
+#define kMuxQueueLimit      1024
+#define kMuxBulkLimit       kMuxMaxFrame
+
+/* Resends of one frame before the link is declared dead */
+#define kMuxMaxRetries      10
+
+/* Frame kinds */
+#define kMuxFrameData       1
+#define kMuxFrameEnd        2
+#define kMuxFrameAck        3
+#define kMuxFrameClose      4
+
+/* Handshake, as for compression; see SerialFindMarker() */
+#define kMuxHello           "\033Mx1?"
+#define kMuxAccept          "\033Mx1!"
+#define kMuxMarkerLength    5
+
+/* Serial access and delivery supplied by the application */
+typedef struct MuxIO {
+    void *context;
+
+    /* Serial output: bytes queued but not yet sent, and queue more */
+    long (*writeQueued)(void *context);
+    void (*write)(void *context, const unsigned char *data, long count);
+
+    /* Received data: room for a channel's data now, and hand it over */
+    long (*accept)(void *context, short channel);
+    void (*deliver)(void *context, short channel, const unsigned char *data,
+                    long count, int end);
+
+    /* Clock in 1/60 second ticks */
+    unsigned long (*ticks)(void *context);
+} MuxIO;
+
+typedef struct MuxSlot {
+    short state;                    /* Sending: free, queued, sent or acked */
+    short length;
+    int end;                        /* Last frame of a message */
+    short retries;
+    unsigned long sentTicks;
+    unsigned long sentOrder;        /* Frames sent on the link before this one */
+    unsigned char data[kMuxMaxPayload];
+} MuxSlot;
+
+typedef struct MuxChannel {
+    /* Sending: bytes not yet framed, then the window of frames */
+    unsigned char queue[kMuxQueueSize];
+    unsigned long queueHead;        /* Next byte written, free-running */
+    unsigned long queueTail;        /* Next byte framed, free-running */
+    unsigned long endAt[kMuxEnds];  /* queueHead where each message ended */
+    unsigned char endHead;
+    unsigned char endTail;
+    MuxSlot tx[kMuxWindow];
+    unsigned char base;             /* Oldest unacknowledged seq */
+    unsigned char next;             /* Next seq to assign */
+
+    /* Receiving: frames held until the application takes them */
+    MuxSlot rx[kMuxWindow];
+    unsigned char expected;         /* Next seq to deliver */
+    int ackDue;
+
+    unsigned long framesOut;
+    unsigned long framesIn;
+} MuxChannel;
+
+typedef struct MuxState {
+    const MuxIO *io;
+    MuxChannel channels[kMuxChannels];
+    unsigned long retryTicks;       /* Resend an unacknowledged frame after this */
+    unsigned long sendOrder;
+
+    short frameLength;              /* Encoded frame being received */
+    int frameOverflow;
+    unsigned char frame[kMuxMaxFrame];
+    unsigned char out[kMuxMaxFrame];
+
+    int closed;                     /* Far end sent close */
+    int failed;                     /* A frame ran out of retries */
+    unsigned long retransmits;
+    unsigned long badFrames;
+} MuxState;
+
+void MuxStart(MuxState *m, const MuxIO *io, unsigned long retryTicks);
+long MuxWrite(MuxState *m, short channel, const unsigned char *data, long count, int end);
+long MuxWriteRoom(MuxState *m, short channel);
+long MuxInput(MuxState *m, const unsigned char *data, long count);
+void MuxPoll(MuxState *m);
+void MuxClose(MuxState *m);
+int MuxIdle(MuxState *m);
+
+#endif /* MUX_H */
@@ -6,11 +6,48 @@ Connects to /dev/tnt0 (pairs with emulator's /dev/tnt1 via tty0tty).
 
 import sys
 import os
+import re
 import select
 import termios
 import tty
 import argparse
+import binascii
+import csv
+import heapq
+import struct
 import time
+import zlib
+
+
+# Interactive loop: bytes taken per read, and how often --stats reports
+READ_SIZE = 65536
+STATS_INTERVAL = 1.0
+
+# Streaming file send (-f): source bytes read at a time, the most written
+# in one go, how often progress is shown, and the wait while flow is held
+FILE_CHUNK = 4096
+FILE_BURST = 64
+PROGRESS_INTERVAL = 0.25
+FLOW_POLL = 0.01
+
+# Port B watch (-w): bytes read at a time, the poll interval without
+# inotify, and how often to look anyway when no event has come
+WATCH_READ = 65536
+WATCH_POLL = 0.1
+WATCH_RECHECK = 1.0
+
+# inotify: modify, attrib, close-write, moved from/to, create, delete
+INOTIFY_MASK = 0x002 | 0x004 | 0x008 | 0x040 | 0x080 | 0x100 | 0x200
+INOTIFY_EVENT = struct.Struct('iIII')
+
+# The Mac's File > Log Statistics to Port B line: "#stat key=value ...",
+# where a profile section's value is calls/total ms/longest call in us
+STAT_PREFIX = '#stat '
+STAT_SECTION_FIELDS = ('calls', 'ms', 'max_us')
+
+# Any line ending in received text
+NEWLINES = re.compile(rb'\r\n|\r|\n')
+CLEAR_SCREEN = b'\033[2J\033[H'
 
 
 def open_serial(device, baud=9600):
@@ -19,6 +56,56 @@ def open_serial(device, baud=9600):
     return serial.Serial(device, baud, timeout=0)
 
 
+# Bot mode: replies go out this long after the @bot line arrives, and a
+# line that grows past BOT_MAX_LINE without an ending is handled as is
+BOT_REPLY_DELAY = 0.1
+BOT_MAX_LINE = 4096
+
+# Command word -> handler(args) returning the reply, filled by @bot_command
+BOT_COMMANDS = {}
+BOT_USAGE = []
+
+
+def bot_command(name, *aliases, usage=None):
+    """Register a bot command handler under its name and any aliases."""
+    def register(handler):
+        for word in (name,) + aliases:
+            BOT_COMMANDS[word] = handler
+        BOT_USAGE.append(usage or name)
+        return handler
+    return register
+
+
+@bot_command('hello', 'hi')
+def _bot_hello(args):
+    return "Hello from the host machine!"
+
+
+@bot_command('time')
+def _bot_time(args):
+    return f"Current time: {time.strftime('%H:%M:%S')}"
+
+
+@bot_command('date')
+def _bot_date(args):
+    return f"Today is {time.strftime('%Y-%m-%d')}"
+
+
+@bot_command('ping')
+def _bot_ping(args):
+    return "Pong!"
+
+
+@bot_command('echo', usage='echo <text>')
+def _bot_echo(args):
+    return args
+
+
+@bot_command('help')
+def _bot_help(args):
+    return "Commands: " + ", ".join(BOT_USAGE)
+
+
 def handle_bot_message(message):
     """Generate a response to a @bot message."""
     # Strip the @bot prefix and whitespace
@@ -26,29 +113,667 @@ def handle_bot_message(message):
     if content.lower().startswith('@bot'):
         content = content[4:].strip()
 
-    # Simple responses based on content
-    content_lower = content.lower()
-
     if not content:
         return "Hello! I'm a bot. Send me a message after @bot."
-    elif 'hello' in content_lower or 'hi' in content_lower:
-        return "Hello from the host machine!"
-    elif 'time' in content_lower:
-        return f"Current time: {time.strftime('%H:%M:%S')}"
-    elif 'date' in content_lower:
-        return f"Today is {time.strftime('%Y-%m-%d')}"
-    elif 'ping' in content_lower:
-        return "Pong!"
-    elif 'help' in content_lower:
-        return "Commands: hello, time, date, ping, echo <text>"
-    elif content_lower.startswith('echo '):
-        return content[5:]
-    else:
+
+    # The first word picks the handler; the rest is its argument
+    word, _, args = content.partition(' ')
+    handler = BOT_COMMANDS.get(word.lower())
+    if handler is None:
         return f"Received: {content}"
+    return handler(args)
+
+
+class LineFramer:
+    """Split a byte stream into lines ending in CR, LF or CR+LF.
+
+    Only an unfinished line is kept between calls and only new bytes are
+    scanned, so framing costs the same per byte however the stream is cut.
+    """
+
+    def __init__(self, max_line=BOT_MAX_LINE):
+        self.partial = bytearray()
+        self.pending_cr = False
+        self.max_line = max_line
+
+    def feed(self, data):
+        """Add received bytes; return the lines they complete."""
+        if not data:
+            return []
+
+        # A lone LF can finish a CR+LF and leave nothing, but the CR is used up
+        pending_cr = self.pending_cr
+        self.pending_cr = data.endswith(b'\r')
+        data = _after_cr(data, pending_cr)
+        if not data:
+            return []
+
+        lines = []
+        start = 0
+        for match in NEWLINES.finditer(data):
+            if self.partial:
+                self.partial += data[start:match.start()]
+                lines.append(bytes(self.partial))
+                self.partial.clear()
+            else:
+                lines.append(data[start:match.start()])
+            start = match.end()
+        self.partial += data[start:]
+
+        # A sender that never ends its line must not grow the buffer forever
+        if len(self.partial) >= self.max_line:
+            lines.append(bytes(self.partial))
+            self.partial.clear()
+        return lines
+
+
+class TimerQueue:
+    """Items released at a due time, earliest first; ties keep their order."""
+
+    def __init__(self):
+        self.heap = []
+        self.sequence = 0
+
+    def schedule(self, due, item):
+        heapq.heappush(self.heap, (due, self.sequence, item))
+        self.sequence += 1
+
+    def next_due(self):
+        """Time of the earliest item, or None when the queue is empty."""
+        return self.heap[0][0] if self.heap else None
+
+    def pop_due(self, now):
+        """Remove and return every item due by now."""
+        items = []
+        while self.heap and self.heap[0][0] <= now:
+            items.append(heapq.heappop(self.heap)[2])
+        return items
+
+
+class BotDispatcher:
+    """Frame received lines, answer @bot ones, and hold replies until due.
+
+    Nothing here sleeps: the terminal loop feeds bytes in, waits no longer
+    than next_due(), and sends whatever replies() hands back.
+    """
+
+    def __init__(self, delay=BOT_REPLY_DELAY):
+        self.framer = LineFramer()
+        self.timers = TimerQueue()
+        self.delay = delay
+
+    def feed(self, data, now):
+        for line in self.framer.feed(data):
+            if line.lstrip()[:4].lower() == b'@bot':
+                response = handle_bot_message(line.decode('latin-1'))
+                self.timers.schedule(now + self.delay, response)
+
+    def next_due(self):
+        return self.timers.next_due()
+
+    def replies(self, now):
+        return self.timers.pop_due(now)
+
+
+# Compressed link, the same format as lzss.c: 4 KB window, 3..18 byte
+# matches, blocks of at most 4 KB behind a 1- or 2-byte length header
+LZSS_WINDOW = 4096
+LZSS_MIN_MATCH = 3
+LZSS_MAX_MATCH = 18
+LZSS_MAX_BLOCK = 4096
+LZSS_MAX_KEYS = 65536   # Forget old match candidates past this many
+LZSS_END = b'\x00'
+LZSS_HELLO = b'\033Lz1?'
+LZSS_ACCEPT = b'\033Lz1!'
+
+
+class LzssEncoder:
+    """Streaming LZSS encoder; each encode() call emits whole blocks."""
+
+    def __init__(self):
+        self.buf = bytearray(LZSS_WINDOW)   # Zeros before the stream, as in lzss.c
+        self.base = -LZSS_WINDOW            # Stream position of buf[0]
+        self.pos = 0
+        self.last = {}                      # Latest position of each 3-byte string
+
+    def encode(self, data):
+        out = bytearray()
+        for start in range(0, len(data), LZSS_MAX_BLOCK):
+            out += self._block(data[start:start + LZSS_MAX_BLOCK])
+        return bytes(out)
+
+    def _block(self, block):
+        buf = self.buf
+        buf += block
+        if len(self.last) > LZSS_MAX_KEYS:
+            self.last.clear()
+
+        payload = bytearray()
+        flag_at = 0
+        bit = 8
+        n = len(block)
+        i = 0
+        while i < n:
+            if bit == 8:
+                flag_at = len(payload)
+                payload.append(0)
+                bit = 0
+
+            pos = self.pos + i
+            at = pos - self.base
+            best = distance = 0
+            if n - i >= LZSS_MIN_MATCH:
+                key = bytes(buf[at:at + LZSS_MIN_MATCH])
+                candidate = self.last.get(key)
+                self.last[key] = pos
+                if candidate is not None and pos - candidate < LZSS_WINDOW:
+                    distance = pos - candidate
+                    limit = min(LZSS_MAX_MATCH, n - i)
+                    from_at = candidate - self.base
+                    while best < limit and buf[from_at + best] == buf[at + best]:
+                        best += 1
+
+            if best >= LZSS_MIN_MATCH:
+                payload += bytes((distance >> 4,
+                                  ((distance & 15) << 4) | (best - LZSS_MIN_MATCH)))
+                for j in range(1, min(best, n - i - LZSS_MIN_MATCH + 1)):
+                    self.last[bytes(buf[at + j:at + j + LZSS_MIN_MATCH])] = pos + j
+                i += best
+            else:
+                payload[flag_at] |= 1 << bit
+                payload.append(block[i])
+                i += 1
+            bit += 1
+
+        self.pos += n
+        excess = len(buf) - LZSS_WINDOW
+        if excess > 0:
+            del buf[:excess]
+            self.base += excess
+
+        if len(payload) < 0x80:
+            return bytes((len(payload),)) + payload
+        return bytes((0x80 | len(payload) >> 8, len(payload) & 0xFF)) + payload
+
+
+class LzssDecoder:
+    """Byte-driven LZSS decoder that stops just after the end marker."""
+
+    HEADER, HEADER2, FLAGS, ITEM, MATCH = range(5)
+
+    def __init__(self):
+        self.window = bytearray(LZSS_WINDOW)
+        self.pos = 0
+        self.state = self.HEADER
+        self.remaining = 0
+        self.flags = 0
+        self.flag_bits = 0
+        self.match_high = 0
+        self.ended = False
+
+    def decode(self, data):
+        """Returns (decoded bytes, input bytes used)."""
+        out = bytearray()
+        window = self.window
+        used = 0
+        for c in data:
+            if self.ended:
+                break
+            used += 1
+
+            if self.state == self.HEADER:
+                if c == 0:
+                    self.ended = True
+                elif c & 0x80:
+                    self.remaining = (c & 0x7F) << 8
+                    self.state = self.HEADER2
+                else:
+                    self.remaining = c
+                    self.state = self.FLAGS
+                continue
+            if self.state == self.HEADER2:
+                self.remaining |= c
+                self.state = self.FLAGS if self.remaining else self.HEADER
+                continue
+
+            if self.state == self.FLAGS:
+                self.flags = c
+                self.flag_bits = 8
+                self.state = self.ITEM
+            elif self.state == self.ITEM and self.flags & 1:
+                out.append(c)
+                window[self.pos & (LZSS_WINDOW - 1)] = c
+                self.pos += 1
+                self.flags >>= 1
+                self.flag_bits -= 1
+            elif self.state == self.ITEM:
+                self.match_high = c
+                self.state = self.MATCH
+            else:
+                distance = (self.match_high << 4) | (c >> 4)
+                for _ in range((c & 15) + LZSS_MIN_MATCH):
+                    b = window[(self.pos - distance) & (LZSS_WINDOW - 1)]
+                    out.append(b)
+                    window[self.pos & (LZSS_WINDOW - 1)] = b
+                    self.pos += 1
+                self.flags >>= 1
+                self.flag_bits -= 1
+                self.state = self.ITEM
+
+            self.remaining -= 1
+            if self.remaining == 0:
+                self.state = self.HEADER
+            elif self.state == self.ITEM and self.flag_bits == 0:
+                self.state = self.FLAGS
+        return bytes(out), used
+
+
+class CompressedLink:
+    """
+    Host end of SerialSend's compressed link. Plain until the Mac sends
+    LZSS_HELLO; then both directions are LZSS until either end sends
+    LZSS_END, which the other answers in kind.
+    """
+
+    def __init__(self, enabled=True):
+        self.enabled = enabled
+        self.on = False
+        self.encoder = self.decoder = None
+        self.matched = 0
+        self.wire_in = self.wire_out = self.plain_in = self.plain_out = 0
+
+    def receive(self, data):
+        """
+        Returns (plain bytes, bytes to send now, notes). The bytes to send
+        are already in wire form and go after anything queued before.
+        """
+        plain = bytearray()
+        reply = bytearray()
+        notes = []
+        while data:
+            if not self.on:
+                at = self._find_hello(data) if self.enabled else -1
+                if at < 0:
+                    plain += data
+                    break
+                plain += data[:max(0, at - len(LZSS_HELLO))]
+                data = data[at:]
+                self.encoder = LzssEncoder()
+                self.decoder = LzssDecoder()
+                self.wire_in = self.wire_out = self.plain_in = self.plain_out = 0
+                reply += LZSS_ACCEPT
+                self.on = True
+                notes.append('link compressed')
+            else:
+                out, used = self.decoder.decode(data)
+                plain += out
+                self.wire_in += used
+                self.plain_in += len(out)
+                data = data[used:]
+                if self.decoder.ended:
+                    reply += LZSS_END
+                    self.on = False
+                    notes.append('link uncompressed')
+        return bytes(plain), bytes(reply), notes
+
+    def send(self, data):
+        """Wire form of outgoing bytes."""
+        if not self.on or not data:
+            return data
+        wire = self.encoder.encode(data)
+        self.plain_out += len(data)
+        self.wire_out += len(wire)
+        return wire
+
+    def close(self):
+        """The end marker to send before letting go of the port, if any."""
+        if not self.on:
+            return b''
+        self.on = False
+        return LZSS_END
+
+    def ratio(self):
+        wire = self.wire_in + self.wire_out
+        return (self.plain_in + self.plain_out) / wire if wire else 1.0
+
+    def _find_hello(self, data):
+        for i, c in enumerate(data):
+            if c == LZSS_HELLO[self.matched]:
+                self.matched += 1
+                if self.matched == len(LZSS_HELLO):
+                    self.matched = 0
+                    return i + 1
+            else:
+                self.matched = 1 if c == LZSS_HELLO[0] else 0
+        return -1
+
+
+# Framed channels, the same format as mux.c: COBS frames checked by a
+# CRC-16, three channels each with its own 8-frame window and resends
+MUX_CONSOLE, MUX_BOT, MUX_BULK = 0, 1, 2
+MUX_CHANNELS = 3
+MUX_WINDOW = 8
+MUX_MAX_PAYLOAD = 128
+MUX_MAX_FRAME = 2 + MUX_MAX_PAYLOAD + 2 + 2
+MUX_QUEUE_LIMIT = 1024          # Console and bot frames wait above this backlog
+MUX_BULK_LIMIT = MUX_MAX_FRAME  # Bulk frames wait until the line is this idle
+MUX_MAX_RETRIES = 10
+MUX_DATA, MUX_END, MUX_ACK, MUX_CLOSE = 1, 2, 3, 4
+MUX_HELLO = b'\033Mx1?'
+MUX_ACCEPT = b'\033Mx1!'
+MUX_BLOCKED_POLL = 0.01         # Recheck this often while the backlog holds frames back
+MUX_FILE_CHUNK = 4096
+
+
+def cobs_encode(body):
+    """COBS form of body, with the 0x00 delimiter."""
+    out = bytearray()
+    for run in body.split(b'\0'):
+        while len(run) >= 254:
+            out.append(255)
+            out += run[:254]
+            run = run[254:]
+        out.append(len(run) + 1)
+        out += run
+    out.append(0)
+    return bytes(out)
+
+
+def cobs_decode(frame):
+    """Body of a frame without its delimiter, or None if it is malformed."""
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame):
+            return None
+        out += frame[i + 1:i + code]
+        i += code
+        if code != 255 and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def mux_frame(body):
+    crc = crc16(body)
+    return cobs_encode(body + bytes((crc >> 8, crc & 0xFF)))
+
+
+class MuxChannel:
+    """One channel's sending window and receiving window."""
+
+    def __init__(self):
+        self.pending = []           # [bytearray, ended] messages not yet framed
+        self.slots = {}             # seq -> [state, data, end, sent_at, order, retries]
+        self.base = self.next = 0
+        self.held = {}              # seq -> (data, end) received ahead of a gap
+        self.expected = 0
+        self.ack_due = False
+
+
+class MuxLink:
+    """
+    Host end of SerialSend's channel link. Plain until the Mac sends
+    MUX_HELLO; then everything is mux.c frames until either end sends a
+    close frame, which the other answers in kind.
+    """
+
+    QUEUED, SENT, ACKED = 1, 2, 3
+
+    def __init__(self, enabled=True, baud=9600):
+        self.enabled = enabled
+        self.on = False
+        self.matched = 0
+        # Long enough for the line to drain a full backlog and a window
+        self.retry = 0.5 + (MUX_QUEUE_LIMIT + MUX_WINDOW * MUX_MAX_FRAME) / max(baud / 10, 1)
+        self.retransmits = self.bad_frames = 0
+        self._reset()
+
+    def _reset(self):
+        self.channels = [MuxChannel() for _ in range(MUX_CHANNELS)]
+        self.frame = bytearray()
+        self.out = bytearray()
+        self.delivered = []         # (channel, data, end) in arrival order
+        self.order = 0
+        self.failed = False
+        self.close_sent = False
+
+    def receive(self, data):
+        """
+        Returns (plain bytes, notes). Channel data collects in delivered;
+        anything to send comes out of the next poll().
+        """
+        plain = bytearray()
+        notes = []
+        while data:
+            if not self.on:
+                at = self._find_hello(data) if self.enabled else -1
+                if at < 0:
+                    plain += data
+                    break
+                plain += data[:max(0, at - len(MUX_HELLO))]
+                data = data[at:]
+                self._reset()
+                self.out += MUX_ACCEPT
+                self.on = True
+                notes.append('channels on')
+                continue
+
+            end = data.find(b'\0')
+            if end < 0:
+                self.frame += data
+                break
+            self.frame += data[:end]
+            data = data[end + 1:]
+            frame, self.frame = bytes(self.frame), bytearray()
+            if frame and self._frame(frame):
+                if not self.close_sent:
+                    self.out += mux_frame(bytes((MUX_CLOSE << 4,)))
+                self.on = False
+                notes.append('channels closed')
+        return bytes(plain), notes
+
+    def write(self, channel, data, end=False):
+        """Queue bytes on a channel; end closes the message."""
+        pending = self.channels[channel].pending
+        if not pending or pending[-1][1]:
+            pending.append([bytearray(), False])
+        pending[-1][0] += data
+        pending[-1][1] = end
+
+    def pending(self, channel):
+        """Bytes on a channel not yet framed."""
+        return sum(len(message) for message, _ in self.channels[channel].pending)
+
+    def poll(self, now, queued):
+        """
+        Frame, resend and acknowledge. queued is what already waits for
+        the port. Returns the bytes to send.
+        """
+        out, self.out = self.out, bytearray()
+        if not self.on:
+            return bytes(out)
+
+        for ch in self.channels:
+            for slot in ch.slots.values():
+                if slot[0] == self.SENT and now - slot[3] >= self.retry:
+                    slot[0] = self.QUEUED
+                    slot[5] += 1
+                    self.retransmits += 1
+                    if slot[5] > MUX_MAX_RETRIES:
+                        self.failed = True
+            self._fill(ch)
 
+        for i, ch in enumerate(self.channels):
+            if ch.ack_due and queued + len(out) < MUX_QUEUE_LIMIT:
+                held = 0
+                for bit in range(MUX_WINDOW):
+                    if (ch.expected + bit) & 0xFF in ch.held:
+                        held |= 1 << bit
+                out += mux_frame(bytes(((MUX_ACK << 4) | i, ch.expected, held)))
+                ch.ack_due = False
 
-def run_terminal(device, baud, bot_mode=False):
-    """Run interactive terminal."""
+        for i, ch in enumerate(self.channels):
+            limit = MUX_BULK_LIMIT if i == MUX_BULK else MUX_QUEUE_LIMIT
+            for n in range((ch.next - ch.base) & 0xFF):
+                seq = (ch.base + n) & 0xFF
+                slot = ch.slots[seq]
+                if slot[0] != self.QUEUED:
+                    continue
+                if queued + len(out) >= limit:
+                    break
+                kind = MUX_END if slot[2] else MUX_DATA
+                out += mux_frame(bytes(((kind << 4) | i, seq)) + slot[1])
+                slot[0], slot[3], slot[4] = self.SENT, now, self.order
+                self.order += 1
+        return bytes(out)
+
+    def next_due(self, now):
+        """When poll() next has work, or None when only input can make some."""
+        if not self.on:
+            return None
+        due = None
+        for ch in self.channels:
+            if ch.ack_due or (ch.pending and (ch.next - ch.base) & 0xFF < MUX_WINDOW):
+                return now + MUX_BLOCKED_POLL
+            for slot in ch.slots.values():
+                if slot[0] == self.QUEUED:
+                    return now + MUX_BLOCKED_POLL
+                if slot[0] == self.SENT and (due is None or slot[3] + self.retry < due):
+                    due = slot[3] + self.retry
+        return due
+
+    def idle(self):
+        return all(not ch.pending and not ch.slots and not ch.ack_due for ch in self.channels)
+
+    def close(self):
+        """The close frame to send before letting go of the port, if any."""
+        if not self.on:
+            return b''
+        self.on = False
+        self.close_sent = True
+        return mux_frame(bytes((MUX_CLOSE << 4,)))
+
+    def _fill(self, ch):
+        """Cut pending messages into frames while the window has room."""
+        while ch.pending and (ch.next - ch.base) & 0xFF < MUX_WINDOW:
+            message, ended = ch.pending[0]
+            if not message and not ended:
+                ch.pending.pop(0)
+                continue
+            data = bytes(message[:MUX_MAX_PAYLOAD])
+            del message[:MUX_MAX_PAYLOAD]
+            end = ended and not message
+            if not message:
+                ch.pending.pop(0)
+            ch.slots[ch.next] = [self.QUEUED, data, end, 0.0, 0, 0]
+            ch.next = (ch.next + 1) & 0xFF
+
+    def _frame(self, frame):
+        """Act on one received frame; True if it was a close."""
+        body = cobs_decode(frame)
+        if body is None or len(body) < 3 or crc16(body[:-2]) != (body[-2] << 8 | body[-1]):
+            self.bad_frames += 1
+            return False
+        body = body[:-2]
+        kind, channel = body[0] >> 4, body[0] & 15
+        if kind == MUX_CLOSE and len(body) == 1:
+            return True
+        if channel >= MUX_CHANNELS:
+            self.bad_frames += 1
+        elif kind in (MUX_DATA, MUX_END) and 2 <= len(body) <= 2 + MUX_MAX_PAYLOAD:
+            self._data(channel, body[1], body[2:], kind == MUX_END)
+        elif kind == MUX_ACK and len(body) == 3:
+            self._ack(self.channels[channel], body[1], body[2])
+        else:
+            self.bad_frames += 1
+        return False
+
+    def _data(self, channel, seq, data, end):
+        ch = self.channels[channel]
+        ch.ack_due = True
+        if (seq - ch.expected) & 0xFF >= MUX_WINDOW or seq in ch.held:
+            return
+        ch.held[seq] = (data, end)
+        # Everything here is taken at once, so held frames only wait on a gap
+        while ch.expected in ch.held:
+            data, end = ch.held.pop(ch.expected)
+            self.delivered.append((channel, data, end))
+            ch.expected = (ch.expected + 1) & 0xFF
+
+    def _ack(self, ch, expected, held):
+        in_flight = (ch.next - ch.base) & 0xFF
+        if (expected - ch.base) & 0xFF > in_flight:
+            return
+        while ch.base != expected:
+            del ch.slots[ch.base]
+            ch.base = (ch.base + 1) & 0xFF
+
+        latest = None
+        for bit in range(MUX_WINDOW):
+            seq = (expected + bit) & 0xFF
+            if held & (1 << bit) and seq in ch.slots:
+                slot = ch.slots[seq]
+                if slot[0] in (self.SENT, self.ACKED) and (latest is None or slot[4] > latest):
+                    latest = slot[4]
+                slot[0] = self.ACKED
+
+        # Serial lines keep order: a frame sent before one that arrived was lost
+        if latest is not None:
+            for slot in ch.slots.values():
+                if slot[0] == self.SENT and slot[4] < latest:
+                    slot[0] = self.QUEUED
+                    self.retransmits += 1
+
+    def _find_hello(self, data):
+        for i, c in enumerate(data):
+            if c == MUX_HELLO[self.matched]:
+                self.matched += 1
+                if self.matched == len(MUX_HELLO):
+                    self.matched = 0
+                    return i + 1
+            else:
+                self.matched = 1 if c == MUX_HELLO[0] else 0
+        return -1
+
+
+class BulkReceiver:
+    """Files arriving on the bulk channel: a name message, then the data."""
+
+    def __init__(self, directory):
+        self.directory = directory
+        self.name = bytearray()
+        self.file = None
+        self.path = None
+        self.size = 0
+
+    def feed(self, data, end):
+        """Take one delivery; returns a note for the screen, or None."""
+        if self.file is None:
+            self.name += data
+            if not end:
+                return None
+            self.path = _safe_name(self.directory, self.name.decode('latin-1'))
+            self.name.clear()
+            self.file = open(self.path, 'wb')
+            self.size = 0
+            return f"receiving {os.path.basename(self.path)} on the bulk channel"
+        self.file.write(data)
+        self.size += len(data)
+        if not end:
+            return None
+        self.close()
+        return f"saved {self.path}, {self.size} bytes"
+
+    def close(self):
+        if self.file is not None:
+            self.file.close()
+            self.file = None
+
+
+def run_terminal(device, baud, bot_mode=False, stats=False, record=None, compress=True,
+                 channels=True, bulk=None):
+    """Run interactive terminal, optionally recording the session to a file."""
     try:
         ser = open_serial(device, baud)
     except Exception as e:
@@ -58,133 +783,413 @@ def run_terminal(device, baud, bot_mode=False):
         print("  sudo chmod 666 /dev/tnt*")
         return 1
 
+    recorder = None
+    if record:
+        try:
+            recorder = SessionRecorder(record)
+        except OSError as e:
+            print(f"Cannot record to {record}: {e}")
+            ser.close()
+            return 1
+
     print(f"Connected to {device} at {baud} baud")
     if bot_mode:
         print("Bot mode enabled - will respond to @bot messages")
+    if recorder:
+        print(f"Recording to {record}")
     print("Press Ctrl+C to exit, Ctrl+L to clear screen")
     print("-" * 40)
 
+    stdin_fd = sys.stdin.fileno()
+    stdout_fd = sys.stdout.fileno()
+    ser_fd = ser.fileno()
+
     # Save terminal settings
-    old_settings = termios.tcgetattr(sys.stdin)
+    old_settings = termios.tcgetattr(stdin_fd)
+
+    # Bytes waiting for the port, and screen output built up this wakeup
+    tx_queue = bytearray()
+    screen = bytearray()
+
+    # Received stream ended in CR, so a leading LF is the rest of a CR+LF
+    pending_cr = False
+
+    # Bot mode: @bot lines get their replies from a timer queue
+    bot = BotDispatcher() if bot_mode else None
+
+    # A ZMODEM sender on the other end starts a receive once this
+    # wakeup's text is shown and its sends have gone out
+    zmodem = ZModemWatch()
+    zmodem_start = False
 
-    # Buffer for incoming lines (for bot detection)
-    line_buffer = ""
+    # Answers the Mac's File > Compress Link unless --no-compress
+    link = CompressedLink(compress)
+    plain_rx_mark = plain_tx_mark = 0
+
+    # Answers the Mac's File > Channels unless --no-channels; --bulk sends
+    # a file on the bulk channel once they are up
+    mux = MuxLink(channels, baud)
+    bulk_in = BulkReceiver(os.getcwd())
+    bulk_out = None
+
+    rx_total = tx_total = 0
+    rx_mark = tx_mark = 0
+    started = mark_time = time.monotonic()
 
     try:
         # Set terminal to raw mode
-        tty.setraw(sys.stdin.fileno())
+        tty.setraw(stdin_fd)
 
         while True:
-            # Check for input from keyboard or serial
-            readable, _, _ = select.select([sys.stdin, ser], [], [], 0.1)
-
-            for source in readable:
-                if source == sys.stdin:
-                    # Read from keyboard
-                    char = sys.stdin.read(1)
-
-                    if char == '\x03':  # Ctrl+C
-                        raise KeyboardInterrupt
-                    elif char == '\x0c':  # Ctrl+L - clear screen
-                        sys.stdout.write('\033[2J\033[H')
-                        sys.stdout.flush()
-                        continue
-                    elif char == '\r':  # Enter key
-                        # Send CR+LF to serial
-                        ser.write(b'\r\n')
-                        # Echo newline locally
-                        sys.stdout.write('\r\n')
-                        sys.stdout.flush()
+            # Sleep until input, the next stats report or the next bot reply
+            deadlines = []
+            if stats:
+                deadlines.append(mark_time + STATS_INTERVAL)
+            if bot and bot.next_due() is not None:
+                deadlines.append(bot.next_due())
+            if mux.next_due(time.monotonic()) is not None:
+                deadlines.append(mux.next_due(time.monotonic()))
+            timeout = None
+            if deadlines:
+                timeout = max(0.0, min(deadlines) - time.monotonic())
+            writers = [ser_fd] if tx_queue else []
+            readable, writable, _ = select.select([stdin_fd, ser_fd], writers, [], timeout)
+
+            if stdin_fd in readable:
+                # Everything typed or pasted since the last wakeup
+                keys = os.read(stdin_fd, READ_SIZE)
+                quit_at = keys.find(b'\x03')  # Ctrl+C
+                if quit_at >= 0:
+                    keys = keys[:quit_at]
+                for i, part in enumerate(keys.split(b'\x0c')):
+                    if i > 0:  # Ctrl+L - clear screen
+                        screen += CLEAR_SCREEN
+                    # Enter sends CR+LF; echo locally the same way
+                    part = part.replace(b'\r', b'\r\n')
+                    if mux.on:
+                        mux.write(MUX_CONSOLE, part, end=True)
+                    else:
+                        tx_queue += link.send(part)
+                    screen += part
+                if quit_at >= 0:
+                    raise KeyboardInterrupt
+
+            if ser_fd in readable:
+                # Everything the port has buffered
+                data = ser.read(READ_SIZE)
+                if data:
+                    rx_total += len(data)
+                    if recorder:
+                        recorder.record(REC_FROM_MAC, data)
+
+                    # Channel frames are unpacked first; console and bot
+                    # text then goes where plain text would
+                    if not link.on:
+                        data, notes = mux.receive(data)
+                        text = bytearray(data)
+                        for channel, payload, end in mux.delivered:
+                            if channel == MUX_BULK:
+                                note = bulk_in.feed(payload, end)
+                                if note:
+                                    notes.append(note)
+                            else:
+                                text += payload
+                        mux.delivered.clear()
+                        data = bytes(text)
+                        for note in notes:
+                            screen += f"\r\n[{note}]\r\n".encode()
+                        if mux.on and bulk and bulk_out is None and 'channels on' in notes:
+                            bulk_out = open(bulk, 'rb')
+                            mux.write(MUX_BULK, os.path.basename(bulk).encode('latin-1'),
+                                      end=True)
+
+                    # Everything below sees the bytes as the Mac meant them
+                    if not mux.on:
+                        data, reply, notes = link.receive(data)
+                        tx_queue += reply
+                        for note in notes:
+                            screen += f"\r\n[{note}]\r\n".encode()
+
+                    # Only the text ahead of a ZMODEM start is shown
+                    if not mux.on:
+                        data, zmodem_start = zmodem.feed(data)
+
+                    # Display received text with its line endings made CR+LF,
+                    # in one pass over the bytes
+                    text = _after_cr(data, pending_cr)
+                    pending_cr = data.endswith(b'\r')
+                    screen += NEWLINES.sub(b'\r\n', text)
+
+                    # Bot mode: answers are scheduled, not sent inline
+                    if bot:
+                        bot.feed(data, time.monotonic())
+
+                    if zmodem_start:
+                        screen += b'\r\n[ZMODEM receive]\r\n'
+
+            # Bot replies that have come due join the transmit queue
+            if bot:
+                for response in bot.replies(time.monotonic()):
+                    if mux.on:
+                        mux.write(MUX_BOT, (response + '\r\n').encode('latin-1'), end=True)
                     else:
-                        # Send character to serial
-                        ser.write(char.encode('latin-1'))
-                        # Echo locally
-                        sys.stdout.write(char)
-                        sys.stdout.flush()
-
-                elif source == ser:
-                    # Read from serial
-                    data = ser.read(256)
-                    if data:
-                        text = data.decode('latin-1', errors='replace')
-
-                        # Display received text
-                        display_text = text.replace('\r\n', '\r\n')
-                        display_text = display_text.replace('\r', '\r\n')
-                        sys.stdout.write(display_text)
-                        sys.stdout.flush()
-
-                        # Bot mode: buffer and check for @bot messages
-                        if bot_mode:
-                            line_buffer += text
-                            # Process complete lines
-                            while '\r' in line_buffer or '\n' in line_buffer:
-                                # Find end of line
-                                idx = -1
-                                for i, c in enumerate(line_buffer):
-                                    if c in '\r\n':
-                                        idx = i
-                                        break
-                                if idx == -1:
-                                    break
-
-                                line = line_buffer[:idx]
-                                # Skip past line ending (CR, LF, or CRLF)
-                                line_buffer = line_buffer[idx+1:]
-                                if line_buffer.startswith('\n'):
-                                    line_buffer = line_buffer[1:]
-
-                                # Check for @bot command
-                                if line.strip().lower().startswith('@bot'):
-                                    response = handle_bot_message(line)
-                                    # Send response after small delay
-                                    time.sleep(0.1)
-                                    response_bytes = (response + '\r\n')
-                                    ser.write(response_bytes.encode('latin-1'))
-                                    # Echo response locally
-                                    sys.stdout.write(f"\r\n[BOT] {response}\r\n")
-                                    sys.stdout.flush()
+                        tx_queue += link.send((response + '\r\n').encode('latin-1'))
+                    screen += f"\r\n[BOT] {response}\r\n".encode('latin-1')
+
+            # Keep the file going on the bulk channel a chunk ahead
+            if bulk_out is not None and mux.on and mux.pending(MUX_BULK) < MUX_FILE_CHUNK:
+                chunk = bulk_out.read(MUX_FILE_CHUNK)
+                mux.write(MUX_BULK, chunk, end=len(chunk) < MUX_FILE_CHUNK)
+                if len(chunk) < MUX_FILE_CHUNK:
+                    bulk_out.close()
+                    bulk_out = None
+                    bulk = None
+                    screen += b"\r\n[file queued on the bulk channel]\r\n"
+
+            # Frames, resends and acknowledgements, behind what is queued already
+            tx_queue += mux.poll(time.monotonic(), len(tx_queue) + ser.out_waiting)
+            if mux.failed:
+                mux.on = False
+                screen += b"\r\n[channels lost: the Mac stopped answering]\r\n"
+
+            # Send as much of the queue as the port will take without blocking
+            if tx_queue:
+                try:
+                    sent = os.write(ser_fd, tx_queue)
+                except BlockingIOError:
+                    sent = 0
+                if recorder and sent:
+                    recorder.record(REC_TO_MAC, tx_queue[:sent])
+                del tx_queue[:sent]
+                tx_total += sent
+
+            if stats:
+                now = time.monotonic()
+                if now - mark_time >= STATS_INTERVAL:
+                    elapsed = now - mark_time
+                    if link.on and (rx_total != rx_mark or tx_total != tx_mark):
+                        # Effective rates, as the text flows before compression
+                        screen += (f"\r\n[rx {(link.plain_in - plain_rx_mark) / elapsed:.0f} B/s, "
+                                   f"tx {(link.plain_out - plain_tx_mark) / elapsed:.0f} B/s "
+                                   f"effective, LZ {link.ratio():.1f}:1]\r\n").encode()
+                    elif mux.on and (rx_total != rx_mark or tx_total != tx_mark):
+                        screen += (f"\r\n[rx {(rx_total - rx_mark) / elapsed:.0f} B/s, "
+                                   f"tx {(tx_total - tx_mark) / elapsed:.0f} B/s, "
+                                   f"resent {mux.retransmits}, bad {mux.bad_frames}]\r\n").encode()
+                    elif rx_total != rx_mark or tx_total != tx_mark:
+                        screen += (f"\r\n[rx {(rx_total - rx_mark) / elapsed:.0f} B/s, "
+                                   f"tx {(tx_total - tx_mark) / elapsed:.0f} B/s]\r\n").encode()
+                    rx_mark, tx_mark, mark_time = rx_total, tx_total, now
+                    plain_rx_mark, plain_tx_mark = link.plain_in, link.plain_out
+
+            # One write per wakeup however many chunks arrived
+            if screen:
+                _write_all(stdout_fd, screen)
+                del screen[:]
+
+            # The transfer has the port to itself, so what is still queued
+            # goes out first
+            if zmodem_start:
+                zmodem_start = False
+                if tx_queue:
+                    ser.write(bytes(tx_queue))
+                    if recorder:
+                        recorder.record(REC_TO_MAC, bytes(tx_queue))
+                    tx_total += len(tx_queue)
+                    del tx_queue[:]
+                port = RecordedPort(ser, recorder) if recorder else ser
+                try:
+                    for path in transfer_receive(port, os.getcwd(), 'zmodem', False):
+                        _write_all(stdout_fd, f"\r\n[Saved {path}]\r\n".encode())
+                except (OSError, TransferError) as e:
+                    _write_all(stdout_fd, f"\r\n[Transfer failed: {e}]\r\n".encode())
+                pending_cr = False
 
     except KeyboardInterrupt:
         pass
     finally:
         # Restore terminal settings
-        termios.tcsetattr(sys.stdin, termios.TCSADRAIN, old_settings)
+        termios.tcsetattr(stdin_fd, termios.TCSADRAIN, old_settings)
+
+        # Leave the Mac talking plain bytes
+        bulk_in.close()
+        if bulk_out is not None:
+            bulk_out.close()
+        end = mux.close() + link.close()
+        if end:
+            ser.timeout = None
+            ser.write(bytes(tx_queue) + end)
+            ser.flush()
         ser.close()
         print("\r\nDisconnected.")
+        if recorder:
+            recorder.close()
+            print(f"Recorded {recorder.chunks} chunks to {record}")
+        if stats:
+            elapsed = max(time.monotonic() - started, 1e-6)
+            print(f"Received {rx_total} bytes ({rx_total / elapsed:.0f} B/s), "
+                  f"sent {tx_total} bytes ({tx_total / elapsed:.0f} B/s) "
+                  f"in {elapsed:.1f} s")
+            if link.wire_in or link.wire_out:
+                print(f"Compressed link: {link.plain_in + link.plain_out} bytes "
+                      f"as {link.wire_in + link.wire_out} on the wire "
+                      f"({link.ratio():.1f}:1)")
+            if mux.retransmits or mux.bad_frames:
+                print(f"Channels: {mux.retransmits} frames resent, "
+                      f"{mux.bad_frames} damaged frames dropped")
 
     return 0
 
 
-def send_file(device, baud, filename):
-    """Send a file to the serial port."""
+def _after_cr(data, pending_cr):
+    """Drop a leading LF that completes a CR+LF split across two reads."""
+    if pending_cr and data[:1] == b'\n':
+        return data[1:]
+    return data
+
+
+def _write_all(fd, data):
+    """Write everything to a blocking descriptor such as the terminal."""
+    view = memoryview(data)
+    while view:
+        view = view[os.write(fd, view):]
+
+
+def send_file(device, baud, filename, offset=0, binary=False, flow='none'):
+    """Stream a file to the serial port in constant memory.
+
+    Text has its line endings made CR+LF a chunk at a time; --binary sends
+    the bytes as they are. Output is paced to the baud rate, or with flow
+    control held while the Mac sends XOFF or drops CTS, so its receive
+    buffer never overflows. offset resumes a send part way through.
+    """
     try:
-        ser = open_serial(device, baud)
-    except Exception as e:
-        print(f"Error opening {device}: {e}")
+        f = open(filename, 'rb')
+    except OSError as e:
+        print(f"Cannot open {filename}: {e}")
         return 1
 
-    try:
-        with open(filename, 'r') as f:
-            content = f.read()
+    with f:
+        total = os.fstat(f.fileno()).st_size
+        if offset < 0:
+            print(f"Offset {offset} is negative")
+            return 1
+        if offset > total:
+            print(f"Offset {offset} is past the end of {filename} ({total} bytes)")
+            return 1
 
-        # Convert newlines to CR+LF
-        content = content.replace('\r\n', '\n')
-        content = content.replace('\r', '\n')
-        content = content.replace('\n', '\r\n')
+        # Resuming between the CR and LF of a line ending: skip the LF
+        pending_cr = False
+        if offset and not binary:
+            f.seek(offset - 1)
+            pending_cr = f.read(1) == b'\r'
+        f.seek(offset)
 
-        ser.write(content.encode('latin-1'))
-        print(f"Sent {len(content)} bytes from {filename}")
+        try:
+            ser = open_serial(device, baud)
+        except Exception as e:
+            print(f"Error opening {device}: {e}")
+            return 1
+        if flow == 'rtscts':
+            ser.rtscts = True
 
-    except FileNotFoundError:
-        print(f"File not found: {filename}")
-        return 1
-    finally:
-        ser.close()
+        pacer = _SendPacer(ser, baud, flow)
+        position = offset       # Source bytes whose output is all written
+        written = 0             # Output bytes of the current chunk written
+        shown = time.monotonic()
+        try:
+            while True:
+                chunk = f.read(FILE_CHUNK)
+                if not chunk:
+                    break
+                data = chunk
+                if not binary:
+                    data = NEWLINES.sub(b'\r\n', _after_cr(chunk, pending_cr))
+                    pending_cr = chunk.endswith(b'\r')
+
+                view = memoryview(data)
+                written = 0
+                while written < len(view):
+                    written += pacer.write(view[written:])
+                    now = time.monotonic()
+                    if now - shown >= PROGRESS_INTERVAL:
+                        done = position + (written if binary else 0)
+                        _progress(filename, done, total, pacer.rate())
+                        shown = now
+                position += len(chunk)
+
+            ser.flush()
+            _progress(filename, position, total, pacer.rate())
+            sys.stderr.write("\n")
+            print(f"Sent {position - offset} bytes from {filename} "
+                  f"({pacer.sent} on the wire) at {pacer.rate():.0f} B/s")
+        except KeyboardInterrupt:
+            # Text chunks are resent whole; their translated length differs
+            if binary:
+                position += written
+            sys.stderr.write("\n")
+            print(f"Stopped at byte {position}; resume with --offset {position}")
+            return 1
+        finally:
+            ser.close()
 
     return 0
 
 
+class _SendPacer:
+    """Write to the port no faster than the far end can take it.
+
+    Without flow control, a token bucket holds output to the baud rate
+    (ten bit times per byte). With XON/XOFF, XOFF from the far end stops
+    output until XON; with RTS/CTS, output waits for CTS.
+    """
+
+    def __init__(self, ser, baud, flow):
+        self.ser = ser
+        self.flow = flow
+        self.byte_rate = baud / 10
+        self.credit = FILE_BURST
+        self.stopped = False
+        self.started = self.last = time.monotonic()
+        self.sent = 0
+
+    def write(self, data):
+        """Write what may be sent now, waiting briefly if nothing may."""
+        if self.flow == 'none':
+            now = time.monotonic()
+            self.credit = min(FILE_BURST, self.credit + (now - self.last) * self.byte_rate)
+            self.last = now
+            want = min(len(data), FILE_BURST)
+            if self.credit < want:
+                time.sleep((want - self.credit) / self.byte_rate)
+                return 0
+            count = self.ser.write(data[:want])
+            self.credit -= count
+        else:
+            if self._held():
+                select.select([self.ser], [], [], FLOW_POLL)
+                return 0
+            count = self.ser.write(data[:FILE_BURST])
+        self.sent += count
+        return count
+
+    def _held(self):
+        """True while the far end has asked us to stop."""
+        if self.flow == 'rtscts':
+            return not self.ser.cts
+        # The last XON or XOFF received decides; other bytes are dropped
+        incoming = self.ser.read(self.ser.in_waiting or 1)
+        if incoming:
+            last_off = incoming.rfind(bytes([XOFF]))
+            last_on = incoming.rfind(bytes([XON]))
+            if last_off != last_on:
+                self.stopped = last_off > last_on
+        return self.stopped
+
+    def rate(self):
+        return self.sent / max(time.monotonic() - self.started, 1e-6)
+
+
 def send_text(device, baud, text):
     """Send text to the serial port."""
     try:
@@ -205,32 +1210,1090 @@ def send_text(device, baud, text):
     return 0
 
 
-def watch_file(filepath):
-    """Watch ser_b.out file for new output (for port B)."""
-    print(f"Watching {filepath} (Ctrl+C to stop)")
-    print("-" * 40)
+def run_echo(device, baud):
+    """Echo every byte straight back - the far end for the Mac's Link Benchmark."""
+    try:
+        ser = open_serial(device, baud)
+    except Exception as e:
+        print(f"Error opening {device}: {e}")
+        return 1
 
+    print(f"Echoing {device} at {baud} baud - start File > Link Benchmark on the Mac")
+    print("Press Ctrl+C to stop")
+
+    total = 0
+    last_total = 0
+    last_time = time.monotonic()
     try:
-        with open(filepath, 'rb') as f:
-            # Seek to end
-            f.seek(0, 2)
+        while True:
+            readable, _, _ = select.select([ser], [], [], 0.5)
+            if readable:
+                data = ser.read(4096)
+                if data:
+                    ser.write(data)
+                    total += len(data)
 
-            while True:
-                line = f.read(256)
-                if line:
-                    text = line.decode('latin-1', errors='replace')
-                    text = text.replace('\r\n', '\n').replace('\r', '\n')
-                    sys.stdout.write(text)
-                    sys.stdout.flush()
-                else:
-                    time.sleep(0.1)
+            now = time.monotonic()
+            if now - last_time >= 1.0:
+                rate = (total - last_total) / (now - last_time)
+                sys.stdout.write(f"\r{total} bytes echoed, {rate:.0f} cps   ")
+                sys.stdout.flush()
+                last_total = total
+                last_time = now
     except KeyboardInterrupt:
-        print("\nStopped.")
+        pass
+    finally:
+        ser.close()
+        print(f"\nEchoed {total} bytes.")
+
+    return 0
+
+
+def watch_file(filepath, timestamps=False, stat_log=None):
+    """Watch ser_b.out file for new output (for port B)."""
+    try:
+        tail = _FileTail(filepath, timestamps)
     except FileNotFoundError:
         print(f"File not found: {filepath}")
         print("Start the emulator first, or check the path.")
         return 1
+    if stat_log:
+        tail.stats = StatLog(stat_log)
+
+    # inotify on the directory sees writes, truncation and re-creation
+    directory = os.path.dirname(os.path.abspath(filepath))
+    notify_fd = _inotify_watch(directory)
+    name = os.fsencode(os.path.basename(filepath))
+
+    print(f"Watching {filepath} (Ctrl+C to stop)"
+          + ("" if notify_fd is not None else " - polling"))
+    print("-" * 40)
+
+    try:
+        while True:
+            if notify_fd is None:
+                time.sleep(WATCH_POLL)
+            else:
+                # A quiet recheck now and then covers any event missed
+                readable, _, _ = select.select([notify_fd], [], [], WATCH_RECHECK)
+                if readable and name not in _inotify_names(os.read(notify_fd, 65536)):
+                    continue
+            tail.update()
+    except KeyboardInterrupt:
+        print("\nStopped.")
+    finally:
+        tail.close()
+        if notify_fd is not None:
+            os.close(notify_fd)
+
+    return 0
+
+
+class _FileTail:
+    """Follow a file that may be truncated or replaced while it is read."""
+
+    def __init__(self, path, timestamps):
+        self.path = path
+        self.timestamps = timestamps
+        self.file = open(path, 'rb', buffering=0)
+        self.identity = self._identity(os.fstat(self.file.fileno()))
+        self.file.seek(0, 2)
+        self.pending_cr = False
+        self.line_start = True
+        self.stats = None
+
+    @staticmethod
+    def _identity(st):
+        return (st.st_dev, st.st_ino)
+
+    def update(self):
+        """Show everything written since the last call."""
+        try:
+            st = os.stat(self.path)
+        except FileNotFoundError:
+            # Removed: show what was written before, then wait for a new one
+            self._read_all()
+            return
+
+        if self._identity(st) != self.identity:
+            self._read_all()
+            self.file.close()
+            self.file = open(self.path, 'rb', buffering=0)
+            self.identity = self._identity(os.fstat(self.file.fileno()))
+            self._notice("recreated")
+        elif st.st_size < self.file.tell():
+            self.file.seek(0)
+            self._notice("truncated")
+        self._read_all()
+
+    def _read_all(self):
+        while True:
+            data = self.file.read(WATCH_READ)
+            if not data:
+                break
+            self._show(data)
+
+    def _show(self, data):
+        text = NEWLINES.sub(b'\n', _after_cr(data, self.pending_cr))
+        self.pending_cr = data.endswith(b'\r')
+        if not text:
+            return
+        text = text.decode('latin-1')
+        if self.stats:
+            self.stats.feed(text)
+
+        # Stamp each line as it starts; one time serves the whole read
+        if self.timestamps:
+            now = time.time()
+            stamp = time.strftime('[%H:%M:%S', time.localtime(now)) + f".{int(now * 1000) % 1000:03d}] "
+            if self.line_start:
+                text = stamp + text
+            self.line_start = text.endswith('\n')
+            text = text.replace('\n', '\n' + stamp)
+            if self.line_start:
+                text = text[:-len(stamp)]
+
+        sys.stdout.write(text)
+        sys.stdout.flush()
+
+    def _notice(self, what):
+        if not self.line_start:
+            sys.stdout.write('\n')
+        sys.stdout.write(f"--- {os.path.basename(self.path)} {what} ---\n")
+        sys.stdout.flush()
+        self.pending_cr = False
+        self.line_start = True
+
+    def close(self):
+        self.file.close()
+        if self.stats:
+            self.stats.close()
+
+
+def parse_stat_line(line):
+    """Fields of a '#stat' line, a section's a/b/c split into three."""
+    fields = {}
+    for item in line[len(STAT_PREFIX):].split():
+        key, _, value = item.partition('=')
+        parts = value.split('/')
+        if len(parts) == len(STAT_SECTION_FIELDS):
+            for name, part in zip(STAT_SECTION_FIELDS, parts):
+                fields[f'{key}_{name}'] = part
+        else:
+            fields[key] = value
+    return fields
+
+
+class StatLog:
+    """Append the Mac's '#stat' lines to a CSV file, one row each."""
+
+    def __init__(self, path):
+        self.file = open(path, 'a', newline='')
+        self.writer = csv.writer(self.file)
+        self.columns = None
+        self.partial = ''
+        self.fresh = self.file.tell() == 0
+
+    def feed(self, text):
+        """Take received text with '\n' line endings."""
+        lines = (self.partial + text).split('\n')
+        self.partial = lines.pop()
+        for line in lines:
+            if line.startswith(STAT_PREFIX):
+                self._row(parse_stat_line(line))
+
+    def _row(self, fields):
+        # The first line fixes the columns; a header only for a new file
+        if self.columns is None:
+            self.columns = list(fields)
+            if self.fresh:
+                self.writer.writerow(['time'] + self.columns)
+        self.writer.writerow([f"{time.time():.3f}"] +
+                             [fields.get(name, '') for name in self.columns])
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+def _inotify_watch(directory):
+    """An inotify descriptor watching directory, or None where there is none."""
+    try:
+        import ctypes
+        import ctypes.util
+        libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+        fd = libc.inotify_init1(os.O_NONBLOCK | os.O_CLOEXEC)
+    except (OSError, AttributeError, TypeError):
+        return None
+    if fd < 0:
+        return None
+    if libc.inotify_add_watch(fd, os.fsencode(directory), INOTIFY_MASK) < 0:
+        os.close(fd)
+        return None
+    return fd
+
+
+def _inotify_names(events):
+    """File names in a buffer of inotify events."""
+    names = set()
+    offset = 0
+    while offset + INOTIFY_EVENT.size <= len(events):
+        _, _, _, length = INOTIFY_EVENT.unpack_from(events, offset)
+        offset += INOTIFY_EVENT.size
+        names.add(events[offset:offset + length].rstrip(b'\0'))
+        offset += length
+    return names
+
+
+# ---------------------------------------------------------------------------
+# Session recording and replay.
+#
+# A recording is REC_MAGIC, the wall-clock start time as a little-endian
+# double, then one record per chunk: direction byte, microseconds since
+# the previous record (uint32), payload length (uint32), payload.
+
+REC_MAGIC = b'SSNDREC1'
+REC_START = struct.Struct('<d')
+REC_HEADER = struct.Struct('<cII')
+REC_TO_MAC = b'T'
+REC_FROM_MAC = b'R'
+REC_MAX_DELTA = 0xFFFFFFFF
+REPLAY_SETTLE = 2.0     # Wait for the Mac's last responses when verifying
+
+
+class SessionRecorder:
+    """Append timestamped chunks in each direction to a recording file."""
+
+    def __init__(self, path):
+        self.file = open(path, 'wb')
+        self.file.write(REC_MAGIC + REC_START.pack(time.time()))
+        self.last = time.monotonic()
+        self.chunks = 0
+
+    def record(self, direction, data):
+        now = time.monotonic()
+        delta = min(int((now - self.last) * 1e6), REC_MAX_DELTA)
+        self.last = now
+        self.file.write(REC_HEADER.pack(direction, delta, len(data)))
+        self.file.write(data)
+        self.chunks += 1
+
+    def close(self):
+        self.file.close()
+
+
+class RecordedPort:
+    """A port whose reads and writes also go into a SessionRecorder.
+
+    Transfers run their own read loop on the port; this keeps their
+    traffic in the recording so a replay drives the same transfer.
+    """
+
+    def __init__(self, ser, recorder):
+        self.ser = ser
+        self.recorder = recorder
+
+    def fileno(self):
+        return self.ser.fileno()
+
+    def read(self, size):
+        data = self.ser.read(size)
+        if data:
+            self.recorder.record(REC_FROM_MAC, data)
+        return data
+
+    def write(self, data):
+        self.ser.write(data)
+        self.recorder.record(REC_TO_MAC, bytes(data))
+
+
+def read_session(path):
+    """Yield (seconds from start, direction, payload) for each recorded chunk."""
+    with open(path, 'rb') as f:
+        if f.read(len(REC_MAGIC)) != REC_MAGIC:
+            raise ValueError(f"{path} is not a session recording")
+        f.read(REC_START.size)
+        elapsed = 0
+        while True:
+            header = f.read(REC_HEADER.size)
+            if len(header) < REC_HEADER.size:
+                return
+            direction, delta, length = REC_HEADER.unpack(header)
+            data = f.read(length)
+            if len(data) < length:
+                return
+            elapsed += delta
+            yield elapsed / 1e6, direction, data
+
+
+def replay_session(device, baud, path, speed=1.0, verify=False):
+    """Send a recording's host-to-Mac chunks to the port with their timing.
+
+    speed scales time (2 is twice as fast); 0 sends everything flat-out.
+    With verify, what the Mac sends back is compared to what it sent in
+    the recording and the first difference is reported.
+    """
+    chunks = []
+    expected = bytearray()
+    try:
+        for at, direction, data in read_session(path):
+            if direction == REC_TO_MAC:
+                chunks.append((at, data))
+            elif verify:
+                expected += data
+    except (OSError, ValueError) as e:
+        print(f"Cannot replay {path}: {e}")
+        return 1
+
+    try:
+        ser = open_serial(device, baud)
+    except Exception as e:
+        print(f"Error opening {device}: {e}")
+        return 1
+
+    ser_fd = ser.fileno()
+    total = sum(len(data) for _, data in chunks)
+    tx_queue = bytearray()
+    next_chunk = 0
+    sent = received = 0
+    mismatch = None
+    started = shown = time.monotonic()
+    settle_until = None
+    try:
+        while True:
+            now = time.monotonic()
+
+            # Chunks whose recorded time has come join the queue
+            while next_chunk < len(chunks) and (
+                    speed == 0 or chunks[next_chunk][0] / speed <= now - started):
+                tx_queue += chunks[next_chunk][1]
+                next_chunk += 1
+
+            if next_chunk == len(chunks) and not tx_queue:
+                if not verify or received >= len(expected) or mismatch is not None:
+                    break
+                if settle_until is None:
+                    settle_until = now + REPLAY_SETTLE
+                elif now >= settle_until:
+                    break
+
+            # Sleep until the port is ready, the next chunk is due or the
+            # responses have had their time
+            timeout = None
+            if not tx_queue:
+                if next_chunk < len(chunks):
+                    timeout = max(0.0, started + chunks[next_chunk][0] / speed - now)
+                elif settle_until is not None:
+                    timeout = max(0.0, settle_until - now)
+            readable, writable, _ = select.select(
+                [ser_fd], [ser_fd] if tx_queue else [], [], timeout)
+
+            if ser_fd in readable:
+                data = ser.read(READ_SIZE)
+                if verify and mismatch is None:
+                    want = expected[received:received + len(data)]
+                    if data != want:
+                        mismatch = received + _first_difference(data, want)
+                received += len(data)
+
+            if ser_fd in writable:
+                try:
+                    count = os.write(ser_fd, tx_queue)
+                except BlockingIOError:
+                    count = 0
+                del tx_queue[:count]
+                sent += count
+                if now - shown >= PROGRESS_INTERVAL:
+                    _progress(path, sent, total)
+                    shown = now
+    except KeyboardInterrupt:
+        sys.stderr.write("\n")
+        print(f"Stopped after {sent} of {total} bytes")
+        return 1
+    finally:
+        ser.close()
+
+    elapsed = max(time.monotonic() - started, 1e-6)
+    _progress(path, sent, total)
+    sys.stderr.write("\n")
+    print(f"Replayed {sent} bytes in {len(chunks)} chunks in {elapsed:.2f} s "
+          f"({sent / elapsed:.0f} B/s)")
+    if verify:
+        if mismatch is not None:
+            print(f"Responses differ from the recording at byte {mismatch}")
+            return 1
+        if received < len(expected):
+            print(f"Responses stopped short: {received} of {len(expected)} bytes")
+            return 1
+        print(f"Responses match the recording ({received} bytes)")
+    return 0
+
+
+def _first_difference(a, b):
+    """Index of the first byte where a and b differ, or the shorter length."""
+    for i, (x, y) in enumerate(zip(a, b)):
+        if x != y:
+            return i
+    return min(len(a), len(b))
+
+
+# ---------------------------------------------------------------------------
+# File transfer: ZMODEM with YMODEM / XMODEM-1K fallback.
+# Wire-compatible with transfer.c in the Mac application and with lrzsz.
+
+SOH, STX, EOT, ACK, BS, NAK, CAN, SUB = 0x01, 0x02, 0x04, 0x06, 0x08, 0x15, 0x18, 0x1A
+XON, XOFF = 0x11, 0x13
+ZDLE = 0x18
+
+ZRQINIT, ZRINIT, ZSINIT, ZACK, ZFILE, ZSKIP, ZNAK, ZABORT = range(8)
+ZFIN, ZRPOS, ZDATA, ZEOF, ZFERR = 8, 9, 10, 11, 12
+
+ZCRCE, ZCRCG, ZCRCQ, ZCRCW = ord('h'), ord('i'), ord('j'), ord('k')
+ZRUB0, ZRUB1 = ord('l'), ord('m')
+
+CANFDX, CANOVIO, CANFC32 = 0x01, 0x02, 0x20
+ZCBIN = 1
+
+XFER_BLOCK = 1024
+XFER_RETRY = 3.0        # Resend an init or header
+XFER_DATA_TIMEOUT = 10.0
+XFER_MAX_RETRIES = 10
+XFER_FALLBACK_TRIES = 3  # ZRINITs before trying YMODEM
+
+ZRQINIT_START = b'**\x18B00'
+
+_ESCAPED = {ZDLE, 0x10, XON, XOFF, 0x90, 0x91, 0x93, 0x98}
+
+
+class ZModemWatch:
+    """Spot a ZMODEM sender's ZRQINIT in the received stream.
+
+    The start may be split across reads, so the tail of each read is kept
+    to look at with the next one.
+    """
+
+    def __init__(self):
+        self.recent = b''
+
+    def feed(self, data):
+        """Return the bytes ahead of a ZRQINIT, and whether one has started."""
+        start = (self.recent + data).find(ZRQINIT_START)
+        if start < 0:
+            self.recent = (self.recent + data)[-len(ZRQINIT_START):]
+            return data, False
+        before = data[:max(0, start - len(self.recent))]
+        self.recent = b''
+        return before, True
+
+
+class TransferError(Exception):
+    pass
+
+
+def crc16(data, crc=0):
+    return binascii.crc_hqx(data, crc)
 
+
+def crc32(data, crc=0):
+    return zlib.crc32(data, crc) & 0xFFFFFFFF
+
+
+def zdle_escape(data):
+    out = bytearray()
+    last = 0
+    for c in data:
+        if c in _ESCAPED or (c in (0x0D, 0x8D) and (last & 0x7F) == 0x40):
+            out.append(ZDLE)
+            c ^= 0x40
+        out.append(c)
+        last = c
+    return bytes(out)
+
+
+def position_bytes(position):
+    return struct.pack('<I', position & 0xFFFFFFFF)
+
+
+class Link:
+    """Byte-at-a-time reads with timeouts on top of a non-blocking port."""
+
+    def __init__(self, ser):
+        self.ser = ser
+        self.buf = bytearray()
+        self.cans = 0
+
+    def write(self, data):
+        self.ser.write(data)
+
+    def fill(self, timeout):
+        if not self.buf:
+            readable, _, _ = select.select([self.ser], [], [], timeout)
+            if readable:
+                self.buf += self.ser.read(4096)
+        return bool(self.buf)
+
+    def read_byte(self, timeout):
+        """Next byte, or None on timeout; five CANs in a row abort."""
+        deadline = time.monotonic() + timeout
+        while not self.buf:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or not self.fill(remaining):
+                if time.monotonic() >= deadline:
+                    return None
+        c = self.buf.pop(0)
+        self.cans = self.cans + 1 if c == CAN else 0
+        if self.cans >= 5:
+            raise TransferError('Cancelled by remote')
+        return c
+
+    def pending(self):
+        """True when input is waiting; never blocks."""
+        return self.fill(0)
+
+    def cancel(self):
+        self.write(bytes([CAN] * 8 + [BS] * 10))
+
+
+class ZModem:
+    """ZMODEM headers and subpackets over a Link."""
+
+    def __init__(self, link):
+        self.link = link
+        self.use_crc32 = False
+        self.fmt = ord('B')
+
+    def hex_header(self, ftype, p=b'\0\0\0\0'):
+        header = bytes([ftype]) + p
+        frame = b'**\x18B' + (header + struct.pack('>H', crc16(header))).hex().encode()
+        frame += b'\r\x8a'
+        if ftype not in (ZFIN, ZACK):
+            frame += bytes([XON])
+        self.link.write(frame)
+
+    def binary_header(self, ftype, p=b'\0\0\0\0'):
+        header = bytes([ftype]) + p
+        if self.use_crc32:
+            frame = b'*\x18C' + zdle_escape(header + struct.pack('<I', crc32(header)))
+        else:
+            frame = b'*\x18A' + zdle_escape(header + struct.pack('>H', crc16(header)))
+        self.link.write(frame)
+
+    def subpacket(self, data, end):
+        if self.use_crc32:
+            crc = struct.pack('<I', crc32(bytes([end]), crc32(data)))
+        else:
+            crc = struct.pack('>H', crc16(bytes([end]), crc16(data)))
+        frame = zdle_escape(data) + bytes([ZDLE, end]) + zdle_escape(crc)
+        if end == ZCRCW:
+            frame += bytes([XON])
+        return frame
+
+    def _unescaped(self, timeout):
+        """Next decoded byte, 0x100 + terminator, or None on timeout."""
+        while True:
+            c = self.link.read_byte(timeout)
+            if c is None:
+                return None
+            if c == ZDLE:
+                c = self.link.read_byte(timeout)
+                if c is None:
+                    return None
+                if c in (ZCRCE, ZCRCG, ZCRCQ, ZCRCW):
+                    return 0x100 + c
+                if c == ZRUB0:
+                    return 0x7F
+                if c == ZRUB1:
+                    return 0xFF
+                return c ^ 0x40
+            if c & 0x7F in (XON, XOFF):
+                continue
+            return c
+
+    def read_header(self, timeout, watch=None):
+        """(type, p) of the next valid header, None on timeout, or
+        'C'/NAK when a byte in watch arrives outside a frame."""
+        deadline = time.monotonic() + timeout
+        state = 0
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            c = self.link.read_byte(remaining)
+            if c is None:
+                return None
+            if state == 0:
+                if c == ord('*'):
+                    state = 1
+                elif watch and c in watch:
+                    return c
+            elif state == 1:
+                state = 2 if c == ZDLE else (1 if c == ord('*') else 0)
+            else:
+                state = 0
+                header = self._header_body(c, remaining)
+                if header is not None:
+                    return header
+
+    def _header_body(self, fmt, timeout):
+        if fmt == ord('B'):
+            digits = bytearray()
+            while len(digits) < 14:
+                c = self.link.read_byte(timeout)
+                if c is None or chr(c) not in '0123456789abcdef':
+                    return None
+                digits.append(c)
+            raw = bytes.fromhex(digits.decode())
+            if crc16(raw[:5]) != struct.unpack('>H', raw[5:7])[0]:
+                return None
+        elif fmt in (ord('A'), ord('C')):
+            raw = bytearray()
+            for _ in range(9 if fmt == ord('C') else 7):
+                c = self._unescaped(timeout)
+                if c is None or c > 0xFF:
+                    return None
+                raw.append(c)
+            raw = bytes(raw)
+            if fmt == ord('C'):
+                if crc32(raw[:5]) != struct.unpack('<I', raw[5:9])[0]:
+                    return None
+            elif crc16(raw[:5]) != struct.unpack('>H', raw[5:7])[0]:
+                return None
+        else:
+            return None
+        self.fmt = fmt
+        return raw[0], raw[1:5]
+
+    def read_subpacket(self, timeout):
+        """(data, terminator) or None on timeout or a bad CRC."""
+        data = bytearray()
+        while True:
+            c = self._unescaped(timeout)
+            if c is None:
+                return None
+            if c > 0xFF:
+                end = c - 0x100
+                break
+            data.append(c)
+            if len(data) > 8192:
+                return None
+        crc = bytearray()
+        for _ in range(4 if self.fmt == ord('C') else 2):
+            c = self._unescaped(timeout)
+            if c is None or c > 0xFF:
+                return None
+            crc.append(c)
+        if self.fmt == ord('C'):
+            good = crc32(bytes([end]), crc32(data)) == struct.unpack('<I', crc)[0]
+        else:
+            good = crc16(bytes([end]), crc16(data)) == struct.unpack('>H', crc)[0]
+        return (bytes(data), end) if good else None
+
+
+def _progress(name, done, total, rate=None):
+    if total and total > 0:
+        line = f"\r{name}: {done}/{total} bytes ({100 * done // total}%)"
+    else:
+        line = f"\r{name}: {done} bytes"
+    if rate is not None:
+        line += f", {rate:.0f} B/s"
+    sys.stderr.write(line)
+    sys.stderr.flush()
+
+
+def _file_info(path):
+    name = os.path.basename(path)
+    size = os.path.getsize(path)
+    return name, size, f"{name}\0{size} {int(os.path.getmtime(path)):o}\0".encode('latin-1')
+
+
+def zmodem_send(link, path):
+    """Stream one file with ZMODEM; drops to YMODEM if the receiver asks for it."""
+    zm = ZModem(link)
+    name, size, info = _file_info(path)
+    link.write(b'rz\r')
+    zm.hex_header(ZRQINIT)
+
+    for _ in range(XFER_MAX_RETRIES):
+        reply = zm.read_header(XFER_RETRY, watch=(ord('C'),))
+        if reply == ord('C'):
+            return ymodem_send(link, path, started=True)
+        if reply and reply[0] == ZRINIT:
+            zm.use_crc32 = bool(reply[1][3] & CANFC32)
+            break
+        zm.hex_header(ZRQINIT)
+    else:
+        raise TransferError('No ZRINIT from receiver')
+
+    with open(path, 'rb') as f:
+        position = None
+        for _ in range(XFER_MAX_RETRIES):
+            zm.binary_header(ZFILE, bytes([0, 0, 0, ZCBIN]))
+            link.write(zm.subpacket(info, ZCRCW))
+            reply = zm.read_header(XFER_DATA_TIMEOUT)
+            if reply and reply[0] == ZRPOS:
+                position = struct.unpack('<I', reply[1])[0]
+                break
+            if reply and reply[0] == ZSKIP:
+                position = size
+                break
+        if position is None:
+            raise TransferError('No ZRPOS from receiver')
+
+        skipped = reply[0] == ZSKIP
+        last_rpos, retries = position, 0
+        while not skipped:
+            f.seek(position)
+            zm.binary_header(ZDATA, position_bytes(position))
+            restart = None
+            while True:
+                chunk = f.read(XFER_BLOCK)
+                end = ZCRCE if position + len(chunk) >= size else ZCRCG
+                link.write(zm.subpacket(chunk, end))
+                position += len(chunk)
+                _progress(name, position, size)
+                if link.pending():
+                    reply = zm.read_header(0.1)
+                    if reply and reply[0] == ZRPOS:
+                        restart = struct.unpack('<I', reply[1])[0]
+                        break
+                if end == ZCRCE:
+                    break
+            if restart is None:
+                zm.binary_header(ZEOF, position_bytes(position))
+                reply = zm.read_header(XFER_DATA_TIMEOUT)
+                if reply and reply[0] in (ZRINIT, ZSKIP):
+                    break
+                restart = struct.unpack('<I', reply[1])[0] if reply and reply[0] == ZRPOS else position
+            retries = retries + 1 if restart == last_rpos else 0
+            if retries > XFER_MAX_RETRIES:
+                raise TransferError('Too many errors')
+            position = last_rpos = restart
+
+    for _ in range(3):
+        zm.hex_header(ZFIN)
+        reply = zm.read_header(XFER_RETRY)
+        if reply and reply[0] == ZFIN:
+            break
+    link.write(b'OO')
+    sys.stderr.write('\n')
+    return name
+
+
+def _safe_name(directory, name):
+    name = os.path.basename(name.replace('\\', '/')) or 'received.bin'
+    path = os.path.join(directory, name)
+    base, ext = os.path.splitext(path)
+    n = 1
+    while os.path.exists(path):
+        path = f"{base}.{n}{ext}"
+        n += 1
+    return path
+
+
+def _parse_info(info):
+    fields = info.split(b'\0')
+    name = fields[0].decode('latin-1')
+    size = None
+    if len(fields) > 1 and fields[1][:1].isdigit():
+        size = int(fields[1].split(b' ')[0])
+    return name, size
+
+
+def zmodem_receive(link, directory, fallback=True):
+    """Receive a ZMODEM batch into directory; returns the saved paths."""
+    zm = ZModem(link)
+    saved = []
+    seen_header = False
+    tries = 0
+    zrinit = bytes([0, 0, 0, CANFDX | CANOVIO | CANFC32])
+    zm.hex_header(ZRINIT, zrinit)
+
+    while True:
+        reply = zm.read_header(XFER_RETRY)
+        if reply is None:
+            tries += 1
+            if fallback and not seen_header and tries >= XFER_FALLBACK_TRIES:
+                return ymodem_receive(link, directory)
+            if tries > XFER_MAX_RETRIES:
+                raise TransferError('Timed out')
+            zm.hex_header(ZRINIT, zrinit)
+            continue
+        seen_header = True
+        ftype = reply[0]
+        if ftype == ZRQINIT:
+            zm.hex_header(ZRINIT, zrinit)
+        elif ftype == ZSINIT:
+            if zm.read_subpacket(XFER_DATA_TIMEOUT):
+                zm.hex_header(ZACK)
+        elif ftype == ZFIN:
+            zm.hex_header(ZFIN)
+            deadline = time.monotonic() + 1.0
+            got = 0
+            while got < 2 and time.monotonic() < deadline:
+                if link.read_byte(deadline - time.monotonic()) == ord('O'):
+                    got += 1
+            sys.stderr.write('\n')
+            return saved
+        elif ftype == ZFILE:
+            packet = zm.read_subpacket(XFER_DATA_TIMEOUT)
+            if packet is None:
+                zm.hex_header(ZNAK)
+                continue
+            name, size = _parse_info(packet[0])
+            path = _safe_name(directory, name)
+            _zmodem_receive_file(zm, path, size)
+            saved.append(path)
+            tries = 0
+            zm.hex_header(ZRINIT, zrinit)
+
+
+def _zmodem_receive_file(zm, path, size):
+    name = os.path.basename(path)
+    position = 0
+    retries = 0
+    with open(path, 'wb') as f:
+        zm.hex_header(ZRPOS, position_bytes(position))
+        while True:
+            reply = zm.read_header(XFER_DATA_TIMEOUT)
+            if reply is None or reply[0] == ZFILE:
+                retries += 1
+                if retries > XFER_MAX_RETRIES:
+                    raise TransferError('Timed out')
+                zm.hex_header(ZRPOS, position_bytes(position))
+                continue
+            ftype, p = reply
+            offset = struct.unpack('<I', p)[0]
+            if ftype == ZEOF and offset == position:
+                return
+            if ftype in (ZABORT, ZFERR):
+                raise TransferError('Sender aborted')
+            if ftype != ZDATA:
+                continue
+            if offset != position:
+                zm.hex_header(ZRPOS, position_bytes(position))
+                continue
+            while True:
+                packet = zm.read_subpacket(XFER_DATA_TIMEOUT)
+                if packet is None:
+                    retries += 1
+                    if retries > XFER_MAX_RETRIES:
+                        raise TransferError('Too many errors')
+                    zm.hex_header(ZRPOS, position_bytes(position))
+                    break
+                data, end = packet
+                f.write(data)
+                position += len(data)
+                retries = 0
+                _progress(name, position, size)
+                if end in (ZCRCW, ZCRCQ):
+                    zm.hex_header(ZACK, position_bytes(position))
+                if end in (ZCRCE, ZCRCW):
+                    break
+
+
+def _block(number, data, size, pad):
+    data = data.ljust(size, bytes([pad]))
+    head = bytes([SOH if size == 128 else STX, number & 0xFF, 0xFF - (number & 0xFF)])
+    return head + data + struct.pack('>H', crc16(data))
+
+
+def _await(link, wanted, timeout):
+    deadline = time.monotonic() + timeout
+    while True:
+        c = link.read_byte(max(0.0, deadline - time.monotonic()))
+        if c is None or c in wanted:
+            return c
+        if c == CAN and link.read_byte(1.0) == CAN:
+            raise TransferError('Cancelled by remote')
+
+
+def _send_block(link, block, wanted=(ACK,)):
+    for _ in range(XFER_MAX_RETRIES):
+        link.write(block)
+        reply = _await(link, wanted + (NAK, ord('C')), XFER_DATA_TIMEOUT)
+        if reply in wanted:
+            return
+    raise TransferError('Too many errors')
+
+
+def ymodem_send(link, path, xmodem=False, started=False):
+    """YMODEM batch (or XMODEM-1K) with CRC-16; started means 'C' already seen."""
+    name, size, info = _file_info(path)
+    if not started and _await(link, (ord('C'),), 60.0) is None:
+        raise TransferError("Receiver never sent 'C'")
+    if not xmodem:
+        _send_block(link, _block(0, info, 128, 0))
+        if _await(link, (ord('C'),), XFER_DATA_TIMEOUT) is None:
+            raise TransferError("Receiver never sent 'C'")
+    number, position = 1, 0
+    with open(path, 'rb') as f:
+        while position < size:
+            chunk = f.read(XFER_BLOCK)
+            _send_block(link, _block(number, chunk, XFER_BLOCK if len(chunk) > 128 else 128, SUB))
+            number += 1
+            position += len(chunk)
+            _progress(name, position, size)
+    _send_block(link, bytes([EOT]))
+    if not xmodem:
+        _await(link, (ord('C'),), XFER_DATA_TIMEOUT)
+        _send_block(link, _block(0, b'', 128, 0))
+    sys.stderr.write('\n')
+    return name
+
+
+def _read_block(link, timeout):
+    """(number, data), EOT, or None on timeout or a damaged block."""
+    c = _await(link, (SOH, STX, EOT), timeout)
+    if c is None or c == EOT:
+        return c
+    size = 128 if c == SOH else XFER_BLOCK
+    body = bytearray()
+    while len(body) < size + 4:
+        c = link.read_byte(1.0)
+        if c is None:
+            return None
+        body.append(c)
+    number, inverse, data = body[0], body[1], bytes(body[2:size + 2])
+    if number != 0xFF - inverse or crc16(data) != struct.unpack('>H', body[size + 2:])[0]:
+        return None
+    return number, data
+
+
+def ymodem_receive(link, directory, xmodem=False):
+    """Receive a YMODEM batch, or one XMODEM-1K file, into directory."""
+    saved = []
+    while True:
+        for _ in range(XFER_MAX_RETRIES):
+            link.write(b'C')
+            block = _read_block(link, XFER_RETRY)
+            if block is not None and (block != EOT or xmodem):
+                break
+        else:
+            raise TransferError('Timed out')
+        if block == EOT:
+            # An empty XMODEM file is nothing but EOT
+            link.write(bytes([ACK]))
+            path = _safe_name(directory, 'received.bin')
+            open(path, 'wb').close()
+            sys.stderr.write('\n')
+            return [path]
+        number, data = block
+        if number == 0 and not xmodem:
+            if data[0] == 0:
+                link.write(bytes([ACK]))
+                sys.stderr.write('\n')
+                return saved
+            name, size = _parse_info(data)
+            link.write(bytes([ACK, ord('C')]))
+            block = None
+        else:
+            name, size = 'received.bin', None
+        path = _safe_name(directory, name)
+        _ymodem_receive_file(link, path, size, block)
+        saved.append(path)
+        if xmodem or number != 0:
+            sys.stderr.write('\n')
+            return saved
+
+
+def _ymodem_receive_file(link, path, size, first):
+    expected, position, eots, retries = 1, 0, 0, 0
+    with open(path, 'wb') as f:
+        block = first
+        while True:
+            if block is None:
+                block = _read_block(link, XFER_DATA_TIMEOUT)
+            if block is None:
+                retries += 1
+                if retries > XFER_MAX_RETRIES:
+                    raise TransferError('Too many errors')
+                link.write(bytes([NAK]))
+            elif block == EOT:
+                eots += 1
+                if eots == 1:
+                    link.write(bytes([NAK]))
+                else:
+                    link.write(bytes([ACK]))
+                    return
+            else:
+                number, data = block
+                if number == (expected - 1) & 0xFF:
+                    link.write(bytes([ACK]))
+                    if number == 0:
+                        link.write(b'C')
+                elif number != expected & 0xFF:
+                    link.cancel()
+                    raise TransferError('Lost block sync')
+                else:
+                    if size is not None:
+                        data = data[:max(0, size - position)]
+                    f.write(data)
+                    position += len(data)
+                    expected += 1
+                    retries = 0
+                    link.write(bytes([ACK]))
+                    _progress(os.path.basename(path), position, size)
+            block = None
+
+
+def transfer_send(ser, path, protocol):
+    link = Link(ser)
+    try:
+        if protocol == 'zmodem':
+            zmodem_send(link, path)
+        else:
+            ymodem_send(link, path, xmodem=(protocol == 'xmodem1k'))
+    except TransferError:
+        link.cancel()
+        raise
+
+
+def transfer_receive(ser, directory, protocol, fallback=True):
+    link = Link(ser)
+    try:
+        if protocol == 'zmodem':
+            return zmodem_receive(link, directory, fallback)
+        return ymodem_receive(link, directory, xmodem=(protocol == 'xmodem1k'))
+    except TransferError:
+        link.cancel()
+        raise
+
+
+def transfer_file(device, baud, path, protocol):
+    """Send one file with ZMODEM, YMODEM or XMODEM-1K."""
+    try:
+        ser = open_serial(device, baud)
+    except Exception as e:
+        print(f"Error opening {device}: {e}")
+        return 1
+
+    try:
+        transfer_send(ser, path, protocol)
+        print(f"Sent {path} with {protocol}")
+    except (OSError, TransferError) as e:
+        print(f"\nTransfer failed: {e}")
+        return 1
+    finally:
+        ser.close()
+    return 0
+
+
+def receive_files(device, baud, directory, protocol):
+    """Wait for a sender and save what it sends into directory."""
+    try:
+        ser = open_serial(device, baud)
+    except Exception as e:
+        print(f"Error opening {device}: {e}")
+        return 1
+
+    try:
+        for path in transfer_receive(ser, directory, protocol):
+            print(f"Received {path}")
+    except (OSError, TransferError) as e:
+        print(f"\nTransfer failed: {e}")
+        return 1
+    finally:
+        ser.close()
     return 0
 
 
@@ -242,10 +2305,29 @@ def main():
 Examples:
   %(prog)s                    Interactive terminal on /dev/tnt0
   %(prog)s --bot              Enable bot mode (respond to @bot messages)
+  %(prog)s --stats            Show bytes/sec in each direction
+  %(prog)s --no-compress      Refuse the Mac's File > Compress Link
+  %(prog)s --bulk photo.bin   Send a file on the bulk channel once the Mac
+                              turns on File > Channels
   %(prog)s -d /dev/ttyUSB0    Use different serial device
   %(prog)s -s "Hello World"   Send text and exit
   %(prog)s -f script.txt      Send file contents
+  %(prog)s -f rom.bin --binary --offset 65536
+                              Resume a binary send 64 KB in
+  %(prog)s -f log.txt --flow xonxoff
+                              Send as fast as XON/XOFF allows
   %(prog)s -w                 Watch ser_b.out file (port B output)
+  %(prog)s -w --timestamps    The same with the time on each line
+  %(prog)s -w --stat-log stats.csv
+                              Also collect the Mac's statistics lines as CSV
+  %(prog)s --zsend photo.bin  Send a file with ZMODEM
+  %(prog)s --receive incoming Receive files into a directory
+  %(prog)s --zsend a.txt --protocol ymodem
+                              Send with YMODEM instead
+  %(prog)s --echo             Echo everything back for the Mac's Link Benchmark
+  %(prog)s --record s.rec     Record an interactive session
+  %(prog)s --replay s.rec --speed 0 --verify
+                              Replay it flat-out and check the Mac's answers
 
 Bot commands (when --bot enabled):
   @bot hello                  Get a greeting
@@ -264,10 +2346,47 @@ Bot commands (when --bot enabled):
                         help='Send text and exit')
     parser.add_argument('-f', '--file', metavar='FILE',
                         help='Send file contents and exit')
+    parser.add_argument('--offset', type=int, default=0, metavar='N',
+                        help='With -f, start N bytes into the file (resume)')
+    parser.add_argument('--binary', action='store_true',
+                        help='With -f, send bytes without line ending translation')
+    parser.add_argument('--flow', default='none',
+                        choices=['none', 'xonxoff', 'rtscts'],
+                        help='With -f, pace by flow control instead of baud rate')
     parser.add_argument('-w', '--watch', action='store_true',
                         help='Watch ser_b.out file instead of using tty')
+    parser.add_argument('--timestamps', action='store_true',
+                        help='With -w, start each line with the time it arrived')
+    parser.add_argument('--stat-log', metavar='FILE',
+                        help="With -w, append the Mac's #stat lines to FILE as CSV")
     parser.add_argument('--bot', action='store_true',
                         help='Enable bot mode - respond to @bot messages')
+    parser.add_argument('--stats', action='store_true',
+                        help='Print bytes/sec in each direction once a second')
+    parser.add_argument('--no-compress', action='store_true',
+                        help="Keep the link plain even if the Mac asks to compress")
+    parser.add_argument('--no-channels', action='store_true',
+                        help="Keep the link plain even if the Mac asks for channels")
+    parser.add_argument('--bulk', metavar='FILE',
+                        help='Send FILE on the bulk channel once channels are on')
+    parser.add_argument('--record', metavar='FILE',
+                        help='Record the interactive session to FILE')
+    parser.add_argument('--replay', metavar='FILE',
+                        help='Send a recorded session to the port and exit')
+    parser.add_argument('--speed', type=float, default=1.0, metavar='N',
+                        help='With --replay, run N times as fast; 0 for flat-out')
+    parser.add_argument('--verify', action='store_true',
+                        help="With --replay, check the Mac's responses against the recording")
+    parser.add_argument('--echo', action='store_true',
+                        help='Echo received bytes back (Link Benchmark far end)')
+    parser.add_argument('--zsend', metavar='FILE',
+                        help='Send a file with an error-checked protocol')
+    parser.add_argument('--receive', metavar='DIR', nargs='?', const='.',
+                        help='Receive files into DIR (default: current directory)')
+    parser.add_argument('--protocol', default='zmodem',
+                        choices=['zmodem', 'ymodem', 'xmodem1k'],
+                        help='Transfer protocol (default: zmodem, which '
+                             'falls back to YMODEM)')
     parser.add_argument(
         '--watch-file',
         default=os.path.expanduser('~/Retro68-build/ser_b.out'),
@@ -285,13 +2404,26 @@ Bot commands (when --bot enabled):
             return 1
 
     if args.watch:
-        return watch_file(args.watch_file)
+        return watch_file(args.watch_file, timestamps=args.timestamps,
+                          stat_log=args.stat_log)
     elif args.send:
         return send_text(args.device, args.baud, args.send)
     elif args.file:
-        return send_file(args.device, args.baud, args.file)
+        return send_file(args.device, args.baud, args.file,
+                         offset=args.offset, binary=args.binary, flow=args.flow)
+    elif args.echo:
+        return run_echo(args.device, args.baud)
+    elif args.replay:
+        return replay_session(args.device, args.baud, args.replay,
+                              speed=args.speed, verify=args.verify)
+    elif args.zsend:
+        return transfer_file(args.device, args.baud, args.zsend, args.protocol)
+    elif args.receive:
+        return receive_files(args.device, args.baud, args.receive, args.protocol)
     else:
-        return run_terminal(args.device, args.baud, bot_mode=args.bot)
+        return run_terminal(args.device, args.baud, bot_mode=args.bot, stats=args.stats,
+                            record=args.record, compress=not args.no_compress,
+                            channels=not args.no_channels, bulk=args.bulk)
 
 
 if __name__ == '__main__':
@@ -0,0 +1,287 @@
+/*
+ * serialcore.c - Portable serial terminal logic
+ *
+ * Everything here works on plain memory: the application owns the port,
+ * the timers and the screen, and calls in with bytes. Nothing allocates,
+ * so the scrollback store's chunks and line index come from the caller.
+ */
+
+#include "serialcore.h"
+
+static void ScrollbackBeginLine(ScrollbackStore *sb);
+
+/*
+ * Open the port through the driver and announce it with the greeting.
+ * Returns 1 when the port is open, 0 when the driver could not open it.
+ */
+int SerialOpen(const SerialDriver *driver, short port, short baud,
+               const char *portName, const char *baudName)
+{
+    char msg[kSerialReadyMax];
+    long count;
+
+    if (driver->open(driver->context, port, baud) != 0) {
+        return 0;
+    }
+
+    count = SerialFormatReady(msg, portName, baudName);
+    driver->write(driver->context, msg, count);
+    return 1;
+}
+
+/*
+ * Build "Serial ready: Modem @ 9600\r\n" in dest, which must hold
+ * kSerialReadyMax bytes. Overlong names are cut short. Returns the length.
+ */
+long SerialFormatReady(char *dest, const char *portName, const char *baudName)
+{
+    const char *prefix = "Serial ready: ";
+    char *out;
+    char *limit;
+
+    out = dest;
+    limit = dest + kSerialReadyMax - 5;     /* Leave room for " @ " and CR+LF */
+
+    while (*prefix) {
+        *out++ = *prefix++;
+    }
+    while (*portName && out < limit) {
+        *out++ = *portName++;
+    }
+    *out++ = ' ';
+    *out++ = '@';
+    *out++ = ' ';
+    limit = dest + kSerialReadyMax - 2;
+    while (*baudName && out < limit) {
+        *out++ = *baudName++;
+    }
+    *out++ = '\r';
+    *out++ = '\n';
+
+    return out - dest;
+}
+
+/*
+ * Translate Mac text for the wire in one pass: each CR becomes CR+LF,
+ * and CR+LF is appended if the text does not already end with a line.
+ * dest must hold length * 2 + 2 bytes. Returns the translated length.
+ */
+long SerialTranslateOutgoing(const char *text, long length, char *dest)
+{
+    const char *end;
+    char *out;
+
+    end = text + length;
+    out = dest;
+
+    while (text < end) {
+        char c = *text++;
+
+        *out++ = c;
+        if (c == '\r') {
+            *out++ = '\n';
+        }
+    }
+
+    if (length > 0 && end[-1] != '\r') {
+        *out++ = '\r';
+        *out++ = '\n';
+    }
+
+    return out - dest;
+}
+
+/*
+ * Translate received line endings to Mac CRs in place: CR+LF and a lone
+ * LF both become CR. *lastWasCR carries a CR that ended the previous
+ * batch, so a CR+LF split across batches still yields one line break.
+ * Returns the new length.
+ */
+long SerialTranslateIncoming(char *buffer, long count, int *lastWasCR)
+{
+    char *src;
+    char *dst;
+    char *end;
+    int wasCR;
+
+    src = buffer;
+    dst = buffer;
+    end = buffer + count;
+    wasCR = *lastWasCR;
+
+    while (src < end) {
+        char c = *src++;
+
+        if (c == '\n') {
+            if (wasCR) {
+                /* Second half of CR+LF - already emitted */
+                wasCR = 0;
+                continue;
+            }
+            c = '\r';
+        } else {
+            wasCR = (c == '\r');
+        }
+        *dst++ = c;
+    }
+
+    *lastWasCR = wasCR;
+    return dst - buffer;
+}
+
+/*
+ * Discard all stored text
+ */
+void ScrollbackClear(ScrollbackStore *sb)
+{
+    sb->writePos = 0;
+    sb->writePtr = sb->chunks[0];
+    sb->firstLine = 0;
+    sb->lineCount = 0;
+    sb->lineOpen = 0;
+    sb->topLine = 0;
+    sb->followTail = 1;
+    sb->dirty = 1;
+    sb->dirtyLine = 0;
+}
+
+/*
+ * Start a new line at the write position.
+ * A line never crosses a chunk, so skip to the next chunk when a full-width
+ * line would not fit. Lines whose text the new one may overwrite, or whose
+ * index slot it needs, are dropped from the head - constant cost per line.
+ */
+static void ScrollbackBeginLine(ScrollbackStore *sb)
+{
+    unsigned long pos;
+    unsigned long offset;
+    unsigned long reuseLimit;
+    unsigned long line;
+
+    pos = sb->writePos;
+    offset = pos & kScrollbackChunkMask;
+    if (offset + sb->columns > kScrollbackChunkSize) {
+        pos += kScrollbackChunkSize - offset;
+        offset = 0;
+    }
+
+    /* Bytes before reuseLimit are overwritten by the ring wrapping */
+    reuseLimit = pos + sb->columns - sb->capacity;
+    while (sb->lineCount > 0 &&
+           (sb->lineCount >= kScrollbackLines ||
+            (long)(sb->lineStart[sb->firstLine & kScrollbackLineMask] - reuseLimit) < 0)) {
+        sb->firstLine++;
+        sb->lineCount--;
+    }
+
+    line = (sb->firstLine + sb->lineCount) & kScrollbackLineMask;
+    sb->lineStart[line] = pos;
+    sb->lineLength[line] = 0;
+    sb->lineCount++;
+    sb->lineOpen = 1;
+
+    sb->writePos = pos;
+    sb->writePtr = sb->chunks[(pos >> kScrollbackChunkShift) % sb->chunkCount] + offset;
+}
+
+/*
+ * Append text whose line endings are already CRs
+ */
+void ScrollbackAppend(ScrollbackStore *sb, const char *text, long count)
+{
+    unsigned char *length;
+    const char *end;
+    long run;
+    long copied;
+    char c;
+
+    end = text + count;
+
+    /* Only the open line and lines after it can change */
+    if (!sb->dirty) {
+        sb->dirty = 1;
+        sb->dirtyLine = sb->firstLine + sb->lineCount - (sb->lineOpen ? 1 : 0);
+    }
+
+    length = 0;
+    if (sb->lineOpen) {
+        length = &sb->lineLength[(sb->firstLine + sb->lineCount - 1) & kScrollbackLineMask];
+    }
+
+    while (text < end) {
+        c = *text;
+
+        if (c == '\r') {
+            /* An empty line still needs an index entry */
+            if (!sb->lineOpen) {
+                ScrollbackBeginLine(sb);
+            }
+            sb->lineOpen = 0;
+            text++;
+            continue;
+        }
+
+        if (!sb->lineOpen || *length >= sb->columns) {
+            ScrollbackBeginLine(sb);
+            length = &sb->lineLength[(sb->firstLine + sb->lineCount - 1) & kScrollbackLineMask];
+        }
+
+        /* Copy the run of characters that fits on this line */
+        run = sb->columns - *length;
+        if (run > end - text) {
+            run = end - text;
+        }
+        copied = 0;
+        while (copied < run && text[copied] != '\r') {
+            sb->writePtr[copied] = text[copied];
+            copied++;
+        }
+        sb->writePtr += copied;
+        sb->writePos += copied;
+        *length += copied;
+        text += copied;
+    }
+
+    /* Keep the view pinned to the newest text unless the user scrolled up */
+    if (sb->topLine < sb->firstLine) {
+        sb->topLine = sb->firstLine;
+    }
+    if (sb->followTail && sb->lineCount > (unsigned long)sb->rows) {
+        sb->topLine = sb->firstLine + sb->lineCount - sb->rows;
+    }
+}
+
+/*
+ * Address of a retained line's text
+ */
+char *ScrollbackLinePtr(ScrollbackStore *sb, unsigned long line)
+{
+    unsigned long pos;
+
+    pos = sb->lineStart[line & kScrollbackLineMask];
+    return sb->chunks[(pos >> kScrollbackChunkShift) % sb->chunkCount] +
+           (pos & kScrollbackChunkMask);
+}
+
+/*
+ * Watch a received stream for a handshake marker, a C string whose first
+ * byte appears nowhere else in it. *matched carries state across calls.
+ * Returns the offset just past the marker, or -1.
+ */
+long SerialFindMarker(const unsigned char *data, long count, const char *marker,
+                      short *matched)
+{
+    long i;
+
+    for (i = 0; i < count; i++) {
+        if (data[i] == (unsigned char)marker[*matched]) {
+            if (marker[++*matched] == 0) {
+                *matched = 0;
+                return i + 1;
+            }
+        } else {
+            *matched = (data[i] == (unsigned char)marker[0]) ? 1 : 0;
+        }
+    }
+    return -1;
+}
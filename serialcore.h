@@ -0,0 +1,92 @@
+/*
+ * serialcore.h - Portable serial terminal logic
+ *
+ * Line ending translation, the "Serial ready" greeting and the chunked
+ * scrollback store, with no Toolbox calls. The application reaches the
+ * port through a SerialDriver; the host build links the same code
+ * against a memory loopback for the tests and benchmarks.
+ */
+
+#ifndef SERIALCORE_H
+#define SERIALCORE_H
+
+/*
+ * Scrollback store: a ring of fixed-size text chunks plus a ring of line
+ * starts. Lines are wrapped to the receive area width when stored and
+ * never cross a chunk boundary, so each one can be drawn with one call.
+ */
+#define kScrollbackChunkShift   12
+#define kScrollbackChunkSize    (1L << kScrollbackChunkShift)   /* 4 KB */
+#define kScrollbackChunkMask    (kScrollbackChunkSize - 1)
+#define kScrollbackMaxChunks    64                              /* 256 KB */
+#define kScrollbackMinChunks    2
+#define kScrollbackLines        16384                           /* Power of two */
+#define kScrollbackLineMask     (kScrollbackLines - 1)
+#define kScrollbackMaxColumns   255
+
+/* Longest greeting SerialFormatReady() builds */
+#define kSerialReadyMax         64
+
+/* Line error flags reported by a driver's status call */
+#define kSerialOverrun          0x01
+#define kSerialParity           0x02
+#define kSerialFraming          0x04
+
+typedef struct SerialStatus {
+    unsigned long received;         /* Bytes received since open, free-running */
+    long inputWaiting;              /* Bytes that a read would return now */
+    short lineErrors;               /* kSerial* flags since the last status call */
+} SerialStatus;
+
+/* Port access supplied by the application */
+typedef struct SerialDriver {
+    void *context;
+
+    /* Open the port at a baud rate index; returns 0 on success */
+    int (*open)(void *context, short port, short baud);
+
+    /* Bytes already received, never waiting for more; returns the count */
+    long (*read)(void *context, char *data, long maxCount);
+
+    /* Send bytes; returns the count accepted */
+    long (*write)(void *context, const char *data, long count);
+
+    /* Returns 0 on success */
+    int (*status)(void *context, SerialStatus *status);
+} SerialDriver;
+
+/* Received text history with its own line index */
+typedef struct ScrollbackStore {
+    char *chunks[kScrollbackMaxChunks];
+    short chunkCount;
+    unsigned long capacity;         /* chunkCount * kScrollbackChunkSize */
+    unsigned long writePos;         /* Next byte to write, free-running */
+    char *writePtr;                 /* Address of writePos */
+    unsigned long *lineStart;       /* Ring of line start positions */
+    unsigned char *lineLength;      /* Ring of line lengths */
+    unsigned long firstLine;        /* Oldest line still retained */
+    unsigned long lineCount;        /* Retained lines, including an open one */
+    int lineOpen;                   /* Last line still accepts characters */
+    short columns;                  /* Wrap width in characters */
+    short rows;                     /* Height of the view in lines */
+    unsigned long topLine;          /* First line shown in the view */
+    int followTail;                 /* View tracks the newest line */
+    int dirty;                      /* Text changed since the last render */
+    unsigned long dirtyLine;        /* Lowest line changed since the last render */
+} ScrollbackStore;
+
+int SerialOpen(const SerialDriver *driver, short port, short baud,
+               const char *portName, const char *baudName);
+long SerialFormatReady(char *dest, const char *portName, const char *baudName);
+
+long SerialTranslateOutgoing(const char *text, long length, char *dest);
+long SerialTranslateIncoming(char *buffer, long count, int *lastWasCR);
+
+void ScrollbackClear(ScrollbackStore *sb);
+void ScrollbackAppend(ScrollbackStore *sb, const char *text, long count);
+char *ScrollbackLinePtr(ScrollbackStore *sb, unsigned long line);
+
+long SerialFindMarker(const unsigned char *data, long count, const char *marker,
+                      short *matched);
+
+#endif /* SERIALCORE_H */
@@ -0,0 +1,1044 @@
+/*
+ * terminal.c - VT100 subset emulation on a character-cell grid
+ *
+ * The parser is two tables: one sorts each byte into a class, the other
+ * gives the action and next state for every state and class. Runs of
+ * printable bytes in the ground state skip the tables and go onto the
+ * grid a row segment at a time, which is what nearly all traffic is.
+ */
+
+#include <string.h>
+
+#include "terminal.h"
+
+/* Parser states */
+#define kStateGround        0
+#define kStateEscape        1
+#define kStateEscInter      2       /* ESC, then intermediates */
+#define kStateCsiEntry      3
+#define kStateCsiParam      4
+#define kStateCsiInter      5
+#define kStateCsiIgnore     6       /* Malformed; runs to the final byte */
+#define kStateOsc           7       /* Operating system command; swallowed */
+
+/* Byte classes */
+#define kClassControl       0
+#define kClassBell          1
+#define kClassCancel        2       /* CAN, SUB */
+#define kClassEscape        3
+#define kClassInter         4       /* 0x20-0x2F */
+#define kClassDigit         5
+#define kClassSemicolon     6
+#define kClassColon         7
+#define kClassPrivate       8       /* < = > ? */
+#define kClassBracket       9       /* [ */
+#define kClassOsc           10      /* ] */
+#define kClassFinal         11      /* Other 0x40-0x7E */
+#define kClassDelete        12
+#define kClassHigh          13
+#define kClassCount         14
+
+/* Actions, in the high nibble of a transition */
+#define kActNone            0
+#define kActPrint           1
+#define kActExecute         2
+#define kActClear           3       /* Start a new sequence */
+#define kActCollect         4       /* Intermediate or private marker */
+#define kActParam           5
+#define kActEscDispatch     6
+#define kActCsiDispatch     7
+
+#define T(action, state)    (unsigned char)(((action) << 4) | (state))
+
+#define G                   kStateGround
+#define E                   kStateEscape
+#define EI                  kStateEscInter
+#define CE                  kStateCsiEntry
+#define CP                  kStateCsiParam
+#define CI                  kStateCsiInter
+#define CX                  kStateCsiIgnore
+#define O                   kStateOsc
+
+static const unsigned char gTransitions[8][kClassCount] = {
+    /*  Control          Bell             Cancel         Escape
+        Inter            Digit            Semicolon      Colon
+        Private          Bracket          Osc            Final
+        Delete           High */
+
+    /* Ground */
+    {   T(kActExecute, G),  T(kActExecute, G),  T(kActNone, G),     T(kActClear, E),
+        T(kActPrint, G),    T(kActPrint, G),    T(kActPrint, G),    T(kActPrint, G),
+        T(kActPrint, G),    T(kActPrint, G),    T(kActPrint, G),    T(kActPrint, G),
+        T(kActNone, G),     T(kActPrint, G) },
+
+    /* Escape */
+    {   T(kActExecute, E),  T(kActExecute, E),  T(kActNone, G),     T(kActClear, E),
+        T(kActCollect, EI), T(kActEscDispatch, G), T(kActEscDispatch, G), T(kActEscDispatch, G),
+        T(kActEscDispatch, G), T(kActClear, CE), T(kActNone, O),    T(kActEscDispatch, G),
+        T(kActNone, E),     T(kActNone, G) },
+
+    /* Escape intermediate */
+    {   T(kActExecute, EI), T(kActExecute, EI), T(kActNone, G),     T(kActClear, E),
+        T(kActCollect, EI), T(kActEscDispatch, G), T(kActEscDispatch, G), T(kActEscDispatch, G),
+        T(kActEscDispatch, G), T(kActEscDispatch, G), T(kActEscDispatch, G), T(kActEscDispatch, G),
+        T(kActNone, EI),    T(kActNone, G) },
+
+    /* CSI entry */
+    {   T(kActExecute, CE), T(kActExecute, CE), T(kActNone, G),     T(kActClear, E),
+        T(kActCollect, CI), T(kActParam, CP),   T(kActParam, CP),   T(kActNone, CX),
+        T(kActCollect, CP), T(kActCsiDispatch, G), T(kActCsiDispatch, G), T(kActCsiDispatch, G),
+        T(kActNone, CE),    T(kActNone, G) },
+
+    /* CSI parameters */
+    {   T(kActExecute, CP), T(kActExecute, CP), T(kActNone, G),     T(kActClear, E),
+        T(kActCollect, CI), T(kActParam, CP),   T(kActParam, CP),   T(kActNone, CX),
+        T(kActNone, CX),    T(kActCsiDispatch, G), T(kActCsiDispatch, G), T(kActCsiDispatch, G),
+        T(kActNone, CP),    T(kActNone, G) },
+
+    /* CSI intermediate */
+    {   T(kActExecute, CI), T(kActExecute, CI), T(kActNone, G),     T(kActClear, E),
+        T(kActCollect, CI), T(kActNone, CX),    T(kActNone, CX),    T(kActNone, CX),
+        T(kActNone, CX),    T(kActCsiDispatch, G), T(kActCsiDispatch, G), T(kActCsiDispatch, G),
+        T(kActNone, CI),    T(kActNone, G) },
+
+    /* CSI ignore */
+    {   T(kActExecute, CX), T(kActExecute, CX), T(kActNone, G),     T(kActClear, E),
+        T(kActNone, CX),    T(kActNone, CX),    T(kActNone, CX),    T(kActNone, CX),
+        T(kActNone, CX),    T(kActNone, G),     T(kActNone, G),     T(kActNone, G),
+        T(kActNone, CX),    T(kActNone, G) },
+
+    /* OSC: BEL or ESC \ ends it */
+    {   T(kActNone, O),     T(kActNone, G),     T(kActNone, G),     T(kActClear, E),
+        T(kActNone, O),     T(kActNone, O),     T(kActNone, O),     T(kActNone, O),
+        T(kActNone, O),     T(kActNone, O),     T(kActNone, O),     T(kActNone, O),
+        T(kActNone, O),     T(kActNone, O) }
+};
+
+#undef G
+#undef E
+#undef EI
+#undef CE
+#undef CP
+#undef CI
+#undef CX
+#undef O
+
+/* Built on first use from the ranges in TermClassify() */
+static unsigned char gClasses[256];
+static int gClassesReady = 0;
+
+/* DEC special graphics 0x5F-0x7E, drawn with what Monaco has (Mac Roman) */
+static const unsigned char gLineDrawing[32] = {
+    ' ',  0xD7, '#',  'h',  'f',  'c',  'l',  0xA1,     /* _ ` a b c d e f */
+    0xB1, 'n',  'v',  '+',  '+',  '+',  '+',  '+',      /* g h i j k l m n */
+    '-',  '-',  '-',  '-',  '_',  '+',  '+',  '+',      /* o p q r s t u v */
+    '+',  '|',  0xB2, 0xB3, 0xB9, 0xAD, 0xA3, 0xA5      /* w x y z { | } ~ */
+};
+
+static void TermClassify(void);
+static void TermMark(TermScreen *t, short row, short left, short right);
+static void TermMarkRows(TermScreen *t, short first, short last);
+static void TermClearCells(TermScreen *t, short row, short left, short right);
+static void TermPrint(TermScreen *t, const unsigned char *text, long count);
+static void TermIndex(TermScreen *t);
+static void TermReverseIndex(TermScreen *t);
+static void TermScrollUp(TermScreen *t, short top, short bottom, short count, int history);
+static void TermScrollDown(TermScreen *t, short top, short bottom, short count);
+static void TermMoveTo(TermScreen *t, short row, short column);
+static void TermExecute(TermScreen *t, unsigned char c);
+static void TermEscDispatch(TermScreen *t, unsigned char c);
+static void TermCsiDispatch(TermScreen *t, unsigned char c);
+static void TermSetModes(TermScreen *t, int on);
+static void TermSelectGraphics(TermScreen *t);
+static void TermReply(TermScreen *t, const char *text);
+static short TermParam(TermScreen *t, short index, short fallback);
+static char *TermFormatNumber(char *dest, short value);
+
+/*
+ * Start with a blank screen of rows by columns, clamped to the grid
+ */
+void TermInit(TermScreen *t, const TermIO *io, short rows, short columns)
+{
+    TermClassify();
+
+    if (rows > kTermMaxRows) {
+        rows = kTermMaxRows;
+    }
+    if (rows < 2) {
+        rows = 2;
+    }
+    if (columns > kTermMaxColumns) {
+        columns = kTermMaxColumns;
+    }
+    if (columns < 2) {
+        columns = 2;
+    }
+
+    t->io = io;
+    t->rows = rows;
+    t->columns = columns;
+    t->bells = 0;
+    TermReset(t);
+}
+
+/*
+ * Power-on state: blank screen, home cursor, default modes, nothing
+ * half-parsed. The whole screen is left dirty.
+ */
+void TermReset(TermScreen *t)
+{
+    short row;
+
+    t->row = 0;
+    t->column = 0;
+    t->wrapPending = 0;
+    t->attr = 0;
+    t->top = 0;
+    t->bottom = t->rows - 1;
+    t->savedRow = 0;
+    t->savedColumn = 0;
+    t->savedAttr = 0;
+    t->autoWrap = 1;
+    t->newLine = 0;
+    t->cursorVisible = 1;
+    t->lineDrawing = 0;
+
+    t->state = kStateGround;
+    t->paramCount = 0;
+    t->privateMark = 0;
+    t->intermediate = 0;
+
+    for (row = 0; row < t->rows; row++) {
+        memset(t->chars[row], ' ', t->columns);
+        memset(t->attrs[row], 0, t->columns);
+    }
+    t->scrolled = 0;
+    TermMarkRows(t, 0, t->rows - 1);
+}
+
+/*
+ * Run received bytes through the parser onto the grid
+ */
+void TermWrite(TermScreen *t, const unsigned char *data, long count)
+{
+    const unsigned char *end = data + count;
+    const unsigned char *run;
+    unsigned char c;
+    unsigned char next;
+
+    while (data < end) {
+        /* Printable text in the ground state goes straight onto the grid */
+        if (t->state == kStateGround && *data >= 0x20 && *data != 0x7F) {
+            run = data + 1;
+            while (run < end && *run >= 0x20 && *run != 0x7F) {
+                run++;
+            }
+            TermPrint(t, data, run - data);
+            data = run;
+            continue;
+        }
+
+        c = *data++;
+        next = gTransitions[t->state][gClasses[c]];
+        t->state = next & 0x0F;
+
+        switch (next >> 4) {
+            case kActPrint:
+                TermPrint(t, &c, 1);
+                break;
+
+            case kActExecute:
+                TermExecute(t, c);
+                break;
+
+            case kActClear:
+                t->paramCount = 0;
+                t->privateMark = 0;
+                t->intermediate = 0;
+                break;
+
+            case kActCollect:
+                if (c >= 0x3C) {
+                    t->privateMark = c;
+                } else {
+                    t->intermediate = c;
+                }
+                break;
+
+            case kActParam:
+                if (t->paramCount == 0) {
+                    t->params[0] = 0;
+                    t->paramCount = 1;
+                }
+                if (c == ';') {
+                    if (t->paramCount < kTermMaxParams) {
+                        t->params[t->paramCount++] = 0;
+                    }
+                } else if (t->params[t->paramCount - 1] < 1000) {
+                    t->params[t->paramCount - 1] =
+                        t->params[t->paramCount - 1] * 10 + (c - '0');
+                }
+                break;
+
+            case kActEscDispatch:
+                TermEscDispatch(t, c);
+                break;
+
+            case kActCsiDispatch:
+                TermCsiDispatch(t, c);
+                break;
+        }
+    }
+}
+
+/*
+ * Mark one cell for redrawing, as when the cursor leaves it
+ */
+void TermTouch(TermScreen *t, short row, short column)
+{
+    if (row >= 0 && row < t->rows && column >= 0 && column < t->columns) {
+        TermMark(t, row, column, column + 1);
+    }
+}
+
+/*
+ * The renderer has drawn every change: forget them
+ */
+void TermClean(TermScreen *t)
+{
+    short row;
+
+    for (row = 0; row < t->rows; row++) {
+        t->dirtyLeft[row] = t->columns;
+        t->dirtyRight[row] = 0;
+    }
+    t->dirty = 0;
+    t->scrolled = 0;
+}
+
+/*
+ * Characters in a row up to its last non-blank one
+ */
+short TermRowLength(TermScreen *t, short row)
+{
+    short length = t->columns;
+
+    while (length > 0 && t->chars[row][length - 1] == ' ') {
+        length--;
+    }
+    return length;
+}
+
+/*
+ * Fill in the byte class table
+ */
+static void TermClassify(void)
+{
+    short c;
+
+    if (gClassesReady) {
+        return;
+    }
+
+    for (c = 0; c < 256; c++) {
+        if (c < 0x20) {
+            gClasses[c] = kClassControl;
+        } else if (c < 0x30) {
+            gClasses[c] = kClassInter;
+        } else if (c < 0x3A) {
+            gClasses[c] = kClassDigit;
+        } else if (c < 0x40) {
+            gClasses[c] = kClassPrivate;
+        } else if (c < 0x7F) {
+            gClasses[c] = kClassFinal;
+        } else if (c == 0x7F) {
+            gClasses[c] = kClassDelete;
+        } else {
+            gClasses[c] = kClassHigh;
+        }
+    }
+    gClasses[0x07] = kClassBell;
+    gClasses[0x18] = kClassCancel;
+    gClasses[0x1A] = kClassCancel;
+    gClasses[0x1B] = kClassEscape;
+    gClasses[';'] = kClassSemicolon;
+    gClasses[':'] = kClassColon;
+    gClasses['['] = kClassBracket;
+    gClasses[']'] = kClassOsc;
+
+    gClassesReady = 1;
+}
+
+/*
+ * Widen a row's dirty span to cover left..right-1
+ */
+static void TermMark(TermScreen *t, short row, short left, short right)
+{
+    if (left < t->dirtyLeft[row]) {
+        t->dirtyLeft[row] = left;
+    }
+    if (right > t->dirtyRight[row]) {
+        t->dirtyRight[row] = right;
+    }
+    t->dirty = 1;
+}
+
+/*
+ * Mark rows first..last entirely dirty
+ */
+static void TermMarkRows(TermScreen *t, short first, short last)
+{
+    short row;
+
+    for (row = first; row <= last; row++) {
+        t->dirtyLeft[row] = 0;
+        t->dirtyRight[row] = t->columns;
+    }
+    t->dirty = 1;
+}
+
+/*
+ * Blank cells left..right-1 of a row
+ */
+static void TermClearCells(TermScreen *t, short row, short left, short right)
+{
+    if (left < 0) {
+        left = 0;
+    }
+    if (right > t->columns) {
+        right = t->columns;
+    }
+    if (left >= right) {
+        return;
+    }
+
+    memset(t->chars[row] + left, ' ', right - left);
+    memset(t->attrs[row] + left, 0, right - left);
+    TermMark(t, row, left, right);
+}
+
+/*
+ * Put printable bytes at the cursor, a row segment at a time. The
+ * cursor stays on the last column after writing there, with the wrap
+ * held until another character arrives.
+ */
+static void TermPrint(TermScreen *t, const unsigned char *text, long count)
+{
+    unsigned char *dest;
+    short span;
+    short i;
+
+    while (count > 0) {
+        if (t->wrapPending) {
+            t->wrapPending = 0;
+            if (t->autoWrap) {
+                t->column = 0;
+                TermIndex(t);
+            } else {
+                /* Without wrap, only the last byte past the margin shows */
+                text += count - 1;
+                count = 1;
+            }
+        }
+
+        span = t->columns - t->column;
+        if (span > count) {
+            span = (short)count;
+        }
+
+        dest = t->chars[t->row] + t->column;
+        if (t->lineDrawing) {
+            for (i = 0; i < span; i++) {
+                dest[i] = (text[i] >= 0x5F && text[i] <= 0x7E) ?
+                          gLineDrawing[text[i] - 0x5F] : text[i];
+            }
+        } else {
+            memcpy(dest, text, span);
+        }
+        memset(t->attrs[t->row] + t->column, t->attr, span);
+        TermMark(t, t->row, t->column, t->column + span);
+
+        text += span;
+        count -= span;
+        t->column += span;
+        if (t->column >= t->columns) {
+            t->column = t->columns - 1;
+            t->wrapPending = 1;
+        }
+    }
+}
+
+/*
+ * Move down a line, scrolling the region at its bottom margin
+ */
+static void TermIndex(TermScreen *t)
+{
+    if (t->row == t->bottom) {
+        TermScrollUp(t, t->top, t->bottom, 1, 1);
+    } else if (t->row < t->rows - 1) {
+        t->row++;
+    }
+}
+
+/*
+ * Move up a line, scrolling the region at its top margin
+ */
+static void TermReverseIndex(TermScreen *t)
+{
+    if (t->row == t->top) {
+        TermScrollDown(t, t->top, t->bottom, 1);
+    } else if (t->row > 0) {
+        t->row--;
+    }
+}
+
+/*
+ * Move rows top..bottom up by count, blanking the rows opened at the
+ * bottom. When the region is the whole screen the renderer is told how
+ * far, so it can scroll pixels, and with history set the departing
+ * lines go to the application.
+ */
+static void TermScrollUp(TermScreen *t, short top, short bottom, short count, int history)
+{
+    short height = bottom - top + 1;
+    short row;
+
+    if (count > height) {
+        count = height;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    if (top == 0 && bottom == t->rows - 1) {
+        if (history && t->io != NULL && t->io->scrollOff != NULL) {
+            for (row = 0; row < count; row++) {
+                t->io->scrollOff(t->io->context, t->chars[row], TermRowLength(t, row));
+            }
+        }
+
+        /* Pending changes move with the rows they belong to */
+        for (row = 0; row + count < t->rows; row++) {
+            t->dirtyLeft[row] = t->dirtyLeft[row + count];
+            t->dirtyRight[row] = t->dirtyRight[row + count];
+        }
+        for (; row < t->rows; row++) {
+            t->dirtyLeft[row] = t->columns;
+            t->dirtyRight[row] = 0;
+        }
+        t->scrolled += count;
+        if (t->scrolled > t->rows) {
+            t->scrolled = t->rows;
+        }
+    } else {
+        TermMarkRows(t, top, bottom);
+    }
+
+    memmove(t->chars[top], t->chars[top + count],
+            (long)(height - count) * kTermMaxColumns);
+    memmove(t->attrs[top], t->attrs[top + count],
+            (long)(height - count) * kTermMaxColumns);
+    for (row = bottom - count + 1; row <= bottom; row++) {
+        TermClearCells(t, row, 0, t->columns);
+    }
+}
+
+/*
+ * Move rows top..bottom down by count, blanking the rows opened at the top
+ */
+static void TermScrollDown(TermScreen *t, short top, short bottom, short count)
+{
+    short height = bottom - top + 1;
+    short row;
+
+    if (count > height) {
+        count = height;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    memmove(t->chars[top + count], t->chars[top],
+            (long)(height - count) * kTermMaxColumns);
+    memmove(t->attrs[top + count], t->attrs[top],
+            (long)(height - count) * kTermMaxColumns);
+    for (row = top; row < top + count; row++) {
+        memset(t->chars[row], ' ', t->columns);
+        memset(t->attrs[row], 0, t->columns);
+    }
+    TermMarkRows(t, top, bottom);
+}
+
+/*
+ * Put the cursor at row, column, clamped to the screen
+ */
+static void TermMoveTo(TermScreen *t, short row, short column)
+{
+    if (row < 0) {
+        row = 0;
+    }
+    if (row >= t->rows) {
+        row = t->rows - 1;
+    }
+    if (column < 0) {
+        column = 0;
+    }
+    if (column >= t->columns) {
+        column = t->columns - 1;
+    }
+
+    t->row = row;
+    t->column = column;
+    t->wrapPending = 0;
+}
+
+/*
+ * Carry out a C0 control character
+ */
+static void TermExecute(TermScreen *t, unsigned char c)
+{
+    short column;
+
+    switch (c) {
+        case 0x07: /* BEL */
+            t->bells++;
+            break;
+
+        case 0x08: /* BS */
+            if (t->column > 0) {
+                t->column--;
+            }
+            t->wrapPending = 0;
+            break;
+
+        case 0x09: /* HT */
+            column = (t->column / kTermTabWidth + 1) * kTermTabWidth;
+            TermMoveTo(t, t->row, column);
+            break;
+
+        case 0x0A: /* LF */
+        case 0x0B: /* VT */
+        case 0x0C: /* FF */
+            TermIndex(t);
+            if (t->newLine) {
+                t->column = 0;
+            }
+            t->wrapPending = 0;
+            break;
+
+        case 0x0D: /* CR */
+            t->column = 0;
+            t->wrapPending = 0;
+            break;
+    }
+}
+
+/*
+ * Carry out ESC followed by a final byte
+ */
+static void TermEscDispatch(TermScreen *t, unsigned char c)
+{
+    if (t->intermediate == '(') {
+        /* Designate G0 */
+        t->lineDrawing = (c == '0');
+        return;
+    }
+    if (t->intermediate != 0) {
+        return;
+    }
+
+    switch (c) {
+        case '7': /* Save cursor */
+            t->savedRow = t->row;
+            t->savedColumn = t->column;
+            t->savedAttr = t->attr;
+            break;
+
+        case '8': /* Restore cursor */
+            TermMoveTo(t, t->savedRow, t->savedColumn);
+            t->attr = t->savedAttr;
+            break;
+
+        case 'D': /* Index */
+            TermIndex(t);
+            t->wrapPending = 0;
+            break;
+
+        case 'E': /* Next line */
+            TermIndex(t);
+            t->column = 0;
+            t->wrapPending = 0;
+            break;
+
+        case 'M': /* Reverse index */
+            TermReverseIndex(t);
+            t->wrapPending = 0;
+            break;
+
+        case 'c': /* Reset */
+            TermReset(t);
+            break;
+    }
+}
+
+/*
+ * Carry out a control sequence
+ */
+static void TermCsiDispatch(TermScreen *t, unsigned char c)
+{
+    short n;
+    short row;
+    short column;
+    char reply[24];
+    char *p;
+
+    if (t->intermediate != 0) {
+        return;
+    }
+    if (t->privateMark != 0 && c != 'h' && c != 'l') {
+        /* Only ?-modes are understood; answer nothing else */
+        return;
+    }
+
+    n = TermParam(t, 0, 1);
+
+    switch (c) {
+        case 'A': /* Cursor up, stopping at the top margin */
+            row = t->row - n;
+            if (t->row >= t->top && row < t->top) {
+                row = t->top;
+            }
+            TermMoveTo(t, row, t->column);
+            break;
+
+        case 'B': /* Cursor down, stopping at the bottom margin */
+            row = t->row + n;
+            if (t->row <= t->bottom && row > t->bottom) {
+                row = t->bottom;
+            }
+            TermMoveTo(t, row, t->column);
+            break;
+
+        case 'C': /* Cursor forward */
+            TermMoveTo(t, t->row, t->column + n);
+            break;
+
+        case 'D': /* Cursor back */
+            TermMoveTo(t, t->row, t->column - n);
+            break;
+
+        case 'E': /* Cursor to the start of a later line */
+            TermMoveTo(t, t->row + n, 0);
+            break;
+
+        case 'F': /* Cursor to the start of an earlier line */
+            TermMoveTo(t, t->row - n, 0);
+            break;
+
+        case 'G': /* Cursor to column */
+            TermMoveTo(t, t->row, n - 1);
+            break;
+
+        case 'H': /* Cursor position */
+        case 'f':
+            TermMoveTo(t, n - 1, TermParam(t, 1, 1) - 1);
+            break;
+
+        case 'd': /* Cursor to row */
+            TermMoveTo(t, n - 1, t->column);
+            break;
+
+        case 'J': /* Erase in display */
+            switch (TermParam(t, 0, 0)) {
+                case 0:
+                    TermClearCells(t, t->row, t->column, t->columns);
+                    for (row = t->row + 1; row < t->rows; row++) {
+                        TermClearCells(t, row, 0, t->columns);
+                    }
+                    break;
+
+                case 1:
+                    for (row = 0; row < t->row; row++) {
+                        TermClearCells(t, row, 0, t->columns);
+                    }
+                    TermClearCells(t, t->row, 0, t->column + 1);
+                    break;
+
+                default:
+                    for (row = 0; row < t->rows; row++) {
+                        TermClearCells(t, row, 0, t->columns);
+                    }
+                    break;
+            }
+            break;
+
+        case 'K': /* Erase in line */
+            switch (TermParam(t, 0, 0)) {
+                case 0:
+                    TermClearCells(t, t->row, t->column, t->columns);
+                    break;
+
+                case 1:
+                    TermClearCells(t, t->row, 0, t->column + 1);
+                    break;
+
+                default:
+                    TermClearCells(t, t->row, 0, t->columns);
+                    break;
+            }
+            break;
+
+        case 'X': /* Erase characters */
+            TermClearCells(t, t->row, t->column, t->column + n);
+            break;
+
+        case '@': /* Insert characters */
+        case 'P': /* Delete characters */
+            column = t->column;
+            if (n > t->columns - column) {
+                n = t->columns - column;
+            }
+            if (c == '@') {
+                memmove(t->chars[t->row] + column + n, t->chars[t->row] + column,
+                        t->columns - column - n);
+                memmove(t->attrs[t->row] + column + n, t->attrs[t->row] + column,
+                        t->columns - column - n);
+                TermClearCells(t, t->row, column, column + n);
+            } else {
+                memmove(t->chars[t->row] + column, t->chars[t->row] + column + n,
+                        t->columns - column - n);
+                memmove(t->attrs[t->row] + column, t->attrs[t->row] + column + n,
+                        t->columns - column - n);
+                TermClearCells(t, t->row, t->columns - n, t->columns);
+            }
+            TermMark(t, t->row, column, t->columns);
+            t->wrapPending = 0;
+            break;
+
+        case 'L': /* Insert lines */
+            if (t->row >= t->top && t->row <= t->bottom) {
+                TermScrollDown(t, t->row, t->bottom, n);
+                t->column = 0;
+                t->wrapPending = 0;
+            }
+            break;
+
+        case 'M': /* Delete lines */
+            if (t->row >= t->top && t->row <= t->bottom) {
+                TermScrollUp(t, t->row, t->bottom, n, 0);
+                t->column = 0;
+                t->wrapPending = 0;
+            }
+            break;
+
+        case 'S': /* Scroll up */
+            TermScrollUp(t, t->top, t->bottom, n, 1);
+            break;
+
+        case 'T': /* Scroll down */
+            TermScrollDown(t, t->top, t->bottom, n);
+            break;
+
+        case 'r': /* Scrolling region */
+            row = TermParam(t, 0, 1) - 1;
+            n = TermParam(t, 1, t->rows) - 1;
+            if (n >= t->rows) {
+                n = t->rows - 1;
+            }
+            if (row < n) {
+                t->top = row;
+                t->bottom = n;
+                TermMoveTo(t, 0, 0);
+            }
+            break;
+
+        case 's': /* Save cursor */
+            t->savedRow = t->row;
+            t->savedColumn = t->column;
+            t->savedAttr = t->attr;
+            break;
+
+        case 'u': /* Restore cursor */
+            TermMoveTo(t, t->savedRow, t->savedColumn);
+            t->attr = t->savedAttr;
+            break;
+
+        case 'm': /* Character attributes */
+            TermSelectGraphics(t);
+            break;
+
+        case 'n': /* Device status */
+            if (TermParam(t, 0, 0) == 5) {
+                TermReply(t, "\033[0n");
+            } else if (TermParam(t, 0, 0) == 6) {
+                p = reply;
+                *p++ = '\033';
+                *p++ = '[';
+                p = TermFormatNumber(p, t->row + 1);
+                *p++ = ';';
+                p = TermFormatNumber(p, t->column + 1);
+                *p++ = 'R';
+                *p = '\0';
+                TermReply(t, reply);
+            }
+            break;
+
+        case 'c': /* Device attributes: a VT100 without options */
+            if (TermParam(t, 0, 0) == 0) {
+                TermReply(t, "\033[?1;0c");
+            }
+            break;
+
+        case 'h': /* Set mode */
+            TermSetModes(t, 1);
+            break;
+
+        case 'l': /* Reset mode */
+            TermSetModes(t, 0);
+            break;
+    }
+}
+
+/*
+ * Set or reset each mode listed in the parameters
+ */
+static void TermSetModes(TermScreen *t, int on)
+{
+    short i;
+    short row;
+
+    for (i = 0; i < t->paramCount; i++) {
+        if (t->privateMark == 0) {
+            if (t->params[i] == 20) {
+                t->newLine = on;
+            }
+            continue;
+        }
+        if (t->privateMark != '?') {
+            continue;
+        }
+
+        switch (t->params[i]) {
+            case 7: /* Auto wrap */
+                t->autoWrap = on;
+                t->wrapPending = 0;
+                break;
+
+            case 25: /* Cursor visible */
+                t->cursorVisible = on;
+                TermTouch(t, t->row, t->column);
+                break;
+
+            case 47: /* Alternate screen: there is only one, so start it blank */
+            case 1047:
+            case 1049:
+                if (t->params[i] == 1049 && on) {
+                    t->savedRow = t->row;
+                    t->savedColumn = t->column;
+                    t->savedAttr = t->attr;
+                }
+                for (row = 0; row < t->rows; row++) {
+                    TermClearCells(t, row, 0, t->columns);
+                }
+                if (t->params[i] == 1049 && !on) {
+                    TermMoveTo(t, t->savedRow, t->savedColumn);
+                    t->attr = t->savedAttr;
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * Apply SGR parameters. Colours are skipped, including the extended
+ * forms, so their numbers are not mistaken for attributes.
+ */
+static void TermSelectGraphics(TermScreen *t)
+{
+    short i;
+
+    if (t->paramCount == 0) {
+        t->attr = 0;
+        return;
+    }
+
+    for (i = 0; i < t->paramCount; i++) {
+        switch (t->params[i]) {
+            case 0:
+                t->attr = 0;
+                break;
+
+            case 1:
+                t->attr |= kTermBold;
+                break;
+
+            case 4:
+                t->attr |= kTermUnderline;
+                break;
+
+            case 7:
+                t->attr |= kTermInverse;
+                break;
+
+            case 22:
+                t->attr &= ~kTermBold;
+                break;
+
+            case 24:
+                t->attr &= ~kTermUnderline;
+                break;
+
+            case 27:
+                t->attr &= ~kTermInverse;
+                break;
+
+            case 38:
+            case 48:
+                /* 5;index or 2;red;green;blue */
+                if (i + 1 < t->paramCount) {
+                    i += (t->params[i + 1] == 5) ? 2 : 4;
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * Send an answer back down the line
+ */
+static void TermReply(TermScreen *t, const char *text)
+{
+    if (t->io != NULL && t->io->reply != NULL) {
+        t->io->reply(t->io->context, (const unsigned char *)text, (long)strlen(text));
+    }
+}
+
+/*
+ * Parameter index, or fallback when it is missing or zero
+ */
+static short TermParam(TermScreen *t, short index, short fallback)
+{
+    if (index >= t->paramCount || t->params[index] == 0) {
+        return fallback;
+    }
+    return t->params[index];
+}
+
+/*
+ * Write a positive number in decimal; returns the end
+ */
+static char *TermFormatNumber(char *dest, short value)
+{
+    char digits[6];
+    short count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0) {
+        *dest++ = digits[--count];
+    }
+    return dest;
+}
@@ -0,0 +1,98 @@
+/*
+ * terminal.h - VT100 subset emulation on a character-cell grid
+ *
+ * Received bytes run through a table-driven escape sequence parser
+ * (after the DEC VT500 state diagram, trimmed to what a VT100 needs)
+ * onto a fixed grid of characters and attributes. Every change marks
+ * the cells it touched, so a renderer only redraws what differs from
+ * the last frame; whole-screen scrolls are counted rather than marked,
+ * so the renderer can move the pixels instead of redrawing them.
+ * No Toolbox calls and no allocation: the application owns the
+ * TermScreen and draws it.
+ *
+ * Understood:
+ *
+ *   C0        BEL BS HT LF VT FF CR, CAN and SUB abort a sequence
+ *   ESC       7 8 (save, restore cursor)  D M E (index, reverse, next line)
+ *             c (reset)  ( 0 and ( B (line drawing, ASCII)
+ *   CSI       A B C D E F G H f d (cursor)  J K X (erase)  @ P (chars)
+ *             L M (lines)  S T (scroll)  r (region)  s u (save, restore)
+ *             m (bold, underline, inverse)  n (status, cursor position)
+ *             c (attributes)  h l (20 newline, ?7 wrap, ?25 cursor,
+ *             ?47 ?1047 ?1049 alternate screen, as a clear)
+ *
+ * Anything else is parsed and ignored.
+ */
+
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#define kTermMaxRows        48
+#define kTermMaxColumns     132
+#define kTermMaxParams      16
+#define kTermTabWidth       8
+
+/* Cell attributes */
+#define kTermBold           0x01
+#define kTermUnderline      0x02
+#define kTermInverse        0x04
+
+/* Output to the application */
+typedef struct TermIO {
+    void *context;
+
+    /* A line leaving the top of the screen, trailing blanks trimmed */
+    void (*scrollOff)(void *context, const unsigned char *text, short length);
+
+    /* Answer to a status or attributes request, for the serial line */
+    void (*reply)(void *context, const unsigned char *data, long count);
+} TermIO;
+
+typedef struct TermScreen {
+    const TermIO *io;
+    short rows;
+    short columns;
+
+    /* Cursor and modes */
+    short row;
+    short column;
+    int wrapPending;                /* Last column written; next printable wraps */
+    unsigned char attr;             /* Attributes for new characters */
+    short top;                      /* Scrolling region, inclusive */
+    short bottom;
+    short savedRow;
+    short savedColumn;
+    unsigned char savedAttr;
+    int autoWrap;
+    int newLine;                    /* LF, VT and FF also return the carriage */
+    int cursorVisible;
+    int lineDrawing;                /* G0 is the DEC special graphics set */
+
+    /* Parser */
+    short state;
+    short params[kTermMaxParams];
+    short paramCount;               /* Parameters started, 0 if none */
+    unsigned char privateMark;      /* '?' and friends, or 0 */
+    unsigned char intermediate;
+
+    /* The grid */
+    unsigned char chars[kTermMaxRows][kTermMaxColumns];
+    unsigned char attrs[kTermMaxRows][kTermMaxColumns];
+
+    /* Changes since TermClean(): cells dirtyLeft..dirtyRight-1 of each row */
+    short dirtyLeft[kTermMaxRows];
+    short dirtyRight[kTermMaxRows];
+    int dirty;
+    short scrolled;                 /* Whole-screen scrolls up, already applied */
+
+    unsigned long bells;
+} TermScreen;
+
+void TermInit(TermScreen *t, const TermIO *io, short rows, short columns);
+void TermReset(TermScreen *t);
+void TermWrite(TermScreen *t, const unsigned char *data, long count);
+void TermTouch(TermScreen *t, short row, short column);
+void TermClean(TermScreen *t);
+short TermRowLength(TermScreen *t, short row);
+
+#endif /* TERMINAL_H */
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""
+serial_terminal_test.py - Tests for the host-side serial terminal
+
+Runs on the build host without pyserial: the port is a socket pair and
+the terminal's stdin and stdout are a pipe and a file.
+"""
+
+import os
+import socket
+import sys
+import tempfile
+import threading
+import time
+import unittest
+from unittest import mock
+
+sys.dont_write_bytecode = True
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+import serial_terminal as st
+
+# The hex ZRQINIT header a ZMODEM sender opens with
+ZRQINIT = b'**\x18B00000000000000\r\x8a\x11'
+
+
+class FakePort:
+    """The host end of a socket pair, read and written like the pyserial port."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.sock.setblocking(False)
+        self.timeout = 0
+        self.out_waiting = 0
+
+    def fileno(self):
+        return self.sock.fileno()
+
+    def read(self, size):
+        try:
+            return self.sock.recv(size)
+        except BlockingIOError:
+            return b''
+
+    def write(self, data):
+        self.sock.setblocking(True)
+        self.sock.sendall(data)
+        self.sock.setblocking(False)
+
+    def flush(self):
+        pass
+
+    def close(self):
+        self.sock.close()
+
+
+class ZModemWatchTest(unittest.TestCase):
+
+    def test_text_ahead_of_start(self):
+        watch = st.ZModemWatch()
+        self.assertEqual(watch.feed(b'sz file\r\n' + ZRQINIT), (b'sz file\r\n', True))
+
+    def test_start_split_across_reads(self):
+        watch = st.ZModemWatch()
+        self.assertEqual(watch.feed(b'hello **\x18'), (b'hello **\x18', False))
+        self.assertEqual(watch.feed(b'B00000000000000\r\x8a\x11'), (b'', True))
+
+    def test_plain_text(self):
+        watch = st.ZModemWatch()
+        self.assertEqual(watch.feed(b'**not a header'), (b'**not a header', False))
+        self.assertEqual(watch.feed(b'more'), (b'more', False))
+
+
+class RunTerminalZModemTest(unittest.TestCase):
+    """Text and a ZRQINIT in one read, with keys typed in the same wakeup."""
+
+    def setUp(self):
+        self.mac, host = socket.socketpair()
+        self.port = FakePort(host)
+        self.stdin_read, self.stdin_write = os.pipe()
+        self.stdout = tempfile.TemporaryFile()
+        self.at_transfer = None
+
+    def tearDown(self):
+        self.mac.close()
+        os.close(self.stdin_read)
+        os.close(self.stdin_write)
+        self.stdout.close()
+
+    def fake_transfer_receive(self, ser, directory, protocol, fallback=True):
+        # What the Mac has been sent by the time the transfer takes the port
+        self.mac.setblocking(False)
+        try:
+            self.at_transfer = self.mac.recv(4096)
+        except BlockingIOError:
+            self.at_transfer = b''
+        return []
+
+    def run_terminal(self, seconds):
+        stdin = mock.Mock()
+        stdin.fileno.return_value = self.stdin_read
+        stdout = mock.Mock()
+        stdout.fileno.return_value = self.stdout.fileno()
+        quit_later = threading.Timer(seconds, os.write, (self.stdin_write, b'\x03'))
+        quit_later.start()
+        try:
+            with mock.patch.object(st, 'open_serial', return_value=self.port), \
+                 mock.patch.object(st, 'transfer_receive', self.fake_transfer_receive), \
+                 mock.patch.object(st.termios, 'tcgetattr', return_value=None), \
+                 mock.patch.object(st.termios, 'tcsetattr'), \
+                 mock.patch.object(st.tty, 'setraw'), \
+                 mock.patch.object(st.sys, 'stdin', stdin), \
+                 mock.patch.object(st.sys, 'stdout', stdout), \
+                 mock.patch('builtins.print'):
+                return st.run_terminal('fake', 9600, bot_mode=True)
+        finally:
+            quit_later.cancel()
+
+    def test_bot_line_and_keys_survive_zmodem_start(self):
+        os.write(self.stdin_write, b'k')
+        self.mac.sendall(b'@bot ping\r' + ZRQINIT)
+        time.sleep(0.05)
+
+        self.assertEqual(self.run_terminal(st.BOT_REPLY_DELAY + 0.5), 0)
+
+        # The key went out before the transfer started
+        self.assertEqual(self.at_transfer, b'k')
+
+        # The @bot line ahead of the ZRQINIT was answered afterwards
+        self.mac.settimeout(1.0)
+        self.assertEqual(self.mac.recv(4096), b'Pong!\r\n')
+
+        self.stdout.seek(0)
+        shown = self.stdout.read()
+        self.assertIn(b'@bot ping\r\n\r\n[ZMODEM receive]\r\n', shown)
+        self.assertIn(b'[BOT] Pong!', shown)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,397 @@
+/*
+ * serialcore_bench.c - Throughput of the serial core's hot paths
+ *
+ * Feeds 80-column text, like a chatty device, through each path for a
+ * fixed time and reports megabytes per second:
+ *
+ *   outgoing    SerialTranslateOutgoing (CR to CR+LF)
+ *   incoming    SerialTranslateIncoming on 1 KB batches (CR+LF to CR)
+ *   scrollback  ScrollbackAppend into a 256 KB store, trimming as it goes
+ *   receive     loopback driver read, translate and append, as the
+ *               application's receive path does it
+ *   compress    LZSS encode of 1 KB blocks and decode of the result,
+ *               as a compressed link does at both ends
+ *   terminal    the same lines with bold, inverse and erase sequences
+ *               through an 80 by 24 VT100 screen, scrolled-off lines
+ *               going to the scrollback store as in the application
+ *   glyphs      composing 46-column lines of Monaco 9-sized glyphs into
+ *               a 1-bit row buffer, as the receive area draws them
+ *   find        a fresh case-insensitive search of the store for a
+ *               pattern that is not there, as Find does on a new pattern
+ *   triggers    1 KB batches through a 16-trigger automaton, none of
+ *               which fire, as every received byte goes
+ *
+ * With --min-mbps N the run fails if any path falls below N, so a test
+ * run catches performance regressions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "serialcore.h"
+#include "lzss.h"
+#include "terminal.h"
+#include "glyph.h"
+#include "find.h"
+#include "trigger.h"
+
+#define kBenchSeconds   0.25
+#define kTextSize       65536
+#define kBatchSize      1024        /* Same as the application's kRxPollBudget */
+#define kPipeSize       16384       /* Same as the application's kRxRingSize */
+
+/* Memory loopback: writes land in a ring that reads drain */
+typedef struct Pipe {
+    char data[kPipeSize];
+    unsigned long head;
+    unsigned long tail;
+} Pipe;
+
+static char gText[kTextSize];       /* Device text with CR+LF endings */
+static char gMacText[kTextSize];    /* The same with CR endings */
+static char gAnsiText[kTextSize];   /* Device text with escape sequences */
+static char gOut[kTextSize * 2 + 2];
+static char gBatch[kBatchSize];
+static Pipe gPipe;
+static LzssEncoder gEncoder;
+static LzssDecoder gDecoder;
+static unsigned char gPacked[LzssBound(kBatchSize)];
+static TermScreen gTerm;
+static TermIO gTermIO;
+static GlyphAtlas gAtlas;
+static unsigned char gStrip[kGlyphStripRowBytes * 11];
+static unsigned char gLine[GlyphRowBytes(46, 6) * 11];
+static FindState gFind;
+static TrigSet gTrig;
+
+/* Triggers whose patterns share bytes with the text but never match it */
+static const char kTriggers[] =
+    "login: => send guest\\r\n"
+    "Password: => send secret\\r\n"
+    "ERROR 42 => beep\n"
+    "FATAL => beep\n"
+    "panic: => beep\n"
+    "BEGIN LOG => capture on\n"
+    "END LOG => capture off\n"
+    "\\x1B[5i => capture on\n"
+    "\\x1B[4i => capture off\n"
+    "--More-- => send \\x20\n"
+    "[y/n] => send y\\r\n"
+    "Press any key => send \\r\n"
+    "Connection closed => beep\n"
+    "NO CARRIER => beep\n"
+    "Segmentation fault => beep\n"
+    "root# => send exit\\r\n";
+
+static int PipeOpen(void *context, short port, short baud)
+{
+    Pipe *pipe = (Pipe *)context;
+
+    (void)port;
+    (void)baud;
+    pipe->head = pipe->tail = 0;
+    return 0;
+}
+
+static long PipeRead(void *context, char *data, long maxCount)
+{
+    Pipe *pipe = (Pipe *)context;
+    long count;
+    long chunk;
+
+    count = (long)(pipe->head - pipe->tail);
+    if (count > maxCount) {
+        count = maxCount;
+    }
+    chunk = kPipeSize - (long)(pipe->tail % kPipeSize);
+    if (chunk > count) {
+        chunk = count;
+    }
+    memcpy(data, &pipe->data[pipe->tail % kPipeSize], chunk);
+    memcpy(data + chunk, pipe->data, count - chunk);
+    pipe->tail += count;
+    return count;
+}
+
+static long PipeWrite(void *context, const char *data, long count)
+{
+    Pipe *pipe = (Pipe *)context;
+    long space;
+    long chunk;
+
+    space = kPipeSize - (long)(pipe->head - pipe->tail);
+    if (count > space) {
+        count = space;
+    }
+    chunk = kPipeSize - (long)(pipe->head % kPipeSize);
+    if (chunk > count) {
+        chunk = count;
+    }
+    memcpy(&pipe->data[pipe->head % kPipeSize], data, chunk);
+    memcpy(pipe->data, data + chunk, count - chunk);
+    pipe->head += count;
+    return count;
+}
+
+static int PipeStatus(void *context, SerialStatus *status)
+{
+    Pipe *pipe = (Pipe *)context;
+
+    status->received = pipe->head;
+    status->inputWaiting = (long)(pipe->head - pipe->tail);
+    status->lineErrors = 0;
+    return 0;
+}
+
+static const SerialDriver gPipeDriver = {
+    &gPipe, PipeOpen, PipeRead, PipeWrite, PipeStatus
+};
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * 78 printable characters then a line ending
+ */
+static void MakeText(void)
+{
+    long i;
+    long column;
+
+    for (i = 0; i < kTextSize; i++) {
+        column = i % 80;
+        if (column == 78) {
+            gText[i] = '\r';
+            gMacText[i] = 'x';
+        } else if (column == 79) {
+            gText[i] = '\n';
+            gMacText[i] = '\r';
+        } else {
+            gText[i] = ' ' + (char)((i / 80 + column) % 95);
+            gMacText[i] = gText[i];
+        }
+    }
+}
+
+/*
+ * 80-column lines as a device with a colour prompt sends them: a bold
+ * inverse label, the text, then erase to end of line and CR+LF
+ */
+static void MakeAnsiText(void)
+{
+    static const char label[] = "\033[1;7mdev>\033[0m ";
+    long i;
+    long n;
+
+    i = 0;
+    while (i + 100 < kTextSize) {
+        memcpy(gAnsiText + i, label, sizeof(label) - 1);
+        i += sizeof(label) - 1;
+        for (n = 0; n < 70; n++, i++) {
+            gAnsiText[i] = ' ' + (char)((i / 80 + n) % 95);
+        }
+        memcpy(gAnsiText + i, "\033[K\r\n", 5);
+        i += 5;
+    }
+    while (i < kTextSize) {
+        gAnsiText[i++] = ' ';
+    }
+}
+
+/* Lines leaving the terminal's screen go to the store being benchmarked */
+static void BenchScrollOff(void *context, const unsigned char *text, short length)
+{
+    ScrollbackAppend((ScrollbackStore *)context, (const char *)text, length);
+    ScrollbackAppend((ScrollbackStore *)context, "\r", 1);
+}
+
+static void MakeStore(ScrollbackStore *sb)
+{
+    short i;
+
+    memset(sb, 0, sizeof(*sb));
+    sb->lineStart = (unsigned long *)malloc(kScrollbackLines * sizeof(unsigned long));
+    sb->lineLength = (unsigned char *)malloc(kScrollbackLines);
+    for (i = 0; i < kScrollbackMaxChunks; i++) {
+        sb->chunks[i] = (char *)malloc(kScrollbackChunkSize);
+    }
+    sb->chunkCount = kScrollbackMaxChunks;
+    sb->capacity = (unsigned long)kScrollbackMaxChunks * kScrollbackChunkSize;
+    sb->columns = 46;               /* Monaco 9 across the receive area */
+    sb->rows = 5;
+    ScrollbackClear(sb);
+}
+
+static void FreeStore(ScrollbackStore *sb)
+{
+    short i;
+
+    for (i = 0; i < sb->chunkCount; i++) {
+        free(sb->chunks[i]);
+    }
+    free(sb->lineStart);
+    free(sb->lineLength);
+}
+
+/*
+ * Run one path repeatedly for kBenchSeconds; returns MB/s of input
+ */
+static double RunPath(int path, ScrollbackStore *sb)
+{
+    double start;
+    double elapsed;
+    double bytes;
+    long offset;
+    long count;
+    long used;
+    long n;
+    unsigned long mask;
+    int lastWasCR;
+    volatile long sink;
+
+    bytes = 0;
+    lastWasCR = 0;
+    sink = 0;
+    LzssInitEncoder(&gEncoder);
+    LzssInitDecoder(&gDecoder);
+    gTermIO.context = sb;
+    gTermIO.scrollOff = BenchScrollOff;
+    gTermIO.reply = NULL;
+    TermInit(&gTerm, &gTermIO, 24, 80);
+    if (path == 7) {
+        /* The text searched on each pass */
+        ScrollbackAppend(sb, gMacText, kTextSize);
+    }
+    start = Now();
+    do {
+        for (offset = 0; offset < kTextSize; offset += kBatchSize) {
+            switch (path) {
+                case 0: /* outgoing */
+                    sink += SerialTranslateOutgoing(gMacText + offset, kBatchSize, gOut);
+                    break;
+
+                case 1: /* incoming - works in place, so translate a copy */
+                    memcpy(gBatch, gText + offset, kBatchSize);
+                    sink += SerialTranslateIncoming(gBatch, kBatchSize, &lastWasCR);
+                    break;
+
+                case 2: /* scrollback */
+                    ScrollbackAppend(sb, gMacText + offset, kBatchSize);
+                    break;
+
+                case 3: /* receive */
+                    gPipeDriver.write(gPipeDriver.context, gText + offset, kBatchSize);
+                    while ((count = gPipeDriver.read(gPipeDriver.context, gBatch,
+                                                     kBatchSize)) > 0) {
+                        count = SerialTranslateIncoming(gBatch, count, &lastWasCR);
+                        ScrollbackAppend(sb, gBatch, count);
+                    }
+                    break;
+
+                case 4: /* compress */
+                    count = LzssEncode(&gEncoder, (const unsigned char *)gText + offset,
+                                       kBatchSize, gPacked);
+                    for (n = 0; n < count; n += used) {
+                        sink += LzssDecode(&gDecoder, gPacked + n, count - n, &used,
+                                           (unsigned char *)gOut, sizeof(gOut));
+                    }
+                    break;
+
+                case 5: /* terminal - each batch is one frame's worth */
+                    TermWrite(&gTerm, (const unsigned char *)gAnsiText + offset, kBatchSize);
+                    sink += gTerm.scrolled;
+                    TermClean(&gTerm);
+                    break;
+
+                case 6: /* glyphs */
+                    for (n = 0; n + 46 <= kBatchSize; n += 46) {
+                        GlyphCompose(&gAtlas, (const unsigned char *)gMacText + offset + n,
+                                     46, gLine, (short)GlyphRowBytes(46, 6));
+                    }
+                    GlyphCompose(&gAtlas, (const unsigned char *)gMacText + offset + n,
+                                 (short)(kBatchSize - n), gLine, (short)GlyphRowBytes(46, 6));
+                    sink += gLine[0];
+                    break;
+
+                case 7: /* find - the whole text once per pass */
+                    if (offset == 0) {
+                        FindInit(&gFind);
+                        sink += FindSearch(&gFind, sb, (const unsigned char *)"ERROR 42", 8, 1);
+                    }
+                    break;
+
+                case 8: /* triggers */
+                    for (n = 0; n < kBatchSize; n += used) {
+                        used = TrigScan(&gTrig, (const unsigned char *)gMacText + offset + n,
+                                        kBatchSize - n, &mask);
+                        sink += mask;
+                    }
+                    break;
+            }
+        }
+        bytes += kTextSize;
+        elapsed = Now() - start;
+    } while (elapsed < kBenchSeconds);
+
+    return bytes / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = { "outgoing", "incoming", "scrollback", "receive",
+                                   "compress", "terminal", "glyphs", "find", "triggers" };
+    ScrollbackStore sb;
+    double minimum;
+    double mbps;
+    int path;
+    int failed;
+    short badLine;
+    int i;
+
+    minimum = 0;
+    if (argc == 3 && strcmp(argv[1], "--min-mbps") == 0) {
+        minimum = atof(argv[2]);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--min-mbps N]\n", argv[0]);
+        return 2;
+    }
+
+    MakeText();
+    MakeAnsiText();
+    for (i = 0; i < (int)sizeof(gStrip); i++) {
+        gStrip[i] = (unsigned char)(i * 37);
+    }
+    GlyphLoad(&gAtlas, gStrip, 6, 11);
+    if (TrigLoad(&gTrig, kTriggers, (long)strlen(kTriggers), &badLine) != kTrigOK) {
+        fprintf(stderr, "trigger line %d would not load\n", badLine);
+        return 2;
+    }
+    MakeStore(&sb);
+    if (!SerialOpen(&gPipeDriver, 0, 2, "Loopback", "9600")) {
+        fprintf(stderr, "loopback would not open\n");
+        return 2;
+    }
+    gPipe.tail = gPipe.head;        /* Drop the greeting */
+
+    failed = 0;
+    for (path = 0; path < 9; path++) {
+        ScrollbackClear(&sb);
+        mbps = RunPath(path, &sb);
+        printf("%-12s %10.1f MB/s", names[path], mbps);
+        if (mbps < minimum) {
+            printf("  below %.1f", minimum);
+            failed = 1;
+        }
+        printf("\n");
+    }
+
+    FreeStore(&sb);
+    return failed;
+}
@@ -0,0 +1,1211 @@
+/*
+ * serialcore_test.c - Unit tests for the portable serial core
+ *
+ * Runs on the build host. Each check prints the failing expression and
+ * the run exits nonzero if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "serialcore.h"
+#include "transfer.h"
+#include "lzss.h"
+#include "mux.h"
+#include "terminal.h"
+#include "glyph.h"
+#include "find.h"
+#include "trigger.h"
+
+static int gFailures = 0;
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            gFailures++; \
+        } \
+    } while (0)
+
+/* Memory loopback standing in for the port */
+typedef struct Loopback {
+    int openResult;
+    short port;
+    short baud;
+    char data[256];
+    long length;
+} Loopback;
+
+static int LoopbackOpen(void *context, short port, short baud)
+{
+    Loopback *lb = (Loopback *)context;
+
+    lb->port = port;
+    lb->baud = baud;
+    return lb->openResult;
+}
+
+static long LoopbackRead(void *context, char *data, long maxCount)
+{
+    Loopback *lb = (Loopback *)context;
+    long count = (lb->length < maxCount) ? lb->length : maxCount;
+
+    memcpy(data, lb->data, count);
+    memmove(lb->data, lb->data + count, lb->length - count);
+    lb->length -= count;
+    return count;
+}
+
+static long LoopbackWrite(void *context, const char *data, long count)
+{
+    Loopback *lb = (Loopback *)context;
+
+    if (count > (long)sizeof(lb->data) - lb->length) {
+        count = (long)sizeof(lb->data) - lb->length;
+    }
+    memcpy(lb->data + lb->length, data, count);
+    lb->length += count;
+    return count;
+}
+
+static int LoopbackStatus(void *context, SerialStatus *status)
+{
+    Loopback *lb = (Loopback *)context;
+
+    status->received = 0;
+    status->inputWaiting = lb->length;
+    status->lineErrors = 0;
+    return 0;
+}
+
+/*
+ * Translate text for the wire and compare with the expected bytes
+ */
+static int OutgoingIs(const char *text, const char *expected)
+{
+    char out[128];
+    long length;
+
+    length = SerialTranslateOutgoing(text, (long)strlen(text), out);
+    return length == (long)strlen(expected) && memcmp(out, expected, length) == 0;
+}
+
+static void TestOutgoing(void)
+{
+    CHECK(OutgoingIs("", ""));
+    CHECK(OutgoingIs("hi", "hi\r\n"));
+    CHECK(OutgoingIs("hi\r", "hi\r\n"));
+    CHECK(OutgoingIs("a\rb", "a\r\nb\r\n"));
+    CHECK(OutgoingIs("\r\r", "\r\n\r\n"));
+    CHECK(OutgoingIs("x\ny", "x\ny\r\n"));
+}
+
+static void TestIncoming(void)
+{
+    char buffer[64];
+    long length;
+    int lastWasCR;
+
+    lastWasCR = 0;
+    strcpy(buffer, "a\r\nb\nc\rd");
+    length = SerialTranslateIncoming(buffer, (long)strlen(buffer), &lastWasCR);
+    CHECK(length == 7 && memcmp(buffer, "a\rb\rc\rd", 7) == 0);
+    CHECK(lastWasCR == 0);
+
+    /* CR+LF split across two batches is still one line break */
+    strcpy(buffer, "one\r");
+    length = SerialTranslateIncoming(buffer, 4, &lastWasCR);
+    CHECK(length == 4 && lastWasCR == 1);
+    strcpy(buffer, "\ntwo");
+    length = SerialTranslateIncoming(buffer, 4, &lastWasCR);
+    CHECK(length == 3 && memcmp(buffer, "two", 3) == 0);
+
+    /* LF+LF is two lines, CR+CR is two lines */
+    lastWasCR = 0;
+    strcpy(buffer, "\n\n\r\r");
+    length = SerialTranslateIncoming(buffer, 4, &lastWasCR);
+    CHECK(length == 4 && memcmp(buffer, "\r\r\r\r", 4) == 0);
+}
+
+static void TestReady(void)
+{
+    char msg[kSerialReadyMax];
+    char longName[200];
+    long length;
+    Loopback lb;
+    SerialDriver driver = { &lb, LoopbackOpen, LoopbackRead, LoopbackWrite, LoopbackStatus };
+
+    length = SerialFormatReady(msg, "Modem", "9600");
+    CHECK(length == 28 && memcmp(msg, "Serial ready: Modem @ 9600\r\n", 28) == 0);
+
+    /* Overlong names are cut short, the line ending survives */
+    memset(longName, 'x', sizeof(longName) - 1);
+    longName[sizeof(longName) - 1] = 0;
+    length = SerialFormatReady(msg, longName, longName);
+    CHECK(length <= kSerialReadyMax);
+    CHECK(msg[length - 2] == '\r' && msg[length - 1] == '\n');
+
+    /* Open announces the port through the driver */
+    memset(&lb, 0, sizeof(lb));
+    CHECK(SerialOpen(&driver, 1, 5, "Printer", "57600") == 1);
+    CHECK(lb.port == 1 && lb.baud == 5);
+    CHECK(lb.length == 31 && memcmp(lb.data, "Serial ready: Printer @ 57600\r\n", 31) == 0);
+
+    /* A failed open sends nothing */
+    memset(&lb, 0, sizeof(lb));
+    lb.openResult = -28;
+    CHECK(SerialOpen(&driver, 0, 2, "Modem", "9600") == 0);
+    CHECK(lb.length == 0);
+}
+
+/*
+ * Set up a store over malloc'd chunks
+ */
+static void MakeStore(ScrollbackStore *sb, short chunks, short columns, short rows)
+{
+    short i;
+
+    memset(sb, 0, sizeof(*sb));
+    sb->lineStart = (unsigned long *)malloc(kScrollbackLines * sizeof(unsigned long));
+    sb->lineLength = (unsigned char *)malloc(kScrollbackLines);
+    for (i = 0; i < chunks; i++) {
+        sb->chunks[i] = (char *)malloc(kScrollbackChunkSize);
+    }
+    sb->chunkCount = chunks;
+    sb->capacity = (unsigned long)chunks * kScrollbackChunkSize;
+    sb->columns = columns;
+    sb->rows = rows;
+    ScrollbackClear(sb);
+}
+
+static void FreeStore(ScrollbackStore *sb)
+{
+    short i;
+
+    for (i = 0; i < sb->chunkCount; i++) {
+        free(sb->chunks[i]);
+    }
+    free(sb->lineStart);
+    free(sb->lineLength);
+}
+
+/*
+ * Text of the retained line as a C string
+ */
+static const char *LineText(ScrollbackStore *sb, unsigned long line)
+{
+    static char text[kScrollbackMaxColumns + 1];
+    long length = sb->lineLength[line & kScrollbackLineMask];
+
+    memcpy(text, ScrollbackLinePtr(sb, line), length);
+    text[length] = 0;
+    return text;
+}
+
+static void TestScrollbackWrap(void)
+{
+    ScrollbackStore sb;
+
+    MakeStore(&sb, 2, 10, 3);
+
+    ScrollbackAppend(&sb, "hello\r\rthis line wraps here\r", 28);
+    CHECK(sb.lineCount == 4);
+    CHECK(strcmp(LineText(&sb, 0), "hello") == 0);
+    CHECK(strcmp(LineText(&sb, 1), "") == 0);
+    CHECK(strcmp(LineText(&sb, 2), "this line ") == 0);
+    CHECK(strcmp(LineText(&sb, 3), "wraps here") == 0);
+
+    /* The view follows the newest rows */
+    CHECK(sb.topLine == 1);
+
+    /* A line continues across appends */
+    ScrollbackClear(&sb);
+    ScrollbackAppend(&sb, "ab", 2);
+    ScrollbackAppend(&sb, "cd\r", 3);
+    CHECK(sb.lineCount == 1 && strcmp(LineText(&sb, 0), "abcd") == 0);
+    CHECK(sb.lineOpen == 0);
+
+    FreeStore(&sb);
+}
+
+static void TestScrollbackTrim(void)
+{
+    ScrollbackStore sb;
+    char line[32];
+    long i;
+    long length;
+    unsigned long n;
+    int intact;
+
+    MakeStore(&sb, 2, 80, 5);
+
+    /* Far more than two chunks: the oldest lines are dropped */
+    for (i = 0; i < 5000; i++) {
+        length = sprintf(line, "line %ld\r", i);
+        ScrollbackAppend(&sb, line, length);
+    }
+
+    CHECK(sb.firstLine > 0);
+    CHECK(sb.firstLine + sb.lineCount == 5000);
+    CHECK(sb.writePos - sb.lineStart[sb.firstLine & kScrollbackLineMask] <= sb.capacity);
+
+    /* Every retained line still holds its own text */
+    intact = 1;
+    for (n = sb.firstLine; n < sb.firstLine + sb.lineCount; n++) {
+        sprintf(line, "line %lu", n);
+        if (strcmp(LineText(&sb, n), line) != 0) {
+            intact = 0;
+        }
+    }
+    CHECK(intact);
+
+    /* The line index is trimmed too when lines are short */
+    ScrollbackClear(&sb);
+    for (i = 0; i < kScrollbackLines + 100; i++) {
+        ScrollbackAppend(&sb, "\r", 1);
+    }
+    CHECK(sb.lineCount <= kScrollbackLines);
+    CHECK(sb.firstLine + sb.lineCount == kScrollbackLines + 100);
+
+    FreeStore(&sb);
+}
+
+static void TestCrc(void)
+{
+    const unsigned char *check = (const unsigned char *)"123456789";
+
+    /* Standard check values for CRC-16/XMODEM and CRC-32 */
+    CHECK(XferCrc16(0, check, 9) == 0x31C3);
+    CHECK((~XferCrc32(0xFFFFFFFFUL, check, 9) & 0xFFFFFFFFUL) == 0xCBF43926UL);
+}
+
+/* One end of a simulated file transfer */
+typedef struct XferEnd {
+    XferState x;
+    XferIO io;
+    unsigned char wire[16384];      /* Sent, not yet carried across */
+    long wireLength;
+    long carried;                   /* Bytes carried across so far */
+    const unsigned char *file;      /* Sending */
+    long fileSize;
+    unsigned char got[8192];        /* Receiving */
+    long gotLength;
+    char name[kXferMaxName];
+    long announced;                 /* Size passed to createFile */
+    int closed;                     /* closeFile's complete, or -1 while open */
+} XferEnd;
+
+static unsigned long gXferTicks;
+static long gXferSteps;             /* Taken by the last XferRun */
+
+static long XferEndRoom(void *context)
+{
+    XferEnd *end = (XferEnd *)context;
+
+    return (long)sizeof(end->wire) - end->wireLength;
+}
+
+static void XferEndWrite(void *context, const unsigned char *data, long count)
+{
+    XferEnd *end = (XferEnd *)context;
+
+    if (end->wireLength + count <= (long)sizeof(end->wire)) {
+        memcpy(end->wire + end->wireLength, data, count);
+        end->wireLength += count;
+    }
+}
+
+static long XferEndRead(void *context, long offset, unsigned char *data, long count)
+{
+    XferEnd *end = (XferEnd *)context;
+
+    if (offset < 0 || offset > end->fileSize) {
+        return -1;
+    }
+    if (count > end->fileSize - offset) {
+        count = end->fileSize - offset;
+    }
+    memcpy(data, end->file + offset, count);
+    return count;
+}
+
+static int XferEndCreate(void *context, const char *name, long size)
+{
+    XferEnd *end = (XferEnd *)context;
+
+    strcpy(end->name, name);
+    end->announced = size;
+    end->gotLength = 0;
+    end->closed = -1;
+    return 1;
+}
+
+static int XferEndWriteFile(void *context, const unsigned char *data, long count)
+{
+    XferEnd *end = (XferEnd *)context;
+
+    if (end->gotLength + count > (long)sizeof(end->got)) {
+        return 0;
+    }
+    memcpy(end->got + end->gotLength, data, count);
+    end->gotLength += count;
+    return 1;
+}
+
+static void XferEndClose(void *context, int complete)
+{
+    ((XferEnd *)context)->closed = complete;
+}
+
+static unsigned long XferEndTicks(void *context)
+{
+    (void)context;
+    return gXferTicks;
+}
+
+static void XferEndStart(XferEnd *end, const unsigned char *file, long fileSize)
+{
+    memset(end, 0, sizeof(*end));
+    end->io.context = end;
+    end->io.writeRoom = XferEndRoom;
+    end->io.write = XferEndWrite;
+    end->io.readFile = XferEndRead;
+    end->io.createFile = XferEndCreate;
+    end->io.writeFile = XferEndWriteFile;
+    end->io.closeFile = XferEndClose;
+    end->io.ticks = XferEndTicks;
+    end->file = file;
+    end->fileSize = fileSize;
+    end->closed = -2;
+}
+
+/*
+ * Carry everything from one end's wire to the other, flipping a bit of
+ * the damageAt'th byte carried if it is among them
+ */
+static void XferCarry(XferEnd *from, XferEnd *to, long damageAt)
+{
+    long count = from->wireLength;
+
+    if (damageAt >= from->carried && damageAt < from->carried + count) {
+        from->wire[damageAt - from->carried] ^= 0x01;
+    }
+    from->carried += count;
+    from->wireLength = 0;
+    XferInput(&to->x, from->wire, count);
+}
+
+/*
+ * Run a sender against a receiver until both have finished, one tick
+ * per step, counting the steps in gXferSteps
+ */
+static void XferRun(XferEnd *s, XferEnd *r, long damageAt)
+{
+    for (gXferSteps = 0; gXferSteps < 20000; gXferSteps++) {
+        if (s->x.status != kXferRunning && r->x.status != kXferRunning) {
+            break;
+        }
+        gXferTicks++;
+        XferPoll(&s->x);
+        XferCarry(s, r, damageAt);
+        XferPoll(&r->x);
+        XferCarry(r, s, -1);
+    }
+}
+
+/*
+ * Send a file from one engine to another. Returns 1 if both ends
+ * finished and the file arrived intact; X/YMODEM-1K pads the last block
+ * with SUB when the size is not sent.
+ */
+static int XferRoundTrip(short protocol, const unsigned char *file, long size,
+                         long damageAt, XferEnd *s, XferEnd *r)
+{
+    long i;
+
+    XferEndStart(s, file, size);
+    XferEndStart(r, NULL, 0);
+    XferStartReceive(&r->x, &r->io, protocol);
+    XferStartSend(&s->x, &s->io, protocol, "dir/test.bin", size);
+    XferRun(s, r, damageAt);
+
+    if (s->x.status != kXferDone || r->x.status != kXferDone ||
+        r->closed != 1 || r->x.filesDone != 1 || r->gotLength < size ||
+        memcmp(r->got, file, size) != 0) {
+        return 0;
+    }
+    if (protocol == kXferXModem1K) {
+        for (i = size; i < r->gotLength; i++) {
+            if (r->got[i] != 0x1A) {
+                return 0;
+            }
+        }
+        return strcmp(r->name, "received.bin") == 0 && r->gotLength % 128 == 0;
+    }
+    return strcmp(r->name, "test.bin") == 0 && r->announced == size &&
+           r->gotLength == size;
+}
+
+static void TestTransfer(void)
+{
+    static XferEnd s;
+    static XferEnd r;
+    static unsigned char file[5000];
+    short protocol;
+    long i;
+
+    /* Every byte value, with runs of ZDLE and CR after '@' to be escaped */
+    for (i = 0; i < (long)sizeof(file); i++) {
+        file[i] = (unsigned char)(i * 7 + i / 256);
+    }
+    memset(file + 100, 0x18, 6);
+    memcpy(file + 200, "@\r@\x8D\x11\x13\x91\x93\x10\x90\x7F\xFF", 12);
+
+    for (protocol = kXferZModem; protocol <= kXferXModem1K; protocol++) {
+        CHECK(XferRoundTrip(protocol, file, (long)sizeof(file), -1, &s, &r));
+        CHECK(s.x.protocol == protocol && r.x.protocol == protocol);
+
+        /* A short file, and an empty one */
+        CHECK(XferRoundTrip(protocol, file, 100, -1, &s, &r));
+        CHECK(XferRoundTrip(protocol, file, 0, -1, &s, &r));
+    }
+
+    /*
+     * A damaged subpacket: the receiver asks for the rest from its
+     * offset, with no wait for a timeout
+     */
+    CHECK(XferRoundTrip(kXferZModem, file, (long)sizeof(file), 3000, &s, &r));
+    CHECK(s.x.zLastRpos > 0 && s.x.zLastRpos < (long)sizeof(file) &&
+          s.x.zLastRpos % kXferBlockSize == 0);
+    CHECK(gXferSteps < 100);
+
+    /* A damaged block is refused at once and sent again */
+    CHECK(XferRoundTrip(kXferYModem, file, (long)sizeof(file), 2000, &s, &r));
+    CHECK(gXferSteps < 100);
+    CHECK(XferRoundTrip(kXferXModem1K, file, (long)sizeof(file), 2000, &s, &r));
+    CHECK(gXferSteps < 100);
+}
+
+/*
+ * Compress text in blocks of blockSize, then decode the stream feeding
+ * feedSize bytes at a time into a small output buffer. Returns 1 if the
+ * text comes back intact; *wire gets the compressed length.
+ */
+static int LzssRoundTrip(const unsigned char *text, long length, long blockSize,
+                         long feedSize, long *wire)
+{
+    static LzssEncoder e;
+    static LzssDecoder d;
+    static unsigned char packed[LzssBound(65536L)];
+    static unsigned char unpacked[65536];
+    unsigned char out[64];
+    long packedLength;
+    long unpackedLength;
+    long offset;
+    long count;
+    long used;
+    long n;
+
+    LzssInitEncoder(&e);
+    packedLength = 0;
+    for (offset = 0; offset < length; offset += count) {
+        count = (length - offset < blockSize) ? length - offset : blockSize;
+        packedLength += LzssEncode(&e, text + offset, count, packed + packedLength);
+    }
+    *wire = packedLength;
+
+    LzssInitDecoder(&d);
+    unpackedLength = 0;
+    for (offset = 0; offset < packedLength; offset += count) {
+        count = (packedLength - offset < feedSize) ? packedLength - offset : feedSize;
+        for (n = 0; n < count; n += used) {
+            long got = LzssDecode(&d, packed + offset + n, count - n, &used,
+                                  out, sizeof(out));
+            if (unpackedLength + got > length) {
+                return 0;
+            }
+            memcpy(unpacked + unpackedLength, out, got);
+            unpackedLength += got;
+        }
+    }
+
+    return unpackedLength == length && memcmp(unpacked, text, length) == 0;
+}
+
+static void TestLzss(void)
+{
+    static unsigned char text[65536];
+    static LzssEncoder e;
+    static LzssDecoder d;
+    unsigned char packed[64];
+    unsigned char out[64];
+    unsigned long seed;
+    long wire;
+    long used;
+    long count;
+    long i;
+    short matched;
+
+    /* Text with the repetition of a device log */
+    for (i = 0; i < (long)sizeof(text); i++) {
+        text[i] = "temp=21.5C  humidity=40%  status=OK\r\n"[i % 37];
+    }
+    CHECK(LzssRoundTrip(text, sizeof(text), kLzssMaxBlock, 4096, &wire));
+    CHECK(wire < (long)sizeof(text) / 4);
+    CHECK(LzssRoundTrip(text, 5000, 1, 1, &wire));
+    CHECK(LzssRoundTrip(text, 5000, 37, 3, &wire));
+
+    /* Noise does not compress, and never grows past the bound */
+    seed = 1;
+    for (i = 0; i < (long)sizeof(text); i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        text[i] = (unsigned char)(seed >> 16);
+    }
+    CHECK(LzssRoundTrip(text, sizeof(text), kLzssMaxBlock, 1000, &wire));
+    CHECK(wire <= LzssBound((long)sizeof(text)));
+
+    /* Runs match against themselves, and long blocks take two-byte headers */
+    memset(text, 'a', 1000);
+    CHECK(LzssRoundTrip(text, 1000, 1000, 7, &wire));
+    memset(text, 0, 300);
+    CHECK(LzssRoundTrip(text, 300, 300, 300, &wire));
+
+    /* The end marker hands the rest of the input back as plain bytes */
+    LzssInitEncoder(&e);
+    count = LzssEncode(&e, (const unsigned char *)"hello", 5, packed);
+    packed[count++] = kLzssEnd;
+    memcpy(packed + count, "plain", 5);
+    LzssInitDecoder(&d);
+    CHECK(LzssDecode(&d, packed, count + 5, &used, out, sizeof(out)) == 5);
+    CHECK(memcmp(out, "hello", 5) == 0);
+    CHECK(d.ended);
+    CHECK(used == count);
+
+    /* Handshake markers are found across reads */
+    matched = 0;
+    CHECK(SerialFindMarker((const unsigned char *)"ok\033Lz", 5, kLzssAccept, &matched) == -1);
+    CHECK(SerialFindMarker((const unsigned char *)"1!xy", 4, kLzssAccept, &matched) == 2);
+    matched = 0;
+    CHECK(SerialFindMarker((const unsigned char *)"\033\033Lz1?", 6, kLzssHello, &matched) == 6);
+    CHECK(SerialFindMarker((const unsigned char *)"\033Lz1?", 5, kLzssAccept, &matched) == -1);
+}
+
+/* One end of a simulated channel link */
+typedef struct MuxEnd {
+    MuxState m;
+    MuxIO io;
+    unsigned char wire[4096];       /* Sent, not yet carried across */
+    long wireLength;
+    unsigned char got[kMuxChannels][32768];
+    long gotLength[kMuxChannels];
+    long ends[kMuxChannels];
+    long room[kMuxChannels];        /* What accept() reports */
+    long framesCarried;
+} MuxEnd;
+
+static unsigned long gMuxTicks;
+
+static long MuxEndQueued(void *context)
+{
+    return ((MuxEnd *)context)->wireLength;
+}
+
+static void MuxEndWrite(void *context, const unsigned char *data, long count)
+{
+    MuxEnd *end = (MuxEnd *)context;
+
+    if (end->wireLength + count <= (long)sizeof(end->wire)) {
+        memcpy(end->wire + end->wireLength, data, count);
+        end->wireLength += count;
+    }
+}
+
+static long MuxEndAccept(void *context, short channel)
+{
+    return ((MuxEnd *)context)->room[channel];
+}
+
+static void MuxEndDeliver(void *context, short channel, const unsigned char *data,
+                          long count, int end)
+{
+    MuxEnd *e = (MuxEnd *)context;
+
+    if (e->gotLength[channel] + count <= (long)sizeof(e->got[channel])) {
+        memcpy(e->got[channel] + e->gotLength[channel], data, count);
+        e->gotLength[channel] += count;
+    }
+    e->ends[channel] += end;
+}
+
+static unsigned long MuxEndTicks(void *context)
+{
+    (void)context;
+    return gMuxTicks;
+}
+
+static void MuxEndStart(MuxEnd *end)
+{
+    short i;
+
+    memset(end, 0, sizeof(*end));
+    end->io.context = end;
+    end->io.writeQueued = MuxEndQueued;
+    end->io.write = MuxEndWrite;
+    end->io.accept = MuxEndAccept;
+    end->io.deliver = MuxEndDeliver;
+    end->io.ticks = MuxEndTicks;
+    for (i = 0; i < kMuxChannels; i++) {
+        end->room[i] = 1L << 30;
+    }
+    MuxStart(&end->m, &end->io, 30);
+}
+
+/*
+ * Carry everything from one end's wire to the other. Every damageEvery'th
+ * frame gets a byte flipped, or is dropped outright when drop is set.
+ */
+static void MuxCarry(MuxEnd *from, MuxEnd *to, long damageEvery, int drop)
+{
+    long start;
+    long i;
+
+    start = 0;
+    for (i = 0; i < from->wireLength; i++) {
+        if (from->wire[i] != 0) {
+            continue;
+        }
+        from->framesCarried++;
+        if (damageEvery > 0 && from->framesCarried % damageEvery == 0) {
+            if (!drop) {
+                from->wire[start + (i - start) / 2] ^= 0x01;
+                if (from->wire[start + (i - start) / 2] == 0) {
+                    from->wire[start + (i - start) / 2] = 0x80;
+                }
+                MuxInput(&to->m, from->wire + start, i + 1 - start);
+            }
+        } else {
+            MuxInput(&to->m, from->wire + start, i + 1 - start);
+        }
+        start = i + 1;
+    }
+    memmove(from->wire, from->wire + start, from->wireLength - start);
+    from->wireLength -= start;
+}
+
+static void MuxRun(MuxEnd *a, MuxEnd *b, long steps, long damageEvery, int drop)
+{
+    long i;
+
+    for (i = 0; i < steps; i++) {
+        gMuxTicks++;
+        MuxPoll(&a->m);
+        MuxCarry(a, b, damageEvery, drop);
+        MuxPoll(&b->m);
+        MuxCarry(b, a, damageEvery, drop);
+    }
+}
+
+static void TestMux(void)
+{
+    static MuxEnd a;
+    static MuxEnd b;
+    static unsigned char data[20000];
+    long i;
+    long sent;
+    short matched;
+
+    for (i = 0; i < (long)sizeof(data); i++) {
+        data[i] = (unsigned char)(i * 7 + (i >> 8));
+    }
+
+    /* All three channels at once over a clean line */
+    gMuxTicks = 0;
+    MuxEndStart(&a);
+    MuxEndStart(&b);
+    CHECK(MuxWrite(&a.m, kMuxConsole, (const unsigned char *)"ls\r", 3, 1) == 3);
+    CHECK(MuxWrite(&a.m, kMuxBot, (const unsigned char *)"@bot ping", 9, 1) == 9);
+    CHECK(MuxWrite(&b.m, kMuxConsole, (const unsigned char *)"", 0, 1) == 0);
+    sent = 0;
+    for (i = 0; i < 400 && sent < (long)sizeof(data); i++) {
+        sent += MuxWrite(&a.m, kMuxBulk, data + sent, sizeof(data) - sent, 0);
+        MuxRun(&a, &b, 1, 0, 0);
+    }
+    CHECK(MuxWrite(&a.m, kMuxBulk, data, 0, 1) == 0);
+    MuxRun(&a, &b, 50, 0, 0);
+    CHECK(b.gotLength[kMuxConsole] == 3 && memcmp(b.got[kMuxConsole], "ls\r", 3) == 0);
+    CHECK(b.gotLength[kMuxBot] == 9 && b.ends[kMuxBot] == 1);
+    CHECK(b.gotLength[kMuxBulk] == (long)sizeof(data));
+    CHECK(memcmp(b.got[kMuxBulk], data, sizeof(data)) == 0);
+    CHECK(b.ends[kMuxBulk] == 1);
+    CHECK(a.ends[kMuxConsole] == 1 && a.gotLength[kMuxConsole] == 0);
+    CHECK(a.m.retransmits == 0 && b.m.badFrames == 0);
+    CHECK(MuxIdle(&a.m) && MuxIdle(&b.m));
+
+    /* Damaged frames in both directions are caught and sent again */
+    gMuxTicks = 0;
+    MuxEndStart(&a);
+    MuxEndStart(&b);
+    sent = 0;
+    for (i = 0; i < 4000 && !(sent == (long)sizeof(data) && MuxIdle(&a.m)); i++) {
+        sent += MuxWrite(&a.m, kMuxBulk, data + sent, sizeof(data) - sent, 0);
+        if (i % 50 == 0) {
+            MuxWrite(&b.m, kMuxConsole, (const unsigned char *)"key", 3, 1);
+        }
+        MuxRun(&a, &b, 1, 7, 0);
+    }
+    CHECK(b.gotLength[kMuxBulk] == (long)sizeof(data));
+    CHECK(memcmp(b.got[kMuxBulk], data, sizeof(data)) == 0);
+    CHECK(a.gotLength[kMuxConsole] == a.ends[kMuxConsole] * 3);
+    CHECK(a.m.retransmits > 0 && b.m.badFrames > 0);
+    CHECK(!a.m.failed && !b.m.failed);
+
+    /* Dropped frames too, including acknowledgements */
+    gMuxTicks = 0;
+    MuxEndStart(&a);
+    MuxEndStart(&b);
+    sent = 0;
+    for (i = 0; i < 4000 && !(sent == (long)sizeof(data) && MuxIdle(&a.m)); i++) {
+        sent += MuxWrite(&a.m, kMuxBulk, data + sent, sizeof(data) - sent, 0);
+        MuxRun(&a, &b, 1, 5, 1);
+    }
+    CHECK(b.gotLength[kMuxBulk] == (long)sizeof(data));
+    CHECK(memcmp(b.got[kMuxBulk], data, sizeof(data)) == 0);
+
+    /* Console frames go ahead of bulk data, which waits for the line */
+    gMuxTicks = 0;
+    MuxEndStart(&a);
+    MuxEndStart(&b);
+    MuxWrite(&a.m, kMuxBulk, data, 2000, 0);
+    MuxWrite(&a.m, kMuxConsole, (const unsigned char *)"x", 1, 1);
+    MuxPoll(&a.m);
+    CHECK(a.wireLength < 2 * kMuxMaxFrame);
+    MuxCarry(&a, &b, 0, 0);
+    CHECK(b.gotLength[kMuxConsole] == 1);
+    CHECK(b.gotLength[kMuxBulk] == kMuxMaxPayload);
+
+    /* A stalled reader holds its own channel shut and no other */
+    gMuxTicks = 0;
+    MuxEndStart(&a);
+    MuxEndStart(&b);
+    b.room[kMuxBulk] = 0;
+    MuxWrite(&a.m, kMuxBulk, data, 2000, 0);
+    MuxRun(&a, &b, 200, 0, 0);
+    MuxWrite(&a.m, kMuxConsole, (const unsigned char *)"still here", 10, 1);
+    MuxRun(&a, &b, 5, 0, 0);
+    CHECK(b.gotLength[kMuxBulk] == 0);
+    CHECK(b.gotLength[kMuxConsole] == 10);
+    CHECK(a.m.retransmits == 0 && !a.m.failed);
+    b.room[kMuxBulk] = 1L << 30;
+    MuxRun(&a, &b, 50, 0, 0);
+    CHECK(b.gotLength[kMuxBulk] == 2000);
+
+    /* Close hands the rest of the input back as plain bytes */
+    MuxClose(&a.m);
+    MuxEndWrite(&a, (const unsigned char *)"plain", 5);
+    i = MuxInput(&b.m, a.wire, a.wireLength);
+    CHECK(b.m.closed);
+    CHECK(i == a.wireLength - 5);
+    CHECK(MuxInput(&b.m, a.wire + i, 5) == 0);
+
+    /* Handshake markers are found across reads */
+    matched = 0;
+    CHECK(SerialFindMarker((const unsigned char *)"\033Mx", 3, kMuxAccept, &matched) == -1);
+    CHECK(SerialFindMarker((const unsigned char *)"1!", 2, kMuxAccept, &matched) == 2);
+}
+
+/* What a terminal handed back to the application */
+static char gTermScrolled[8][kTermMaxColumns + 1];
+static short gTermScrolledCount;
+static char gTermReply[32];
+
+static void TermTestScrollOff(void *context, const unsigned char *text, short length)
+{
+    (void)context;
+    if (gTermScrolledCount < 8) {
+        memcpy(gTermScrolled[gTermScrolledCount], text, length);
+        gTermScrolled[gTermScrolledCount][length] = '\0';
+    }
+    gTermScrolledCount++;
+}
+
+static void TermTestReply(void *context, const unsigned char *data, long count)
+{
+    (void)context;
+    memcpy(gTermReply, data, count);
+    gTermReply[count] = '\0';
+}
+
+static void TermSend(TermScreen *t, const char *text)
+{
+    TermWrite(t, (const unsigned char *)text, (long)strlen(text));
+}
+
+/* A row's text with trailing blanks trimmed */
+static const char *TermRow(TermScreen *t, short row)
+{
+    static char text[kTermMaxColumns + 1];
+    short length = TermRowLength(t, row);
+
+    memcpy(text, t->chars[row], length);
+    text[length] = '\0';
+    return text;
+}
+
+static void TestTerminal(void)
+{
+    static TermScreen t;
+    TermIO io;
+    short row;
+
+    io.context = NULL;
+    io.scrollOff = TermTestScrollOff;
+    io.reply = TermTestReply;
+    gTermScrolledCount = 0;
+
+    TermInit(&t, &io, 4, 10);
+    CHECK(t.dirty && t.dirtyLeft[3] == 0 && t.dirtyRight[3] == 10);
+    TermClean(&t);
+
+    /* Plain text, wrap held at the margin until the next character */
+    TermSend(&t, "0123456789");
+    CHECK(strcmp(TermRow(&t, 0), "0123456789") == 0);
+    CHECK(t.row == 0 && t.column == 9 && t.wrapPending);
+    TermSend(&t, "ab\r\ncd");
+    CHECK(strcmp(TermRow(&t, 1), "ab") == 0);
+    CHECK(strcmp(TermRow(&t, 2), "cd") == 0);
+    CHECK(t.row == 2 && t.column == 2);
+
+    /* Only the touched cells are dirty */
+    TermClean(&t);
+    TermSend(&t, "\033[1;4HX");
+    CHECK(t.chars[0][3] == 'X');
+    CHECK(t.dirtyLeft[0] == 3 && t.dirtyRight[0] == 4);
+    CHECK(t.dirtyLeft[1] >= t.dirtyRight[1]);
+
+    /* Erase to end of line and whole display */
+    TermSend(&t, "\033[K");
+    CHECK(strcmp(TermRow(&t, 0), "012X") == 0);
+    TermSend(&t, "\033[2J");
+    for (row = 0; row < 4; row++) {
+        CHECK(TermRow(&t, row)[0] == '\0');
+    }
+
+    /* A sequence split across writes, and a bad one swallowed whole */
+    TermSend(&t, "\033[3");
+    TermSend(&t, ";5H*");
+    CHECK(t.chars[2][4] == '*');
+    TermSend(&t, "\033[1:2Hz");
+    CHECK(t.chars[2][5] == 'z');
+    TermSend(&t, "\033]0;title\007ok");
+    CHECK(t.chars[2][6] == 'o' && t.chars[2][7] == 'k');
+
+    /* Attributes, with a 256-colour code that must not set underline */
+    TermSend(&t, "\033[H\033[1;7;38;5;4mB\033[0mn");
+    CHECK(t.attrs[0][0] == (kTermBold | kTermInverse));
+    CHECK(t.attrs[0][1] == 0);
+
+    /* Whole-screen scrolls are counted and hand the top line over */
+    TermSend(&t, "\033[2J\033[Htop\r\n2\r\n3\r\n4");
+    TermClean(&t);
+    TermSend(&t, "\r\nnew");
+    CHECK(t.scrolled == 1);
+    CHECK(gTermScrolledCount == 1 && strcmp(gTermScrolled[0], "top") == 0);
+    CHECK(strcmp(TermRow(&t, 0), "2") == 0 && strcmp(TermRow(&t, 3), "new") == 0);
+    CHECK(t.dirtyLeft[2] >= t.dirtyRight[2]);
+    CHECK(t.dirtyLeft[3] == 0 && t.dirtyRight[3] == 10);
+
+    /* Scrolling inside a region touches nothing outside it */
+    TermClean(&t);
+    TermSend(&t, "\033[2;3r\033[3;1H\n");
+    CHECK(t.scrolled == 0 && gTermScrolledCount == 1);
+    CHECK(strcmp(TermRow(&t, 0), "2") == 0);
+    CHECK(strcmp(TermRow(&t, 1), "4") == 0 && TermRow(&t, 2)[0] == '\0');
+    CHECK(strcmp(TermRow(&t, 3), "new") == 0);
+    CHECK(t.dirtyLeft[0] >= t.dirtyRight[0] && t.dirtyLeft[3] >= t.dirtyRight[3]);
+    TermSend(&t, "\033[r");
+    CHECK(t.top == 0 && t.bottom == 3);
+
+    /* Insert and delete characters */
+    TermSend(&t, "\033[2J\033[Habcdef\033[1;2H\033[2@");
+    CHECK(strcmp(TermRow(&t, 0), "a  bcdef") == 0);
+    TermSend(&t, "\033[3P");
+    CHECK(strcmp(TermRow(&t, 0), "acdef") == 0);
+
+    /* Status reports go back through the reply hook */
+    TermSend(&t, "\033[4;7H\033[6n");
+    CHECK(strcmp(gTermReply, "\033[4;7R") == 0);
+    TermSend(&t, "\033[c");
+    CHECK(strcmp(gTermReply, "\033[?1;0c") == 0);
+
+    /* Modes: cursor visibility, auto wrap off, line drawing */
+    TermSend(&t, "\033[?25l");
+    CHECK(!t.cursorVisible);
+    TermSend(&t, "\033[?7l\033[2;1H0123456789XYZ");
+    CHECK(strcmp(TermRow(&t, 1), "012345678Z") == 0 && t.row == 1);
+    TermSend(&t, "\033[?7h\033[?25h\033[3;1H\033(0lqk\033(Bq");
+    CHECK(strcmp(TermRow(&t, 2), "+-+q") == 0);
+
+    /* Reset clears everything and leaves it all dirty */
+    TermClean(&t);
+    TermSend(&t, "\033c");
+    CHECK(TermRow(&t, 1)[0] == '\0' && t.row == 0 && t.column == 0);
+    CHECK(t.dirtyLeft[0] == 0 && t.dirtyRight[0] == 10);
+
+    /* Bells are counted, not drawn */
+    TermSend(&t, "\007\007");
+    CHECK(t.bells == 2 && TermRow(&t, 0)[0] == '\0');
+}
+
+/* Pixel x, y of a 1-bit image, leftmost pixel in the high bit */
+static int GlyphPixel(const unsigned char *image, long rowBytes, long x, long y)
+{
+    return (image[y * rowBytes + x / 8] >> (7 - x % 8)) & 1;
+}
+
+static void TestGlyphs(void)
+{
+    static unsigned char strip[kGlyphStripRowBytes * 11];
+    static GlyphAtlas atlas;
+    static const unsigned char text[] = "Hello, glyphs! \x7F\xA5";
+    unsigned char line[GlyphRowBytes(40, 6) * 11];
+    short rowBytes = (short)GlyphRowBytes(40, 6);
+    long x;
+    long y;
+    long i;
+    int same;
+
+    /* A made-up font with different bits in every row of every code */
+    for (i = 0; i < (long)sizeof(strip); i++) {
+        strip[i] = (unsigned char)(i * 37 + (i >> 8) * 11);
+    }
+
+    CHECK(!GlyphLoad(&atlas, strip, 9, 11));
+    CHECK(!GlyphLoad(&atlas, strip, 6, kGlyphMaxHeight + 1));
+    CHECK(GlyphLoad(&atlas, strip, 6, 11));
+
+    /* Each character's cell shows the left 6 pixels of its strip cell */
+    memset(line, 0xFF, sizeof(line));
+    GlyphCompose(&atlas, text, (short)(sizeof(text) - 1), line, rowBytes);
+    same = 1;
+    for (y = 0; y < 11; y++) {
+        for (x = 0; x < rowBytes * 8; x++) {
+            i = x / 6;
+            if (i < (long)sizeof(text) - 1) {
+                if (GlyphPixel(line, rowBytes, x, y) !=
+                    GlyphPixel(strip, kGlyphStripRowBytes, text[i] * 8 + x % 6, y)) {
+                    same = 0;
+                }
+            } else if (GlyphPixel(line, rowBytes, x, y)) {
+                /* Past the text the line is clear */
+                same = 0;
+            }
+        }
+    }
+    CHECK(same);
+
+    /* More text than the row holds stops at the edge */
+    memset(line, 0xFF, sizeof(line));
+    GlyphCompose(&atlas, strip, 200, line, 4);
+    CHECK(GlyphPixel(line, 4, 24, 0) == GlyphPixel(strip, kGlyphStripRowBytes,
+                                                   strip[4] * 8, 0));
+    CHECK(!GlyphPixel(line, 4, 30, 0) && !GlyphPixel(line, 4, 31, 10));
+    CHECK(line[4 * 11] == 0xFF);
+}
+
+static void TestFind(void)
+{
+    static FindState f;
+    ScrollbackStore sb;
+    FindHit *hit;
+    unsigned long searched;
+    char line[32];
+    long i;
+    long length;
+
+    MakeStore(&sb, 2, 20, 5);
+    FindInit(&f);
+
+    ScrollbackAppend(&sb, "boot ok\rERROR 12 disk\rerror 7\rno errors here\r", 45);
+    ScrollbackAppend(&sb, "aaaa\r", 5);
+
+    /* Exact case, then ignoring it */
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"ERROR", 5, 0) == 1);
+    CHECK(FindHitAt(&f, 0)->line == 1 && FindHitAt(&f, 0)->column == 0);
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"error", 5, 1) == 3);
+    hit = FindHitAt(&f, 2);
+    CHECK(hit->line == 3 && hit->column == 3);
+
+    /* Overlapping matches are all found */
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"aa", 2, 0) == 3);
+
+    /* A longer pattern re-checks the hits instead of searching again */
+    FindSearch(&f, &sb, (const unsigned char *)"err", 3, 1);
+    searched = f.linesSearched;
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"error ", 6, 1) == 2);
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"error 7", 7, 1) == 1);
+    CHECK(f.linesSearched == searched);
+    CHECK(FindHitAt(&f, 0)->line == 2);
+
+    /* Only new text is searched as it arrives, and the open line again */
+    ScrollbackAppend(&sb, "late error 7", 12);
+    FindUpdate(&f, &sb);
+    CHECK(f.count == 2 && f.linesSearched == searched + 1);
+    ScrollbackAppend(&sb, "; error 7\r", 10);
+    FindUpdate(&f, &sb);
+    CHECK(f.count == 2 && f.linesSearched == searched + 3);
+    CHECK(FindHitAt(&f, 1)->line == 5 && FindHitAt(&f, 1)->column == 5);
+
+    /* The second match was split by wrapping at 20 columns, so it is not found */
+    CHECK(sb.lineCount == 7 && strcmp(LineText(&sb, 6), "7") == 0);
+
+    /* Lookup by position */
+    CHECK(FindHitIndex(&f, 0, 0) == 0);
+    CHECK(FindHitIndex(&f, 2, 1) == 1);
+    CHECK(FindHitIndex(&f, 5, 5) == 1);
+    CHECK(FindHitIndex(&f, 6, 0) == 2);
+
+    /* Hits on lines trimmed from the store are forgotten */
+    for (i = 0; i < 2000; i++) {
+        length = sprintf(line, "line %ld\r", i);
+        ScrollbackAppend(&sb, line, length);
+    }
+    FindUpdate(&f, &sb);
+    CHECK(f.count == 0);
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"line 1999", 9, 0) == 1);
+    CHECK(FindHitAt(&f, 0)->line == sb.firstLine + sb.lineCount - 1);
+
+    /* A full ring keeps the newest hits */
+    ScrollbackClear(&sb);
+    for (i = 0; i < kFindMaxHits + 10; i++) {
+        ScrollbackAppend(&sb, "x\r", 2);
+    }
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"x", 1, 0) == kFindMaxHits);
+    CHECK(f.dropped == 10 && FindHitAt(&f, 0)->line == 10);
+
+    /* An empty pattern finds nothing */
+    CHECK(FindSearch(&f, &sb, (const unsigned char *)"", 0, 0) == 0);
+
+    FreeStore(&sb);
+}
+
+/*
+ * Scan text in pieces of the given size and list the entries fired, as
+ * digits in the order they fired
+ */
+static const char *TriggersFired(TrigSet *t, const char *text, long piece)
+{
+    static char fired[64];
+    unsigned long mask;
+    long length;
+    long count;
+    long used;
+    short i;
+    int n;
+
+    n = 0;
+    length = (long)strlen(text);
+    while (length > 0) {
+        count = (length < piece) ? length : piece;
+        while (count > 0) {
+            used = TrigScan(t, (const unsigned char *)text, count, &mask);
+            for (i = 0; i < kTrigMaxTriggers; i++) {
+                if ((mask & (1UL << i)) && n < (int)sizeof(fired) - 1) {
+                    fired[n++] = (char)('0' + i);
+                }
+            }
+            text += used;
+            length -= used;
+            count -= used;
+        }
+    }
+    fired[n] = 0;
+    return fired;
+}
+
+static void TestTriggers(void)
+{
+    static TrigSet t;
+    static const char list[] =
+        "# Comments and blank lines are skipped\r"
+        "\r"
+        "login: => send guest\\r\n"
+        "  ERROR   =>   BEEP  \r"
+        "he => capture on\r"
+        "she => capture off\r"
+        "hers => beep\r"
+        "\\x1B[5i => send \\e\\x41\\\\\r";
+    char many[512];
+    short badLine;
+    long length;
+    short i;
+
+    CHECK(TrigLoad(&t, list, (long)strlen(list), &badLine) == kTrigOK);
+    CHECK(t.count == 6 && badLine == 0);
+    CHECK(t.entries[0].action == kTrigSend && t.entries[0].textLength == 6 &&
+          memcmp(t.entries[0].text, "guest\r", 6) == 0);
+    CHECK(t.entries[1].action == kTrigBeep && t.entries[1].patternLength == 5);
+    CHECK(t.entries[2].action == kTrigCaptureOn && t.entries[3].action == kTrigCaptureOff);
+    CHECK(t.entries[5].patternLength == 4 && t.entries[5].pattern[0] == 0x1B);
+    CHECK(t.entries[5].textLength == 3 && memcmp(t.entries[5].text, "\x1B" "A\\", 3) == 0);
+
+    /* Overlapping patterns: "she" holds "he", and "hers" follows on */
+    CHECK(strcmp(TriggersFired(&t, "ushers", 100), "234") == 0);
+
+    /* The same wherever the batches split */
+    CHECK(strcmp(TriggersFired(&t, "xx login: yy ERROR zz", 100), "01") == 0);
+    CHECK(strcmp(TriggersFired(&t, "xx login: yy ERROR zz", 1), "01") == 0);
+    CHECK(strcmp(TriggersFired(&t, "log", 100), "") == 0);
+    CHECK(strcmp(TriggersFired(&t, "in: \x1B[5i", 2), "05") == 0);
+    CHECK(strcmp(TriggersFired(&t, "ERRO ERROR", 3), "1") == 0);
+
+    /* Errors name the line and leave nothing armed */
+    CHECK(TrigLoad(&t, "ok => beep\rno arrow here\r", 25, &badLine) == kTrigErrSyntax);
+    CHECK(badLine == 2 && t.count == 0);
+    CHECK(strcmp(TriggersFired(&t, "ok", 100), "") == 0);
+    CHECK(TrigLoad(&t, "x => explode", 12, &badLine) == kTrigErrSyntax && badLine == 1);
+    CHECK(TrigLoad(&t, " => beep", 8, &badLine) == kTrigErrSyntax);
+    CHECK(TrigLoad(&t, "x => send 0123456789012345678901234567890123456789", 50,
+                   &badLine) == kTrigErrTooLong);
+
+    length = 0;
+    for (i = 0; i <= kTrigMaxTriggers; i++) {
+        length += sprintf(many + length, "p%d => beep\r", i);
+    }
+    CHECK(TrigLoad(&t, many, length, &badLine) == kTrigErrTooMany &&
+          badLine == kTrigMaxTriggers + 1);
+
+    /* More distinct bytes than the table has classes */
+    length = 0;
+    for (i = 0; i < kTrigMaxClasses; i++) {
+        length += sprintf(many + length, "\\x%02X", 0x80 + i);
+        if (i % 8 == 7) {
+            length += sprintf(many + length, " => beep\r");
+        }
+    }
+    CHECK(TrigLoad(&t, many, length, &badLine) == kTrigErrTooBig && badLine == 0);
+}
+
+int main(void)
+{
+    TestOutgoing();
+    TestIncoming();
+    TestReady();
+    TestScrollbackWrap();
+    TestScrollbackTrim();
+    TestCrc();
+    TestTransfer();
+    TestLzss();
+    TestMux();
+    TestTerminal();
+    TestGlyphs();
+    TestFind();
+    TestTriggers();
+
+    if (gFailures != 0) {
+        printf("%d check(s) failed\n", gFailures);
+        return 1;
+    }
+    printf("All serial core tests passed\n");
+    return 0;
+}
@@ -0,0 +1,1534 @@
+/*
+ * transfer.c - ZMODEM, YMODEM and XMODEM-1K file transfer engine
+ *
+ * Both roles of all three protocols are driven from XferInput() for
+ * received bytes and XferPoll() for streaming and timeouts. Nothing
+ * here blocks: every wait is a phase plus a tick timer, so the
+ * application keeps handling events while a transfer runs.
+ */
+
+#include <string.h>
+
+#include "transfer.h"
+
+/* Control characters */
+#define SOH     0x01
+#define STX     0x02
+#define EOT     0x04
+#define ACK     0x06
+#define BS      0x08
+#define NAK     0x15
+#define CAN     0x18
+#define SUB     0x1A
+#define XON     0x11
+#define XOFF    0x13
+#define ZDLE    0x18
+
+/* ZMODEM frame types */
+#define ZRQINIT     0
+#define ZRINIT      1
+#define ZSINIT      2
+#define ZACK        3
+#define ZFILE       4
+#define ZSKIP       5
+#define ZNAK        6
+#define ZABORT      7
+#define ZFIN        8
+#define ZRPOS       9
+#define ZDATA       10
+#define ZEOF        11
+#define ZFERR       12
+#define ZCRC        13
+#define ZCOMMAND    18
+
+/* Subpacket terminators following ZDLE */
+#define ZCRCE       'h'     /* End of frame, header follows */
+#define ZCRCG       'i'     /* Frame continues nonstop */
+#define ZCRCQ       'j'     /* Frame continues, ZACK expected */
+#define ZCRCW       'k'     /* End of frame, ZACK expected */
+#define ZRUB0       'l'
+#define ZRUB1       'm'
+
+/* ZRINIT capability flags (ZF0) and ZFILE conversion option */
+#define CANFDX      0x01
+#define CANOVIO     0x02
+#define CANFC32     0x20
+#define ZCBIN       1
+
+/* Header byte positions: P0..P3 carry a position, ZF0 is the last */
+#define ZP0         0
+#define ZF0         3
+
+/* Decoder states */
+#define kZSeekPad       0
+#define kZSeekZdle      1
+#define kZSeekFormat    2
+#define kZHexHeader     3
+#define kZBinHeader     4
+#define kZData          5
+#define kZDataCrc       6
+
+#define kBHead          0
+#define kBNumber        1
+#define kBNumberInv     2
+#define kBData          3
+#define kBCrcHigh       4
+#define kBCrcLow        5
+
+/* Phases */
+enum {
+    kSendZInit,         /* ZRQINIT sent, waiting for ZRINIT */
+    kSendZFile,         /* ZFILE sent, waiting for ZRPOS */
+    kSendZData,         /* Streaming subpackets */
+    kSendZEof,          /* ZEOF sent, waiting for ZRINIT */
+    kSendZFin,          /* ZFIN sent, waiting for ZFIN */
+    kSendYStart,        /* Waiting for the receiver's 'C' */
+    kSendYHeaderAck,    /* Block 0 sent, waiting for ACK */
+    kSendYDataStart,    /* Block 0 ACKed, waiting for 'C' */
+    kSendYDataAck,      /* Data block sent, waiting for ACK */
+    kSendYEotAck,       /* EOT sent, waiting for ACK */
+    kSendYEndStart,     /* Waiting for 'C' before the empty block 0 */
+    kSendYEndAck,       /* Empty block 0 sent, waiting for ACK */
+
+    kRecvZInit,         /* ZRINIT sent, waiting for ZFILE */
+    kRecvZFileInfo,     /* Decoding the ZFILE subpacket */
+    kRecvZSinit,        /* Decoding the ZSINIT subpacket */
+    kRecvZWaitData,     /* ZRPOS sent, waiting for ZDATA or ZEOF */
+    kRecvZData,         /* Decoding data subpackets */
+    kRecvZFin,          /* ZFIN answered, waiting for "OO" */
+    kRecvYStart,        /* Sending 'C', waiting for a first block */
+    kRecvYData          /* Receiving data blocks */
+};
+
+/* Waits, in ticks */
+#define kXferRetryTicks     180     /* Resend an init or header */
+#define kXferDataTicks      600     /* Silence in the middle of a file */
+#define kXferFinTicks       60      /* Wait for "OO" after ZFIN */
+#define kXferMaxRetries     10
+#define kXferFallbackTries  3       /* ZRINITs before trying YMODEM */
+
+static unsigned short gCrc16Table[256];
+static unsigned long gCrc32Table[256];
+static int gCrcTablesBuilt = 0;
+
+static const char kHexDigits[] = "0123456789abcdef";
+
+/*
+ * Build the tables for the CCITT CRC-16 (XMODEM variant) and the IEEE
+ * CRC-32
+ */
+static void BuildCrcTables(void)
+{
+    unsigned long c;
+    unsigned short s;
+    int i, bit;
+
+    for (i = 0; i < 256; i++) {
+        s = (unsigned short)(i << 8);
+        for (bit = 0; bit < 8; bit++) {
+            s = (s & 0x8000) ? (unsigned short)((s << 1) ^ 0x1021) : (unsigned short)(s << 1);
+        }
+        gCrc16Table[i] = s;
+
+        c = (unsigned long)i;
+        for (bit = 0; bit < 8; bit++) {
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : c >> 1;
+        }
+        gCrc32Table[i] = c;
+    }
+    gCrcTablesBuilt = 1;
+}
+
+unsigned short XferCrc16(unsigned short crc, const unsigned char *data, long count)
+{
+    if (!gCrcTablesBuilt) {
+        BuildCrcTables();
+    }
+    while (count-- > 0) {
+        crc = (unsigned short)((crc << 8) ^ gCrc16Table[((crc >> 8) ^ *data++) & 0xFF]);
+    }
+    return crc;
+}
+
+/*
+ * Continue a CRC-32; pass 0xFFFFFFFF to start and complement the result
+ */
+unsigned long XferCrc32(unsigned long crc, const unsigned char *data, long count)
+{
+    if (!gCrcTablesBuilt) {
+        BuildCrcTables();
+    }
+    while (count-- > 0) {
+        crc = (crc >> 8) ^ gCrc32Table[(crc ^ *data++) & 0xFF];
+    }
+    return crc & 0xFFFFFFFFUL;
+}
+
+/*
+ * Output is gathered in x->out and handed to the application in
+ * pieces no larger than the buffer
+ */
+static void FlushOutput(XferState *x)
+{
+    if (x->outLength > 0) {
+        x->io->write(x->io->context, x->out, x->outLength);
+        x->outLength = 0;
+    }
+}
+
+static void PutByte(XferState *x, unsigned char c)
+{
+    if (x->outLength >= (long)sizeof(x->out)) {
+        FlushOutput(x);
+    }
+    x->out[x->outLength++] = c;
+}
+
+static void PutBytes(XferState *x, const unsigned char *data, long count)
+{
+    while (count-- > 0) {
+        PutByte(x, *data++);
+    }
+}
+
+static unsigned long Now(XferState *x)
+{
+    return x->io->ticks(x->io->context);
+}
+
+static void StartWait(XferState *x, short phase)
+{
+    x->phase = phase;
+    x->timer = Now(x);
+}
+
+static void Finish(XferState *x, short status, const char *message)
+{
+    FlushOutput(x);
+    x->status = status;
+    x->message = message;
+}
+
+/*
+ * Stop the transfer and tell the far end to stop too
+ */
+static void Fail(XferState *x, const char *message)
+{
+    int i;
+
+    if (!x->sending && x->fileName[0] != '\0' && x->position >= 0) {
+        x->io->closeFile(x->io->context, 0);
+    }
+    for (i = 0; i < 8; i++) {
+        PutByte(x, CAN);
+    }
+    for (i = 0; i < 10; i++) {
+        PutByte(x, BS);
+    }
+    Finish(x, kXferFailed, message);
+}
+
+/* ------------------------------------------------------------------ */
+/* ZMODEM encoding                                                     */
+
+static void PositionBytes(unsigned char *p, long position)
+{
+    p[0] = (unsigned char)(position & 0xFF);
+    p[1] = (unsigned char)((position >> 8) & 0xFF);
+    p[2] = (unsigned char)((position >> 16) & 0xFF);
+    p[3] = (unsigned char)((position >> 24) & 0xFF);
+}
+
+static long HeaderPosition(const unsigned char *header)
+{
+    return (long)header[1] | ((long)header[2] << 8) |
+           ((long)header[3] << 16) | ((long)header[4] << 24);
+}
+
+static void PutHex(XferState *x, unsigned char c)
+{
+    PutByte(x, (unsigned char)kHexDigits[c >> 4]);
+    PutByte(x, (unsigned char)kHexDigits[c & 0x0F]);
+}
+
+/*
+ * ZDLE-encode one byte of a binary header or subpacket
+ */
+static void PutEscaped(XferState *x, unsigned char c, unsigned char *last)
+{
+    switch (c) {
+        case ZDLE: case 0x10: case XON: case XOFF:
+        case 0x90: case 0x91: case 0x93: case 0x98:
+            PutByte(x, ZDLE);
+            c ^= 0x40;
+            break;
+        case '\r': case 0x8D:
+            if ((*last & 0x7F) == '@') {
+                PutByte(x, ZDLE);
+                c ^= 0x40;
+            }
+            break;
+    }
+    PutByte(x, c);
+    *last = c;
+}
+
+static void SendHexHeader(XferState *x, unsigned char type, const unsigned char *p)
+{
+    unsigned char header[5];
+    unsigned short crc;
+    int i;
+
+    header[0] = type;
+    memcpy(header + 1, p, 4);
+    crc = XferCrc16(0, header, 5);
+
+    PutByte(x, '*');
+    PutByte(x, '*');
+    PutByte(x, ZDLE);
+    PutByte(x, 'B');
+    for (i = 0; i < 5; i++) {
+        PutHex(x, header[i]);
+    }
+    PutHex(x, (unsigned char)(crc >> 8));
+    PutHex(x, (unsigned char)(crc & 0xFF));
+    PutByte(x, '\r');
+    PutByte(x, 0x8A);
+    if (type != ZFIN && type != ZACK) {
+        PutByte(x, XON);
+    }
+}
+
+static void SendHexPosition(XferState *x, unsigned char type, long position)
+{
+    unsigned char p[4];
+
+    PositionBytes(p, position);
+    SendHexHeader(x, type, p);
+}
+
+static void SendBinaryHeader(XferState *x, unsigned char type, const unsigned char *p)
+{
+    unsigned char header[5];
+    unsigned char last = 0;
+    unsigned long crc32;
+    unsigned short crc;
+    int i;
+
+    header[0] = type;
+    memcpy(header + 1, p, 4);
+
+    PutByte(x, '*');
+    PutByte(x, ZDLE);
+    PutByte(x, x->zUseCrc32 ? 'C' : 'A');
+    for (i = 0; i < 5; i++) {
+        PutEscaped(x, header[i], &last);
+    }
+    if (x->zUseCrc32) {
+        crc32 = ~XferCrc32(0xFFFFFFFFUL, header, 5) & 0xFFFFFFFFUL;
+        for (i = 0; i < 4; i++) {
+            PutEscaped(x, (unsigned char)((crc32 >> (8 * i)) & 0xFF), &last);
+        }
+    } else {
+        crc = XferCrc16(0, header, 5);
+        PutEscaped(x, (unsigned char)(crc >> 8), &last);
+        PutEscaped(x, (unsigned char)(crc & 0xFF), &last);
+    }
+}
+
+static void SendBinaryPosition(XferState *x, unsigned char type, long position)
+{
+    unsigned char p[4];
+
+    PositionBytes(p, position);
+    SendBinaryHeader(x, type, p);
+}
+
+/*
+ * Send a subpacket: the data, the ZDLE frame end, then a CRC over both
+ */
+static void SendSubpacket(XferState *x, const unsigned char *data, long count,
+                          unsigned char frameEnd)
+{
+    unsigned char last = 0;
+    unsigned long crc32;
+    unsigned short crc;
+    long i;
+
+    for (i = 0; i < count; i++) {
+        PutEscaped(x, data[i], &last);
+    }
+    PutByte(x, ZDLE);
+    PutByte(x, frameEnd);
+
+    if (x->zUseCrc32) {
+        crc32 = XferCrc32(0xFFFFFFFFUL, data, count);
+        crc32 = ~XferCrc32(crc32, &frameEnd, 1) & 0xFFFFFFFFUL;
+        for (i = 0; i < 4; i++) {
+            PutEscaped(x, (unsigned char)((crc32 >> (8 * i)) & 0xFF), &last);
+        }
+    } else {
+        crc = XferCrc16(XferCrc16(0, data, count), &frameEnd, 1);
+        PutEscaped(x, (unsigned char)(crc >> 8), &last);
+        PutEscaped(x, (unsigned char)(crc & 0xFF), &last);
+    }
+    if (frameEnd == ZCRCW) {
+        PutByte(x, XON);
+    }
+}
+
+static void SendZRInit(XferState *x)
+{
+    unsigned char p[4];
+
+    p[0] = 0;
+    p[1] = 0;
+    p[2] = 0;
+    p[ZF0] = CANFDX | CANOVIO | CANFC32;
+    SendHexHeader(x, ZRINIT, p);
+}
+
+/* ------------------------------------------------------------------ */
+/* X/YMODEM encoding                                                   */
+
+/*
+ * Send an SOH or STX block with a CRC-16, padding short data
+ */
+static void SendBlock(XferState *x, unsigned char number, const unsigned char *data,
+                      long count, short size, unsigned char pad)
+{
+    unsigned char *block = x->block;
+    unsigned short crc;
+
+    memcpy(block, data, (size_t)count);
+    memset(block + count, pad, (size_t)(size - count));
+    crc = XferCrc16(0, block, size);
+
+    PutByte(x, size == 128 ? SOH : STX);
+    PutByte(x, number);
+    PutByte(x, (unsigned char)~number);
+    PutBytes(x, block, size);
+    PutByte(x, (unsigned char)(crc >> 8));
+    PutByte(x, (unsigned char)(crc & 0xFF));
+    FlushOutput(x);
+}
+
+/*
+ * Send block 0 holding "name\0size\0", or an empty one to end the batch
+ */
+static void SendYHeader(XferState *x, int empty)
+{
+    unsigned char info[128];
+    long length = 0;
+    char digits[12];
+    long size;
+    int n = 0;
+
+    memset(info, 0, sizeof(info));
+    if (!empty) {
+        length = (long)strlen(x->fileName);
+        memcpy(info, x->fileName, (size_t)length);
+        length++;
+        size = x->fileSize;
+        do {
+            digits[n++] = (char)('0' + size % 10);
+            size /= 10;
+        } while (size > 0 && n < 11);
+        while (n > 0) {
+            info[length++] = (unsigned char)digits[--n];
+        }
+        length++;
+    }
+    SendBlock(x, 0, info, length, 128, 0);
+}
+
+/*
+ * Send the block at x->position; short tails go as 128-byte blocks
+ */
+static void SendYData(XferState *x)
+{
+    long count;
+    short size;
+
+    count = x->fileSize - x->position;
+    if (count > kXferBlockSize) {
+        count = kXferBlockSize;
+    }
+    size = count > 128 ? kXferBlockSize : 128;
+    count = x->io->readFile(x->io->context, x->position, x->fileData, count);
+    if (count < 0) {
+        Fail(x, "File read error");
+        return;
+    }
+    x->bSize = (short)count;
+    SendBlock(x, x->bNumber, x->fileData, count, size, SUB);
+    StartWait(x, kSendYDataAck);
+}
+
+static void SendYEot(XferState *x)
+{
+    PutByte(x, EOT);
+    FlushOutput(x);
+    StartWait(x, kSendYEotAck);
+}
+
+/*
+ * The receiver asked for CRC blocks with 'C'
+ */
+static void StartYSend(XferState *x)
+{
+    x->retries = 0;
+    x->bNumber = 1;
+    if (x->protocol == kXferYModem) {
+        SendYHeader(x, 0);
+        StartWait(x, kSendYHeaderAck);
+    } else if (x->fileSize > 0) {
+        SendYData(x);
+    } else {
+        SendYEot(x);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Sender                                                              */
+
+static void SendZFile(XferState *x)
+{
+    unsigned char info[kXferMaxName + 16];
+    unsigned char p[4];
+    char digits[12];
+    long length, size;
+    int n = 0;
+
+    length = (long)strlen(x->fileName) + 1;
+    memcpy(info, x->fileName, (size_t)length);
+    size = x->fileSize;
+    do {
+        digits[n++] = (char)('0' + size % 10);
+        size /= 10;
+    } while (size > 0 && n < 11);
+    while (n > 0) {
+        info[length++] = (unsigned char)digits[--n];
+    }
+    info[length++] = 0;
+
+    p[0] = 0;
+    p[1] = 0;
+    p[2] = 0;
+    p[ZF0] = ZCBIN;
+    SendBinaryHeader(x, ZFILE, p);
+    SendSubpacket(x, info, length, ZCRCW);
+    FlushOutput(x);
+    StartWait(x, kSendZFile);
+}
+
+static void SendZFin(XferState *x)
+{
+    unsigned char p[4];
+
+    memset(p, 0, sizeof(p));
+    SendHexHeader(x, ZFIN, p);
+    FlushOutput(x);
+    StartWait(x, kSendZFin);
+}
+
+/*
+ * The receiver asked for data from an earlier offset
+ */
+static void Reposition(XferState *x, long position)
+{
+    if (position < 0 || position > x->fileSize) {
+        Fail(x, "Bad ZRPOS");
+        return;
+    }
+    if (position == x->zLastRpos) {
+        if (++x->retries > kXferMaxRetries) {
+            Fail(x, "Too many errors");
+            return;
+        }
+    } else {
+        x->retries = 0;
+    }
+    x->zLastRpos = position;
+    x->position = position;
+    x->zDataHeaderDue = 1;
+    StartWait(x, kSendZData);
+}
+
+static void SenderHeader(XferState *x, unsigned char type)
+{
+    long position = HeaderPosition(x->zHeader);
+
+    switch (x->phase) {
+        case kSendZInit:
+            if (type == ZRINIT) {
+                x->zUseCrc32 = (x->zHeader[4] & CANFC32) != 0;
+                x->retries = 0;
+                SendZFile(x);
+            }
+            break;
+        case kSendZFile:
+            if (type == ZRPOS) {
+                x->zLastRpos = -1;
+                Reposition(x, position);
+            } else if (type == ZSKIP) {
+                x->position = x->fileSize;
+                SendZFin(x);
+            } else if (type == ZRINIT && Now(x) - x->timer > kXferRetryTicks) {
+                SendZFile(x);
+            }
+            break;
+        case kSendZData:
+        case kSendZEof:
+            if (type == ZRPOS) {
+                Reposition(x, position);
+            } else if (type == ZSKIP) {
+                SendZFin(x);
+            } else if (type == ZRINIT && x->phase == kSendZEof) {
+                x->filesDone++;
+                SendZFin(x);
+            }
+            break;
+        case kSendZFin:
+            if (type == ZFIN) {
+                PutByte(x, 'O');
+                PutByte(x, 'O');
+                Finish(x, kXferDone, NULL);
+            }
+            break;
+    }
+    if (type == ZABORT || type == ZFERR) {
+        Finish(x, kXferFailed, "Receiver aborted");
+    }
+}
+
+static void SenderYByte(XferState *x, unsigned char c)
+{
+    switch (x->phase) {
+        case kSendZInit:
+            /* A receiver that never answers ZMODEM but asks for CRC blocks */
+            if (c == 'C' && x->allowFallback) {
+                x->protocol = kXferYModem;
+                StartYSend(x);
+            }
+            break;
+        case kSendYStart:
+            if (c == 'C') {
+                StartYSend(x);
+            }
+            break;
+        case kSendYHeaderAck:
+            if (c == ACK) {
+                StartWait(x, kSendYDataStart);
+            } else if (c == NAK || c == 'C') {
+                SendYHeader(x, 0);
+            }
+            break;
+        case kSendYDataStart:
+            if (c == 'C') {
+                x->retries = 0;
+                if (x->fileSize > 0) {
+                    SendYData(x);
+                } else {
+                    SendYEot(x);
+                }
+            }
+            break;
+        case kSendYDataAck:
+            if (c == ACK) {
+                x->retries = 0;
+                x->position += x->bSize;
+                x->bNumber++;
+                if (x->position < x->fileSize) {
+                    SendYData(x);
+                } else {
+                    SendYEot(x);
+                }
+            } else if (c == NAK) {
+                if (++x->retries > kXferMaxRetries) {
+                    Fail(x, "Too many errors");
+                } else {
+                    SendYData(x);
+                }
+            }
+            break;
+        case kSendYEotAck:
+            if (c == ACK) {
+                x->filesDone++;
+                if (x->protocol == kXferYModem) {
+                    StartWait(x, kSendYEndStart);
+                } else {
+                    Finish(x, kXferDone, NULL);
+                }
+            } else if (c == NAK) {
+                SendYEot(x);
+            }
+            break;
+        case kSendYEndStart:
+            if (c == 'C') {
+                SendYHeader(x, 1);
+                StartWait(x, kSendYEndAck);
+            }
+            break;
+        case kSendYEndAck:
+            if (c == ACK) {
+                Finish(x, kXferDone, NULL);
+            } else if (c == NAK) {
+                SendYHeader(x, 1);
+            }
+            break;
+    }
+}
+
+/*
+ * Queue subpackets while the application has room
+ */
+static void StreamZData(XferState *x)
+{
+    unsigned char frameEnd;
+    long count;
+
+    while (x->status == kXferRunning && x->phase == kSendZData &&
+           x->io->writeRoom(x->io->context) >= kXferMaxPacketOut) {
+        if (x->zDataHeaderDue) {
+            SendBinaryPosition(x, ZDATA, x->position);
+            x->zDataHeaderDue = 0;
+        }
+        count = x->fileSize - x->position;
+        if (count > kXferBlockSize) {
+            count = kXferBlockSize;
+        }
+        count = x->io->readFile(x->io->context, x->position, x->fileData, count);
+        if (count < 0) {
+            Fail(x, "File read error");
+            return;
+        }
+        frameEnd = (x->position + count >= x->fileSize) ? ZCRCE : ZCRCG;
+        SendSubpacket(x, x->fileData, count, frameEnd);
+        x->position += count;
+        if (frameEnd == ZCRCE) {
+            SendBinaryPosition(x, ZEOF, x->position);
+            StartWait(x, kSendZEof);
+        }
+        FlushOutput(x);
+        x->timer = Now(x);
+    }
+}
+
+static void SenderTimeout(XferState *x)
+{
+    unsigned long elapsed = Now(x) - x->timer;
+    unsigned long limit = kXferRetryTicks;
+
+    if (x->phase == kSendZData) {
+        return;
+    }
+    if (x->phase == kSendYStart || x->phase == kSendYDataAck) {
+        limit = kXferDataTicks;
+    }
+    if (elapsed < limit) {
+        return;
+    }
+
+    if (++x->retries > kXferMaxRetries) {
+        Fail(x, "Timed out");
+        return;
+    }
+    x->timer = Now(x);
+    switch (x->phase) {
+        case kSendZInit:
+            SendHexPosition(x, ZRQINIT, 0);
+            break;
+        case kSendZFile:
+            SendZFile(x);
+            break;
+        case kSendZEof:
+            SendBinaryPosition(x, ZEOF, x->position);
+            break;
+        case kSendZFin:
+            if (x->retries > 3) {
+                Finish(x, kXferDone, NULL);
+            } else {
+                SendZFin(x);
+            }
+            break;
+        case kSendYHeaderAck:
+            SendYHeader(x, 0);
+            break;
+        case kSendYDataAck:
+            SendYData(x);
+            break;
+        case kSendYEotAck:
+            SendYEot(x);
+            break;
+        case kSendYEndAck:
+            SendYHeader(x, 1);
+            break;
+    }
+    FlushOutput(x);
+}
+
+/* ------------------------------------------------------------------ */
+/* Receiver                                                            */
+
+static void SendZRPos(XferState *x)
+{
+    SendHexPosition(x, ZRPOS, x->position);
+    StartWait(x, kRecvZWaitData);
+}
+
+/*
+ * Parse "name\0size ..." from ZFILE or block 0 and create the file
+ */
+static int OpenReceivedFile(XferState *x, const unsigned char *info, long count)
+{
+    const unsigned char *name = info;
+    const unsigned char *p;
+    long length = 0;
+    long size = -1;
+
+    while (length < count && info[length] != 0) {
+        length++;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    for (p = info; p < info + length; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    length = (long)(info + length - name);
+    if (length >= kXferMaxName) {
+        length = kXferMaxName - 1;
+    }
+    memcpy(x->fileName, name, (size_t)length);
+    x->fileName[length] = '\0';
+
+    p = name + length;
+    while (p < info + count && *p != 0) {
+        p++;
+    }
+    p++;
+    if (p < info + count && *p >= '0' && *p <= '9') {
+        size = 0;
+        while (p < info + count && *p >= '0' && *p <= '9') {
+            size = size * 10 + (*p++ - '0');
+        }
+    }
+    x->fileSize = size;
+    x->position = 0;
+    return x->io->createFile(x->io->context, x->fileName, size);
+}
+
+static void ReceiverHeader(XferState *x, unsigned char type)
+{
+    long position = HeaderPosition(x->zHeader);
+
+    x->zSeenHeader = 1;
+    switch (type) {
+        case ZRQINIT:
+            if (x->phase == kRecvZInit) {
+                SendZRInit(x);
+                x->timer = Now(x);
+            }
+            break;
+        case ZSINIT:
+            x->zWantData = 1;
+            StartWait(x, kRecvZSinit);
+            break;
+        case ZFILE:
+            if (x->phase == kRecvZInit || x->phase == kRecvYStart) {
+                x->zWantData = 1;
+                StartWait(x, kRecvZFileInfo);
+            } else if (x->phase == kRecvZWaitData) {
+                /* Our ZRPOS was lost */
+                SendZRPos(x);
+            }
+            break;
+        case ZDATA:
+            if (x->phase != kRecvZWaitData && x->phase != kRecvZData) {
+                break;
+            }
+            if (position == x->position) {
+                x->zWantData = 1;
+                x->retries = 0;
+                StartWait(x, kRecvZData);
+            } else {
+                SendZRPos(x);
+            }
+            break;
+        case ZEOF:
+            if (x->phase != kRecvZWaitData || position != x->position) {
+                break;
+            }
+            x->io->closeFile(x->io->context, 1);
+            x->fileName[0] = '\0';
+            x->filesDone++;
+            SendZRInit(x);
+            x->retries = 0;
+            StartWait(x, kRecvZInit);
+            break;
+        case ZFIN:
+            SendHexPosition(x, ZFIN, 0);
+            x->bIndex = 0;
+            StartWait(x, kRecvZFin);
+            break;
+        case ZABORT:
+        case ZFERR:
+            Fail(x, "Sender aborted");
+            break;
+    }
+}
+
+static void ReceiverSubpacket(XferState *x, int good)
+{
+    unsigned char p[4];
+
+    switch (x->phase) {
+        case kRecvZSinit:
+            if (good) {
+                memset(p, 0, sizeof(p));
+                SendHexHeader(x, ZACK, p);
+                StartWait(x, kRecvZInit);
+            } else {
+                SendHexPosition(x, ZNAK, 0);
+            }
+            break;
+        case kRecvZFileInfo:
+            if (!good) {
+                SendHexPosition(x, ZNAK, 0);
+                StartWait(x, kRecvZInit);
+            } else if (OpenReceivedFile(x, x->zData, x->zDataLength)) {
+                SendZRPos(x);
+            } else {
+                x->fileName[0] = '\0';
+                SendHexPosition(x, ZSKIP, 0);
+                StartWait(x, kRecvZInit);
+            }
+            break;
+        case kRecvZData:
+            if (!good) {
+                if (++x->retries > kXferMaxRetries) {
+                    Fail(x, "Too many errors");
+                } else {
+                    SendZRPos(x);
+                }
+                break;
+            }
+            if (x->zDataLength > 0 &&
+                !x->io->writeFile(x->io->context, x->zData, x->zDataLength)) {
+                Fail(x, "File write error");
+                break;
+            }
+            x->position += x->zDataLength;
+            x->timer = Now(x);
+            if (x->zFrameEnd == ZCRCW || x->zFrameEnd == ZCRCQ) {
+                SendHexPosition(x, ZACK, x->position);
+            }
+            if (x->zFrameEnd == ZCRCE || x->zFrameEnd == ZCRCW) {
+                StartWait(x, kRecvZWaitData);
+            } else {
+                x->zWantData = 1;
+            }
+            break;
+    }
+}
+
+/*
+ * Handle a complete X/YMODEM block with a good CRC
+ */
+static void ReceiverBlock(XferState *x)
+{
+    long count;
+
+    if (x->phase == kRecvYStart && x->bNumber == 0 && x->protocol != kXferXModem1K) {
+        x->protocol = kXferYModem;
+        if (x->block[0] == 0) {
+            PutByte(x, ACK);
+            Finish(x, kXferDone, NULL);
+            return;
+        }
+        if (!OpenReceivedFile(x, x->block, 128)) {
+            x->fileName[0] = '\0';
+            Fail(x, "Cannot create file");
+            return;
+        }
+        PutByte(x, ACK);
+        PutByte(x, 'C');
+        x->bExpected = 1;
+        x->eotCount = 0;
+        x->retries = 0;
+        StartWait(x, kRecvYData);
+        return;
+    }
+
+    if (x->phase == kRecvYStart && x->bNumber == 1 && x->filesDone == 0) {
+        /* XMODEM-1K has no header block; pick a name ourselves */
+        x->protocol = kXferXModem1K;
+        strcpy(x->fileName, "received.bin");
+        x->fileSize = -1;
+        x->position = 0;
+        if (!x->io->createFile(x->io->context, x->fileName, -1)) {
+            x->fileName[0] = '\0';
+            Fail(x, "Cannot create file");
+            return;
+        }
+        x->bExpected = 1;
+        x->eotCount = 0;
+        StartWait(x, kRecvYData);
+    }
+
+    if (x->phase != kRecvYData) {
+        return;
+    }
+    if (x->bNumber == (unsigned char)(x->bExpected - 1)) {
+        PutByte(x, ACK);        /* Our ACK was lost; the block is a repeat */
+        if (x->bNumber == 0) {
+            PutByte(x, 'C');
+        }
+        return;
+    }
+    if (x->bNumber != x->bExpected) {
+        Fail(x, "Lost block sync");
+        return;
+    }
+
+    count = x->bSize;
+    if (x->fileSize >= 0 && x->position + count > x->fileSize) {
+        count = x->fileSize - x->position;
+    }
+    if (count > 0 && !x->io->writeFile(x->io->context, x->block, count)) {
+        Fail(x, "File write error");
+        return;
+    }
+    x->position += count;
+    x->bExpected++;
+    x->retries = 0;
+    x->timer = Now(x);
+    PutByte(x, ACK);
+}
+
+static void ReceiverEot(XferState *x)
+{
+    if (x->phase == kRecvYStart && x->protocol == kXferXModem1K && x->filesDone == 0) {
+        /* An empty XMODEM file is nothing but EOT */
+        strcpy(x->fileName, "received.bin");
+        x->position = 0;
+        if (!x->io->createFile(x->io->context, x->fileName, 0)) {
+            x->fileName[0] = '\0';
+            Fail(x, "Cannot create file");
+            return;
+        }
+        x->eotCount = 1;
+        x->phase = kRecvYData;
+    }
+    if (x->phase != kRecvYData) {
+        return;
+    }
+    /* NAK the first EOT so a stray byte cannot end the file */
+    if (x->eotCount++ == 0) {
+        PutByte(x, NAK);
+        x->timer = Now(x);
+        return;
+    }
+    PutByte(x, ACK);
+    x->io->closeFile(x->io->context, 1);
+    x->fileName[0] = '\0';
+    x->filesDone++;
+    if (x->protocol == kXferYModem) {
+        PutByte(x, 'C');
+        x->retries = 0;
+        StartWait(x, kRecvYStart);
+    } else {
+        Finish(x, kXferDone, NULL);
+    }
+}
+
+/*
+ * Decode X/YMODEM blocks one byte at a time
+ */
+static void BlockByte(XferState *x, unsigned char c)
+{
+    unsigned short crc;
+
+    switch (x->bState) {
+        case kBHead:
+            if (c == SOH || c == STX) {
+                x->bSize = (c == SOH) ? 128 : kXferBlockSize;
+                x->bState = kBNumber;
+            } else if (c == EOT) {
+                ReceiverEot(x);
+            }
+            break;
+        case kBNumber:
+            x->bNumber = c;
+            x->bState = kBNumberInv;
+            break;
+        case kBNumberInv:
+            if ((unsigned char)~c != x->bNumber) {
+                x->bState = kBHead;
+                break;
+            }
+            x->bIndex = 0;
+            x->bState = kBData;
+            break;
+        case kBData:
+            x->block[x->bIndex++] = c;
+            if (x->bIndex == x->bSize) {
+                x->bState = kBCrcHigh;
+            }
+            break;
+        case kBCrcHigh:
+            x->block[x->bSize] = c;
+            x->bState = kBCrcLow;
+            break;
+        case kBCrcLow:
+            x->bState = kBHead;
+            crc = XferCrc16(0, x->block, x->bSize);
+            if (crc != (unsigned short)((x->block[x->bSize] << 8) | c)) {
+                if (++x->retries > kXferMaxRetries) {
+                    Fail(x, "Too many errors");
+                } else {
+                    PutByte(x, NAK);
+                }
+                break;
+            }
+            ReceiverBlock(x);
+            break;
+    }
+}
+
+static void ReceiverTimeout(XferState *x)
+{
+    unsigned long elapsed = Now(x) - x->timer;
+
+    switch (x->phase) {
+        case kRecvZFin:
+            if (elapsed >= kXferFinTicks) {
+                Finish(x, kXferDone, NULL);
+            }
+            return;
+        case kRecvZInit:
+        case kRecvYStart:
+            if (elapsed < kXferRetryTicks) {
+                return;
+            }
+            break;
+        default:
+            if (elapsed < kXferDataTicks) {
+                return;
+            }
+            break;
+    }
+
+    if (++x->retries > kXferMaxRetries) {
+        Fail(x, "Timed out");
+        return;
+    }
+    x->timer = Now(x);
+    switch (x->phase) {
+        case kRecvZInit:
+            if (x->allowFallback && !x->zSeenHeader && x->retries >= kXferFallbackTries) {
+                /* Nothing ZMODEM heard: ask for YMODEM instead */
+                x->protocol = kXferYModem;
+                x->retries = 0;
+                x->phase = kRecvYStart;
+                PutByte(x, 'C');
+            } else {
+                SendZRInit(x);
+            }
+            break;
+        case kRecvZFileInfo:
+        case kRecvZSinit:
+            x->zWantData = 0;
+            x->zState = kZSeekPad;
+            SendZRInit(x);
+            x->phase = kRecvZInit;
+            break;
+        case kRecvZWaitData:
+        case kRecvZData:
+            x->zWantData = 0;
+            x->zState = kZSeekPad;
+            SendZRPos(x);
+            break;
+        case kRecvYStart:
+            PutByte(x, 'C');
+            break;
+        case kRecvYData:
+            x->bState = kBHead;
+            PutByte(x, NAK);
+            break;
+    }
+    FlushOutput(x);
+}
+
+/* ------------------------------------------------------------------ */
+/* ZMODEM decoder                                                      */
+
+static int IsHex(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
+
+static int HexValue(unsigned char c)
+{
+    return (c <= '9') ? c - '0' : c - 'a' + 10;
+}
+
+/*
+ * Act on a header decoded with a good CRC
+ */
+static void HeaderDone(XferState *x)
+{
+    x->zWantData = 0;
+    if (x->sending) {
+        SenderHeader(x, x->zHeader[0]);
+    } else {
+        ReceiverHeader(x, x->zHeader[0]);
+    }
+    if (x->zWantData) {
+        x->zState = kZData;
+        x->zDataLength = 0;
+        x->zEscape = 0;
+    } else {
+        x->zState = kZSeekPad;
+    }
+}
+
+/*
+ * Undo ZDLE escaping. Returns a data byte, a frame end as 0x100 + char,
+ * or -1 when the byte was consumed without producing anything
+ */
+static int Unescape(XferState *x, unsigned char c)
+{
+    if (x->zEscape) {
+        x->zEscape = 0;
+        switch (c) {
+            case ZCRCE: case ZCRCG: case ZCRCQ: case ZCRCW:
+                return 0x100 + c;
+            case ZRUB0:
+                return 0x7F;
+            case ZRUB1:
+                return 0xFF;
+        }
+        return c ^ 0x40;
+    }
+    if (c == ZDLE) {
+        x->zEscape = 1;
+        return -1;
+    }
+    if ((c & 0x7F) == XON || (c & 0x7F) == XOFF) {
+        return -1;
+    }
+    return c;
+}
+
+static void ZModemByte(XferState *x, unsigned char c)
+{
+    unsigned long crc32;
+    unsigned short crc;
+    unsigned char end;
+    int needed;
+    int v;
+
+    switch (x->zState) {
+        case kZSeekPad:
+            if (c == '*') {
+                x->zState = kZSeekZdle;
+            }
+            break;
+        case kZSeekZdle:
+            if (c == ZDLE) {
+                x->zState = kZSeekFormat;
+            } else if (c != '*') {
+                x->zState = kZSeekPad;
+            }
+            break;
+        case kZSeekFormat:
+            x->zIndex = 0;
+            x->zEscape = 0;
+            x->zFormat = c;
+            if (c == 'B') {
+                x->zState = kZHexHeader;
+            } else if (c == 'A' || c == 'C') {
+                x->zState = kZBinHeader;
+            } else {
+                x->zState = kZSeekPad;
+            }
+            break;
+        case kZHexHeader:
+            if (!IsHex(c)) {
+                x->zState = kZSeekPad;
+                break;
+            }
+            if (x->zIndex & 1) {
+                x->zHeader[x->zIndex >> 1] |= (unsigned char)HexValue(c);
+            } else {
+                x->zHeader[x->zIndex >> 1] = (unsigned char)(HexValue(c) << 4);
+            }
+            if (++x->zIndex == 14) {
+                crc = XferCrc16(0, x->zHeader, 5);
+                if (crc == (unsigned short)((x->zHeader[5] << 8) | x->zHeader[6])) {
+                    HeaderDone(x);
+                } else {
+                    x->zState = kZSeekPad;
+                }
+            }
+            break;
+        case kZBinHeader:
+            v = Unescape(x, c);
+            if (v < 0) {
+                break;
+            }
+            if (v > 0xFF) {
+                x->zState = kZSeekPad;
+                break;
+            }
+            x->zHeader[x->zIndex++] = (unsigned char)v;
+            needed = (x->zFormat == 'C') ? 9 : 7;
+            if (x->zIndex < needed) {
+                break;
+            }
+            if (x->zFormat == 'C') {
+                crc32 = ~XferCrc32(0xFFFFFFFFUL, x->zHeader, 5) & 0xFFFFFFFFUL;
+                v = crc32 == ((unsigned long)x->zHeader[5] |
+                              ((unsigned long)x->zHeader[6] << 8) |
+                              ((unsigned long)x->zHeader[7] << 16) |
+                              ((unsigned long)x->zHeader[8] << 24));
+            } else {
+                crc = XferCrc16(0, x->zHeader, 5);
+                v = crc == (unsigned short)((x->zHeader[5] << 8) | x->zHeader[6]);
+            }
+            if (v) {
+                HeaderDone(x);
+            } else {
+                x->zState = kZSeekPad;
+            }
+            break;
+        case kZData:
+            v = Unescape(x, c);
+            if (v < 0) {
+                break;
+            }
+            if (v > 0xFF) {
+                x->zFrameEnd = (short)(v - 0x100);
+                x->zIndex = 0;
+                x->zState = kZDataCrc;
+                break;
+            }
+            if (x->zDataLength >= kXferMaxSubpacket) {
+                x->zState = kZSeekPad;
+                x->zWantData = 0;
+                ReceiverSubpacket(x, 0);
+                break;
+            }
+            x->zData[x->zDataLength++] = (unsigned char)v;
+            break;
+        case kZDataCrc:
+            v = Unescape(x, c);
+            if (v < 0) {
+                break;
+            }
+            x->zHeader[8 + x->zIndex++] = (unsigned char)v;
+            needed = (x->zFormat == 'C') ? 4 : 2;
+            if (x->zIndex < needed) {
+                break;
+            }
+            end = (unsigned char)x->zFrameEnd;
+            if (x->zFormat == 'C') {
+                crc32 = XferCrc32(0xFFFFFFFFUL, x->zData, x->zDataLength);
+                crc32 = ~XferCrc32(crc32, &end, 1) & 0xFFFFFFFFUL;
+                v = crc32 == ((unsigned long)x->zHeader[8] |
+                              ((unsigned long)x->zHeader[9] << 8) |
+                              ((unsigned long)x->zHeader[10] << 16) |
+                              ((unsigned long)x->zHeader[11] << 24));
+            } else {
+                crc = XferCrc16(XferCrc16(0, x->zData, x->zDataLength), &end, 1);
+                v = crc == (unsigned short)((x->zHeader[8] << 8) | x->zHeader[9]);
+            }
+            x->zWantData = 0;
+            x->zState = kZSeekPad;
+            ReceiverSubpacket(x, v);
+            if (x->zWantData) {
+                x->zState = kZData;
+                x->zDataLength = 0;
+                x->zEscape = 0;
+            }
+            break;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Public entry points                                                 */
+
+static void ResetState(XferState *x, const XferIO *io, short protocol, int sending)
+{
+    memset(x, 0, sizeof(*x));
+    x->io = io;
+    x->protocol = protocol;
+    x->sending = sending;
+    x->status = kXferRunning;
+    x->fileSize = -1;
+    x->zLastRpos = -1;
+    x->allowFallback = (protocol == kXferZModem);
+    x->zState = kZSeekPad;
+    x->bState = kBHead;
+}
+
+/*
+ * Begin sending one file of a known size
+ */
+void XferStartSend(XferState *x, const XferIO *io, short protocol,
+                   const char *name, long size)
+{
+    size_t length = strlen(name);
+
+    ResetState(x, io, protocol, 1);
+    if (length >= kXferMaxName) {
+        length = kXferMaxName - 1;
+    }
+    memcpy(x->fileName, name, length);
+    x->fileName[length] = '\0';
+    x->fileSize = size;
+
+    if (protocol == kXferZModem) {
+        PutBytes(x, (const unsigned char *)"rz\r", 3);
+        SendHexPosition(x, ZRQINIT, 0);
+        FlushOutput(x);
+        StartWait(x, kSendZInit);
+    } else {
+        StartWait(x, kSendYStart);
+    }
+}
+
+/*
+ * Invite the sender; file names come from the sender
+ */
+void XferStartReceive(XferState *x, const XferIO *io, short protocol)
+{
+    ResetState(x, io, protocol, 0);
+    x->position = -1;
+    if (protocol == kXferZModem) {
+        SendZRInit(x);
+        StartWait(x, kRecvZInit);
+    } else {
+        PutByte(x, 'C');
+        StartWait(x, kRecvYStart);
+    }
+    FlushOutput(x);
+}
+
+/*
+ * Feed bytes received from the serial port
+ */
+void XferInput(XferState *x, const unsigned char *data, long count)
+{
+    int zmodem;
+    unsigned char c;
+
+    while (count-- > 0 && x->status == kXferRunning) {
+        c = *data++;
+        zmodem = (x->phase <= kSendZFin) ||
+                 (x->phase >= kRecvZInit && x->phase <= kRecvZFin);
+
+        /* Five CANs cancel ZMODEM; two at a block boundary cancel X/YMODEM */
+        if (c == CAN) {
+            x->canCount++;
+            if ((zmodem && x->canCount >= 5) ||
+                (!zmodem && x->canCount >= 2 && (x->sending || x->bState == kBHead))) {
+                if (!x->sending && x->fileName[0] != '\0' && x->position >= 0) {
+                    x->io->closeFile(x->io->context, 0);
+                }
+                Finish(x, kXferCancelled, "Cancelled by remote");
+                return;
+            }
+        } else {
+            x->canCount = 0;
+        }
+
+        if (x->sending) {
+            if (x->phase == kSendZInit) {
+                SenderYByte(x, c);
+            }
+            if (zmodem) {
+                ZModemByte(x, c);
+            } else if (c != CAN) {
+                SenderYByte(x, c);
+            }
+        } else if (x->phase == kRecvZFin) {
+            if (c == 'O' && ++x->bIndex == 2) {
+                Finish(x, kXferDone, NULL);
+            }
+        } else if (zmodem) {
+            ZModemByte(x, c);
+        } else {
+            if (x->phase == kRecvYStart && x->allowFallback && c == '*') {
+                /* A ZMODEM sender answered late; go back to ZMODEM */
+                x->protocol = kXferZModem;
+                x->phase = kRecvZInit;
+                ZModemByte(x, c);
+                continue;
+            }
+            BlockByte(x, c);
+        }
+    }
+    if (x->status == kXferRunning) {
+        FlushOutput(x);
+    }
+}
+
+/*
+ * Stream data and handle timeouts; call often
+ */
+void XferPoll(XferState *x)
+{
+    if (x->status != kXferRunning) {
+        return;
+    }
+    if (x->sending) {
+        StreamZData(x);
+        if (x->status == kXferRunning) {
+            SenderTimeout(x);
+        }
+    } else {
+        ReceiverTimeout(x);
+    }
+    if (x->status == kXferRunning) {
+        FlushOutput(x);
+    }
+}
+
+/*
+ * Abandon the transfer locally and tell the far end
+ */
+void XferCancel(XferState *x)
+{
+    if (x->status != kXferRunning) {
+        return;
+    }
+    Fail(x, "Cancelled");
+    x->status = kXferCancelled;
+}
+
+/*
+ * Watch a received stream for "**<ZDLE>B00", the start of a ZRQINIT
+ * header; *matched carries state across calls
+ */
+int XferIsZModemStart(const unsigned char *data, long count, short *matched)
+{
+    static const unsigned char pattern[] = { '*', '*', ZDLE, 'B', '0', '0' };
+
+    while (count-- > 0) {
+        if (*data == pattern[*matched]) {
+            if (++*matched == (short)sizeof(pattern)) {
+                *matched = 0;
+                return 1;
+            }
+        } else {
+            *matched = (*data != '*') ? 0 : (*matched == 2) ? 2 : 1;
+        }
+        data++;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * transfer.h - ZMODEM, YMODEM and XMODEM-1K file transfer engine
+ *
+ * The engine is a byte-driven state machine with no Toolbox calls.
+ * The application feeds it received bytes with XferInput(), calls
+ * XferPoll() from its event loop so it can stream data and handle
+ * timeouts, and supplies serial output and file access through XferIO.
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+/* Protocols */
+#define kXferZModem         0   /* Streaming ZMODEM, falls back to YMODEM */
+#define kXferYModem         1   /* YMODEM batch, 1K blocks, CRC-16 */
+#define kXferXModem1K       2   /* XMODEM-1K, single file, CRC-16 */
+
+/* Engine status */
+#define kXferIdle           0
+#define kXferRunning        1
+#define kXferDone           2
+#define kXferFailed         3
+#define kXferCancelled      4
+
+/* Largest ZMODEM data subpacket accepted, and X/YMODEM block size */
+#define kXferMaxSubpacket   8192
+#define kXferBlockSize      1024
+
+/* Room the sender needs in the output queue before it builds a packet */
+#define kXferMaxPacketOut   (kXferBlockSize * 2 + 64)
+
+#define kXferMaxName        64
+
+/* Serial and file access supplied by the application */
+typedef struct XferIO {
+    void *context;
+
+    /* Serial output: bytes that can be queued now, and queue them */
+    long (*writeRoom)(void *context);
+    void (*write)(void *context, const unsigned char *data, long count);
+
+    /* Sending: read file data at an offset, returns bytes read or -1 */
+    long (*readFile)(void *context, long offset, unsigned char *data, long count);
+
+    /* Receiving: create a file (size -1 if unknown), append to it, close it */
+    int (*createFile)(void *context, const char *name, long size);
+    int (*writeFile)(void *context, const unsigned char *data, long count);
+    void (*closeFile)(void *context, int complete);
+
+    /* Clock in 1/60 second ticks */
+    unsigned long (*ticks)(void *context);
+} XferIO;
+
+typedef struct XferState {
+    const XferIO *io;
+    short protocol;                 /* Protocol in use after any fallback */
+    short status;
+    short phase;                    /* Role- and protocol-specific step */
+    int sending;
+    char fileName[kXferMaxName];
+    long fileSize;                  /* -1 when the sender did not say */
+    long position;                  /* Bytes sent or written so far */
+    long filesDone;
+    const char *message;            /* Reason for failure */
+
+    unsigned long timer;            /* Ticks when the current wait began */
+    short retries;
+    short canCount;                 /* Consecutive CAN bytes seen */
+
+    /* ZMODEM header/subpacket decoder */
+    short zState;
+    short zFormat;                  /* 'A', 'B' or 'C' of the last header */
+    short zIndex;
+    int zEscape;
+    int zWantData;                  /* Decode a subpacket after this header */
+    int zUseCrc32;                  /* Sender: receiver can check CRC-32 */
+    short zFrameEnd;
+    unsigned char zHeader[16];
+    long zDataLength;
+    unsigned char zData[kXferMaxSubpacket + 8];
+    long zLastRpos;                 /* Sender: repeated ZRPOS detection */
+    int zDataHeaderDue;             /* Sender: next packet needs ZDATA first */
+    int zSeenHeader;                /* Receiver: the far end speaks ZMODEM */
+    int allowFallback;              /* ZMODEM may drop back to YMODEM */
+
+    /* X/YMODEM block decoder */
+    short bState;
+    short bSize;
+    short bIndex;
+    unsigned char bNumber;
+    unsigned char bExpected;
+    short eotCount;
+    unsigned char block[kXferBlockSize + 8];
+
+    /* Packet being built for output */
+    long outLength;
+    unsigned char out[kXferMaxPacketOut];
+    unsigned char fileData[kXferBlockSize];
+} XferState;
+
+void XferStartSend(XferState *x, const XferIO *io, short protocol,
+                   const char *name, long size);
+void XferStartReceive(XferState *x, const XferIO *io, short protocol);
+void XferInput(XferState *x, const unsigned char *data, long count);
+void XferPoll(XferState *x);
+void XferCancel(XferState *x);
+int XferIsZModemStart(const unsigned char *data, long count, short *matched);
+
+unsigned short XferCrc16(unsigned short crc, const unsigned char *data, long count);
+unsigned long XferCrc32(unsigned long crc, const unsigned char *data, long count);
+
+#endif /* TRANSFER_H */
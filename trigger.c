@@ -0,0 +1,326 @@
+/*
+ * trigger.c - Actions fired by patterns in the received stream
+ *
+ * The patterns go into a trie, one state per distinct prefix. A
+ * breadth-first pass then gives each state its failure state, the
+ * longest proper suffix of its prefix that is also in the trie, and
+ * fills every missing transition with the failure state's, so scanning
+ * never has to follow failure links. Each state's fire mask takes in its
+ * failure state's too, which catches a pattern ending inside a longer
+ * one.
+ */
+
+#include <string.h>
+
+#include "trigger.h"
+
+static int TrigParseLine(TrigSet *t, const char *line, long length);
+static short TrigUnescape(const char *src, long length, unsigned char *dest, short max);
+static long TrigWord(const char *text, long length, const char *word);
+static int TrigBuild(TrigSet *t);
+
+/*
+ * Compile a trigger list, lines ending in CR or LF. On an error the
+ * set is left empty, and *badLine is the line at fault, or 0 if the
+ * list as a whole is too big. Returns kTrigOK or a kTrigErr code.
+ */
+int TrigLoad(TrigSet *t, const char *text, long length, short *badLine)
+{
+    const char *end = text + length;
+    const char *line;
+    const char *eol;
+    short lineNumber;
+    int result;
+
+    t->count = 0;
+    *badLine = 0;
+    lineNumber = 0;
+    for (line = text; line < end; line = eol + 1) {
+        eol = line;
+        while (eol < end && *eol != '\r' && *eol != '\n') {
+            eol++;
+        }
+        lineNumber++;
+        result = TrigParseLine(t, line, eol - line);
+        if (result != kTrigOK) {
+            *badLine = lineNumber;
+            t->count = 0;
+            TrigBuild(t);
+            return result;
+        }
+    }
+
+    result = TrigBuild(t);
+    if (result != kTrigOK) {
+        t->count = 0;
+        TrigBuild(t);
+    }
+    return result;
+}
+
+/*
+ * Run received bytes through the automaton up to the first byte that
+ * completes a pattern. Returns the bytes consumed, with the entries that
+ * fired there in *fired by bit, or count with *fired 0.
+ */
+long TrigScan(TrigSet *t, const unsigned char *data, long count, unsigned long *fired)
+{
+    const unsigned char *next = t->next;
+    const unsigned char *classOf = t->classOf;
+    const unsigned long *fires = t->fires;
+    unsigned char state = t->state;
+    long i;
+
+    for (i = 0; i < count; i++) {
+        state = next[(state << kTrigClassShift) | classOf[data[i]]];
+        if (fires[state] != 0) {
+            t->state = state;
+            *fired = fires[state];
+            return i + 1;
+        }
+    }
+    t->state = state;
+    *fired = 0;
+    return count;
+}
+
+/*
+ * Add the trigger on one line, if there is one
+ */
+static int TrigParseLine(TrigSet *t, const char *line, long length)
+{
+    TrigEntry *entry;
+    const char *arrow;
+    const char *action;
+    long patternLength;
+    long actionLength;
+    long used;
+
+    while (length > 0 && (*line == ' ' || *line == '\t')) {
+        line++;
+        length--;
+    }
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+    if (length == 0 || *line == '#') {
+        return kTrigOK;
+    }
+
+    for (arrow = line; arrow + 1 < line + length; arrow++) {
+        if (arrow[0] == '=' && arrow[1] == '>') {
+            break;
+        }
+    }
+    if (arrow + 1 >= line + length) {
+        return kTrigErrSyntax;
+    }
+
+    patternLength = arrow - line;
+    while (patternLength > 0 && (line[patternLength - 1] == ' ' || line[patternLength - 1] == '\t')) {
+        patternLength--;
+    }
+    action = arrow + 2;
+    actionLength = line + length - action;
+    while (actionLength > 0 && (*action == ' ' || *action == '\t')) {
+        action++;
+        actionLength--;
+    }
+
+    if (t->count == kTrigMaxTriggers) {
+        return kTrigErrTooMany;
+    }
+    entry = &t->entries[t->count];
+
+    entry->patternLength = TrigUnescape(line, patternLength, entry->pattern, kTrigMaxPattern);
+    if (entry->patternLength < 0) {
+        return kTrigErrTooLong;
+    }
+    if (entry->patternLength == 0) {
+        return kTrigErrSyntax;
+    }
+
+    entry->textLength = 0;
+    if ((used = TrigWord(action, actionLength, "send")) > 0) {
+        entry->action = kTrigSend;
+        action += used;
+        actionLength -= used;
+        while (actionLength > 0 && (*action == ' ' || *action == '\t')) {
+            action++;
+            actionLength--;
+        }
+        entry->textLength = TrigUnescape(action, actionLength, entry->text, kTrigMaxText);
+        if (entry->textLength < 0) {
+            return kTrigErrTooLong;
+        }
+    } else if (TrigWord(action, actionLength, "beep") == actionLength) {
+        entry->action = kTrigBeep;
+    } else if (TrigWord(action, actionLength, "capture on") == actionLength) {
+        entry->action = kTrigCaptureOn;
+    } else if (TrigWord(action, actionLength, "capture off") == actionLength) {
+        entry->action = kTrigCaptureOff;
+    } else {
+        return kTrigErrSyntax;
+    }
+
+    t->count++;
+    return kTrigOK;
+}
+
+/*
+ * Copy text into dest, turning escapes into the bytes they stand for.
+ * Returns the length, or -1 if it needs more than max bytes.
+ */
+static short TrigUnescape(const char *src, long length, unsigned char *dest, short max)
+{
+    const char *end = src + length;
+    short count;
+    short digits;
+    unsigned char c;
+    char h;
+
+    count = 0;
+    while (src < end) {
+        c = (unsigned char)*src++;
+        if (c == '\\' && src < end) {
+            c = (unsigned char)*src++;
+            switch (c) {
+                case 'r': c = '\r'; break;
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'e': c = 0x1B; break;
+                case 'x':
+                    c = 0;
+                    for (digits = 0; digits < 2 && src < end; digits++, src++) {
+                        h = *src;
+                        if (h >= '0' && h <= '9') {
+                            c = (unsigned char)(c * 16 + h - '0');
+                        } else if (h >= 'a' && h <= 'f') {
+                            c = (unsigned char)(c * 16 + h - 'a' + 10);
+                        } else if (h >= 'A' && h <= 'F') {
+                            c = (unsigned char)(c * 16 + h - 'A' + 10);
+                        } else {
+                            break;
+                        }
+                    }
+                    break;
+                default:
+                    /* \\ and anything else stand for themselves */
+                    break;
+            }
+        }
+        if (count == max) {
+            return -1;
+        }
+        dest[count++] = c;
+    }
+    return count;
+}
+
+/*
+ * If text starts with word, any case, followed by the end or a space,
+ * the length of word; otherwise 0
+ */
+static long TrigWord(const char *text, long length, const char *word)
+{
+    long i;
+    char c;
+
+    for (i = 0; word[i] != 0; i++) {
+        if (i == length) {
+            return 0;
+        }
+        c = text[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (char)(c + 'a' - 'A');
+        }
+        if (c != word[i]) {
+            return 0;
+        }
+    }
+    if (i < length && text[i] != ' ' && text[i] != '\t') {
+        return 0;
+    }
+    return i;
+}
+
+/*
+ * Build the automaton from the entries
+ */
+static int TrigBuild(TrigSet *t)
+{
+    unsigned char fail[kTrigMaxStates];
+    unsigned char queue[kTrigMaxStates];
+    unsigned char *row;
+    const TrigEntry *entry;
+    short head;
+    short tail;
+    short i;
+    short j;
+    short c;
+    unsigned char s;
+    unsigned char u;
+
+    /* A class for each byte some pattern uses; class 0 is every other byte */
+    memset(t->classOf, 0, sizeof(t->classOf));
+    t->classes = 1;
+    for (i = 0; i < t->count; i++) {
+        entry = &t->entries[i];
+        for (j = 0; j < entry->patternLength; j++) {
+            if (t->classOf[entry->pattern[j]] == 0) {
+                if (t->classes == kTrigMaxClasses) {
+                    return kTrigErrTooBig;
+                }
+                t->classOf[entry->pattern[j]] = (unsigned char)t->classes++;
+            }
+        }
+    }
+
+    /* The trie; 0 is the root, so a 0 transition is still missing */
+    memset(t->next, 0, sizeof(t->next));
+    memset(t->fires, 0, sizeof(t->fires));
+    t->states = 1;
+    for (i = 0; i < t->count; i++) {
+        entry = &t->entries[i];
+        s = 0;
+        for (j = 0; j < entry->patternLength; j++) {
+            row = &t->next[s << kTrigClassShift];
+            c = t->classOf[entry->pattern[j]];
+            if (row[c] == 0) {
+                if (t->states == kTrigMaxStates) {
+                    return kTrigErrTooBig;
+                }
+                row[c] = (unsigned char)t->states++;
+            }
+            s = row[c];
+        }
+        t->fires[s] |= 1UL << i;
+    }
+
+    /* Breadth first, so a state's failure state is finished before it */
+    head = 0;
+    tail = 0;
+    for (c = 0; c < t->classes; c++) {
+        u = t->next[c];
+        if (u != 0) {
+            fail[u] = 0;
+            queue[tail++] = u;
+        }
+    }
+    while (head < tail) {
+        s = queue[head++];
+        t->fires[s] |= t->fires[fail[s]];
+        row = &t->next[s << kTrigClassShift];
+        for (c = 0; c < t->classes; c++) {
+            if (row[c] != 0) {
+                fail[row[c]] = t->next[(fail[s] << kTrigClassShift) | c];
+                queue[tail++] = row[c];
+            } else {
+                row[c] = t->next[(fail[s] << kTrigClassShift) | c];
+            }
+        }
+    }
+
+    t->state = 0;
+    return kTrigOK;
+}
@@ -0,0 +1,71 @@
+/*
+ * trigger.h - Actions fired by patterns in the received stream
+ *
+ * A list of "pattern => action" lines is compiled into an Aho-Corasick
+ * automaton held as a full transition table, so each received byte
+ * costs two table lookups however many patterns there are, and matches
+ * are found across batch boundaries. Bytes that appear in no pattern
+ * share one column of the table, which keeps it small. No Toolbox calls
+ * and no allocation: the application performs the actions.
+ *
+ * The list, one trigger per line:
+ *
+ *   # comment
+ *   login: => send guest\r
+ *   ERROR => beep
+ *   BEGIN LOG => capture on
+ *   END LOG => capture off
+ *
+ * Patterns and send text take \r \n \t \e \\ and \xHH escapes. Spaces
+ * around "=>" are dropped; a pattern can start or end with \x20.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#define kTrigMaxTriggers    16
+#define kTrigMaxPattern     32
+#define kTrigMaxText        32      /* Longest send text */
+#define kTrigMaxStates      256     /* One per distinct pattern prefix, with the root */
+#define kTrigClassShift     6
+#define kTrigMaxClasses     (1 << kTrigClassShift)
+
+/* Actions */
+#define kTrigSend           0
+#define kTrigBeep           1
+#define kTrigCaptureOn      2
+#define kTrigCaptureOff     3
+
+/* TrigLoad() results */
+#define kTrigOK             0
+#define kTrigErrSyntax      1       /* No "=>", empty pattern or unknown action */
+#define kTrigErrTooLong     2       /* Pattern or send text */
+#define kTrigErrTooMany     3       /* Triggers */
+#define kTrigErrTooBig      4       /* States or distinct pattern bytes */
+
+typedef struct TrigEntry {
+    unsigned char pattern[kTrigMaxPattern];
+    short patternLength;
+    short action;
+    unsigned char text[kTrigMaxText];
+    short textLength;
+} TrigEntry;
+
+typedef struct TrigSet {
+    TrigEntry entries[kTrigMaxTriggers];
+    short count;
+    short states;
+    short classes;
+
+    /* The automaton: state and byte class to the next state */
+    unsigned char classOf[256];
+    unsigned char next[kTrigMaxStates << kTrigClassShift];
+    unsigned long fires[kTrigMaxStates];    /* Entries whose pattern ends here, by bit */
+
+    unsigned char state;                    /* Carried between TrigScan() calls */
+} TrigSet;
+
+int TrigLoad(TrigSet *t, const char *text, long length, short *badLine);
+long TrigScan(TrigSet *t, const unsigned char *data, long count, unsigned long *fired);
+
+#endif /* TRIGGER_H */